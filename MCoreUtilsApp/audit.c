@@ -0,0 +1,528 @@
+/********************************************//**
+ * @file
+ * @brief Real-time readiness audit of the host and the IOC process.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * All information is read from sysfs and procfs (below the roots set by
+ * @c EPICS_MCORE_SYSFS and @c EPICS_MCORE_PROCFS) and from the
+ * @c cpu_dma_latency device (set by @c EPICS_MCORE_DMA_LATENCY),
+ * so that the checks can be run against a prepared tree.
+ *
+ * @ingroup audit
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sched.h>
+
+#include <errlog.h>
+#include <epicsStdio.h>
+#include <shareLib.h>
+
+#include "utils.h"
+#include "cpumask.h"
+#include "topology.h"
+#include "threadRules.h"
+#include "power.h"
+
+/// @cond NEVER
+#define epicsExportSharedSymbols
+/// @endcond
+#include "mcoreutils.h"
+
+/// highest C-state exit latency accepted on real-time CPUs [us]
+#define AUDIT_MAX_EXIT_LATENCY 10
+/// value of cpu_dma_latency without any PM QoS request [us]
+#define AUDIT_NO_DMA_CONSTRAINT 2000000000
+/// capability bits in /proc/<pid>/status CapEff
+#define AUDIT_CAP_IPC_LOCK 14
+#define AUDIT_CAP_SYS_NICE 23
+
+/**
+ * @brief Results of an audit run.
+ */
+typedef struct auditResult {
+    FILE *out;                  ///< output stream
+    int   checks;               ///< number of checks done
+    int   failed;               ///< number of failed checks
+    int   skipped;              ///< number of checks that could not be done
+} auditResult;
+
+/**
+ * @brief Print the result of one check.
+ *
+ * @param res   audit results
+ * @param check name of the check
+ * @param pass  1 = passed, 0 = failed, -1 = skipped
+ * @param fmt   format of the measured value
+ */
+static void report(auditResult *res, const char *check, int pass, const char *fmt, ...)
+{
+    va_list args;
+
+    res->checks++;
+    if (!pass) res->failed++;
+    if (pass < 0) res->skipped++;
+    fprintf(res->out, "%-16s %-6s ", check, pass > 0 ? "PASS" : pass ? "SKIP" : "FAIL");
+    va_start(args, fmt);
+    vfprintf(res->out, fmt, args);
+    va_end(args);
+    fprintf(res->out, "\n");
+}
+
+/**
+ * @brief Read the first line of a file, without the line end.
+ *
+ * @param path file to read
+ * @param buf  buffer to read into
+ * @param len  size of the buffer
+ * @return 0 on success, -1 on error
+ */
+static int readLine(const char *path, char *buf, size_t len)
+{
+    FILE *fp = fopen(path, "r");
+    char *cp;
+
+    if (!fp) return -1;
+    if (!fgets(buf, (int) len, fp)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    if ((cp = strpbrk(buf, "\n\r"))) *cp = '\0';
+    return 0;
+}
+
+/**
+ * @brief Read the value of a "key: value" line (as in @c meminfo or @c status).
+ *
+ * @param path  file to read
+ * @param key   key to look for
+ * @param value buffer to read the value into (leading blanks removed)
+ * @param len   size of the buffer
+ * @return 0 on success, -1 if the file or key was not found
+ */
+static int readKey(const char *path, const char *key, char *value, size_t len)
+{
+    char line[256];
+    size_t klen = strlen(key);
+    FILE *fp = fopen(path, "r");
+    int status = -1;
+
+    if (!fp) return -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (0 == strncmp(line, key, klen) && ':' == line[klen]) {
+            char *cp = line + klen + 1;
+            char *end;
+            while (isspace((unsigned char) *cp)) cp++;
+            if ((end = strpbrk(cp, "\n\r"))) *end = '\0';
+            strncpy(value, cp, len - 1);
+            value[len - 1] = '\0';
+            status = 0;
+            break;
+        }
+    }
+    fclose(fp);
+    return status;
+}
+
+/**
+ * @brief Read a numeric "key: value" line.
+ *
+ * @param path file to read
+ * @param key  key to look for
+ * @param base number base (16 for capability masks)
+ * @return value, -1 if not found
+ */
+static long long readKeyNum(const char *path, const char *key, int base)
+{
+    char value[64];
+    if (readKey(path, key, value, sizeof(value))) return -1;
+    return strtoll(value, NULL, base);
+}
+
+/**
+ * @brief Read a cpuset in list format from sysfs, treating a missing or empty file as empty set.
+ *
+ * @param path   file to read
+ * @param cpuset cpuset to write into
+ */
+static void readSysfsCpus(const char *path, cpu_set_t *cpuset)
+{
+    char buf[4096];
+
+    CPU_ZERO_S(cpusetSize(), cpuset);
+    // nohz_full reads "(null)" when not configured
+    if (0 == readLine(path, buf, sizeof(buf)) && isdigit((unsigned char) buf[0])) {
+        strToCpuset(cpuset, buf);
+    }
+}
+
+static int hasCapability(int cap)
+{
+    char path[512];
+    long long caps;
+
+    if (formatPath(path, sizeof(path), "%s/self/status", topologyProcfsRoot())) return 0;
+    caps = readKeyNum(path, "CapEff", 16);
+    return caps > 0 && (caps & (1LL << cap));
+}
+
+/**
+ * @brief Check the CPU frequency governor of the real-time CPUs.
+ */
+static void checkGovernor(auditResult *res, const cpu_set_t *rtset, int ncpus)
+{
+    const size_t setsize = cpusetSize();
+    cpu_set_t *bad = cpusetAlloc();
+    char path[512], gov[64], badGov[64] = "";
+    char *set;
+    int cpu, found = 0;
+
+    if (!bad) return;
+    CPU_ZERO_S(setsize, bad);
+    for (cpu = 0; cpu < ncpus; cpu++) {
+        if (!CPU_ISSET_S(cpu, setsize, rtset)) continue;
+        if (formatPath(path, sizeof(path), "%s/devices/system/cpu/cpu%d/cpufreq/scaling_governor",
+                       topologySysfsRoot(), cpu)
+                || readLine(path, gov, sizeof(gov))) continue;
+        found++;
+        if (strcmp(gov, "performance")) {
+            CPU_SET_S(cpu, setsize, bad);
+            if (!badGov[0]) strcpy(badGov, gov);
+        }
+    }
+    if (!found) {
+        report(res, "governor", -1, "no cpufreq");
+    } else if (CPU_COUNT_S(setsize, bad)) {
+        set = malloc(topologyCpusetStrLen());
+        if (set) cpusetToStr(set, topologyCpusetStrLen(), bad);
+        report(res, "governor", 0, "%s on CPU %s", badGov, set ? set : "?");
+        free(set);
+    } else {
+        report(res, "governor", 1, "performance");
+    }
+    cpusetFree(bad);
+}
+
+/**
+ * @brief Read the current value of the PM QoS CPU latency constraint.
+ *
+ * @return constraint [us], -1 on error
+ */
+static long readDmaLatency(void)
+{
+    int fd = open(powerDmaLatencyPath(), O_RDONLY | O_CLOEXEC);
+    int value;
+
+    if (fd < 0) return -1;
+    if (sizeof(value) != read(fd, &value, sizeof(value))) value = -1;
+    close(fd);
+    return value;
+}
+
+/**
+ * @brief Check the PM QoS constraint and the deepest C-state usable on the real-time CPUs.
+ */
+static void checkCstates(auditResult *res, const cpu_set_t *rtset, int ncpus)
+{
+    const size_t setsize = cpusetSize();
+    long dma = readDmaLatency();
+    long worst = -1;
+    char worstName[32] = "";
+    int cpu, worstCpu = -1;
+
+    if (dma < 0) {
+        report(res, "cpu_dma_latency", -1, "can't read %s: %s", powerDmaLatencyPath(), strerror(errno));
+    } else if (dma >= AUDIT_NO_DMA_CONSTRAINT) {
+        report(res, "cpu_dma_latency", 0, "no constraint");
+    } else {
+        report(res, "cpu_dma_latency", 1, "%ld us", dma);
+    }
+
+    for (cpu = 0; cpu < ncpus; cpu++) {
+        int state;
+        if (!CPU_ISSET_S(cpu, setsize, rtset)) continue;
+        for (state = 0; ; state++) {
+            char path[512], name[32], buf[32];
+            long latency;
+            if (formatPath(path, sizeof(path), "%s/devices/system/cpu/cpu%d/cpuidle/state%d/latency",
+                           topologySysfsRoot(), cpu, state)
+                    || readLine(path, buf, sizeof(buf))) break;
+            latency = strtol(buf, NULL, 10);
+            if (0 == formatPath(path, sizeof(path), "%s/devices/system/cpu/cpu%d/cpuidle/state%d/disable",
+                                topologySysfsRoot(), cpu, state)
+                    && 0 == readLine(path, buf, sizeof(buf)) && '1' == buf[0]) continue;
+            // the idle governor does not select states exceeding the PM QoS constraint
+            if (dma >= 0 && latency > dma) continue;
+            if (latency > worst) {
+                if (formatPath(path, sizeof(path), "%s/devices/system/cpu/cpu%d/cpuidle/state%d/name",
+                               topologySysfsRoot(), cpu, state)
+                        || readLine(path, name, sizeof(name))) strcpy(name, "?");
+                worst = latency;
+                worstCpu = cpu;
+                strcpy(worstName, name);
+            }
+        }
+    }
+    if (worstCpu < 0) {
+        report(res, "C-states", -1, "no cpuidle states");
+    } else {
+        report(res, "C-states", worst <= AUDIT_MAX_EXIT_LATENCY,
+               "deepest %s on CPU %d (exit latency %ld us)", worstName, worstCpu, worst);
+    }
+}
+
+/**
+ * @brief Check the transparent huge pages mode.
+ */
+static void checkThp(auditResult *res)
+{
+    char path[512], buf[128];
+    char *mode, *end;
+
+    if (formatPath(path, sizeof(path), "%s/kernel/mm/transparent_hugepage/enabled", topologySysfsRoot())
+            || readLine(path, buf, sizeof(buf))
+            || !(mode = strchr(buf, '[')) || !(end = strchr(++mode, ']'))) {
+        report(res, "THP", -1, "not available");
+        return;
+    }
+    *end = '\0';
+    report(res, "THP", 0 != strcmp(mode, "always"), "%s", mode);
+}
+
+/**
+ * @brief Check the swap usage of the process and the host.
+ */
+static void checkSwap(auditResult *res)
+{
+    char path[512];
+    long long vmSwap, total, free;
+
+    vmSwap = total = free = -1;
+    if (0 == formatPath(path, sizeof(path), "%s/self/status", topologyProcfsRoot())) {
+        vmSwap = readKeyNum(path, "VmSwap", 10);
+    }
+    if (0 == formatPath(path, sizeof(path), "%s/meminfo", topologyProcfsRoot())) {
+        total = readKeyNum(path, "SwapTotal", 10);
+        free = readKeyNum(path, "SwapFree", 10);
+    }
+    if (vmSwap < 0 || total < 0 || free < 0) {
+        report(res, "swap", -1, "not available");
+        return;
+    }
+    report(res, "swap", 0 == vmSwap, "process %lld kB, host %lld of %lld kB",
+           vmSwap, total - free, total);
+}
+
+/**
+ * @brief Check the real-time throttling settings.
+ */
+static void checkRtThrottling(auditResult *res)
+{
+    char path[512], runtime[32], period[32];
+
+    if (formatPath(path, sizeof(path), "%s/sys/kernel/sched_rt_runtime_us", topologyProcfsRoot())
+            || readLine(path, runtime, sizeof(runtime))) {
+        report(res, "rt_throttling", -1, "not available");
+        return;
+    }
+    if (formatPath(path, sizeof(path), "%s/sys/kernel/sched_rt_period_us", topologyProcfsRoot())
+            || readLine(path, period, sizeof(period))) strcpy(period, "?");
+    if (strtol(runtime, NULL, 10) < 0) {
+        report(res, "rt_throttling", 1, "disabled");
+    } else {
+        report(res, "rt_throttling", 0, "%s us per %s us", runtime, period);
+    }
+}
+
+/**
+ * @brief Check that the real-time CPUs are covered by a kernel CPU list (isolated, nohz_full).
+ */
+static void checkCoverage(auditResult *res, const char *check, const char *list,
+                          const cpu_set_t *rtset, int nrt)
+{
+    const size_t setsize = cpusetSize();
+    cpu_set_t *covered = cpusetAlloc();
+    cpu_set_t *missing = cpusetAlloc();
+    char *set = malloc(topologyCpusetStrLen());
+    char path[512];
+
+    if (!covered || !missing || !set) {
+        errlogPrintf("Memory allocation error\n");
+    } else if (!nrt) {
+        report(res, check, -1, "no real-time rules with affinity");
+    } else if (formatPath(path, sizeof(path), "%s/devices/system/cpu/%s", topologySysfsRoot(), list)) {
+        report(res, check, -1, "path too long");
+    } else {
+        readSysfsCpus(path, covered);
+        cpumaskAndNot(missing, rtset, covered, setsize);
+        if (CPU_COUNT_S(setsize, missing)) {
+            cpusetToStr(set, topologyCpusetStrLen(), missing);
+            report(res, check, 0, "CPU %s not in %s", set, list);
+        } else {
+            cpusetToStr(set, topologyCpusetStrLen(), covered);
+            report(res, check, 1, "%s", set);
+        }
+    }
+    cpusetFree(covered);
+    cpusetFree(missing);
+    free(set);
+}
+
+/**
+ * @brief Check whether irqbalance is running.
+ */
+static void checkIrqbalance(auditResult *res)
+{
+    DIR *dir = opendir(topologyProcfsRoot());
+    struct dirent *ent;
+    char path[512], comm[32];
+    long pid = 0;
+
+    if (!dir) {
+        report(res, "irqbalance", -1, "can't read %s", topologyProcfsRoot());
+        return;
+    }
+    while ((ent = readdir(dir))) {
+        if (!isdigit((unsigned char) ent->d_name[0])) continue;
+        if (0 == formatPath(path, sizeof(path), "%s/%.32s/comm", topologyProcfsRoot(), ent->d_name)
+                && 0 == readLine(path, comm, sizeof(comm)) && 0 == strcmp(comm, "irqbalance")) {
+            pid = strtol(ent->d_name, NULL, 10);
+            break;
+        }
+    }
+    closedir(dir);
+    if (pid) {
+        report(res, "irqbalance", 0, "running (pid %ld)", pid);
+    } else {
+        report(res, "irqbalance", 1, "not running");
+    }
+}
+
+/**
+ * @brief Check a resource limit of the process, as shown in @c /proc/self/limits.
+ *
+ * @param res    audit results
+ * @param check  name of the check
+ * @param limit  name of the limit in the limits file
+ * @param needed smallest sufficient soft limit
+ * @param cap    capability that overrides the limit
+ */
+static void checkLimit(auditResult *res, const char *check, const char *limit,
+                       unsigned long long needed, int cap)
+{
+    char path[512], line[256], soft[32] = "";
+    size_t len = strlen(limit);
+    FILE *fp;
+
+    if (formatPath(path, sizeof(path), "%s/self/limits", topologyProcfsRoot())
+            || !(fp = fopen(path, "r"))) {
+        report(res, check, -1, "can't read %s", path);
+        return;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        if (0 == strncmp(line, limit, len) && isspace((unsigned char) line[len])) {
+            sscanf(line + len, "%31s", soft);
+            break;
+        }
+    }
+    fclose(fp);
+    if (!soft[0]) {
+        report(res, check, -1, "not available");
+    } else if (hasCapability(cap)) {
+        report(res, check, 1, "%s (overridden by capability)", soft);
+    } else if (0 == strcmp(soft, "unlimited")) {
+        report(res, check, 1, "%s", soft);
+    } else {
+        report(res, check, strtoull(soft, NULL, 10) >= needed, "%s", soft);
+    }
+}
+
+/**
+ * @brief Check whether the process memory is locked.
+ */
+static void checkMemLock(auditResult *res)
+{
+    char path[512];
+    long long locked, rss;
+
+    locked = rss = -1;
+    if (0 == formatPath(path, sizeof(path), "%s/self/status", topologyProcfsRoot())) {
+        locked = readKeyNum(path, "VmLck", 10);
+        rss = readKeyNum(path, "VmRSS", 10);
+    }
+    if (locked < 0 || rss < 0) {
+        report(res, "mlock", -1, "not available");
+        return;
+    }
+    report(res, "mlock", locked > 0, "%lld kB locked, %lld kB resident", locked, rss);
+}
+
+int mcoreRtAudit(void)
+{
+    const size_t setsize = cpusetSize();
+    const int ncpus = topologyNumCpus();
+    auditResult res = { epicsGetStdout(), 0, 0, 0 };
+    cpu_set_t *rtset = cpusetAlloc();
+    char *set = malloc(topologyCpusetStrLen());
+    int nrt;
+
+    if (!rtset || !set) {
+        errlogPrintf("Memory allocation error\n");
+        cpusetFree(rtset);
+        free(set);
+        return -1;
+    }
+    mcoreThreadRulesInit();
+    nrt = rtRulesCpuset(rtset);
+    if (nrt) {
+        cpusetToStr(set, topologyCpusetStrLen(), rtset);
+        fprintf(res.out, "Real-time CPUs (from rules): %s\n", set);
+    } else {
+        CPU_ZERO_S(setsize, rtset);
+        topologyAllowedCpus(rtset);
+        cpusetToStr(set, topologyCpusetStrLen(), rtset);
+        fprintf(res.out, "No real-time rules with affinity, checking allowed CPUs: %s\n", set);
+    }
+    fprintf(res.out, "CHECK            RESULT VALUE\n");
+
+    checkGovernor(&res, rtset, ncpus);
+    checkCstates(&res, rtset, ncpus);
+    checkThp(&res);
+    checkSwap(&res);
+    checkRtThrottling(&res);
+    checkCoverage(&res, "isolcpus", "isolated", rtset, nrt);
+    checkCoverage(&res, "nohz_full", "nohz_full", rtset, nrt);
+    checkIrqbalance(&res);
+    checkLimit(&res, "RLIMIT_RTPRIO", "Max realtime priority",
+               sched_get_priority_max(SCHED_FIFO), AUDIT_CAP_SYS_NICE);
+    checkLimit(&res, "RLIMIT_MEMLOCK", "Max locked memory", ~0ULL, AUDIT_CAP_IPC_LOCK);
+    checkMemLock(&res);
+
+    fprintf(res.out, "%d checks, %d failed, %d skipped\n", res.checks, res.failed, res.skipped);
+    cpusetFree(rtset);
+    free(set);
+    return res.failed;
+}
+
+/**
+ *@}
+ */
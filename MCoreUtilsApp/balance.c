@@ -0,0 +1,533 @@
+/********************************************//**
+ * @file
+ * @brief Adaptive load balancing of threads within their rule's CPUs.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * Threads matching a rule with the @c balanced option are registered with
+ * the balancer, together with the CPUs they may be moved to.
+ * Each balancing pass samples the load of all CPUs from @c /proc/stat and
+ * the run time and run queue delay of the registered threads from
+ * @c /proc/self/task/<tid>/schedstat.
+ * The threads are then considered in order of decreasing run queue delay,
+ * and a thread is pinned to the least loaded of its CPUs if that CPU's load
+ * is lower than the load of the thread's current CPU by more than both the
+ * hysteresis and the thread's own load.
+ * A thread that has been moved stays on its CPU for a number of passes (hold-off),
+ * and the number of migrations per pass is limited.
+ *
+ * @ingroup threadrules
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/types.h>
+
+#include <errlog.h>
+#include <epicsStdio.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <shareLib.h>
+
+#include "utils.h"
+#include "cpumask.h"
+#include "topology.h"
+#include "exclusive.h"
+#include "balance.h"
+
+/// @cond NEVER
+#define epicsExportSharedSymbols
+/// @endcond
+#include "mcoreutils.h"
+
+/// number of balancing decisions kept for mcoreBalanceShow()
+#define DECISION_LOG_SIZE 32
+
+/**
+ * @brief A thread registered with the balancer.
+ */
+typedef struct balancedTask {
+    char       *name;           ///< name of the rule that registered the thread
+    pid_t       tid;            ///< Linux thread id
+    cpu_set_t  *allowed;        ///< CPUs the thread may be moved to
+    unsigned long long runtime; ///< run time at the last pass [ns]
+    unsigned long long delay;   ///< run queue delay at the last pass [ns]
+    double      util;           ///< fraction of the last period spent running
+    double      wait;           ///< fraction of the last period spent waiting on a run queue
+    int         cpu;            ///< CPU the thread last ran on
+    unsigned int holdoff;       ///< passes to wait before the thread may be moved again
+    char        sampled;        ///< flag: run time and delay have been sampled
+    char        done;           ///< flag: not (or no longer) a candidate in the current pass
+} balancedTask;
+
+/**
+ * @brief A migration done by the balancer.
+ */
+typedef struct balanceDecision {
+    epicsTimeStamp time;        ///< time of the migration
+    pid_t       tid;            ///< Linux thread id
+    int         from;           ///< CPU the thread was moved from
+    int         to;             ///< CPU the thread was moved to
+    double      loadFrom;       ///< load of the source CPU before the migration
+    double      loadTo;         ///< load of the target CPU before the migration
+    double      util;           ///< load of the thread
+    double      wait;           ///< run queue delay of the thread (fraction of the period)
+} balanceDecision;
+
+static epicsMutexId balLock;
+static balancedTask *tasks;
+static size_t nTasks, maxTasks;
+static int ncpus;
+static mcoreCpuTimes *times;
+static unsigned long long *prevBusy, *prevTotal;
+static double *load;
+static char havePrev;
+static struct timespec prevTime;
+static cpu_set_t *targets, *forbidden, *pinned;
+static balanceDecision decisions[DECISION_LOG_SIZE];
+static unsigned long nDecisions;
+static double hysteresis = 0.25;
+static unsigned int holdoffPasses = 5;
+static unsigned int maxMigrations = 1;
+static epicsThreadId balThread;
+static epicsEventId balEvent;
+static double balPeriod;
+
+/**
+ * @brief Counters of the balancer.
+ */
+static struct {
+    unsigned long passes;       ///< balancing passes
+    unsigned long migrations;   ///< threads moved
+    unsigned long hysteresis;   ///< moves rejected by the hysteresis
+    unsigned long holdoff;      ///< candidates skipped while in hold-off
+    unsigned long limited;      ///< moves deferred by the migration limit
+    unsigned long errors;       ///< sampling or affinity errors
+} counters;
+
+static balancedTask *findTask(pid_t tid)
+{
+    size_t i;
+    for (i = 0; i < nTasks; i++) {
+        if (tasks[i].tid == tid) return &tasks[i];
+    }
+    return NULL;
+}
+
+static void removeTask(size_t i)
+{
+    free(tasks[i].name);
+    cpusetFree(tasks[i].allowed);
+    tasks[i] = tasks[--nTasks];
+}
+
+/**
+ * @brief Register a thread with the balancer.
+ *
+ * A thread that is already registered gets the new rule name and CPUs.
+ *
+ * @param name   name of the rule
+ * @param tid    Linux thread id
+ * @param cpuset CPUs the thread may be moved to (NULL = all CPUs the process is allowed on)
+ */
+void balanceRegister(const char *name, pid_t tid, const cpu_set_t *cpuset)
+{
+    balancedTask *pt;
+    char *nm;
+
+    balanceInit();
+    epicsMutexLock(balLock);
+    if (!(nm = strdup(name))) {
+        mcoreLog("Memory allocation error\n");
+        epicsMutexUnlock(balLock);
+        return;
+    }
+    if (!(pt = findTask(tid))) {
+        if (nTasks == maxTasks) {
+            size_t max = maxTasks ? 2 * maxTasks : 32;
+            balancedTask *list = realloc(tasks, max * sizeof(balancedTask));
+            if (!list) {
+                mcoreLog("Memory allocation error\n");
+                free(nm);
+                epicsMutexUnlock(balLock);
+                return;
+            }
+            tasks = list;
+            maxTasks = max;
+        }
+        pt = &tasks[nTasks];
+        memset(pt, 0, sizeof(balancedTask));
+        if (!(pt->allowed = cpusetAlloc())) {
+            free(nm);
+            epicsMutexUnlock(balLock);
+            return;
+        }
+        pt->tid = tid;
+        nTasks++;
+    }
+    free(pt->name);
+    pt->name = nm;
+    if (cpuset) {
+        cpusetCopy(pt->allowed, cpuset);
+    } else {
+        CPU_ZERO_S(cpusetSize(), pt->allowed);
+        topologyAllowedCpus(pt->allowed);
+    }
+    epicsMutexUnlock(balLock);
+}
+
+/**
+ * @brief Stop balancing all threads registered by a rule.
+ *
+ * The threads get back all the CPUs they were allowed to be moved to
+ * (except the reserved CPUs of @c exclusive rules).
+ *
+ * @param name name of the rule
+ */
+void balanceRelease(const char *name)
+{
+    const size_t setsize = cpusetSize();
+    size_t i;
+
+    balanceInit();
+    epicsMutexLock(balLock);
+    for (i = 0; i < nTasks; ) {
+        if (0 == strcmp(name, tasks[i].name)) {
+            if (targets && forbidden) {
+                cpusetCopy(targets, tasks[i].allowed);
+                if (exclusiveForbidden(tasks[i].tid, forbidden)) {
+                    cpumaskAndNot(targets, targets, forbidden, setsize);
+                }
+                if (CPU_COUNT_S(setsize, targets)
+                        && sched_setaffinity(tasks[i].tid, setsize, targets) && ESRCH != errno) {
+                    counters.errors++;
+                    if (errVerbose)
+                        checkStatus(errno,"sched_setaffinity");
+                }
+            }
+            removeTask(i);
+        } else {
+            i++;
+        }
+    }
+    epicsMutexUnlock(balLock);
+}
+
+/**
+ * @brief Count the threads registered by a rule.
+ *
+ * @param name name of the rule
+ * @return number of threads
+ */
+int balanceCount(const char *name)
+{
+    size_t i;
+    int count = 0;
+
+    balanceInit();
+    epicsMutexLock(balLock);
+    for (i = 0; i < nTasks; i++) {
+        if (0 == strcmp(name, tasks[i].name)) count++;
+    }
+    epicsMutexUnlock(balLock);
+    return count;
+}
+
+/**
+ * @brief Sample the CPU loads and the registered threads.
+ *
+ * Threads that do not exist any more are removed.
+ *
+ * @return 1 if loads of a complete period are available, 0 otherwise
+ */
+static int samplePass(void)
+{
+    struct timespec now;
+    double elapsed;
+    size_t i;
+    int cpu, valid;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - prevTime.tv_sec) * 1e9 + (now.tv_nsec - prevTime.tv_nsec);
+    prevTime = now;
+
+    if (!ncpus || readCpuTimes(times, ncpus) < 0) {
+        counters.errors++;
+        havePrev = 0;
+        return 0;
+    }
+    for (cpu = 0; cpu < ncpus; cpu++) {
+        unsigned long long busy = cpuTimesBusy(&times[cpu]);
+        unsigned long long total = cpuTimesTotal(&times[cpu]);
+        load[cpu] = 0.0;
+        if (havePrev && total > prevTotal[cpu] && busy >= prevBusy[cpu]) {
+            load[cpu] = (double) (busy - prevBusy[cpu]) / (total - prevTotal[cpu]);
+        }
+        prevBusy[cpu] = busy;
+        prevTotal[cpu] = total;
+    }
+    valid = havePrev;
+    havePrev = 1;
+
+    for (i = 0; i < nTasks; ) {
+        balancedTask *pt = &tasks[i];
+        unsigned long long runtime, delay;
+
+        if (taskSchedstat(pt->tid, &runtime, &delay, NULL)) {
+            removeTask(i);
+            continue;
+        }
+        pt->util = pt->wait = 0.0;
+        if (pt->sampled && valid && elapsed > 0.0) {
+            pt->util = (runtime - pt->runtime) / elapsed;
+            pt->wait = (delay - pt->delay) / elapsed;
+        }
+        pt->runtime = runtime;
+        pt->delay = delay;
+        pt->cpu = taskCpu(pt->tid);
+        pt->done = !pt->sampled || !valid || pt->cpu < 0 || pt->cpu >= ncpus;
+        pt->sampled = 1;
+        if (pt->holdoff) {
+            pt->holdoff--;
+            if (!pt->done) counters.holdoff++;
+            pt->done = 1;
+        }
+        i++;
+    }
+    return valid;
+}
+
+static void logDecision(balancedTask *pt, int to)
+{
+    balanceDecision *pd = &decisions[nDecisions++ % DECISION_LOG_SIZE];
+
+    epicsTimeGetCurrent(&pd->time);
+    pd->tid = pt->tid;
+    pd->from = pt->cpu;
+    pd->to = to;
+    pd->loadFrom = load[pt->cpu];
+    pd->loadTo = load[to];
+    pd->util = pt->util;
+    pd->wait = pt->wait;
+}
+
+/**
+ * @brief Run one balancing pass.
+ */
+static void balancePass(void)
+{
+    const size_t setsize = cpusetSize();
+    unsigned int moves = 0;
+
+    epicsMutexLock(balLock);
+    counters.passes++;
+    if (!samplePass() || !targets || !forbidden || !pinned) {
+        epicsMutexUnlock(balLock);
+        return;
+    }
+
+    for (;;) {
+        balancedTask *pt = NULL;
+        size_t i;
+        int cpu, to = -1;
+
+        for (i = 0; i < nTasks; i++) {
+            if (!tasks[i].done && (!pt || tasks[i].wait > pt->wait)) pt = &tasks[i];
+        }
+        if (!pt) break;
+        pt->done = 1;
+
+        cpusetCopy(targets, pt->allowed);
+        if (exclusiveForbidden(pt->tid, forbidden)) {
+            cpumaskAndNot(targets, targets, forbidden, setsize);
+        }
+        for (cpu = cpumaskNextSet(targets, setsize, 0); cpu >= 0 && cpu < ncpus;
+             cpu = cpumaskNextSet(targets, setsize, cpu + 1)) {
+            if (cpu != pt->cpu && (to < 0 || load[cpu] < load[to])) to = cpu;
+        }
+        if (to < 0) continue;
+        if (load[pt->cpu] - load[to] < hysteresis || load[pt->cpu] - load[to] <= pt->util) {
+            counters.hysteresis++;
+            continue;
+        }
+        if (moves >= maxMigrations) {
+            counters.limited++;
+            continue;
+        }
+
+        CPU_ZERO_S(setsize, pinned);
+        CPU_SET_S(to, setsize, pinned);
+        if (sched_setaffinity(pt->tid, setsize, pinned)) {
+            counters.errors++;
+            if (errVerbose)
+                mcoreLog("sched_setaffinity error %s\n", strerror(errno));
+            continue;
+        }
+        logDecision(pt, to);
+        load[pt->cpu] -= pt->util;
+        load[to] += pt->util;
+        pt->cpu = to;
+        pt->holdoff = holdoffPasses;
+        counters.migrations++;
+        moves++;
+    }
+    epicsMutexUnlock(balLock);
+}
+
+/**
+ * @brief Balancer thread main loop, balancing until the period is set to zero.
+ *
+ * @param arg unused
+ */
+static void balanceLoop(void *arg)
+{
+    epicsMutexLock(balLock);
+    while (balPeriod > 0.0) {
+        double period = balPeriod;
+        epicsMutexUnlock(balLock);
+        balancePass();
+        epicsEventWaitWithTimeout(balEvent, period);
+        epicsMutexLock(balLock);
+    }
+    balThread = NULL;
+    havePrev = 0;
+    epicsMutexUnlock(balLock);
+}
+
+/**
+ * @brief Set the period of the balancer.
+ */
+void mcoreBalancePeriod(double period)
+{
+    balanceInit();
+    epicsMutexLock(balLock);
+    balPeriod = period;
+    if (period > 0.0 && !balThread) {
+        balThread = ownThreadCreate("mcoreBalance",
+                                    epicsThreadPriorityHigh,
+                                    epicsThreadGetStackSize(epicsThreadStackSmall),
+                                    balanceLoop, NULL);
+        if (!balThread) {
+            errlogPrintf("mcoreBalance: can't create balancer thread\n");
+            balPeriod = 0.0;
+        }
+    }
+    epicsMutexUnlock(balLock);
+    epicsEventSignal(balEvent);
+}
+
+/**
+ * @brief Set the balancer's hysteresis and migration limits.
+ */
+void mcoreBalanceTune(double threshold, int holdoff, int migrations)
+{
+    balanceInit();
+    epicsMutexLock(balLock);
+    if (threshold >= 0.0) hysteresis = threshold / 100.0;
+    if (holdoff >= 0) holdoffPasses = holdoff;
+    if (migrations >= 0) maxMigrations = migrations;
+    epicsMutexUnlock(balLock);
+}
+
+/**
+ * @brief Print the balancer's state, counters and decisions.
+ */
+void mcoreBalanceShow(unsigned int level)
+{
+    FILE *out = epicsGetStdout();
+    char buf[topologyCpusetStrLen()];
+    char name[32];
+    unsigned long i, first;
+
+    balanceInit();
+    epicsMutexLock(balLock);
+    if (balPeriod > 0.0) {
+        fprintf(out, "Balancer running, period %g s", balPeriod);
+    } else {
+        fprintf(out, "Balancer stopped");
+    }
+    fprintf(out, ", hysteresis %g%%, hold-off %u passes, max. %u migration(s) per pass\n",
+            hysteresis * 100.0, holdoffPasses, maxMigrations);
+    fprintf(out, "%lu passes, %lu migrations, %lu rejected by hysteresis, %lu in hold-off, "
+            "%lu deferred by limit, %lu errors\n",
+            counters.passes, counters.migrations, counters.hysteresis,
+            counters.holdoff, counters.limited, counters.errors);
+    if (!level) {
+        fprintf(out, "%lu thread(s) balanced.\n", (unsigned long) nTasks);
+        epicsMutexUnlock(balLock);
+        return;
+    }
+
+    if (nTasks) {
+        fprintf(out, "            NAME   LWP ID CPU  LOAD  WAIT HOLD RULE             CPUS\n");
+    }
+    for (i = 0; i < nTasks; i++) {
+        balancedTask *pt = &tasks[i];
+        if (taskName(pt->tid, name, sizeof(name))) strcpy(name, "-");
+        cpusetToStr(buf, sizeof(buf), pt->allowed);
+        fprintf(out, "%16.16s %8d %3d %4.0f%% %4.0f%% %4u %-16.16s %s\n",
+                name, (int) pt->tid, pt->cpu, pt->util * 100.0, pt->wait * 100.0,
+                pt->holdoff, pt->name, buf);
+    }
+
+    if (nDecisions) {
+        first = nDecisions > DECISION_LOG_SIZE ? nDecisions - DECISION_LOG_SIZE : 0;
+        fprintf(out, "Recent migrations:\n"
+                "    TIME   LWP ID FROM  LOAD   TO  LOAD THREAD  WAIT\n");
+        for (i = first; i < nDecisions; i++) {
+            balanceDecision *pd = &decisions[i % DECISION_LOG_SIZE];
+            char stamp[16];
+            epicsTimeToStrftime(stamp, sizeof(stamp), "%H:%M:%S", &pd->time);
+            fprintf(out, "%8s %8d %4d %4.0f%% %4d %4.0f%% %5.0f%% %4.0f%%\n",
+                    stamp, (int) pd->tid, pd->from, pd->loadFrom * 100.0,
+                    pd->to, pd->loadTo * 100.0, pd->util * 100.0, pd->wait * 100.0);
+        }
+    }
+    epicsMutexUnlock(balLock);
+}
+
+static void once(void *arg)
+{
+    balLock = epicsMutexMustCreate();
+    balEvent = epicsEventMustCreate(epicsEventEmpty);
+    ncpus = topologyNumCpus();
+    times = calloc(ncpus, sizeof(mcoreCpuTimes));
+    prevBusy = calloc(ncpus, sizeof(unsigned long long));
+    prevTotal = calloc(ncpus, sizeof(unsigned long long));
+    load = calloc(ncpus, sizeof(double));
+    if (!times || !prevBusy || !prevTotal || !load) {
+        errlogPrintf("Memory allocation error\n");
+        ncpus = 0;
+    }
+    targets = cpusetAlloc();
+    forbidden = cpusetAlloc();
+    pinned = cpusetAlloc();
+}
+
+/**
+ * @brief Initialization routine.
+ */
+void balanceInit(void)
+{
+    static epicsThreadOnceId onceFlag = EPICS_THREAD_ONCE_INIT;
+    epicsThreadOnce(&onceFlag, once, NULL);
+}
+
+/**
+ *@}
+ */
@@ -0,0 +1,31 @@
+/********************************************//**
+ * @file
+ * @brief Header file for balance.c
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+#ifndef BALANCE_H
+#define BALANCE_H
+
+#include <sched.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void balanceInit(void);
+void balanceRegister(const char *name, pid_t tid, const cpu_set_t *cpuset);
+void balanceRelease(const char *name);
+int balanceCount(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BALANCE_H
@@ -0,0 +1,600 @@
+/********************************************//**
+ * @file
+ * @brief Priority boosting of threads missing their run queue latency target.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * Threads matching a rule with the @c latency option are registered with
+ * the latency monitor. Once per period, the monitor reads the run queue delay
+ * and the number of times each thread was scheduled from
+ * @c /proc/self/task/<tid>/schedstat, and records the mean wait per
+ * scheduling in a window of the last samples.
+ * If the 99th percentile of the window exceeds the thread's latency target,
+ * the thread is boosted by one level (real-time threads: priority raised by
+ * #BOOST_STEP up to the ceiling, other threads: nice value lowered by
+ * #BOOST_NICE_STEP down to -20). If it is below half the target, the thread
+ * decays by one level towards its original priority.
+ * The window is cleared after each change, so that decisions are based on
+ * samples taken at the new priority.
+ *
+ * The changes are decided with #boostLock held and applied after releasing it,
+ * as mcoreThreadModify() takes the rule list lock, which the thread start hook
+ * holds when registering threads. #applyLock (taken before #boostLock) keeps
+ * a release from restoring a thread while a pass is changing it.
+ *
+ * @ingroup threadrules
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+#include <sys/types.h>
+
+#include <errlog.h>
+#include <epicsStdio.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <shareLib.h>
+
+#include "utils.h"
+#include "boost.h"
+
+/// @cond NEVER
+#define epicsExportSharedSymbols
+/// @endcond
+#include "mcoreutils.h"
+
+/// OSI priority added per boost level (real-time threads)
+#define BOOST_STEP 5
+/// nice value subtracted per boost level (other threads)
+#define BOOST_NICE_STEP 5
+/// number of samples kept per thread for the percentile
+#define BOOST_WINDOW 100
+/// minimum number of samples needed for a decision
+#define BOOST_MIN_SAMPLES 10
+/// number of priority changes kept for mcoreBoostShow()
+#define BOOST_LOG_SIZE 64
+
+/**
+ * @brief A thread watched by the latency monitor.
+ */
+typedef struct boostedTask {
+    char       *name;           ///< name of the rule that registered the thread
+    pid_t       tid;            ///< Linux thread id
+    char        epics;          ///< flag: EPICS thread (priority changed through mcoreThreadModify())
+    char        rt;             ///< flag: real-time (FIFO or RR) thread
+    char        sampled;        ///< flag: delay and slices have been sampled
+    unsigned long latency;      ///< latency target [ns]
+    int         ceiling;        ///< highest OSI priority a boost may set
+    int         basePrio;       ///< original OSI priority
+    int         baseNice;       ///< original nice value
+    int         level;          ///< current boost level (0 = not boosted)
+    unsigned long long delay;   ///< run queue delay at the last pass [ns]
+    unsigned long slices;       ///< number of times scheduled at the last pass
+    double      waits[BOOST_WINDOW]; ///< mean wait per scheduling of the last passes [ns]
+    unsigned int nWaits;        ///< number of valid samples in the window
+    unsigned int next;          ///< window position of the next sample
+    double      p99;            ///< 99th percentile of the window at the last decision [ns]
+} boostedTask;
+
+/**
+ * @brief A priority change done by the latency monitor.
+ */
+typedef struct boostChange {
+    epicsTimeStamp time;        ///< time of the change
+    pid_t       tid;            ///< Linux thread id
+    double      p99;            ///< 99th percentile wait that triggered the change [ns]
+    int         from;           ///< previous boost level
+    int         to;             ///< new boost level
+    int         value;          ///< new OSI priority (real-time threads) or nice value
+    char        rt;             ///< flag: value is a priority
+} boostChange;
+
+/**
+ * @brief A priority change decided with #boostLock held, to be applied after releasing it.
+ */
+typedef struct boostDecision {
+    pid_t       tid;            ///< Linux thread id
+    epicsThreadId id;           ///< EPICS thread id (NULL = none found)
+    char        epics;          ///< flag: EPICS thread
+    char        rt;             ///< flag: real-time (FIFO or RR) thread
+    int         from;           ///< boost level at the decision
+    int         to;             ///< new boost level
+    int         value;          ///< OSI priority (real-time threads) or nice value of the new level
+    int         status;         ///< result of setting the level
+} boostDecision;
+
+static epicsMutexId boostLock;
+static epicsMutexId applyLock;          ///< serializes the priority changes of passes and releases
+static boostedTask *tasks;
+static size_t nTasks, maxTasks;
+static boostChange changes[BOOST_LOG_SIZE];
+static unsigned long nChanges;
+static epicsThreadId boostThread;
+static epicsEventId boostEvent;
+static double boostPeriod;
+static __thread boostDecision *mapDecisions;    ///< decisions to look up by findEpicsThreads()
+static __thread size_t nMapDecisions;           ///< number of decisions to look up
+
+/**
+ * @brief Counters of the latency monitor.
+ */
+static struct {
+    unsigned long passes;       ///< monitor passes
+    unsigned long boosts;       ///< priorities raised
+    unsigned long decays;       ///< priorities lowered
+    unsigned long ceiling;      ///< boosts prevented by the ceiling
+    unsigned long errors;       ///< errors setting priorities
+} counters;
+
+static boostedTask *findTask(pid_t tid)
+{
+    size_t i;
+    for (i = 0; i < nTasks; i++) {
+        if (tasks[i].tid == tid) return &tasks[i];
+    }
+    return NULL;
+}
+
+static void removeTask(size_t i)
+{
+    free(tasks[i].name);
+    tasks[i] = tasks[--nTasks];
+}
+
+/**
+ * @brief Map callback finding the EPICS threads of the decisions in #mapDecisions.
+ *
+ * @param id current thread (map argument)
+ */
+static void findEpicsThreads(epicsThreadId id)
+{
+    size_t i;
+    for (i = 0; i < nMapDecisions; i++) {
+        if (mapDecisions[i].tid == id->lwpId) mapDecisions[i].id = id;
+    }
+}
+
+/**
+ * @brief Look up the EPICS threads of a list of decisions.
+ *
+ * Must not be called with #boostLock held: the thread start hook registers
+ * threads while the EPICS thread list is locked.
+ *
+ * @param list decisions to look up
+ * @param n    number of decisions
+ */
+static void lookupEpicsThreads(boostDecision *list, size_t n)
+{
+    mapDecisions = list;
+    nMapDecisions = n;
+    epicsThreadMap(findEpicsThreads);
+    mapDecisions = NULL;
+    nMapDecisions = 0;
+}
+
+static int levelValue(const boostedTask *pt, int level)
+{
+    if (pt->rt) {
+        int prio = pt->basePrio + level * BOOST_STEP;
+        return prio > pt->ceiling ? (pt->ceiling > pt->basePrio ? pt->ceiling : pt->basePrio) : prio;
+    } else {
+        int nice = pt->baseNice - level * BOOST_NICE_STEP;
+        return nice < -20 ? -20 : nice;
+    }
+}
+
+/**
+ * @brief Record a decision to set a watched thread to a boost level.
+ *
+ * @param pd    decision to write into
+ * @param pt    watched thread
+ * @param level boost level to set
+ */
+static void decide(boostDecision *pd, const boostedTask *pt, int level)
+{
+    pd->tid = pt->tid;
+    pd->id = NULL;
+    pd->epics = pt->epics;
+    pd->rt = pt->rt;
+    pd->from = pt->level;
+    pd->to = level;
+    pd->value = levelValue(pt, level);
+    pd->status = 0;
+}
+
+/**
+ * @brief Set the priority (or nice value) of a thread as decided.
+ *
+ * Must not be called with #boostLock held: mcoreThreadModify() takes the rule
+ * list lock, which the thread start hook holds when registering threads.
+ *
+ * @param pd decision (real-time EPICS threads are changed through their EPICS thread id)
+ * @return 0 on success, errno on error
+ */
+static int setLevel(const boostDecision *pd)
+{
+    mcoreSchedAttr attr;
+    int status;
+
+    if (pd->rt && pd->epics && pd->id) {
+        char prio[16];
+        sprintf(prio, "%d", pd->value);
+        mcoreThreadModify(pd->id, NULL, prio, NULL);
+        return 0;
+    }
+    status = schedGetAttr(pd->tid, &attr);
+    if (!status) {
+        attr.sched_flags &= SCHED_FLAG_RESET_ON_FORK;
+        if (pd->rt) {
+            attr.sched_priority = osiToPosixPriority(attr.sched_policy, pd->value);
+        } else {
+            attr.sched_nice = pd->value;
+        }
+        status = schedSetAttr(pd->tid, &attr);
+    }
+    if (status && errVerbose)
+        mcoreLog("sched_setattr error %s\n", strerror(status));
+    return status;
+}
+
+static void logChange(boostedTask *pt, int to)
+{
+    boostChange *pc = &changes[nChanges++ % BOOST_LOG_SIZE];
+
+    epicsTimeGetCurrent(&pc->time);
+    pc->tid = pt->tid;
+    pc->p99 = pt->p99;
+    pc->from = pt->level;
+    pc->to = to;
+    pc->value = levelValue(pt, to);
+    pc->rt = pt->rt;
+}
+
+/**
+ * @brief Register a thread with the latency monitor.
+ *
+ * A thread that is already registered gets the new rule name and target.
+ *
+ * @param name    name of the rule
+ * @param tid     Linux thread id
+ * @param id      EPICS thread id (NULL = not an EPICS thread)
+ * @param latency latency target [us]
+ * @param ceiling highest OSI priority a boost may set (0 = original priority + 2 levels)
+ */
+void boostRegister(const char *name, pid_t tid, epicsThreadId id, unsigned long latency, int ceiling)
+{
+    boostedTask *pt;
+    mcoreSchedAttr attr;
+    char *nm;
+
+    boostInit();
+    epicsMutexLock(boostLock);
+    if (!(nm = strdup(name))) {
+        mcoreLog("Memory allocation error\n");
+        epicsMutexUnlock(boostLock);
+        return;
+    }
+    if (!(pt = findTask(tid))) {
+        if (nTasks == maxTasks) {
+            size_t max = maxTasks ? 2 * maxTasks : 16;
+            boostedTask *list = realloc(tasks, max * sizeof(boostedTask));
+            if (!list) {
+                mcoreLog("Memory allocation error\n");
+                free(nm);
+                epicsMutexUnlock(boostLock);
+                return;
+            }
+            tasks = list;
+            maxTasks = max;
+        }
+        pt = &tasks[nTasks++];
+        memset(pt, 0, sizeof(boostedTask));
+        pt->tid = tid;
+    }
+    free(pt->name);
+    pt->name = nm;
+    pt->epics = id ? 1 : 0;
+    pt->latency = latency * 1000;
+    if (!pt->level && 0 == schedGetAttr(tid, &attr)) {
+        pt->rt = (SCHED_FIFO == attr.sched_policy || SCHED_RR == attr.sched_policy);
+        pt->basePrio = id ? (int) id->osiPriority
+                          : posixToOsiPriority(attr.sched_policy, attr.sched_priority);
+        pt->baseNice = attr.sched_nice;
+    }
+    pt->ceiling = ceiling ? ceiling : pt->basePrio + 2 * BOOST_STEP;
+    if (pt->ceiling > epicsThreadPriorityMax) pt->ceiling = epicsThreadPriorityMax;
+    epicsMutexUnlock(boostLock);
+}
+
+/**
+ * @brief Stop watching all threads registered by a rule, restoring their priorities.
+ *
+ * @param name name of the rule
+ */
+void boostRelease(const char *name)
+{
+    boostDecision *restores = NULL;
+    size_t i, n = 0;
+    int lookup = 0;
+
+    boostInit();
+    epicsMutexLock(applyLock);
+    epicsMutexLock(boostLock);
+    if (nTasks && !(restores = calloc(nTasks, sizeof(boostDecision)))) {
+        errlogPrintf("Memory allocation error\n");
+    }
+    for (i = 0; i < nTasks; ) {
+        if (0 == strcmp(name, tasks[i].name)) {
+            if (restores && tasks[i].level && taskExists(tasks[i].tid)) {
+                decide(&restores[n++], &tasks[i], 0);
+                if (tasks[i].rt && tasks[i].epics) lookup = 1;
+            }
+            removeTask(i);
+        } else {
+            i++;
+        }
+    }
+    epicsMutexUnlock(boostLock);
+
+    if (lookup) lookupEpicsThreads(restores, n);
+    for (i = 0; i < n; i++) {
+        setLevel(&restores[i]);
+    }
+    epicsMutexUnlock(applyLock);
+    free(restores);
+}
+
+/**
+ * @brief Count the threads registered by a rule.
+ *
+ * @param name name of the rule
+ * @return number of threads
+ */
+int boostCount(const char *name)
+{
+    size_t i;
+    int count = 0;
+
+    boostInit();
+    epicsMutexLock(boostLock);
+    for (i = 0; i < nTasks; i++) {
+        if (0 == strcmp(name, tasks[i].name)) count++;
+    }
+    epicsMutexUnlock(boostLock);
+    return count;
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+    double da = *(const double *) a, db = *(const double *) b;
+    return (da > db) - (da < db);
+}
+
+/**
+ * @brief Get the 99th percentile of a thread's window.
+ *
+ * @param pt watched thread
+ * @return 99th percentile wait [ns]
+ */
+static double percentile99(const boostedTask *pt)
+{
+    double sorted[BOOST_WINDOW];
+    unsigned int index = (unsigned int) ceil(0.99 * pt->nWaits) - 1;
+
+    memcpy(sorted, pt->waits, pt->nWaits * sizeof(double));
+    qsort(sorted, pt->nWaits, sizeof(double), compareDouble);
+    return sorted[index];
+}
+
+/**
+ * @brief Run one monitor pass, sampling all watched threads and boosting or decaying them.
+ */
+static void boostPass(void)
+{
+    boostDecision *decided = NULL;
+    size_t i, n = 0;
+    int lookup = 0;
+
+    epicsMutexLock(applyLock);
+    epicsMutexLock(boostLock);
+    counters.passes++;
+    if (nTasks && !(decided = calloc(nTasks, sizeof(boostDecision)))) {
+        errlogPrintf("Memory allocation error\n");
+        epicsMutexUnlock(boostLock);
+        epicsMutexUnlock(applyLock);
+        return;
+    }
+    for (i = 0; i < nTasks; ) {
+        boostedTask *pt = &tasks[i];
+        unsigned long long runtime, delay;
+        unsigned long slices;
+        int to;
+
+        if (taskSchedstat(pt->tid, &runtime, &delay, &slices)) {
+            removeTask(i);
+            continue;
+        }
+        i++;
+        if (pt->sampled && slices > pt->slices) {
+            pt->waits[pt->next] = (double) (delay - pt->delay) / (slices - pt->slices);
+            pt->next = (pt->next + 1) % BOOST_WINDOW;
+            if (pt->nWaits < BOOST_WINDOW) pt->nWaits++;
+        }
+        pt->delay = delay;
+        pt->slices = slices;
+        pt->sampled = 1;
+        if (pt->nWaits < BOOST_MIN_SAMPLES) continue;
+
+        pt->p99 = percentile99(pt);
+        to = pt->level;
+        if (pt->p99 > pt->latency) {
+            if (levelValue(pt, pt->level + 1) == levelValue(pt, pt->level)) {
+                counters.ceiling++;
+                continue;
+            }
+            to++;
+        } else if (pt->level && pt->p99 < pt->latency / 2) {
+            to--;
+        } else {
+            continue;
+        }
+        decide(&decided[n++], pt, to);
+        if (pt->rt && pt->epics) lookup = 1;
+    }
+    epicsMutexUnlock(boostLock);
+
+    if (lookup) lookupEpicsThreads(decided, n);
+    for (i = 0; i < n; i++) {
+        decided[i].status = setLevel(&decided[i]);
+    }
+
+    epicsMutexLock(boostLock);
+    for (i = 0; i < n; i++) {
+        boostedTask *pt = findTask(decided[i].tid);
+        int to = decided[i].to;
+
+        if (decided[i].status) {
+            counters.errors++;
+            continue;
+        }
+        // skip threads released or re-registered meanwhile
+        if (!pt || pt->level != decided[i].from) continue;
+        logChange(pt, to);
+        if (to > pt->level) {
+            counters.boosts++;
+        } else {
+            counters.decays++;
+        }
+        pt->level = to;
+        pt->nWaits = pt->next = 0;
+    }
+    epicsMutexUnlock(boostLock);
+    epicsMutexUnlock(applyLock);
+    free(decided);
+}
+
+/**
+ * @brief Monitor thread main loop, running until the period is set to zero.
+ *
+ * @param arg unused
+ */
+static void boostLoop(void *arg)
+{
+    epicsMutexLock(boostLock);
+    while (boostPeriod > 0.0) {
+        double period = boostPeriod;
+        epicsMutexUnlock(boostLock);
+        boostPass();
+        epicsEventWaitWithTimeout(boostEvent, period);
+        epicsMutexLock(boostLock);
+    }
+    boostThread = NULL;
+    epicsMutexUnlock(boostLock);
+}
+
+/**
+ * @brief Set the period of the latency monitor.
+ */
+void mcoreBoostPeriod(double period)
+{
+    boostInit();
+    epicsMutexLock(boostLock);
+    boostPeriod = period;
+    if (period > 0.0 && !boostThread) {
+        boostThread = ownThreadCreate("mcoreBoost",
+                                      epicsThreadPriorityMax,
+                                      epicsThreadGetStackSize(epicsThreadStackSmall),
+                                      boostLoop, NULL);
+        if (!boostThread) {
+            errlogPrintf("mcoreBoost: can't create monitor thread\n");
+            boostPeriod = 0.0;
+        }
+    }
+    epicsMutexUnlock(boostLock);
+    epicsEventSignal(boostEvent);
+}
+
+/**
+ * @brief Print the latency monitor's state, counters and priority changes.
+ */
+void mcoreBoostShow(unsigned int level)
+{
+    FILE *out = epicsGetStdout();
+    char name[32];
+    unsigned long i, first;
+
+    boostInit();
+    epicsMutexLock(boostLock);
+    if (boostPeriod > 0.0) {
+        fprintf(out, "Latency monitor running, period %g s\n", boostPeriod);
+    } else {
+        fprintf(out, "Latency monitor stopped\n");
+    }
+    fprintf(out, "%lu passes, %lu boosts, %lu decays, %lu at ceiling, %lu errors\n",
+            counters.passes, counters.boosts, counters.decays, counters.ceiling, counters.errors);
+    if (!level) {
+        fprintf(out, "%lu thread(s) watched.\n", (unsigned long) nTasks);
+        epicsMutexUnlock(boostLock);
+        return;
+    }
+
+    if (nTasks) {
+        fprintf(out, "            NAME   LWP ID TARGET[us]  P99[us] LEVEL  PRIO/NICE RULE\n");
+    }
+    for (i = 0; i < nTasks; i++) {
+        boostedTask *pt = &tasks[i];
+        if (taskName(pt->tid, name, sizeof(name))) strcpy(name, "-");
+        fprintf(out, "%16.16s %8d %10lu %8.0f %5d %4s %4d %s\n",
+                name, (int) pt->tid, pt->latency / 1000, pt->p99 / 1000.0, pt->level,
+                pt->rt ? "prio" : "nice", levelValue(pt, pt->level), pt->name);
+    }
+
+    if (nChanges) {
+        first = nChanges > BOOST_LOG_SIZE ? nChanges - BOOST_LOG_SIZE : 0;
+        fprintf(out, "Recent changes:\n"
+                "    TIME   LWP ID  P99[us] LEVEL       PRIO/NICE\n");
+        for (i = first; i < nChanges; i++) {
+            boostChange *pc = &changes[i % BOOST_LOG_SIZE];
+            char stamp[16];
+            epicsTimeToStrftime(stamp, sizeof(stamp), "%H:%M:%S", &pc->time);
+            fprintf(out, "%8s %8d %8.0f %2d -> %-2d %s %s %d\n",
+                    stamp, (int) pc->tid, pc->p99 / 1000.0, pc->from, pc->to,
+                    pc->to > pc->from ? "boost" : "decay", pc->rt ? "prio" : "nice", pc->value);
+        }
+    }
+    epicsMutexUnlock(boostLock);
+}
+
+static void once(void *arg)
+{
+    boostLock = epicsMutexMustCreate();
+    applyLock = epicsMutexMustCreate();
+    boostEvent = epicsEventMustCreate(epicsEventEmpty);
+}
+
+/**
+ * @brief Initialization routine.
+ */
+void boostInit(void)
+{
+    static epicsThreadOnceId onceFlag = EPICS_THREAD_ONCE_INIT;
+    epicsThreadOnce(&onceFlag, once, NULL);
+}
+
+/**
+ *@}
+ */
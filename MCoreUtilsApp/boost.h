@@ -0,0 +1,32 @@
+/********************************************//**
+ * @file
+ * @brief Header file for boost.c
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+#ifndef BOOST_H
+#define BOOST_H
+
+#include <sys/types.h>
+
+#include <epicsThread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void boostInit(void);
+void boostRegister(const char *name, pid_t tid, epicsThreadId id, unsigned long latency, int ceiling);
+void boostRelease(const char *name);
+int boostCount(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BOOST_H
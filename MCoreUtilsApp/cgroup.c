@@ -0,0 +1,400 @@
+/********************************************//**
+ * @file
+ * @brief cgroup v2 cpuset partition for real-time and exclusive threads.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * The partition is a threaded child group of the IOC process' own cgroup,
+ * so that single threads can be moved into it through @c cgroup.threads.
+ * If the group does not exist, it is created with the CPUs of all rules that
+ * set a real-time policy or the @c exclusive option (together with an affinity),
+ * and turned into an isolated partition. An existing group is joined as it is.
+ *
+ * Once the partition is set up, the threads of these rules are moved into it,
+ * as are all threads matching them later.
+ *
+ * @ingroup threadrules
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <errlog.h>
+#include <envDefs.h>
+#include <epicsStdio.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <shareLib.h>
+
+#include "utils.h"
+#include "cpumask.h"
+#include "topology.h"
+#include "threadRules.h"
+#include "cgroup.h"
+
+/// @cond NEVER
+#define epicsExportSharedSymbols
+/// @endcond
+#include "mcoreutils.h"
+
+/// name of the partition group if none is given
+#define CGROUP_DEFAULT_NAME "rt"
+
+static ENV_PARAM cgroupfsRoot = {"EPICS_MCORE_CGROUPFS","/sys/fs/cgroup"};
+
+static epicsMutexId cgroupLock;
+static char *partition;         ///< path of the partition group (NULL = no partition)
+
+/**
+ * @brief Counters of the partition.
+ */
+static struct {
+    unsigned long attached;     ///< threads moved into the partition
+    unsigned long errors;       ///< errors moving threads
+} counters;
+
+static const char *cgroupRoot(void)
+{
+    const char *root = envGetConfigParamPtr(&cgroupfsRoot);
+    return root ? root : "/sys/fs/cgroup";
+}
+
+/**
+ * @brief Read the first line of a cgroup file, without the line end.
+ *
+ * @param dir  cgroup directory
+ * @param file file name
+ * @param buf  buffer to read into
+ * @param len  size of the buffer
+ * @return 0 on success, errno on error
+ */
+static int readCgroupFile(const char *dir, const char *file, char *buf, size_t len)
+{
+    char path[1024];
+    char *cp;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    if (!(fp = fopen(path, "r"))) return errno;
+    if (!fgets(buf, (int) len, fp)) buf[0] = '\0';
+    fclose(fp);
+    if ((cp = strpbrk(buf, "\n\r"))) *cp = '\0';
+    return 0;
+}
+
+/**
+ * @brief Write a cgroup file.
+ *
+ * @param dir   cgroup directory
+ * @param file  file name
+ * @param value value to write
+ * @return 0 on success, errno on error
+ */
+static int writeCgroupFile(const char *dir, const char *file, const char *value)
+{
+    char path[1024];
+    FILE *fp;
+    int status = 0;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    if (!(fp = fopen(path, "w"))) return errno;
+    if (fputs(value, fp) < 0) status = errno;
+    if (fclose(fp) && !status) status = errno;
+    return status;
+}
+
+/**
+ * @brief Get the path of the process' own cgroup (relative to the cgroupfs root).
+ *
+ * @param buf buffer to write into
+ * @param len size of the buffer
+ * @return 0 on success, -1 if there is no cgroup v2 hierarchy
+ */
+static int ownCgroup(char *buf, size_t len)
+{
+    char path[512], line[512];
+    char *cp;
+    FILE *fp;
+    int status = -1;
+
+    snprintf(path, sizeof(path), "%s/self/cgroup", topologyProcfsRoot());
+    if (!(fp = fopen(path, "r"))) return -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (0 == strncmp(line, "0::", 3)) {
+            if ((cp = strpbrk(line, "\n\r"))) *cp = '\0';
+            strncpy(buf, line + 3, len - 1);
+            buf[len - 1] = '\0';
+            if ((cp = buf + strlen(buf) - 1) > buf && '/' == *cp) *cp = '\0';
+            status = 0;
+            break;
+        }
+    }
+    fclose(fp);
+    return status;
+}
+
+/**
+ * @brief Create the partition group.
+ *
+ * @param parent directory of the parent (the process' own) group
+ * @param dir    directory of the group to create
+ * @param cpus   CPUs of the partition in list format
+ * @return 0 on success, errno on error
+ */
+static int createPartition(const char *parent, const char *dir, const char *cpus)
+{
+    int status;
+
+    if ((status = writeCgroupFile(parent, "cgroup.subtree_control", "+cpuset"))) {
+        errlogPrintf("mcoreCgroupPartition: can't enable cpuset controller in %s - %s\n",
+                     parent, strerror(status));
+        return status;
+    }
+    if (mkdir(dir, 0755)) {
+        status = errno;
+        errlogPrintf("mcoreCgroupPartition: can't create %s - %s\n", dir, strerror(status));
+        return status;
+    }
+    if ((status = writeCgroupFile(dir, "cgroup.type", "threaded"))) {
+        errlogPrintf("mcoreCgroupPartition: can't make %s threaded - %s\n", dir, strerror(status));
+        return status;
+    }
+    if ((status = writeCgroupFile(dir, "cpuset.cpus", cpus))) {
+        errlogPrintf("mcoreCgroupPartition: can't set cpuset.cpus %s - %s\n", cpus, strerror(status));
+        return status;
+    }
+    // needed for partitions whose parent is not a partition root (kernel 6.7+)
+    status = writeCgroupFile(dir, "cpuset.cpus.exclusive", cpus);
+    if (status && ENOENT != status && errVerbose) {
+        errlogPrintf("mcoreCgroupPartition: can't set cpuset.cpus.exclusive %s - %s\n",
+                     cpus, strerror(status));
+    }
+    if ((status = writeCgroupFile(dir, "cpuset.cpus.partition", "isolated"))) {
+        errlogPrintf("mcoreCgroupPartition: can't make %s an isolated partition - %s\n",
+                     dir, strerror(status));
+    }
+    return status;
+}
+
+/**
+ * @brief Move a thread into the partition.
+ *
+ * Does nothing if no partition has been set up.
+ *
+ * @param tid Linux thread id
+ * @return 0 on success (or no partition), errno on error
+ */
+int cgroupAttach(pid_t tid)
+{
+    char value[32];
+    int status = 0;
+
+    cgroupInit();
+    epicsMutexLock(cgroupLock);
+    if (partition) {
+        sprintf(value, "%d", (int) tid);
+        status = writeCgroupFile(partition, "cgroup.threads", value);
+        if (status) {
+            counters.errors++;
+            if (errVerbose)
+                mcoreLog("mcoreCgroup: can't move thread %d into %s - %s\n",
+                         (int) tid, partition, strerror(status));
+        } else {
+            counters.attached++;
+        }
+    }
+    epicsMutexUnlock(cgroupLock);
+    return status;
+}
+
+/**
+ * @brief Create or join the partition group and move the matching threads into it.
+ *
+ * @param name    name of the group
+ * @param cpuset  scratch cpuset
+ * @param present scratch cpuset
+ * @param cpus    scratch buffer for a cpuset string
+ * @param cpuslen size of the buffer
+ */
+static void setupPartition(const char *name, cpu_set_t *cpuset, cpu_set_t *present,
+                           char *cpus, size_t cpuslen)
+{
+    const size_t setsize = cpusetSize();
+    char own[256], parent[512], dir[768], state[128];
+    struct stat st;
+
+    if (strchr(name, '/') || '.' == name[0]) {
+        errlogPrintf("mcoreCgroupPartition: invalid group name %s\n", name);
+        return;
+    }
+    if (ownCgroup(own, sizeof(own))) {
+        errlogPrintf("mcoreCgroupPartition: process is not in a cgroup v2 hierarchy\n");
+        return;
+    }
+    snprintf(parent, sizeof(parent), "%s%s", cgroupRoot(), own);
+    snprintf(dir, sizeof(dir), "%s/%s", parent, name);
+
+    if (0 == stat(dir, &st)) {
+        if (!readCgroupFile(dir, "cpuset.cpus", cpus, cpuslen) && 0 == strToCpuset(present, cpus)
+                && partitionRulesCpuset(cpuset)) {
+            cpumaskAndNot(cpuset, cpuset, present, setsize);
+            if (CPU_COUNT_S(setsize, cpuset)) {
+                cpusetToStr(cpus, cpuslen, cpuset);
+                errlogPrintf("mcoreCgroupPartition: CPU %s of the rules not in existing partition %s\n",
+                             cpus, dir);
+            }
+        }
+        errlogPrintf("mcoreCgroupPartition: joining existing group %s\n", dir);
+    } else {
+        if (!partitionRulesCpuset(cpuset)) {
+            errlogPrintf("mcoreCgroupPartition: no real-time or exclusive rules with affinity\n");
+            return;
+        }
+        cpusetToStr(cpus, cpuslen, cpuset);
+        if (createPartition(parent, dir, cpus)) return;
+    }
+
+    if (0 == readCgroupFile(dir, "cpuset.cpus.partition", state, sizeof(state))
+            && strstr(state, "invalid")) {
+        errlogPrintf("mcoreCgroupPartition: partition %s is %s\n", dir, state);
+    }
+
+    epicsMutexLock(cgroupLock);
+    free(partition);
+    if (!(partition = strdup(dir))) {
+        errlogPrintf("Memory allocation error\n");
+    }
+    epicsMutexUnlock(cgroupLock);
+    partitionRulesAttach();
+}
+
+void mcoreCgroupPartition(const char *name)
+{
+    const int cpuslen = topologyCpusetStrLen();
+    cpu_set_t *cpuset = cpusetAlloc();
+    cpu_set_t *present = cpusetAlloc();
+    char *cpus = malloc(cpuslen);
+
+    cgroupInit();
+    if (!cpuset || !present || !cpus) {
+        errlogPrintf("Memory allocation error\n");
+    } else {
+        setupPartition(name && *name ? name : CGROUP_DEFAULT_NAME, cpuset, present, cpus, cpuslen);
+    }
+    cpusetFree(cpuset);
+    cpusetFree(present);
+    free(cpus);
+}
+
+/**
+ * @brief Get the CPUs the cgroup cpuset of the process provides.
+ *
+ * The CPUs of the partition are included, as the kernel removes them from
+ * the effective CPUs of the parent (the process' own) group.
+ *
+ * @param cpuset cpuset to write into
+ * @return number of CPUs, -1 if there is no cgroup v2 cpuset
+ */
+int cgroupEffectiveCpus(cpu_set_t *cpuset)
+{
+    const size_t setsize = cpusetSize();
+    cpu_set_t *part = cpusetAlloc();
+    char own[256], path[1024];
+
+    cgroupInit();
+    if (!part) return -1;
+    if (ownCgroup(own, sizeof(own))) {
+        cpusetFree(part);
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s%s/cpuset.cpus.effective", cgroupRoot(), own);
+    if (readCpuList(path, cpuset)) {
+        cpusetFree(part);
+        return -1;
+    }
+    epicsMutexLock(cgroupLock);
+    if (partition) {
+        snprintf(path, sizeof(path), "%s/cpuset.cpus.effective", partition);
+        if (0 == readCpuList(path, part)) {
+            cpumaskOr(cpuset, cpuset, part, setsize);
+        }
+    }
+    epicsMutexUnlock(cgroupLock);
+    cpusetFree(part);
+    return CPU_COUNT_S(setsize, cpuset) ? CPU_COUNT_S(setsize, cpuset) : -1;
+}
+
+void mcoreCgroupShow(unsigned int level)
+{
+    static const char *files[] = {
+        "cgroup.type", "cpuset.cpus", "cpuset.cpus.effective", "cpuset.cpus.partition"
+    };
+    FILE *out = epicsGetStdout();
+    char line[256], path[1024], name[32];
+    size_t i;
+    int count = 0;
+    FILE *fp;
+
+    cgroupInit();
+    epicsMutexLock(cgroupLock);
+    if (!partition) {
+        fprintf(out, "No cgroup partition\n");
+        epicsMutexUnlock(cgroupLock);
+        return;
+    }
+    fprintf(out, "cgroup partition %s\n", partition);
+    for (i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        if (readCgroupFile(partition, files[i], line, sizeof(line))) strcpy(line, "-");
+        fprintf(out, "%24s: %s\n", files[i], line);
+    }
+    snprintf(path, sizeof(path), "%s/cgroup.threads", partition);
+    if ((fp = fopen(path, "r"))) {
+        if (level) {
+            fprintf(out, "    LWP ID NAME\n");
+        }
+        while (fgets(line, sizeof(line), fp)) {
+            pid_t tid = (pid_t) atoi(line);
+            count++;
+            if (level) {
+                if (taskName(tid, name, sizeof(name))) strcpy(name, "-");
+                fprintf(out, "%10d %s\n", (int) tid, name);
+            }
+        }
+        fclose(fp);
+    }
+    fprintf(out, "%d thread(s) in partition, %lu moved, %lu errors\n",
+            count, counters.attached, counters.errors);
+    epicsMutexUnlock(cgroupLock);
+}
+
+static void once(void *arg)
+{
+    cgroupLock = epicsMutexMustCreate();
+}
+
+/**
+ * @brief Initialization routine.
+ */
+void cgroupInit(void)
+{
+    static epicsThreadOnceId onceFlag = EPICS_THREAD_ONCE_INIT;
+    epicsThreadOnce(&onceFlag, once, NULL);
+}
+
+/**
+ *@}
+ */
@@ -0,0 +1,30 @@
+/********************************************//**
+ * @file
+ * @brief Header file for cgroup.c
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <sched.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void cgroupInit(void);
+int cgroupAttach(pid_t tid);
+int cgroupEffectiveCpus(cpu_set_t *cpuset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CGROUP_H
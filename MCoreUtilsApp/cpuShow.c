@@ -0,0 +1,258 @@
+/********************************************//**
+ * @file
+ * @brief Per-CPU load, interference and thread report.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * @ingroup topology
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <errlog.h>
+#include <epicsStdio.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <shareLib.h>
+
+#include "utils.h"
+#include "cpumask.h"
+#include "topology.h"
+
+/// @cond NEVER
+#define epicsExportSharedSymbols
+/// @endcond
+#include "mcoreutils.h"
+
+/**
+ * @brief Run queue statistics of a CPU, as read from /proc/schedstat.
+ */
+typedef struct cpuSchedstat {
+    unsigned long long wait;    ///< time spent by tasks waiting on the run queue [ns]
+    unsigned long long slices;  ///< number of time slices run
+} cpuSchedstat;
+
+/**
+ * @brief An EPICS thread, as collected for the report.
+ */
+typedef struct cpuThread {
+    char        name[32];       ///< thread name
+    int         policy;         ///< scheduling policy
+    int         priority;       ///< OSI priority
+    cpu_set_t  *cpuset;         ///< affinity
+} cpuThread;
+
+static epicsMutexId cpuLock;
+static int ncpus;
+static mcoreCpuTimes *times, *prevTimes;
+static cpuSchedstat *sstat, *prevSstat;
+static struct timespec prevTime;
+static cpuThread *threads;
+static size_t nThreads, maxThreads;
+
+/**
+ * @brief Read the run queue statistics of all CPUs from /proc/schedstat.
+ *
+ * Needs a kernel with @c CONFIG_SCHEDSTATS.
+ *
+ * @param stats array of statistics
+ * @param n     length of the array
+ * @return number of CPUs read, -1 on error
+ */
+static int readSchedstat(cpuSchedstat *stats, int n)
+{
+    char line[512];
+    int count = 0;
+    FILE *fp;
+
+    memset(stats, 0, n * sizeof(cpuSchedstat));
+    fp = fopen("/proc/schedstat", "r");
+    if (!fp) return -1;
+    while (fgets(line, sizeof(line), fp)) {
+        unsigned long long f[9];
+        int cpu;
+
+        if (strncmp(line, "cpu", 3) || !isdigit((unsigned char) line[3]))
+            continue;
+        // fields 7 to 9: run time, wait time, time slices
+        if (10 != sscanf(line + 3, "%d %llu %llu %llu %llu %llu %llu %llu %llu %llu", &cpu,
+                         &f[0], &f[1], &f[2], &f[3], &f[4], &f[5], &f[6], &f[7], &f[8])
+                || cpu < 0 || cpu >= n)
+            continue;
+        stats[cpu].wait = f[7];
+        stats[cpu].slices = f[8];
+        count++;
+    }
+    fclose(fp);
+    return count;
+}
+
+/**
+ * @brief Map callback collecting the EPICS threads with their affinity.
+ *
+ * @param id current thread (map argument)
+ */
+static void collectThread(epicsThreadId id)
+{
+    struct sched_param param;
+    cpuThread *pt;
+
+    if (nThreads == maxThreads) {
+        size_t max = maxThreads ? 2 * maxThreads : 64;
+        cpuThread *list = realloc(threads, max * sizeof(cpuThread));
+        if (!list) return;
+        memset(list + maxThreads, 0, (max - maxThreads) * sizeof(cpuThread));
+        threads = list;
+        maxThreads = max;
+    }
+    pt = &threads[nThreads];
+    if (!pt->cpuset && !(pt->cpuset = cpusetAlloc())) return;
+    if (!id->tid
+            || pthread_getaffinity_np(id->tid, cpusetSize(), pt->cpuset)
+            || pthread_getschedparam(id->tid, &pt->policy, &param))
+        return;
+    strncpy(pt->name, id->name, sizeof(pt->name) - 1);
+    pt->name[sizeof(pt->name) - 1] = '\0';
+    pt->priority = id->osiPriority;
+    nThreads++;
+}
+
+static double percent(unsigned long long now, unsigned long long prev, unsigned long long total)
+{
+    return total ? 100.0 * (now - prev) / total : 0.0;
+}
+
+static void once(void *arg)
+{
+    cpuLock = epicsMutexMustCreate();
+    ncpus = topologyNumCpus();
+    times = calloc(ncpus, sizeof(mcoreCpuTimes));
+    prevTimes = calloc(ncpus, sizeof(mcoreCpuTimes));
+    sstat = calloc(ncpus, sizeof(cpuSchedstat));
+    prevSstat = calloc(ncpus, sizeof(cpuSchedstat));
+    if (!times || !prevTimes || !sstat || !prevSstat) {
+        errlogPrintf("Memory allocation error\n");
+        ncpus = 0;
+    }
+}
+
+/**
+ * @brief Initialization routine.
+ */
+static void cpuShowInit(void)
+{
+    static epicsThreadOnceId onceFlag = EPICS_THREAD_ONCE_INIT;
+    epicsThreadOnce(&onceFlag, once, NULL);
+}
+
+/**
+ * @brief Print the per-CPU load, run queue wait and thread report.
+ */
+void mcoreCpuShow(unsigned int level)
+{
+    FILE *out = epicsGetStdout();
+    const size_t setsize = cpusetSize();
+    struct timespec now;
+    double elapsed;
+    int haveSstat, cpu;
+    size_t i;
+
+    cpuShowInit();
+    if (!ncpus) return;
+    epicsMutexLock(cpuLock);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (prevTime.tv_sec || prevTime.tv_nsec) {
+        elapsed = (now.tv_sec - prevTime.tv_sec) + (now.tv_nsec - prevTime.tv_nsec) * 1e-9;
+        fprintf(out, "Since last call (%.1f s):\n", elapsed);
+    } else {
+        elapsed = now.tv_sec + now.tv_nsec * 1e-9;
+        fprintf(out, "Since boot:\n");
+    }
+    prevTime = now;
+
+    if (readCpuTimes(times, ncpus) < 0) {
+        errlogPrintf("mcoreCpuShow: can't read /proc/stat\n");
+        epicsMutexUnlock(cpuLock);
+        return;
+    }
+    haveSstat = readSchedstat(sstat, ncpus) > 0;
+    nThreads = 0;
+    epicsThreadMap(collectThread);
+
+    fprintf(out, " CPU  USER%%  NICE%%   SYS%%   IRQ%%  SIRQ%% STEAL%%  IDLE%% AVGWAIT WAIT[us]"
+            " EPICS    RT\n");
+    for (cpu = 0; cpu < ncpus; cpu++) {
+        mcoreCpuTimes *t = &times[cpu], *p = &prevTimes[cpu];
+        unsigned long long total = cpuTimesTotal(t);
+        unsigned long long dtotal;
+        int nepics = 0, nrt = 0;
+
+        if (!total) continue;
+        if (total < cpuTimesTotal(p)) memset(p, 0, sizeof(mcoreCpuTimes));
+        dtotal = total - cpuTimesTotal(p);
+        fprintf(out, "%4d %6.1f %6.1f %6.1f %6.1f %6.1f %6.1f %6.1f ", cpu,
+                percent(t->user, p->user, dtotal), percent(t->nice, p->nice, dtotal),
+                percent(t->system, p->system, dtotal), percent(t->irq, p->irq, dtotal),
+                percent(t->softirq, p->softirq, dtotal), percent(t->steal, p->steal, dtotal),
+                percent(t->idle + t->iowait, p->idle + p->iowait, dtotal));
+        if (haveSstat && elapsed > 0.0 && sstat[cpu].wait >= prevSstat[cpu].wait) {
+            unsigned long long dwait = sstat[cpu].wait - prevSstat[cpu].wait;
+            unsigned long long dslices = sstat[cpu].slices - prevSstat[cpu].slices;
+            // waiting time per elapsed time: the average number of waiting tasks
+            fprintf(out, "%7.2f %8.1f ", dwait * 1e-9 / elapsed,
+                    dslices ? dwait * 1e-3 / dslices : 0.0);
+        } else {
+            fprintf(out, "      -        - ");
+        }
+        for (i = 0; i < nThreads; i++) {
+            if (CPU_ISSET_S(cpu, setsize, threads[i].cpuset)) {
+                nepics++;
+                if (SCHED_FIFO == threads[i].policy || SCHED_RR == threads[i].policy) nrt++;
+            }
+        }
+        fprintf(out, "%5d %5d\n", nepics, nrt);
+
+        if (level && nepics) {
+            int col = 0;
+            for (i = 0; i < nThreads; i++) {
+                char item[64];
+                int len;
+                if (!CPU_ISSET_S(cpu, setsize, threads[i].cpuset)) continue;
+                if (level < 2 && cpumaskCount(threads[i].cpuset, setsize) > 1
+                        && SCHED_FIFO != threads[i].policy && SCHED_RR != threads[i].policy)
+                    continue;
+                len = snprintf(item, sizeof(item), "%s(%s/%d)", threads[i].name,
+                               policyToStr(threads[i].policy), threads[i].priority);
+                if (col && col + len > 72) {
+                    fprintf(out, "\n");
+                    col = 0;
+                }
+                fprintf(out, "%s%s", col ? " " : "      ", item);
+                col += len + (col ? 1 : 6);
+            }
+            if (col) fprintf(out, "\n");
+        }
+        *p = *t;
+        prevSstat[cpu] = sstat[cpu];
+    }
+    epicsMutexUnlock(cpuLock);
+}
+
+/**
+ *@}
+ */
@@ -0,0 +1,264 @@
+/********************************************//**
+ * @file
+ * @brief Word-level operations on dynamically sized cpusets.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * The cpusets are treated as arrays of machine words, so that scans, counts
+ * and set operations cost one step per word (64 CPUs) instead of one per CPU.
+ * All functions take the size of the cpusets in bytes, as returned by
+ * @c CPU_ALLOC_SIZE() (always a multiple of the word size).
+ *
+ * Where the C library provides a word-level operation (@c CPU_COUNT_S(),
+ * @c CPU_EQUAL_S(), @c CPU_AND_S(), @c CPU_OR_S()), it is used. The scans for
+ * the next set or clear CPU and the highest CPU, the difference and the range
+ * setting have no equivalent there: with @c CPU_ISSET_S() and @c CPU_SET_S()
+ * they would cost one step per CPU, which dominates formatting and parsing
+ * of large sets (see the benchmarks in testApp/testCpumask.c).
+ */
+
+#include <stdio.h>
+#include <sched.h>
+
+#include "cpumask.h"
+
+/// @cond NEVER
+#define WORD_BITS       (8 * sizeof(unsigned long))
+#define NWORDS(setsize) ((setsize) / sizeof(unsigned long))
+/// @endcond
+
+/**
+ * @brief Find the next CPU in a cpuset.
+ *
+ * @param set     cpuset to scan
+ * @param setsize size of @p set in bytes
+ * @param from    first CPU to consider
+ * @return lowest CPU >= @p from that is in the set, -1 if there is none
+ */
+int cpumaskNextSet(const cpu_set_t *set, size_t setsize, int from)
+{
+    const unsigned long *words = (const unsigned long *) set;
+    size_t i;
+    unsigned long word;
+
+    if (from < 0) from = 0;
+    i = from / WORD_BITS;
+    if (i >= NWORDS(setsize)) return -1;
+    word = words[i] & (~0UL << (from % WORD_BITS));
+    while (!word) {
+        if (++i >= NWORDS(setsize)) return -1;
+        word = words[i];
+    }
+    return (int) (i * WORD_BITS) + __builtin_ctzl(word);
+}
+
+/**
+ * @brief Find the next CPU that is not in a cpuset.
+ *
+ * @param set     cpuset to scan
+ * @param setsize size of @p set in bytes
+ * @param from    first CPU to consider
+ * @return lowest CPU >= @p from that is not in the set,
+ * the number of CPUs in @p set (8 * @p setsize) if there is none
+ */
+int cpumaskNextClear(const cpu_set_t *set, size_t setsize, int from)
+{
+    const unsigned long *words = (const unsigned long *) set;
+    const int nbits = (int) (8 * setsize);
+    size_t i;
+    unsigned long word;
+
+    if (from < 0) from = 0;
+    if (from >= nbits) return nbits;
+    i = from / WORD_BITS;
+    word = ~words[i] & (~0UL << (from % WORD_BITS));
+    while (!word) {
+        if (++i >= NWORDS(setsize)) return nbits;
+        word = ~words[i];
+    }
+    return (int) (i * WORD_BITS) + __builtin_ctzl(word);
+}
+
+/**
+ * @brief Find the highest CPU in a cpuset.
+ *
+ * @param set     cpuset to scan
+ * @param setsize size of @p set in bytes
+ * @return highest CPU in the set, -1 if the set is empty
+ */
+int cpumaskLast(const cpu_set_t *set, size_t setsize)
+{
+    const unsigned long *words = (const unsigned long *) set;
+    size_t i = NWORDS(setsize);
+
+    while (i--) {
+        if (words[i]) {
+            return (int) (i * WORD_BITS + WORD_BITS - 1) - __builtin_clzl(words[i]);
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Count the CPUs in a cpuset.
+ *
+ * @param set     cpuset to count
+ * @param setsize size of @p set in bytes
+ * @return number of CPUs in the set
+ */
+int cpumaskCount(const cpu_set_t *set, size_t setsize)
+{
+    return CPU_COUNT_S(setsize, set);
+}
+
+/**
+ * @brief Compare two cpusets.
+ *
+ * @param a       first cpuset
+ * @param b       second cpuset
+ * @param setsize size of the cpusets in bytes
+ * @return 1 if the sets contain the same CPUs, 0 otherwise
+ */
+int cpumaskEqual(const cpu_set_t *a, const cpu_set_t *b, size_t setsize)
+{
+    return CPU_EQUAL_S(setsize, a, b) ? 1 : 0;
+}
+
+/**
+ * @brief Add a range of CPUs to a cpuset.
+ *
+ * CPUs beyond the size of the set are ignored. Contiguous ranges
+ * are set a word at a time.
+ *
+ * @param set     cpuset to add to
+ * @param setsize size of @p set in bytes
+ * @param from    first CPU of the range
+ * @param to      last CPU of the range
+ * @param stride  distance between the CPUs of the range (1 = contiguous)
+ */
+void cpumaskSetRange(cpu_set_t *set, size_t setsize, int from, int to, int stride)
+{
+    unsigned long *words = (unsigned long *) set;
+    const int nbits = (int) (8 * setsize);
+    size_t first, last, i;
+    unsigned long firstMask, lastMask;
+
+    if (from < 0) from = 0;
+    if (to >= nbits) to = nbits - 1;
+    if (from > to || stride < 1) return;
+
+    if (stride > 1) {
+        for (; from <= to; from += stride) {
+            words[from / WORD_BITS] |= 1UL << (from % WORD_BITS);
+        }
+        return;
+    }
+
+    first = from / WORD_BITS;
+    last = to / WORD_BITS;
+    firstMask = ~0UL << (from % WORD_BITS);
+    lastMask = ~0UL >> (WORD_BITS - 1 - to % WORD_BITS);
+    if (first == last) {
+        words[first] |= firstMask & lastMask;
+        return;
+    }
+    words[first] |= firstMask;
+    for (i = first + 1; i < last; i++) {
+        words[i] = ~0UL;
+    }
+    words[last] |= lastMask;
+}
+
+/**
+ * @brief Intersection of two cpusets.
+ *
+ * @param dest    cpuset to write into (may be one of the operands)
+ * @param a       first cpuset
+ * @param b       second cpuset
+ * @param setsize size of the cpusets in bytes
+ */
+void cpumaskAnd(cpu_set_t *dest, const cpu_set_t *a, const cpu_set_t *b, size_t setsize)
+{
+    CPU_AND_S(setsize, dest, a, b);
+}
+
+/**
+ * @brief Union of two cpusets.
+ *
+ * @param dest    cpuset to write into (may be one of the operands)
+ * @param a       first cpuset
+ * @param b       second cpuset
+ * @param setsize size of the cpusets in bytes
+ */
+void cpumaskOr(cpu_set_t *dest, const cpu_set_t *a, const cpu_set_t *b, size_t setsize)
+{
+    CPU_OR_S(setsize, dest, a, b);
+}
+
+/**
+ * @brief Difference of two cpusets.
+ *
+ * @param dest    cpuset to write into (may be one of the operands)
+ * @param a       cpuset to remove from
+ * @param b       cpuset to remove
+ * @param setsize size of the cpusets in bytes
+ */
+void cpumaskAndNot(cpu_set_t *dest, const cpu_set_t *a, const cpu_set_t *b, size_t setsize)
+{
+    unsigned long *wd = (unsigned long *) dest;
+    const unsigned long *wa = (const unsigned long *) a;
+    const unsigned long *wb = (const unsigned long *) b;
+    size_t i;
+
+    for (i = 0; i < NWORDS(setsize); i++) {
+        wd[i] = wa[i] & ~wb[i];
+    }
+}
+
+/**
+ * @brief Format a cpuset as list of CPUs and ranges (e.g. "0,2-3").
+ *
+ * Ranges are found by scanning for the next set and clear CPU a word at a time,
+ * and written directly into the output buffer, so that the cost is linear
+ * in the size of the set and the length of the output.
+ * The output is truncated (at an item boundary) if the buffer is too small.
+ *
+ * @param str     output buffer to write into
+ * @param len     length of @p str
+ * @param set     cpuset to format
+ * @param setsize size of @p set in bytes
+ * @return length of the output (excluding the terminating null byte)
+ */
+size_t cpumaskFormat(char *str, size_t len, const cpu_set_t *set, size_t setsize)
+{
+    size_t pos = 0;
+    int from = cpumaskNextSet(set, setsize, 0);
+
+    if (!str || !len) return 0;
+    str[0] = '\0';
+    while (from >= 0) {
+        int to = cpumaskNextClear(set, setsize, from) - 1;
+        int n;
+
+        if (from == to) {
+            n = snprintf(str + pos, len - pos, "%s%d", pos ? "," : "", from);
+        } else {
+            n = snprintf(str + pos, len - pos, "%s%d-%d", pos ? "," : "", from, to);
+        }
+        if (n < 0 || (size_t) n >= len - pos) {
+            str[pos] = '\0';
+            break;
+        }
+        pos += n;
+        from = cpumaskNextSet(set, setsize, to + 1);
+    }
+    return pos;
+}
@@ -0,0 +1,37 @@
+/********************************************//**
+ * @file
+ * @brief Header file for cpumask.c
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+#ifndef CPUMASK_H
+#define CPUMASK_H
+
+#include <stddef.h>
+#include <sched.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int cpumaskNextSet(const cpu_set_t *set, size_t setsize, int from);
+int cpumaskNextClear(const cpu_set_t *set, size_t setsize, int from);
+int cpumaskLast(const cpu_set_t *set, size_t setsize);
+int cpumaskCount(const cpu_set_t *set, size_t setsize);
+int cpumaskEqual(const cpu_set_t *a, const cpu_set_t *b, size_t setsize);
+void cpumaskSetRange(cpu_set_t *set, size_t setsize, int from, int to, int stride);
+void cpumaskAnd(cpu_set_t *dest, const cpu_set_t *a, const cpu_set_t *b, size_t setsize);
+void cpumaskOr(cpu_set_t *dest, const cpu_set_t *a, const cpu_set_t *b, size_t setsize);
+void cpumaskAndNot(cpu_set_t *dest, const cpu_set_t *a, const cpu_set_t *b, size_t setsize);
+size_t cpumaskFormat(char *str, size_t len, const cpu_set_t *set, size_t setsize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CPUMASK_H
@@ -0,0 +1,560 @@
+/********************************************//**
+ * @file
+ * @brief Exclusive CPU reservations for thread rules.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * When a thread acquires the cpuset of an exclusive rule, the rule's CPUs
+ * are reserved for the threads matching that rule (the owners).
+ * All other threads of the process get the reserved CPUs removed from
+ * their affinity, and the removed CPUs are recorded, so that they can be
+ * given back when the reservation is released (the last owner exits or
+ * the rule is deleted).
+ *
+ * An owner that acquires the reservation for itself registers a thread exit
+ * handler. Owners that are added by another thread (thread modify, task scan,
+ * hotplug watcher) can't do that; they are checked by a low priority watcher
+ * thread, which forgets the owners that do not exist any more.
+ *
+ * @ingroup threadrules
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+
+#include <ellLib.h>
+#include <errlog.h>
+#include <epicsExit.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+
+/// @cond NEVER
+#define epicsExportSharedSymbols
+/// @endcond
+#include "mcoreutils.h"
+#include "utils.h"
+#include "cpumask.h"
+#include "exclusive.h"
+
+/**
+ * @brief A reservation of CPUs for the threads of an exclusive rule.
+ */
+typedef struct reservation {
+    ELLNODE     node;           ///< linked list node
+    char       *name;           ///< name of the rule holding the reservation
+    cpu_set_t  *cpuset;         ///< reserved CPUs
+    pid_t      *owners;         ///< Linux thread ids of the threads allowed on the CPUs
+    size_t      nOwners;        ///< number of owners
+    size_t      maxOwners;      ///< allocated size of the owners array
+} reservation;
+
+/**
+ * @brief The reserved CPUs removed from a thread's affinity.
+ */
+typedef struct eviction {
+    pid_t       tid;            ///< Linux thread id
+    cpu_set_t  *removed;        ///< CPUs removed from the thread's affinity
+} eviction;
+
+static ELLLIST reservations = ELLLIST_INIT;
+static eviction *evictions;
+static size_t nEvictions, maxEvictions;
+static epicsMutexId exclLock;
+static const char *taskDir = "/proc/self/task";
+static int watching;            ///< flag: watcher thread (checking the owners without exit handler) started
+
+#define WATCH_PERIOD 1.0        ///< period of checking the owners without exit handler [s]
+
+static reservation *findReservation(const char *name)
+{
+    reservation *pres = (reservation *) ellFirst(&reservations);
+    while (pres) {
+        if (0 == strcmp(name, pres->name)) return pres;
+        pres = (reservation *) ellNext(&pres->node);
+    }
+    return NULL;
+}
+
+static int isOwner(const reservation *pres, pid_t tid)
+{
+    size_t i;
+    for (i = 0; i < pres->nOwners; i++) {
+        if (pres->owners[i] == tid) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Find the eviction record of a thread.
+ *
+ * @param tid    Linux thread id
+ * @param create flag: create the record if it does not exist
+ * @return eviction record, NULL if not found (or on error)
+ */
+static eviction *findEviction(pid_t tid, int create)
+{
+    size_t i;
+
+    for (i = 0; i < nEvictions; i++) {
+        if (evictions[i].tid == tid) return &evictions[i];
+    }
+    if (!create) return NULL;
+    if (nEvictions == maxEvictions) {
+        size_t max = maxEvictions ? 2 * maxEvictions : 64;
+        eviction *list = realloc(evictions, max * sizeof(eviction));
+        if (!list) {
+            mcoreLog("Memory allocation error\n");
+            return NULL;
+        }
+        evictions = list;
+        maxEvictions = max;
+    }
+    if (!(evictions[nEvictions].removed = cpusetAlloc())) return NULL;
+    evictions[nEvictions].tid = tid;
+    return &evictions[nEvictions++];
+}
+
+/**
+ * @brief Get the reserved CPUs a thread may not run on.
+ *
+ * @param tid       Linux thread id
+ * @param forbidden cpuset to write into
+ * @return number of forbidden CPUs
+ */
+static int forbiddenCpus(pid_t tid, cpu_set_t *forbidden)
+{
+    const size_t setsize = cpusetSize();
+    reservation *pres = (reservation *) ellFirst(&reservations);
+
+    CPU_ZERO_S(setsize, forbidden);
+    while (pres) {
+        if (!isOwner(pres, tid)) {
+            cpumaskOr(forbidden, forbidden, pres->cpuset, setsize);
+        }
+        pres = (reservation *) ellNext(&pres->node);
+    }
+    return cpumaskCount(forbidden, setsize);
+}
+
+/**
+ * @brief Remove the reserved CPUs a thread may not run on from its affinity.
+ *
+ * Threads that would have no CPU left are reported and not changed.
+ *
+ * @param tid       Linux thread id
+ * @param forbidden scratch cpuset
+ * @param cpuset    scratch cpuset
+ */
+static void evictTask(pid_t tid, cpu_set_t *forbidden, cpu_set_t *cpuset)
+{
+    const size_t setsize = cpusetSize();
+    eviction *pevict;
+    int status;
+
+    if (!forbiddenCpus(tid, forbidden)) return;
+    if (sched_getaffinity(tid, setsize, cpuset)) return;
+    cpumaskAnd(forbidden, forbidden, cpuset, setsize);
+    if (!cpumaskCount(forbidden, setsize)) return;
+    cpumaskAndNot(cpuset, cpuset, forbidden, setsize);
+    if (!cpumaskCount(cpuset, setsize)) {
+        mcoreLog("mcoreThreadRules: LWP %d can only run on exclusive CPUs, not evicted\n", (int) tid);
+        return;
+    }
+    status = sched_setaffinity(tid, setsize, cpuset) ? errno : 0;
+    if (status && errVerbose)
+        mcoreLog("sched_setaffinity error %s\n", strerror(status));
+    if (!status && (pevict = findEviction(tid, 1))) {
+        cpumaskOr(pevict->removed, pevict->removed, forbidden, setsize);
+    }
+}
+
+/**
+ * @brief Remove the reserved CPUs from the affinity of all threads of the process.
+ */
+static void evictAll(void)
+{
+    cpu_set_t *forbidden = cpusetAlloc();
+    cpu_set_t *cpuset = cpusetAlloc();
+    struct dirent *ent;
+    DIR *dir;
+
+    if (forbidden && cpuset && (dir = opendir(taskDir))) {
+        while ((ent = readdir(dir))) {
+            char *endp;
+            pid_t tid = (pid_t) strtol(ent->d_name, &endp, 10);
+            if (*endp || tid <= 0) continue;
+            evictTask(tid, forbidden, cpuset);
+        }
+        closedir(dir);
+    }
+    cpusetFree(forbidden);
+    cpusetFree(cpuset);
+}
+
+/**
+ * @brief Give released CPUs back to the threads they were removed from.
+ *
+ * CPUs that are still reserved by another reservation are kept removed.
+ * Records of threads that do not exist any more or have nothing left
+ * to give back are dropped.
+ *
+ * @param released CPUs that have been released
+ */
+static void restoreTasks(const cpu_set_t *released)
+{
+    const size_t setsize = cpusetSize();
+    cpu_set_t *forbidden = cpusetAlloc();
+    cpu_set_t *give = cpusetAlloc();
+    cpu_set_t *cpuset = cpusetAlloc();
+    size_t i, j;
+    int status;
+
+    if (!forbidden || !give || !cpuset) {
+        cpusetFree(forbidden); cpusetFree(give); cpusetFree(cpuset);
+        return;
+    }
+    for (i = 0; i < nEvictions; i++) {
+        eviction *pevict = &evictions[i];
+        cpumaskAnd(give, pevict->removed, released, setsize);
+        forbiddenCpus(pevict->tid, forbidden);
+        cpumaskAndNot(give, give, forbidden, setsize);
+        if (!cpumaskCount(give, setsize)) continue;
+        status = sched_getaffinity(pevict->tid, setsize, cpuset) ? errno : 0;
+        if (!status) {
+            cpumaskOr(cpuset, cpuset, give, setsize);
+            status = sched_setaffinity(pevict->tid, setsize, cpuset) ? errno : 0;
+        }
+        if (!status || ESRCH == status) {
+            cpumaskAndNot(pevict->removed, pevict->removed, give, setsize);
+        } else {
+            // kept, so that a later release tries again
+            mcoreLog("mcoreThreadRules: can't give exclusive CPUs back to LWP %d - %s\n",
+                     (int) pevict->tid, strerror(status));
+        }
+    }
+    for (i = j = 0; i < nEvictions; i++) {
+        if (cpumaskCount(evictions[i].removed, setsize) && taskExists(evictions[i].tid)) {
+            evictions[j++] = evictions[i];
+        } else {
+            cpusetFree(evictions[i].removed);
+        }
+    }
+    nEvictions = j;
+    cpusetFree(forbidden);
+    cpusetFree(give);
+    cpusetFree(cpuset);
+}
+
+/**
+ * @brief Release a reservation, giving its CPUs back to the evicted threads.
+ *
+ * @param pres reservation to release
+ */
+static void releaseReservation(reservation *pres)
+{
+    ellDelete(&reservations, &pres->node);
+    restoreTasks(pres->cpuset);
+    free(pres->name);
+    free(pres->owners);
+    cpusetFree(pres->cpuset);
+    free(pres);
+}
+
+/**
+ * @brief Remove a thread from the owners of all reservations.
+ *
+ * Reservations without owners are released.
+ *
+ * @param tid Linux thread id
+ */
+static void removeOwner(pid_t tid)
+{
+    reservation *pres = (reservation *) ellFirst(&reservations);
+
+    while (pres) {
+        reservation *next = (reservation *) ellNext(&pres->node);
+        size_t i, j;
+        for (i = j = 0; i < pres->nOwners; i++) {
+            if (pres->owners[i] != tid) {
+                pres->owners[j++] = pres->owners[i];
+            }
+        }
+        pres->nOwners = j;
+        if (!pres->nOwners) {
+            releaseReservation(pres);
+        }
+        pres = next;
+    }
+}
+
+/**
+ * @brief Thread exit handler of the owners.
+ *
+ * @param arg Linux thread id
+ */
+static void atThreadExit(void *arg)
+{
+    exclusiveThreadExit((pid_t) (long) arg);
+}
+
+/**
+ * @brief Watcher thread main loop.
+ *
+ * @param arg unused
+ */
+static void watchLoop(void *arg)
+{
+    for (;;) {
+        epicsThreadSleep(WATCH_PERIOD);
+        exclusivePrune();
+    }
+}
+
+/**
+ * @brief Acquire the exclusive use of a cpuset for a thread.
+ *
+ * The thread becomes an owner of the rule's reservation, which is created
+ * if needed. The CPUs are then removed from the affinity of all
+ * other threads of the process.
+ * An owner that is not the calling thread is released by the watcher thread
+ * (started when needed) after it exits.
+ *
+ * @param name   name of the rule
+ * @param tid    Linux thread id
+ * @param cpuset CPUs to reserve
+ */
+void exclusiveAcquire(const char *name, pid_t tid, const cpu_set_t *cpuset)
+{
+    const size_t setsize = cpusetSize();
+    reservation *pres;
+    eviction *pevict;
+    int watch = 0;
+
+    exclusivePrune();
+    epicsMutexLock(exclLock);
+    pres = findReservation(name);
+    if (pres && !cpumaskEqual(pres->cpuset, cpuset, setsize)) {
+        releaseReservation(pres);
+        pres = NULL;
+    }
+    if (!pres) {
+        pres = calloc(1, sizeof(reservation));
+        if (!pres || !(pres->name = strdup(name)) || !(pres->cpuset = cpusetAlloc())) {
+            mcoreLog("Memory allocation error\n");
+            if (pres) free(pres->name);
+            free(pres);
+            epicsMutexUnlock(exclLock);
+            return;
+        }
+        cpusetCopy(pres->cpuset, cpuset);
+        ellAdd(&reservations, &pres->node);
+    }
+    if (!isOwner(pres, tid)) {
+        if (pres->nOwners == pres->maxOwners) {
+            size_t max = pres->maxOwners ? 2 * pres->maxOwners : 8;
+            pid_t *owners = realloc(pres->owners, max * sizeof(pid_t));
+            if (!owners) {
+                mcoreLog("Memory allocation error\n");
+                epicsMutexUnlock(exclLock);
+                return;
+            }
+            pres->owners = owners;
+            pres->maxOwners = max;
+        }
+        pres->owners[pres->nOwners++] = tid;
+        if ((pid_t) syscall(SYS_gettid) == tid) {
+            epicsAtThreadExit(atThreadExit, (void *) (long) tid);
+        } else if (!watching) {
+            watching = watch = 1;
+        }
+    }
+    if ((pevict = findEviction(tid, 0))) {
+        cpumaskAndNot(pevict->removed, pevict->removed, cpuset, setsize);
+    }
+    evictAll();
+    epicsMutexUnlock(exclLock);
+
+    // created outside of the lock, as its start hook may evict it
+    if (watch && !ownThreadCreate("mcoreExclusive",
+                                  epicsThreadPriorityLow,
+                                  epicsThreadGetStackSize(epicsThreadStackSmall),
+                                  watchLoop, NULL)) {
+        mcoreLog("mcoreThreadRules: can't create exclusive owner watcher thread\n");
+        epicsMutexLock(exclLock);
+        watching = 0;
+        epicsMutexUnlock(exclLock);
+    }
+}
+
+/**
+ * @brief Release the reservation of a rule.
+ *
+ * @param name name of the rule
+ */
+void exclusiveRelease(const char *name)
+{
+    reservation *pres;
+
+    exclusiveInit();
+    epicsMutexLock(exclLock);
+    if ((pres = findReservation(name))) {
+        releaseReservation(pres);
+    }
+    epicsMutexUnlock(exclLock);
+}
+
+/**
+ * @brief Forget a thread that exits.
+ *
+ * Reservations that lose their last owner are released.
+ *
+ * @param tid Linux thread id
+ */
+void exclusiveThreadExit(pid_t tid)
+{
+    eviction *pevict;
+
+    exclusiveInit();
+    epicsMutexLock(exclLock);
+    if ((pevict = findEviction(tid, 0))) {
+        CPU_ZERO_S(cpusetSize(), pevict->removed);
+    }
+    removeOwner(tid);
+    epicsMutexUnlock(exclLock);
+}
+
+/**
+ * @brief Remove the reserved CPUs from the affinity of a (new) thread.
+ *
+ * @param tid Linux thread id
+ */
+void exclusiveEvict(pid_t tid)
+{
+    cpu_set_t *forbidden, *cpuset;
+
+    exclusiveInit();
+    epicsMutexLock(exclLock);
+    if (ellCount(&reservations)) {
+        forbidden = cpusetAlloc();
+        cpuset = cpusetAlloc();
+        if (forbidden && cpuset) {
+            evictTask(tid, forbidden, cpuset);
+        }
+        cpusetFree(forbidden);
+        cpusetFree(cpuset);
+    }
+    epicsMutexUnlock(exclLock);
+}
+
+/**
+ * @brief Get the reserved CPUs a thread may not run on.
+ *
+ * @param tid       Linux thread id
+ * @param forbidden cpuset to write into
+ * @return number of forbidden CPUs
+ */
+int exclusiveForbidden(pid_t tid, cpu_set_t *forbidden)
+{
+    int count;
+
+    exclusiveInit();
+    epicsMutexLock(exclLock);
+    count = forbiddenCpus(tid, forbidden);
+    epicsMutexUnlock(exclLock);
+    return count;
+}
+
+/**
+ * @brief Forget all owners that do not exist any more.
+ *
+ * Needed for threads that exit without running the EPICS thread exit handlers.
+ */
+void exclusivePrune(void)
+{
+    reservation *pres;
+
+    exclusiveInit();
+    epicsMutexLock(exclLock);
+    pres = (reservation *) ellFirst(&reservations);
+    while (pres) {
+        size_t i;
+        for (i = 0; i < pres->nOwners; i++) {
+            if (!taskExists(pres->owners[i])) {
+                removeOwner(pres->owners[i]);
+                pres = (reservation *) ellFirst(&reservations);
+                break;
+            }
+        }
+        if (pres && i == pres->nOwners) {
+            pres = (reservation *) ellNext(&pres->node);
+        }
+    }
+    epicsMutexUnlock(exclLock);
+}
+
+/**
+ * @brief List the owners of the reservation of a rule.
+ *
+ * @param name name of the rule
+ * @param str  output buffer to write into (e.g. "1234,1240")
+ * @param len  length of @p str
+ * @return number of owners, -1 if the rule holds no reservation
+ */
+int exclusiveOwnersToStr(const char *name, char *str, size_t len)
+{
+    reservation *pres;
+    size_t i, pos = 0;
+    int count = -1;
+
+    if (!str || !len) return -1;
+    str[0] = '\0';
+    exclusiveInit();
+    epicsMutexLock(exclLock);
+    if ((pres = findReservation(name))) {
+        for (i = 0; i < pres->nOwners; i++) {
+            int n = snprintf(str + pos, len - pos, "%s%d", pos ? "," : "", (int) pres->owners[i]);
+            if (n < 0 || (size_t) n >= len - pos) {
+                str[pos] = '\0';
+                break;
+            }
+            pos += n;
+        }
+        count = (int) pres->nOwners;
+    }
+    epicsMutexUnlock(exclLock);
+    return count;
+}
+
+static void once(void *arg)
+{
+    exclLock = epicsMutexMustCreate();
+}
+
+/**
+ * @brief Initialization routine.
+ */
+void exclusiveInit(void)
+{
+    static epicsThreadOnceId onceFlag = EPICS_THREAD_ONCE_INIT;
+    epicsThreadOnce(&onceFlag, once, NULL);
+}
+
+/**
+ *@}
+ */
@@ -0,0 +1,36 @@
+/********************************************//**
+ * @file
+ * @brief Header file for exclusive.c
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+#ifndef EXCLUSIVE_H
+#define EXCLUSIVE_H
+
+#include <stddef.h>
+#include <sched.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void exclusiveInit(void);
+void exclusiveAcquire(const char *name, pid_t tid, const cpu_set_t *cpuset);
+void exclusiveRelease(const char *name);
+void exclusiveThreadExit(pid_t tid);
+void exclusiveEvict(pid_t tid);
+int exclusiveForbidden(pid_t tid, cpu_set_t *forbidden);
+void exclusivePrune(void);
+int exclusiveOwnersToStr(const char *name, char *str, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EXCLUSIVE_H
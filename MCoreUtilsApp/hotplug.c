@@ -0,0 +1,415 @@
+/********************************************//**
+ * @file
+ * @brief Re-application of the rule affinities after CPU hotplug and cpuset changes.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * When CPUs go offline or the cgroup cpuset of the process shrinks, the kernel
+ * rewrites the affinities of the affected threads, and does not restore them
+ * when the CPUs come back.
+ *
+ * The hotplug watcher compares the online CPUs (sysfs) and the CPUs of the
+ * process' cgroup cpuset (if any) with their previous values, once per period
+ * and whenever the kernel sends a CPU uevent. After a change, it
+ * @li re-reads the topology, with the CPUs allowed at startup (or the cgroup's
+ *     CPUs), limited to the online CPUs, as allowed CPUs,
+ * @li resolves the cpuset specifications of all rules again,
+ * @li applies the affinities of the rules to all EPICS threads and to the
+ *     non-EPICS tasks found by mcoreTaskScan() again.
+ *
+ * Only the affinities are set again: priorities and the exclusive, balancer,
+ * boost and watchdog registrations are not touched. The affinity of the
+ * process' main thread is left alone unless a rule matches it.
+ *
+ * Every changed rule cpuset and thread affinity is logged.
+ *
+ * @ingroup threadrules
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include <errlog.h>
+#include <epicsStdio.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <shareLib.h>
+
+#include "utils.h"
+#include "cpumask.h"
+#include "topology.h"
+#include "cgroup.h"
+#include "taskScan.h"
+#include "threadRules.h"
+#include "hotplug.h"
+
+/// @cond NEVER
+#define epicsExportSharedSymbols
+/// @endcond
+#include "mcoreutils.h"
+
+static epicsMutexId hotplugLock;
+static epicsThreadId hotplugThread;
+static epicsEventId hotplugEvent;
+static double hotplugPeriod;
+static int ueventFd = -1;
+static cpu_set_t *base;         ///< CPUs allowed at startup
+static cpu_set_t *online;       ///< online CPUs at the last pass
+static cpu_set_t *cgroupCpus;   ///< CPUs of the cgroup cpuset at the last pass
+static int haveCgroup;          ///< flag: cgroupCpus is valid
+static cpu_set_t *before, *after;
+static epicsTimeStamp lastChange;
+
+/**
+ * @brief Counters of the hotplug watcher.
+ */
+static struct {
+    unsigned long passes;       ///< watcher passes
+    unsigned long uevents;      ///< CPU uevents received
+    unsigned long changes;      ///< CPU changes detected
+    unsigned long rules;        ///< rule cpusets changed
+    unsigned long threads;      ///< thread affinities changed
+} counters;
+
+/**
+ * @brief Log a changed thread affinity (#before -> #after).
+ *
+ * @param name thread name
+ * @param tid  Linux thread id
+ */
+static void logAdjustment(const char *name, pid_t tid)
+{
+    const int buflen = topologyCpusetStrLen();
+    char *from = malloc(buflen);
+    char *to = malloc(buflen);
+
+    if (from && to) {
+        cpusetToStr(from, buflen, before);
+        cpusetToStr(to, buflen, after);
+        mcoreLog("mcoreHotplug: %s (LWP %d) affinity %s -> %s\n", name, (int) tid, from, to);
+    }
+    free(from);
+    free(to);
+    counters.threads++;
+}
+
+/**
+ * @brief Map callback applying the affinity rules to an EPICS thread again.
+ *
+ * @param id current thread (map argument)
+ */
+static void reapplyEpicsThread(epicsThreadId id)
+{
+    const size_t setsize = cpusetSize();
+
+    if (sched_getaffinity(id->lwpId, setsize, before)) return;
+    if (!applyAffinityRules(id)) return;
+    if (0 == sched_getaffinity(id->lwpId, setsize, after) && !cpumaskEqual(before, after, setsize)) {
+        logAdjustment(id->name, id->lwpId);
+    }
+}
+
+/**
+ * @brief Apply the rules to the non-EPICS tasks found by the task scan again.
+ */
+static void reapplyTasks(void)
+{
+    const size_t setsize = cpusetSize();
+    pid_t *tids = NULL;
+    size_t n, max = 0, i;
+    char name[32];
+
+    while ((n = taskScanKnown(tids, max)) > max) {
+        pid_t *list = realloc(tids, n * sizeof(pid_t));
+        if (!list) {
+            errlogPrintf("Memory allocation error\n");
+            free(tids);
+            return;
+        }
+        tids = list;
+        max = n;
+    }
+    for (i = 0; i < n; i++) {
+        if (taskName(tids[i], name, sizeof(name))
+                || sched_getaffinity(tids[i], setsize, before)
+                || !applyAffinityRulesToTask(tids[i], name))
+            continue;
+        if (0 == sched_getaffinity(tids[i], setsize, after) && !cpumaskEqual(before, after, setsize)) {
+            logAdjustment(name, tids[i]);
+        }
+    }
+    free(tids);
+}
+
+/**
+ * @brief Read the current online CPUs and the CPUs of the cgroup cpuset.
+ *
+ * @param on  cpuset to write the online CPUs into
+ * @param cg  cpuset to write the cgroup's CPUs into
+ * @return 1 if the process has a cgroup cpuset, 0 if not, -1 on error
+ */
+static int sampleCpus(cpu_set_t *on, cpu_set_t *cg)
+{
+    char path[512];
+
+    if (formatPath(path, sizeof(path), "%s/devices/system/cpu/online", topologySysfsRoot())
+            || readCpuList(path, on) || !CPU_COUNT_S(cpusetSize(), on)) return -1;
+    return cgroupEffectiveCpus(cg) > 0 ? 1 : 0;
+}
+
+/**
+ * @brief Run one watcher pass, re-applying the rules if the CPUs have changed.
+ */
+static void hotplugPass(void)
+{
+    const size_t setsize = cpusetSize();
+    const int buflen = topologyCpusetStrLen();
+    cpu_set_t *on = cpusetAlloc();
+    cpu_set_t *cg = cpusetAlloc();
+    cpu_set_t *target = cpusetAlloc();
+    char *from = malloc(buflen);
+    char *to = malloc(buflen);
+    int cgroup, nrules;
+
+    if (!on || !cg || !target || !from || !to) {
+        errlogPrintf("Memory allocation error\n");
+    } else if ((cgroup = sampleCpus(on, cg)) >= 0) {
+        epicsMutexLock(hotplugLock);
+        counters.passes++;
+        if (!cpumaskEqual(on, online, setsize)
+                || cgroup != haveCgroup || (cgroup && !cpumaskEqual(cg, cgroupCpus, setsize))) {
+            counters.changes++;
+            epicsTimeGetCurrent(&lastChange);
+            if (!cpumaskEqual(on, online, setsize)) {
+                cpusetToStr(from, buflen, online);
+                cpusetToStr(to, buflen, on);
+                mcoreLog("mcoreHotplug: online CPUs %s -> %s\n", from, to);
+            }
+            if (cgroup && (!haveCgroup || !cpumaskEqual(cg, cgroupCpus, setsize))) {
+                if (haveCgroup) {
+                    cpusetToStr(from, buflen, cgroupCpus);
+                } else {
+                    strcpy(from, "-");
+                }
+                cpusetToStr(to, buflen, cg);
+                mcoreLog("mcoreHotplug: cgroup CPUs %s -> %s\n", from, to);
+            }
+            cpusetCopy(online, on);
+            cpusetCopy(cgroupCpus, cg);
+            haveCgroup = cgroup;
+
+            cpumaskAnd(target, cgroup ? cg : base, on, setsize);
+            topologyRefreshAllowed(target);
+            nrules = rulesReresolve();
+            counters.rules += nrules;
+            epicsThreadMap(reapplyEpicsThread);
+            reapplyTasks();
+            mcoreLog("mcoreHotplug: %d rule cpuset(s) changed, rule affinities applied again\n", nrules);
+        }
+        epicsMutexUnlock(hotplugLock);
+    }
+    cpusetFree(on);
+    cpusetFree(cg);
+    cpusetFree(target);
+    free(from);
+    free(to);
+}
+
+/**
+ * @brief Open a netlink socket receiving the kernel's uevents.
+ *
+ * @return socket, -1 if uevents are not available (e.g. in a container)
+ */
+static int openUevents(void)
+{
+    struct sockaddr_nl addr;
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+
+    if (fd < 0) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Wait for a CPU uevent or the end of the period.
+ *
+ * @param period period in seconds
+ */
+static void waitForChange(double period)
+{
+    struct pollfd pfd;
+    char buf[4096];
+    int cpuEvent = 0;
+
+    if (ueventFd < 0) {
+        epicsEventWaitWithTimeout(hotplugEvent, period);
+        return;
+    }
+    pfd.fd = ueventFd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, (int) (period * 1000.0)) <= 0) return;
+    for (;;) {
+        ssize_t len = recv(ueventFd, buf, sizeof(buf) - 1, 0);
+        char *cp;
+        if (len <= 0) break;
+        buf[len] = '\0';
+        // message: "action@devpath" followed by NUL separated KEY=value pairs
+        for (cp = buf; cp < buf + len; cp += strlen(cp) + 1) {
+            if (0 == strcmp(cp, "SUBSYSTEM=cpu")) cpuEvent = 1;
+        }
+    }
+    if (cpuEvent) {
+        epicsMutexLock(hotplugLock);
+        counters.uevents++;
+        epicsMutexUnlock(hotplugLock);
+        // give the kernel time to finish updating affinities and cpusets
+        epicsThreadSleep(0.1);
+    }
+}
+
+/**
+ * @brief Watcher thread main loop, running until the period is set to zero.
+ *
+ * @param arg unused
+ */
+static void hotplugLoop(void *arg)
+{
+    epicsMutexLock(hotplugLock);
+    while (hotplugPeriod > 0.0) {
+        double period = hotplugPeriod;
+        epicsMutexUnlock(hotplugLock);
+        hotplugPass();
+        waitForChange(period);
+        epicsMutexLock(hotplugLock);
+    }
+    if (ueventFd >= 0) {
+        close(ueventFd);
+        ueventFd = -1;
+    }
+    hotplugThread = NULL;
+    epicsMutexUnlock(hotplugLock);
+}
+
+/**
+ * @brief Set the period of the hotplug watcher.
+ */
+void mcoreHotplugPeriod(double period)
+{
+    hotplugInit();
+    epicsMutexLock(hotplugLock);
+    hotplugPeriod = period;
+    if (period > 0.0 && !hotplugThread) {
+        ueventFd = openUevents();
+        hotplugThread = ownThreadCreate("mcoreHotplug",
+                                        epicsThreadPriorityLow,
+                                        epicsThreadGetStackSize(epicsThreadStackSmall),
+                                        hotplugLoop, NULL);
+        if (!hotplugThread) {
+            errlogPrintf("mcoreHotplug: can't create watcher thread\n");
+            hotplugPeriod = 0.0;
+            if (ueventFd >= 0) {
+                close(ueventFd);
+                ueventFd = -1;
+            }
+        }
+    }
+    epicsMutexUnlock(hotplugLock);
+    epicsEventSignal(hotplugEvent);
+}
+
+/**
+ * @brief Print the hotplug watcher's state and counters.
+ */
+void mcoreHotplugShow(unsigned int level)
+{
+    FILE *out = epicsGetStdout();
+    const int buflen = topologyCpusetStrLen();
+    char *buf = malloc(buflen);
+    char stamp[32];
+
+    hotplugInit();
+    if (!buf) return;
+    epicsMutexLock(hotplugLock);
+    if (hotplugPeriod > 0.0) {
+        fprintf(out, "Hotplug watcher running, period %g s, %s\n", hotplugPeriod,
+                ueventFd >= 0 ? "listening to uevents" : "polling only");
+    } else {
+        fprintf(out, "Hotplug watcher stopped\n");
+    }
+    fprintf(out, "%lu passes, %lu uevents, %lu changes, %lu rule cpusets and %lu thread affinities changed\n",
+            counters.passes, counters.uevents, counters.changes, counters.rules, counters.threads);
+    if (counters.changes) {
+        epicsTimeToStrftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &lastChange);
+        fprintf(out, "last change: %s\n", stamp);
+    }
+    if (level) {
+        cpusetToStr(buf, buflen, online);
+        fprintf(out, "  online CPUs:  %s\n", buf);
+        if (haveCgroup) {
+            cpusetToStr(buf, buflen, cgroupCpus);
+            fprintf(out, "  cgroup CPUs:  %s\n", buf);
+        }
+        cpusetToStr(buf, buflen, base);
+        fprintf(out, "  startup CPUs: %s\n", buf);
+    }
+    epicsMutexUnlock(hotplugLock);
+    free(buf);
+}
+
+static void once(void *arg)
+{
+    hotplugLock = epicsMutexMustCreate();
+    hotplugEvent = epicsEventMustCreate(epicsEventEmpty);
+    base = cpusetAlloc();
+    online = cpusetAlloc();
+    cgroupCpus = cpusetAlloc();
+    before = cpusetAlloc();
+    after = cpusetAlloc();
+    if (!base || !online || !cgroupCpus || !before || !after) {
+        errlogPrintf("Memory allocation error\n");
+        return;
+    }
+    topologyAllowedCpus(base);
+    haveCgroup = sampleCpus(online, cgroupCpus);
+    if (haveCgroup < 0) {
+        topologyOnlineCpus(online);
+        haveCgroup = 0;
+    }
+}
+
+/**
+ * @brief Initialization routine.
+ */
+void hotplugInit(void)
+{
+    static epicsThreadOnceId onceFlag = EPICS_THREAD_ONCE_INIT;
+    epicsThreadOnce(&onceFlag, once, NULL);
+}
+
+/**
+ *@}
+ */
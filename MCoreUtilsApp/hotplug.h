@@ -0,0 +1,25 @@
+/********************************************//**
+ * @file
+ * @brief Header file for hotplug.c
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+#ifndef HOTPLUG_H
+#define HOTPLUG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void hotplugInit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOTPLUG_H
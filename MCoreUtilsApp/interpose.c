@@ -0,0 +1,257 @@
+/********************************************//**
+ * @file
+ * @brief Interposer applying thread rules at thread creation.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * Defines @c pthread_create() and @c pthread_setname_np(), which forward to
+ * the next definition (usually the C library's) found by the dynamic linker.
+ * Loaded through @c LD_PRELOAD or linked into the IOC executable before the
+ * system libraries, this applies the thread rules to the attributes
+ * of EPICS threads before they are created, and to non-EPICS threads
+ * when they set their own name.
+ *
+ * EPICS threads are recognized by also defining the public thread creation
+ * function of EPICS base (@c epicsThreadCreateOpt() since EPICS 7.0.2,
+ * @c epicsThreadCreate() before), which records the name and priority of the
+ * thread being created for the @c pthread_create() call it makes. This does
+ * not depend on the private layout of the EPICS thread structure.
+ *
+ * @ingroup threadrules
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <epicsThread.h>
+#include <epicsVersion.h>
+
+#include "threadRules.h"
+#include "taskScan.h"
+
+// epicsThreadCreate() calls epicsThreadCreateOpt() since EPICS 7.0.2
+#if defined(VERSION_INT) && EPICS_VERSION_INT >= VERSION_INT(7,0,2,0)
+#define HAVE_THREAD_CREATE_OPT
+#endif
+
+typedef int (*pthreadCreateFunc)(pthread_t *, const pthread_attr_t *,
+                                 void *(*)(void *), void *);
+typedef int (*pthreadSetnameFunc)(pthread_t, const char *);
+#ifdef HAVE_THREAD_CREATE_OPT
+typedef epicsThreadId (*threadCreateOptFunc)(const char *, EPICSTHREADFUNC,
+                                             void *, const epicsThreadOpts *);
+#else
+typedef epicsThreadId (*threadCreateFunc)(const char *, unsigned int, unsigned int,
+                                          EPICSTHREADFUNC, void *);
+#endif
+
+/**
+ * @brief An EPICS thread that is being created.
+ */
+typedef struct epicsThreadCreation {
+    const char *name;               ///< name of the thread
+    unsigned int osiPriority;       ///< OSI priority the thread is created with
+} epicsThreadCreation;
+
+static __thread int inInterposer;
+static __thread const epicsThreadCreation *creating;    ///< EPICS thread the calling thread is creating
+
+/**
+ * @brief Initialize a thread attributes object as a copy of another one.
+ *
+ * The stack address is only copied if the caller has set one: for attributes
+ * with only a stack size (as EPICS creates them), @c pthread_attr_getstack()
+ * reports an address computed from a NULL stack top, which must not be set.
+ *
+ * The affinity is not copied. For attributes without one,
+ * @c pthread_attr_getaffinity_np() reports all CPUs, and setting that would
+ * replace the affinity the thread inherits (taskset, cgroup cpuset, exclusive
+ * CPU evictions) until the start hook runs. EPICS never sets an affinity on
+ * the attributes; the rules set one on the copy if they specify it.
+ *
+ * @param to   attributes to initialize
+ * @param from attributes to copy
+ * @return 0 on success, errno value on error
+ */
+static int copyAttr(pthread_attr_t *to, const pthread_attr_t *from)
+{
+    struct sched_param param;
+    void *stackaddr;
+    size_t size;
+    int value;
+    int status;
+
+    status = pthread_attr_init(to);
+    if (status) return status;
+
+    if (!pthread_attr_getdetachstate(from, &value))
+        status |= pthread_attr_setdetachstate(to, value);
+    if (!pthread_attr_getscope(from, &value))
+        status |= pthread_attr_setscope(to, value);
+    if (!pthread_attr_getinheritsched(from, &value))
+        status |= pthread_attr_setinheritsched(to, value);
+    if (!pthread_attr_getschedpolicy(from, &value))
+        status |= pthread_attr_setschedpolicy(to, value);
+    if (!pthread_attr_getschedparam(from, &param))
+        status |= pthread_attr_setschedparam(to, &param);
+    if (!pthread_attr_getguardsize(from, &size))
+        status |= pthread_attr_setguardsize(to, size);
+    if (!pthread_attr_getstacksize(from, &size) && size)    // 0: default stack size
+        status |= pthread_attr_setstacksize(to, size);
+    // without an explicit stack, the reported address is NULL minus the size
+    if (!pthread_attr_getstack(from, &stackaddr, &size)
+            && (uintptr_t) stackaddr + size != 0)
+        status |= pthread_attr_setstack(to, stackaddr, size);
+
+    if (status) {
+        pthread_attr_destroy(to);
+        return EINVAL;
+    }
+    return 0;
+}
+
+#ifdef HAVE_THREAD_CREATE_OPT
+/**
+ * @brief Create an EPICS thread, recording its name and priority for pthread_create().
+ *
+ * Forwards to the definition of EPICS base, which all other thread creation
+ * functions call.
+ */
+epicsThreadId epicsThreadCreateOpt(const char *name, EPICSTHREADFUNC funptr,
+                                   void *parm, const epicsThreadOpts *opts)
+{
+    static threadCreateOptFunc next;
+    const epicsThreadCreation *outer = creating;
+    epicsThreadCreation pending;
+    epicsThreadId id;
+
+    if (!next) {
+        next = (threadCreateOptFunc) dlsym(RTLD_NEXT, "epicsThreadCreateOpt");
+        if (!next) return NULL;
+    }
+
+    pending.name = name;
+    pending.osiPriority = opts ? opts->priority : epicsThreadPriorityLow;
+    creating = &pending;
+    id = next(name, funptr, parm, opts);
+    creating = outer;
+    return id;
+}
+#else
+/**
+ * @brief Create an EPICS thread, recording its name and priority for pthread_create().
+ *
+ * Forwards to the definition of EPICS base, which epicsThreadMustCreate() calls.
+ */
+epicsThreadId epicsThreadCreate(const char *name, unsigned int priority,
+                                unsigned int stackSize, EPICSTHREADFUNC funptr, void *parm)
+{
+    static threadCreateFunc next;
+    const epicsThreadCreation *outer = creating;
+    epicsThreadCreation pending;
+    epicsThreadId id;
+
+    if (!next) {
+        next = (threadCreateFunc) dlsym(RTLD_NEXT, "epicsThreadCreate");
+        if (!next) return NULL;
+    }
+
+    pending.name = name;
+    pending.osiPriority = priority;
+    creating = &pending;
+    id = next(name, priority, stackSize, funptr, parm);
+    creating = outer;
+    return id;
+}
+#endif
+
+/**
+ * @brief Create a thread, applying the thread rules to its attributes.
+ *
+ * EPICS threads are recognized by being created from inside the EPICS thread
+ * creation function (see above), which provides their name and priority.
+ * Their creation attributes are copied, and the matching rules are applied
+ * to the copy before the thread is created. If the modified attributes are
+ * rejected (e.g. for lack of permission), the thread is created with the
+ * original attributes.
+ *
+ * The rules are applied again by the thread start hook, once the thread runs.
+ */
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                   void *(*start_routine)(void *), void *arg)
+{
+    static pthreadCreateFunc next;
+    const epicsThreadCreation *pending = creating;
+    pthread_attr_t modified;
+    int status;
+
+    if (!next) {
+        next = (pthreadCreateFunc) dlsym(RTLD_NEXT, "pthread_create");
+        if (!next) return EAGAIN;
+    }
+
+    if (inInterposer || !pending || !attr) {
+        return next(thread, attr, start_routine, arg);
+    }
+
+    inInterposer = 1;
+    if (copyAttr(&modified, attr)) {
+        inInterposer = 0;
+        return next(thread, attr, start_routine, arg);
+    }
+    if (applyRulesToAttr(&modified, pending->name, pending->osiPriority)) {
+        status = next(thread, &modified, start_routine, arg);
+        if (EPERM == status || EINVAL == status) {
+            status = next(thread, attr, start_routine, arg);
+        }
+    } else {
+        status = next(thread, attr, start_routine, arg);
+    }
+    pthread_attr_destroy(&modified);
+    inInterposer = 0;
+    return status;
+}
+
+/**
+ * @brief Set a thread's name, applying the thread rules if a thread names itself.
+ *
+ * The thread is marked as handled for the task scan (see mcoreTaskScan()),
+ * which would otherwise apply the rules to it a second time.
+ */
+int pthread_setname_np(pthread_t thread, const char *name)
+{
+    static pthreadSetnameFunc next;
+    int status;
+
+    if (!next) {
+        next = (pthreadSetnameFunc) dlsym(RTLD_NEXT, "pthread_setname_np");
+        if (!next) return ENOSYS;
+    }
+
+    status = next(thread, name);
+    if (!status && !inInterposer && pthread_equal(thread, pthread_self())) {
+        inInterposer = 1;
+        taskScanApply((pid_t) syscall(SYS_gettid), name);
+        inInterposer = 0;
+    }
+    return status;
+}
+
+/**
+ *@}
+ */
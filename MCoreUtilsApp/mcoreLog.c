@@ -0,0 +1,265 @@
+/********************************************//**
+ * @file
+ * @brief Deferred logging through a lock-free ring buffer.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * The ring buffer is a bounded multi-producer queue of fixed-size records,
+ * each carrying a sequence number (D. Vyukov's algorithm): a producer claims
+ * a record by a compare-and-swap on the write position, fills it, and
+ * publishes it by setting its sequence number. The single consumer (the
+ * drain thread) takes the records in order and gives them back by advancing
+ * their sequence numbers by the size of the ring.
+ *
+ * Posting a message never blocks and never takes a lock: the message is
+ * formatted into the record, and if the ring is full, it is dropped and
+ * counted. The record keeps the raw clock_gettime() time, which the drain
+ * thread converts (epicsTimeGetCurrent() takes a lock when generalTime is in
+ * use). The drain thread polls the ring, so that posters do not have to
+ * signal it.
+ *
+ * The sequence numbers are stored relative to the record's index, so that the
+ * zero-initialized ring is valid and messages can be posted before
+ * mcoreLogInit() has started the drain thread.
+ *
+ * @ingroup log
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include <errlog.h>
+#include <epicsStdio.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <epicsAtomic.h>
+#include <epicsExit.h>
+#include <shareLib.h>
+
+/// @cond NEVER
+#define epicsExportSharedSymbols
+/// @endcond
+#include "mcoreutils.h"
+#include "utils.h"
+
+#define LOG_RECORDS 256             ///< number of records in the ring (power of 2)
+#define LOG_MSG_SIZE 160            ///< maximum length of a message (including the terminator)
+#define LOG_POLL_PERIOD 0.1         ///< drain thread polling period [s]
+
+/**
+ * @brief A log record.
+ */
+typedef struct logRecord {
+    size_t          sequence;               ///< sequence number minus the record's index (atomic)
+    struct timespec stamp;                  ///< time the message was posted (CLOCK_REALTIME)
+    char            msg[LOG_MSG_SIZE];      ///< message text
+} logRecord;
+
+static logRecord ring[LOG_RECORDS];
+static size_t writePos;                     ///< next record to claim (atomic)
+static size_t readPos;                      ///< next record to drain (guarded by drainLock)
+static size_t posted;                       ///< messages posted (atomic)
+static size_t dropped;                      ///< messages dropped because the ring was full (atomic)
+static size_t truncated;                    ///< messages truncated to the record size (atomic)
+static size_t reported;                     ///< dropped messages already reported
+static epicsMutexId drainLock;
+static int draining;                        ///< flag: drain thread is running
+
+/**
+ * @brief Get the sequence number of a record.
+ *
+ * @param index record index
+ * @return sequence number
+ */
+static size_t getSequence(size_t index)
+{
+    return epicsAtomicGetSizeT(&ring[index].sequence) + index;
+}
+
+/**
+ * @brief Set the sequence number of a record.
+ *
+ * @param index    record index
+ * @param sequence sequence number
+ */
+static void setSequence(size_t index, size_t sequence)
+{
+    epicsAtomicSetSizeT(&ring[index].sequence, sequence - index);
+}
+
+/**
+ * @brief Take all published records from the ring and forward them to errlog.
+ *
+ * Must be called with drainLock held (single consumer).
+ *
+ * @return number of records forwarded
+ */
+static int drainRing(void)
+{
+    int count = 0;
+    size_t lost;
+
+    for (;;) {
+        size_t index = readPos & (LOG_RECORDS - 1);
+        logRecord *rec = &ring[index];
+        epicsTimeStamp time;
+        char stamp[40];
+
+        if (getSequence(index) != readPos + 1)
+            break;
+        epicsAtomicReadMemoryBarrier();
+        epicsTimeFromTimespec(&time, &rec->stamp);
+        epicsTimeToStrftime(stamp, sizeof(stamp), "%Y/%m/%d %H:%M:%S.%06f", &time);
+        errlogPrintf("%s %s", stamp, rec->msg);
+        setSequence(index, readPos + LOG_RECORDS);
+        readPos++;
+        count++;
+    }
+    lost = epicsAtomicGetSizeT(&dropped);
+    if (lost != reported) {
+        errlogPrintf("mcoreLog: %lu message(s) dropped (ring buffer full)\n",
+                     (unsigned long) (lost - reported));
+        reported = lost;
+    }
+    return count;
+}
+
+/**
+ * @brief Drain thread main loop.
+ *
+ * @param arg unused
+ */
+static void drainLoop(void *arg)
+{
+    for (;;) {
+        epicsThreadSleep(LOG_POLL_PERIOD);
+        epicsMutexLock(drainLock);
+        drainRing();
+        epicsMutexUnlock(drainLock);
+    }
+}
+
+/**
+ * @brief Forward the pending messages at exit.
+ *
+ * @param arg unused
+ */
+static void drainAtExit(void *arg)
+{
+    epicsMutexLock(drainLock);
+    drainRing();
+    epicsMutexUnlock(drainLock);
+}
+
+static void once(void *arg)
+{
+    drainLock = epicsMutexMustCreate();
+    draining = NULL != ownThreadCreate("mcoreLog",
+                                       epicsThreadPriorityLow,
+                                       epicsThreadGetStackSize(epicsThreadStackSmall),
+                                       drainLoop, NULL);
+    if (!draining) {
+        errlogPrintf("mcoreLog: can't create drain thread, messages are forwarded on flush\n");
+    }
+    epicsAtExit(drainAtExit, NULL);
+}
+
+/**
+ * @brief Initialization routine.
+ */
+void mcoreLogInit(void)
+{
+    static epicsThreadOnceId onceFlag = EPICS_THREAD_ONCE_INIT;
+    epicsThreadOnce(&onceFlag, once, NULL);
+}
+
+/**
+ * @brief Post a message to the deferred log.
+ */
+int mcoreLog(const char *format, ...)
+{
+    logRecord *rec;
+    size_t pos, seq, index;
+    va_list args;
+    int len;
+
+    pos = epicsAtomicGetSizeT(&writePos);
+    for (;;) {
+        index = pos & (LOG_RECORDS - 1);
+        seq = getSequence(index);
+        if (seq == pos) {
+            size_t current = epicsAtomicCmpAndSwapSizeT(&writePos, pos, pos + 1);
+            if (current == pos) break;
+            pos = current;
+        } else if ((long) (seq - pos) < 0) {
+            epicsAtomicIncrSizeT(&dropped);
+            return -1;
+        } else {
+            pos = epicsAtomicGetSizeT(&writePos);
+        }
+    }
+
+    rec = &ring[index];
+    clock_gettime(CLOCK_REALTIME, &rec->stamp);
+    va_start(args, format);
+    len = vsnprintf(rec->msg, LOG_MSG_SIZE, format, args);
+    va_end(args);
+    if (len >= LOG_MSG_SIZE) {
+        rec->msg[LOG_MSG_SIZE - 2] = '\n';
+        epicsAtomicIncrSizeT(&truncated);
+    }
+    epicsAtomicWriteMemoryBarrier();
+    setSequence(index, pos + 1);
+    epicsAtomicIncrSizeT(&posted);
+    return 0;
+}
+
+/**
+ * @brief Forward all pending messages to errlog and wait until they are written.
+ */
+void mcoreLogFlush(void)
+{
+    mcoreLogInit();
+    epicsMutexLock(drainLock);
+    drainRing();
+    epicsMutexUnlock(drainLock);
+    errlogFlush();
+}
+
+/**
+ * @brief Print the state and counters of the deferred log.
+ */
+void mcoreLogShow(unsigned int level)
+{
+    FILE *out = epicsGetStdout();
+    size_t pending;
+
+    mcoreLogInit();
+    // readPos is advanced by the drain thread holding drainLock
+    epicsMutexLock(drainLock);
+    pending = epicsAtomicGetSizeT(&writePos) - readPos;
+    epicsMutexUnlock(drainLock);
+    fprintf(out, "Deferred log: %d records of %d bytes, drain thread %s\n",
+            LOG_RECORDS, LOG_MSG_SIZE, draining ? "running" : "not running");
+    fprintf(out, "%lu posted, %lu pending, %lu dropped, %lu truncated\n",
+            (unsigned long) epicsAtomicGetSizeT(&posted), (unsigned long) pending,
+            (unsigned long) epicsAtomicGetSizeT(&dropped),
+            (unsigned long) epicsAtomicGetSizeT(&truncated));
+}
+
+/**
+ *@}
+ */
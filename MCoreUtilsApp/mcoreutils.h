@@ -62,6 +62,13 @@
  *
  * Details can be found in the documentation for module @ref memlock.
  *
+ * @subsection intro_log Deferred Logging
+ * The diagnostics of all modules go through a lock-free ring buffer, drained
+ * to errlog by a low priority thread, so that real-time threads never block on logging.
+ * The logger can be used by drivers, too.
+ *
+ * Details can be found in the documentation for module @ref log.
+ *
  * @section sources Sources
  * The sources are on GitHub at https://github.com/epics-modules/MCoreUtils
  *
@@ -109,6 +116,7 @@
 
 #include <unistd.h>
 
+#include <compilerDependencies.h>
 #include <epicsThread.h>
 #include <shareLib.h>
 
@@ -124,6 +132,9 @@ extern "C" {
  * Adds two new threadShow functions that, in addition to the
  * properties shown by @c epicsThreadShow() and @c epicsThreadShowAll(),
  * print the scheduling policy, and the CPU affinity of each thread.
+ * With a verbosity level > 0, the timer slack (in ns), the I/O priority,
+ * the nice value and the utilization clamps (@c min-max) of each thread
+ * are printed as well.
  *
  * Uses the @c epicsThreadMap() call to have a hook function being called
  * for every thread, which prints out the thread properties.
@@ -185,6 +196,17 @@ epicsShareFunc void mcoreThreadShowAll(unsigned int level);
  * OSI priority value that gets converted to the system's real-time priority schema.
  * @li <em>CPU Affinity</em>@n
  * Set of CPUs that this thread is allowed to run on.
+ * @li <em>Timer Slack</em>@n
+ * Time (in ns) by which the expiration of the thread's timers may be delayed
+ * to group wakeups (default: 50 us). Not used for real-time (FIFO or RR) threads.
+ * @li <em>I/O Priority</em>@n
+ * I/O scheduling class and level of the thread, used by the block layer.
+ * @li <em>Nice Value</em>@n
+ * Relative priority of threads using the non-real-time scheduling policies
+ * (OTHER, BATCH, IDLE), for which the scheduling priority has no effect.
+ * @li <em>Utilization Clamps</em>@n
+ * Minimum and maximum CPU utilization (0..1024) assumed for the thread when selecting
+ * CPU frequency and, on asymmetric (big.LITTLE) systems, CPU type.
  *
  * This is achieved by creating a linked list of rules, which consist of a regular
  * expression pattern and modification instructions.
@@ -219,12 +241,148 @@ epicsShareFunc void mcoreThreadShowAll(unsigned int level);
  * <tr><td>@c priority</td><td>scheduling priority to set for the thread
  * (a @c + or @c - sign adds to the current priority), @c * = don't change</td></tr>
  * <tr><td>@c affinity</td><td>CPUs to set the thread's affinity to (use @c , and @c - to specify
- * multiple CPUs and ranges, e.g. @c 0,3-5), @c * = don't change</td></tr>
+ * multiple CPUs and ranges, e.g. @c 0,3-5, see below for topology based specifications), @c * = don't change</td></tr>
  * <tr><td>@c pattern</td><td>regular expression pattern to match thread names against, see man page for
  * <a href="http://www.kernel.org/doc/man-pages/online/pages/man7/regex.7.html">regex(7)</a> for details</td></tr>
  * </table>
  * @par
+ * Fields containing a @c : (e.g. topology based cpuset specifications) must be enclosed in double quotes.
+ * @par
  * Lines starting with @c # (comments), and empty lines (containing only whitespace) are ignored.
+ * @par
+ * Lines starting with @c @ are directives. The directive
+ * @par
+ * <tt><b>\@options name options</b></tt>
+ * @par
+ * adds options (see below) to the existing rule @c name.
+ * @par
+ * <tt><b>\@partition [name]</b></tt>
+ * @par
+ * creates or joins the cgroup cpuset partition (see mcoreCgroupPartition()).
+ * @par
+ * <tt><b>\@latency us</b></tt>
+ * @par
+ * holds the PM QoS CPU latency limit (see mcoreCpuLatency()).
+ * @par
+ * <tt><b>\@cpufreq cpus governor [min_freq]</b></tt>
+ * @par
+ * sets the cpufreq governor and minimum frequency of a cpuset (see mcoreCpuFreq()).
+ * @par
+ * <tt><b>\@priomap map</b></tt>
+ * @par
+ * sets the OSI to POSIX priority map (see mcorePriorityMap()).
+ *
+ * @par CPU Set Specifications
+ * A cpuset specification is a comma separated list of items, each item being one of
+ * <table border="0">
+ * <tr><td>@c N, @c N-M, @c N-M:S</td><td>CPU @c N, CPUs @c N to @c M, every @c S th CPU
+ * from @c N to @c M</td></tr>
+ * <tr><td>@c core:R</td><td>all CPUs (hyperthreads) of physical core(s) @c R</td></tr>
+ * <tr><td>@c nosmt:R</td><td>CPU(s) @c R, keeping only the lowest-numbered CPU of each physical core</td></tr>
+ * <tr><td>@c llc:R</td><td>all CPUs sharing last-level cache(s) @c R</td></tr>
+ * <tr><td>@c node:R</td><td>all CPUs of NUMA node(s) @c R</td></tr>
+ * <tr><td>@c near:D</td><td>all CPUs local to network interface or PCI device @c D
+ * (e.g. @c near:eth2, @c near:0000:3b:00.0)</td></tr>
+ * <tr><td>@c isolated</td><td>all isolated CPUs (@c isolcpus kernel parameter)</td></tr>
+ * <tr><td>@c allowed</td><td>all CPUs the process may use</td></tr>
+ * <tr><td>@c allowed[I]</td><td>the @c I th allowed CPU (counting from 0, negative @c I counts
+ * from the end)</td></tr>
+ * <tr><td>@c allowed[F:T]</td><td>the allowed CPUs from index @c F up to, but not including, index @c T
+ * (either may be omitted or negative, e.g. @c allowed[-2:] for the last two)</td></tr>
+ * </table>
+ * where @c R is a number or a range (e.g. @c core:2-3).
+ * Ranges may have a stride, e.g. @c 0-31:2 (the even CPUs 0 to 30) or @c core:0-7:2.
+ * Items prefixed with @c ^ are removed from the set, regardless of their position
+ * in the list, e.g. @c node:0,^core:0 (all CPUs of NUMA node 0 except those of the first core).
+ * Physical cores and last-level caches are numbered in the order of their lowest-numbered CPU,
+ * NUMA nodes use the kernel's numbering.
+ * @par
+ * The allowed CPUs are the affinity of the IOC process, which includes the restrictions
+ * of a container or cgroup cpuset. The @c allowed items select CPUs relative to that set,
+ * so that the same rules file works for all container sizes. Slices are clamped to the
+ * allowed CPUs; an index beyond them makes the specification invalid.
+ * The cpuset of a rule is always restricted to the allowed CPUs; CPUs outside are
+ * reported and ignored, and a rule without any allowed CPU does not change the affinity.
+ * mcoreThreadRulesShow() shows the resolved cpuset and, if different, the specification.
+ * @par
+ * The topology is read once from sysfs (see @ref topology), e.g.
+ * @c core:1,core:3 on a host with 4 cores and 2 hyperthreads per core resolves to @c 1,3,5,7
+ * if the kernel numbers the second hyperthreads 4-7.
+ * The @c near items use the @c local_cpulist of the device, found through
+ * @c class/net/D/device or @c bus/pci/devices/D in sysfs, so that driver threads
+ * run next to their hardware without a per-chassis CPU mapping.
+ *
+ * @par Options
+ * Properties beyond policy, priority and affinity are set through options,
+ * a comma separated list of <tt>key=value</tt> pairs.
+ * <table border="0">
+ * <tr><td>@c slack</td><td>timer slack in ns (0 = reset to the process default), see
+ * <a href="http://www.kernel.org/doc/man-pages/online/pages/man2/prctl.2.html">prctl(2)</a>
+ * (@c PR_SET_TIMERSLACK); for threads other than the calling one (task scanner, hotplug
+ * watcher), <tt>/proc/<tid>/timerslack_ns</tt> is written, which needs Linux 4.6 or later
+ * and, on current kernels, the @c CAP_SYS_NICE capability</td></tr>
+ * <tr><td>@c ioprio</td><td>I/O priority as @c class/level, class being one of @c rt, @c be,
+ * @c idle, @c none (first letter, not case sensitive), level 0 (highest) to 7 (lowest, default 4), see
+ * <a href="http://www.kernel.org/doc/man-pages/online/pages/man2/ioprio_set.2.html">ioprio_set(2)</a></td></tr>
+ * <tr><td>@c nice</td><td>nice value (-20..19) for non-real-time threads</td></tr>
+ * <tr><td>@c uclamp_min</td><td>utilization clamp minimum (0..1024, Linux 5.3 or newer)</td></tr>
+ * <tr><td>@c uclamp_max</td><td>utilization clamp maximum (0..1024, Linux 5.3 or newer), see
+ * <a href="http://www.kernel.org/doc/man-pages/online/pages/man2/sched_setattr.2.html">sched_setattr(2)</a>
+ * for details on nice values and utilization clamps</td></tr>
+ * <tr><td>@c exclusive</td><td>reserve the rule's cpuset for the matching threads (no value needed):
+ * all other threads of the process get these CPUs removed from their affinity, the existing
+ * threads when a matching thread acquires the cpuset, new threads when they start.
+ * The CPUs are given back when the last matching thread exits or the rule is deleted.
+ * Threads that are only allowed on the reserved CPUs are not changed.</td></tr>
+ * <tr><td>@c placement</td><td>pin each matching thread to a single CPU of the rule's cpuset
+ * (or of the allowed CPUs if the rule does not set an affinity):
+ * @c spread assigns the CPUs of the set round robin, @c least-loaded picks the CPU of the set
+ * with the fewest threads placed on it (by any rule). A thread keeps its CPU when the rule
+ * is applied again. When applied to the creation attributes (interposer), the complete set is used,
+ * the CPU is selected when the thread starts.
+ * The assignments are shown by mcoreThreadRulesShow() as @c CPU:LWP pairs.</td></tr>
+ * <tr><td>@c group</td><td>co-location group as @c name or @c name/level: all threads matching
+ * rules with the same group name share the CPUs of one cache (default: last level cache,
+ * level 1..4 selects a specific cache level). The cache is the one of the CPU the first member
+ * thread runs on when it joins the group, restricted to that member's rule cpuset (or the allowed
+ * CPUs if the rule does not set an affinity). Can be combined with @c placement.</td></tr>
+ * <tr><td>@c balanced</td><td>let the balancer move the matching threads between the CPUs of the
+ * rule's cpuset (or the allowed CPUs if the rule does not set an affinity) according to the
+ * measured load (no value needed), see mcoreBalancePeriod()</td></tr>
+ * <tr><td>@c latency</td><td>run queue latency target in us: the latency monitor raises the
+ * priority of a matching thread whose 99th percentile wait exceeds the target (real-time threads
+ * by 5 per step, other threads get their nice value lowered by 5 per step), and lowers it
+ * step by step once the wait is below half the target, see mcoreBoostPeriod()</td></tr>
+ * <tr><td>@c ceiling</td><td>highest (OSI) priority a latency boost may set
+ * (default: the thread's priority + 10)</td></tr>
+ * <tr><td>@c budget</td><td>CPU time budget in percent of one CPU: the watchdog demotes a matching
+ * FIFO or RR thread that used more than its budget over the watchdog window to @c SCHED_OTHER,
+ * see mcoreWatchdogPeriod()</td></tr>
+ * </table>
+ * @c exclusive=0, @c balanced=0, @c placement=none, @c latency=0 and @c budget=0 turn the
+ * option off. Given through an @c \@options directive or mcoreThreadModify(), they release the
+ * existing reservation, placements or monitor registrations of the rule (or of the modified thread).
+ *
+ * @par Match Conditions
+ * Further options restrict the threads a rule applies to, in addition to the name pattern.
+ * They are checked before the pattern.
+ * <table border="0">
+ * <tr><td>@c osi</td><td>OSI priority range of the thread as @c N, @c N-M, @c N- or @c -M,
+ * e.g. @c osi=90- for all threads with priority 90 or above. Earlier rules that change the priority
+ * affect the priority later rules see.</td></tr>
+ * <tr><td>@c joinable</td><td>@c 1 or @c yes (or no value) for joinable threads, @c 0 or @c no
+ * for detached threads</td></tr>
+ * <tr><td>@c stack</td><td>stack size class of the thread: @c small, @c medium or @c big
+ * (the largest class whose size the thread's stack has)</td></tr>
+ * </table>
+ * Rules with match conditions never apply to non-EPICS threads (see mcoreTaskScan()),
+ * as their OSI priority, joinable state and stack class are unknown.
+ *
+ * No rule applies to the threads MCoreUtils creates itself (e.g. the watchdog,
+ * latency monitor and balancer threads), which are recorded when they are created;
+ * other threads are matched regardless of their name.
+ * The watchdog places itself on the housekeeping CPUs, the others keep the priority
+ * they are created with.
  *
  * @par Environment Variables
  * <dl>
@@ -232,6 +390,8 @@ epicsShareFunc void mcoreThreadShowAll(unsigned int level);
  * <dd>location of the @c HOME directory (default: `/`)</dd>
  * <dt>`EPICS_MCORE_USERCONFIG`</dt>
  * <dd>name of user configuration file, relative to the @c HOME directory (default: `.rtrules`)</dd>
+ * <dt>`EPICS_MCORE_SYSFS`</dt>
+ * <dd>root of the sysfs tree to read the CPU topology and device locality from (default: `/sys`)</dd>
  * </dl>
  *
  * @par Linux Security
@@ -241,6 +401,42 @@ epicsShareFunc void mcoreThreadShowAll(unsigned int level);
  * See the <a href="http://linux.die.net/man/5/limits.conf">limits.conf(5)</a>
  * man page for details.
  *
+ * @par Non-EPICS Threads
+ * Threads that are not created through the EPICS API (e.g. by vendor libraries,
+ * thread pools or OpenMP) do not call the hook function.
+ * The task scanner reads all tasks of the IOC process from @c /proc/self/task,
+ * on demand or periodically, matches each new task's name (as shown in
+ * <tt>/proc/self/task/<tid>/comm</tt>) against the rules, and applies the modifications of all rules
+ * that match.
+ * Tasks that match no rule but are allowed to run on CPUs that rules assign to
+ * real-time (FIFO or RR) threads are reported.
+ *
+ * @par Thread Creation Interposer
+ * The thread start hook runs inside the new thread, so a thread starts running with its
+ * default properties and may be preempted or migrated before the rules are applied.
+ * The optional @c mcoreinterpose library defines @c pthread_create(), applying the
+ * rules to the creation attributes of EPICS threads, so that they are created with
+ * their final policy, priority and affinity. The rules are applied again by the hook.
+ * It also defines @c pthread_setname_np(), applying the rules to non-EPICS
+ * threads that set their own name.
+ * @par
+ * EPICS threads are recognized through the public EPICS thread creation function
+ * (@c epicsThreadCreateOpt() since EPICS 7.0.2, @c epicsThreadCreate() before),
+ * which the library also defines to record the name and priority of the thread
+ * being created. The library must be built against the major release of EPICS base
+ * (before or since 7.0.2) that the IOC uses.
+ * @par
+ * The library can be preloaded when starting an IOC that includes @c mcoreutils.dbd:
+ * ~~~~
+ * LD_PRELOAD=<top>/lib/linux-x86_64/libmcoreinterpose.so ./st.cmd
+ * ~~~~
+ * or linked into the IOC executable by adding it before the @c mcoreutils library:
+ * ~~~~
+ * mcutest_LIBS += mcoreinterpose mcoreutils
+ * ~~~~
+ * Until the iocsh commands are registered (which reads the configuration files),
+ * threads are created unchanged.
+ *
  * @par Known Issues
  * A thread calling @c epicsThreadSetPriority() to set its priority while running may override
  * the priorities defined in the rules at any time.
@@ -257,7 +453,7 @@ epicsShareFunc void mcoreThreadShowAll(unsigned int level);
  * @c * = don't change)
  *
  * @par IOC Shell
- * <tt><b>mcoreThreadModify thread policy priority cpus</b></tt>
+ * <tt><b>mcoreThreadModify thread policy priority cpus [options]</b></tt>
  * <table border="0">
  * <tr><td>@c thread</td><td>thread name or id</td></tr>
  * <tr><td>@c policy</td><td>scheduling policy to set (@c * = don't change)</td></tr>
@@ -265,6 +461,7 @@ epicsShareFunc void mcoreThreadShowAll(unsigned int level);
  * @c * = don't change)</td></tr>
  * <tr><td>@c cpus</td><td>cpuset specification to set (use @c , and @c - to specify multiple CPUs and ranges,
  * @c * = don't change)</td></tr>
+ * <tr><td>@c options</td><td>comma separated list of @c key=value options (optional)</td></tr>
  * </table>
  */
 epicsShareFunc void mcoreThreadModify(epicsThreadId id,
@@ -272,6 +469,26 @@ epicsShareFunc void mcoreThreadModify(epicsThreadId id,
                                       const char *priority,
                                       const char *cpus);
 
+/**
+ * @brief Modify a thread's real-time properties and options.
+ *
+ * Used by the @c mcoreThreadModify iocShell command, which takes the
+ * options as optional fifth argument.
+ *
+ * @param id       EPICS thread id
+ * @param policy   scheduling policy to set (@c * = don't change)
+ * @param priority scheduling priority (OSI) to set (a @c + or @c - sign adds to the current priority,
+ * @c * = don't change)
+ * @param cpus     cpuset specification to set (use @c , and @c - to specify multiple CPUs and ranges,
+ * @c * = don't change)
+ * @param options  comma separated list of @c key=value options (NULL = none)
+ */
+epicsShareFunc void mcoreThreadModifyOpt(epicsThreadId id,
+                                         const char *policy,
+                                         const char *priority,
+                                         const char *cpus,
+                                         const char *options);
+
 /**
  * @brief Initialization routine.
  *
@@ -294,7 +511,7 @@ epicsShareFunc void mcoreThreadRulesInit();
  * @return (OK, ERROR) as (0,-1)
  *
  * @par IOC Shell
- * <tt><b>mcoreThreadRuleAdd name policy priority cpus pattern</b></tt>
+ * <tt><b>mcoreThreadRuleAdd name policy priority cpus pattern [options]</b></tt>
  * <table border="0">
  * <tr><td>@c name</td><td>rule name (identifier)</td></tr>
  * <tr><td>@c policy</td><td>scheduling policy to set (@c * = don't change)</td></tr>
@@ -305,6 +522,7 @@ epicsShareFunc void mcoreThreadRulesInit();
  * <tr><td>@c pattern</td>
  * <td><a href="http://www.kernel.org/doc/man-pages/online/pages/man7/regex.7.html">regex(7)</a> pattern
  * to match thread names against</td></tr>
+ * <tr><td>@c options</td><td>comma separated list of @c key=value options (optional)</td></tr>
  * </table>
  */
 epicsShareFunc long mcoreThreadRuleAdd(const char *name,
@@ -313,6 +531,30 @@ epicsShareFunc long mcoreThreadRuleAdd(const char *name,
                                        const char *cpus,
                                        const char *pattern);
 
+/**
+ * @brief Add or replace a thread rule with options.
+ *
+ * Used by the @c mcoreThreadRuleAdd iocShell command, which takes the
+ * options as optional sixth argument.
+ *
+ * @param name     rule name (identifier)
+ * @param policy   scheduling policy to set (@c * = don't change)
+ * @param priority scheduling priority (OSI) to set (a @c + or @c - sign adds to the current priority,
+ *                 @c * = don't change)
+ * @param cpus     cpuset specification to set (use @c , and @c - to specify multiple CPUs and ranges,
+ *                 @c * = don't change)
+ * @param pattern  <a href="http://www.kernel.org/doc/man-pages/online/pages/man7/regex.7.html">regex(7)</a>
+ *                 pattern to match thread names against
+ * @param options  comma separated list of @c key=value options (NULL = none)
+ * @return (OK, ERROR) as (0,-1)
+ */
+epicsShareFunc long mcoreThreadRuleAddOpt(const char *name,
+                                          const char *policy,
+                                          const char *priority,
+                                          const char *cpus,
+                                          const char *pattern,
+                                          const char *options);
+
 /**
  * @brief @b iocShell: Delete a thread rule.
  *
@@ -330,19 +572,460 @@ epicsShareFunc void mcoreThreadRuleDelete(const char *name);
  * @brief @b iocShell: Print a comprehensive list of the thread rules.
  *
  * Rule names are shortened to 16 characters.
+ * Rules that have matched threads show their counters (see mcoreThreadRulesStats()).
 
  * @par IOC Shell
  * <tt><b>mcoreThreadRulesShow</b></tt>
  */
 epicsShareFunc void mcoreThreadRulesShow(void);
 
+/**
+ * @brief @b iocShell: Print the rule counters and the thread start hook timing.
+ *
+ * For each rule, shows how often it matched a thread, how often it was applied
+ * without error, and the number of failed system calls with the last error.
+ * Each EPICS thread is counted once, when the thread start hook applies the rules;
+ * failed calls of the interposer (modifying the creation attributes) are included
+ * in the failures.
+ * The first failure of each rule is always logged, further ones with @c errVerbose set.
+ *
+ * The execution time of the thread start hook (applying the rules to a new EPICS thread)
+ * is shown as a histogram with logarithmic (power of 2) microsecond buckets.
+ *
+ * @param level verbosity level (>0 includes rules that never matched and empty buckets)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreThreadRulesStats level</b></tt>
+ * <table border="0">
+ * <tr><td>@c level</td><td>verbosity level</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreThreadRulesStats(unsigned int level);
+
+/**
+ * @brief Initialization routine for the task scanner.
+ *
+ * Must be called before using any of the other task scanner functions,
+ * which is done when registering the iocsh commands.
+ */
+epicsShareFunc void mcoreTaskScanInit(void);
+
+/**
+ * @brief @b iocShell: Apply the thread rules to all new non-EPICS threads.
+ *
+ * Scans @c /proc/self/task for tasks that are not EPICS threads and have not been
+ * found by a previous scan, and applies all matching rules to them.
+ * Unknown threads that may run on real-time CPUs are reported.
+ *
+ * @param level verbosity level (>0 prints each new thread)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreTaskScan level</b></tt>
+ * <table border="0">
+ * <tr><td>@c level</td><td>verbosity level</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreTaskScan(unsigned int level);
+
+/**
+ * @brief @b iocShell: Periodically apply the thread rules to all new non-EPICS threads.
+ *
+ * Starts a low priority thread that calls mcoreTaskScan() periodically.
+ *
+ * @param period scan period in seconds (0 = stop scanning)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreTaskScanPeriod period</b></tt>
+ * <table border="0">
+ * <tr><td>@c period</td><td>scan period in seconds (0 = stop scanning)</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreTaskScanPeriod(double period);
+
+/**
+ * @brief @b iocShell: Periodically rebalance the threads of @c balanced rules.
+ *
+ * Starts a high priority thread that samples the load of all CPUs (@c /proc/stat)
+ * and the run time and run queue delay of the balanced threads
+ * (@c /proc/self/task/<tid>/schedstat) once per period.
+ * Starting with the threads that waited longest on a run queue, a thread is pinned to
+ * the least loaded CPU of its rule's cpuset if that CPU's load is lower than the
+ * load of the thread's current CPU by more than the hysteresis and more than the
+ * thread's own load. Reserved CPUs of @c exclusive rules are skipped.
+ * A moved thread stays on its CPU for a number of periods (hold-off), and
+ * the number of migrations per period is limited, see mcoreBalanceTune().
+ *
+ * @param period balancing period in seconds (0 = stop balancing)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreBalancePeriod period</b></tt>
+ * <table border="0">
+ * <tr><td>@c period</td><td>balancing period in seconds (0 = stop balancing)</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreBalancePeriod(double period);
+
+/**
+ * @brief @b iocShell: Set the balancer's hysteresis and migration limits.
+ *
+ * A negative value leaves the setting unchanged. A hold-off of 0 lets a moved thread
+ * be moved again in the next period, a migration limit of 0 suspends balancing.
+ *
+ * @param hysteresis minimal load difference between two CPUs to move a thread,
+ *                   in percent of a CPU (default 25, <0 = don't change)
+ * @param holdoff    number of periods a moved thread stays on its CPU (default 5, <0 = don't change)
+ * @param migrations maximum number of threads moved per period (default 1, <0 = don't change)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreBalanceTune hysteresis holdoff migrations</b></tt>
+ * <table border="0">
+ * <tr><td>@c hysteresis</td><td>minimal load difference in percent (* or omitted = don't change)</td></tr>
+ * <tr><td>@c holdoff</td><td>periods a moved thread stays on its CPU (* or omitted = don't change)</td></tr>
+ * <tr><td>@c migrations</td><td>maximum migrations per period (* or omitted = don't change)</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreBalanceTune(double hysteresis, int holdoff, int migrations);
+
+/**
+ * @brief @b iocShell: Print the balancer's state and counters.
+ *
+ * @param level verbosity level (>0 lists the balanced threads and the recent migrations)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreBalanceShow level</b></tt>
+ * <table border="0">
+ * <tr><td>@c level</td><td>verbosity level</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreBalanceShow(unsigned int level);
+
+/**
+ * @brief @b iocShell: Periodically watch the run queue latency of threads with a latency target.
+ *
+ * Starts a thread at the highest priority that reads the run queue delay of the
+ * watched threads (@c /proc/self/task/<tid>/schedstat) once per period, and keeps
+ * the mean wait per scheduling of the last 100 periods. When the 99th percentile
+ * exceeds a thread's target, its priority is raised by one step, bounded by the rule's
+ * ceiling. When it drops below half the target, the priority is lowered by one step
+ * until the original priority is reached. After each change, at least 10 new samples
+ * are taken before the next decision.
+ * EPICS threads are changed through mcoreThreadModify(), so that their OSI priority stays
+ * consistent. Deleting the rule restores the original priorities.
+ *
+ * @param period monitor period in seconds (0 = stop monitoring)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreBoostPeriod period</b></tt>
+ * <table border="0">
+ * <tr><td>@c period</td><td>monitor period in seconds (0 = stop monitoring)</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreBoostPeriod(double period);
+
+/**
+ * @brief @b iocShell: Print the latency monitor's state and counters.
+ *
+ * @param level verbosity level (>0 lists the watched threads and the recent priority changes)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreBoostShow level</b></tt>
+ * <table border="0">
+ * <tr><td>@c level</td><td>verbosity level</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreBoostShow(unsigned int level);
+
+/**
+ * @brief @b iocShell: Start, reconfigure or stop the runaway thread watchdog.
+ *
+ * Starts a thread at the highest FIFO priority, pinned to the housekeeping CPUs,
+ * that reads the run time of the threads of rules with a @c budget option
+ * (@c /proc/self/task/<tid>/schedstat) once per period.
+ * A FIFO or RR thread that used more CPU time than its budget over the complete
+ * window is demoted to @c SCHED_OTHER, and an alarm is logged (errlog) and
+ * kept for mcoreWatchdogShow().
+ * The thread stays demoted until a rule, mcoreThreadModify() or epicsThreadSetPriority()
+ * sets its policy again (the EPICS thread keeps its recorded policy and priority).
+ * The watchdog thread itself is not affected by thread rules.
+ * Calling this again with different @p cpus moves the running watchdog thread.
+ *
+ * @param period watchdog period in seconds (0 = stop the watchdog)
+ * @param window window in seconds (0 = 10 periods, at most 100 periods)
+ * @param cpus   housekeeping cpuset specification for the watchdog thread
+ *               (NULL or @c * = the allowed CPUs that no real-time rule uses)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreWatchdogPeriod period [window] [cpus]</b></tt>
+ * <table border="0">
+ * <tr><td>@c period</td><td>watchdog period in seconds (0 = stop the watchdog)</td></tr>
+ * <tr><td>@c window</td><td>window in seconds (default: 10 periods)</td></tr>
+ * <tr><td>@c cpus</td><td>cpuset specification for the watchdog thread (default: housekeeping CPUs)</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreWatchdogPeriod(double period, double window, const char *cpus);
+
+/**
+ * @brief @b iocShell: Limit the time real-time threads may run without blocking.
+ *
+ * Sets the soft @c RLIMIT_RTTIME resource limit of the IOC process, see
+ * <a href="http://www.kernel.org/doc/man-pages/online/pages/man2/getrlimit.2.html">getrlimit(2)</a>.
+ * When a FIFO or RR thread runs longer than the limit without blocking, the kernel
+ * sends @c SIGXCPU to the process (and @c SIGKILL at the hard limit). The signal reaches
+ * an arbitrary thread, so the installed handler only records it: the next watchdog pass
+ * demotes the threads registered with the watchdog (rules with the @c budget option)
+ * that are FIFO or RR and have been running without a voluntary context switch since
+ * the previous pass, and logs the alarm. Without a running watchdog, the signal is ignored.
+ *
+ * @param usec limit in microseconds (0 = no limit)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreWatchdogRtTime usec</b></tt>
+ * <table border="0">
+ * <tr><td>@c usec</td><td>limit in microseconds (0 = no limit)</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreWatchdogRtTime(unsigned long usec);
+
+/**
+ * @brief @b iocShell: Print the watchdog's state, counters and alarms.
+ *
+ * @param level verbosity level (>0 lists the watched threads and the alarms)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreWatchdogShow level</b></tt>
+ * <table border="0">
+ * <tr><td>@c level</td><td>verbosity level</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreWatchdogShow(unsigned int level);
+
+/**
+ * @brief @b iocShell: Create or join a cgroup v2 cpuset partition for the real-time threads.
+ *
+ * Per-thread affinity does not keep other processes off the CPUs of the IOC's
+ * real-time threads. An isolated cpuset partition does, and (unlike @c isolcpus)
+ * can be set up and changed without a reboot.
+ *
+ * The partition is the threaded child group @c name of the IOC process' own cgroup.
+ * If it does not exist, it is created with the CPUs of all rules that set a FIFO or RR
+ * policy or the @c exclusive option together with an affinity, and
+ * @c cpuset.cpus.partition is set to @c isolated. An existing group (e.g. created
+ * by an earlier run of the IOC) is joined without changes.
+ * The EPICS threads matching these rules are moved into the partition,
+ * as are all threads matching them later. Moving a thread resets its affinity,
+ * so threads are moved before the rule affinities are applied, and the existing
+ * threads get their rule affinities again after the move.
+ *
+ * Needs write access to the process' cgroup (e.g. @c Delegate=yes in a systemd unit).
+ * If the kernel refuses the partition, its reason (@c cpuset.cpus.partition) is logged.
+ *
+ * @param name name of the group (NULL or empty = @c rt)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreCgroupPartition [name]</b></tt>
+ * <table border="0">
+ * <tr><td>@c name</td><td>name of the group (default: @c rt)</td></tr>
+ * </table>
+ *
+ * @par Environment Variables
+ * <dl>
+ * <dt>`EPICS_MCORE_CGROUPFS`</dt>
+ * <dd>mount point of the cgroup v2 hierarchy (default: `/sys/fs/cgroup`)</dd>
+ * <dt>`EPICS_MCORE_PROCFS`</dt>
+ * <dd>root of the procfs tree, to find the process' cgroup (default: `/proc`)</dd>
+ * </dl>
+ */
+epicsShareFunc void mcoreCgroupPartition(const char *name);
+
+/**
+ * @brief @b iocShell: Print the state of the cgroup partition.
+ *
+ * Shows the group type, its configured and effective CPUs, the partition state
+ * reported by the kernel, and the number of threads in the partition.
+ *
+ * @param level verbosity level (>0 lists the threads)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreCgroupShow level</b></tt>
+ * <table border="0">
+ * <tr><td>@c level</td><td>verbosity level</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreCgroupShow(unsigned int level);
+
+/**
+ * @brief @b iocShell: Watch for CPU hotplug and cpuset changes and re-apply the rules.
+ *
+ * Starts a low priority thread that compares the online CPUs and the CPUs of
+ * the process' cgroup cpuset with their previous values once per period, and
+ * immediately when the kernel sends a CPU uevent (where uevents are available).
+ *
+ * After a change, the topology is refreshed (with the CPUs allowed at startup,
+ * or the cgroup's CPUs, that are online as allowed CPUs), the cpuset specifications
+ * of the rules are resolved again, and the affinities of the rules are applied again
+ * to all EPICS threads and the non-EPICS threads found by mcoreTaskScan().
+ * Nothing but the affinities is changed; the main thread keeps its affinity
+ * unless a rule matches it. Changed rule cpusets and thread affinities are logged.
+ *
+ * @param period polling period in seconds (0 = stop watching)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreHotplugPeriod period</b></tt>
+ * <table border="0">
+ * <tr><td>@c period</td><td>polling period in seconds (0 = stop watching)</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreHotplugPeriod(double period);
+
+/**
+ * @brief @b iocShell: Print the state and counters of the hotplug watcher.
+ *
+ * @param level verbosity level (>0 shows the online, cgroup and startup CPUs)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreHotplugShow level</b></tt>
+ * <table border="0">
+ * <tr><td>@c level</td><td>verbosity level</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreHotplugShow(unsigned int level);
+
+/**
+ * @brief @b iocShell: Set the mapping of OSI priorities to POSIX real-time priorities.
+ *
+ * EPICS base maps the OSI priorities linearly onto the POSIX range of the
+ * real-time policies, so that neighbouring OSI priorities collide, and EPICS
+ * threads may end up above kernel threads.
+ * The map replaces that mapping for the priorities set by rules, by
+ * mcoreThreadModify() and by latency boosts (SCHED_FIFO and SCHED_RR only).
+ *
+ * The map is a comma separated list of items, each being one of
+ * <table border="0">
+ * <tr><td>@c O=P, @c O1-O2=P1-P2</td><td>map OSI priority @c O (or @c O1 to @c O2, linearly)
+ * to POSIX priority @c P (or @c P1 to @c P2)</td></tr>
+ * <tr><td>@c ^P, @c ^P1-P2</td><td>reserve POSIX priority @c P (or @c P1 to @c P2)</td></tr>
+ * </table>
+ * OSI priorities not covered by a segment keep the linear mapping, spread over the POSIX
+ * priorities that are not reserved. A map that assigns a reserved POSIX priority, or
+ * a lower POSIX priority to a higher OSI priority, is rejected.
+ * An empty map or @c default restores the linear mapping.
+ *
+ * @param map priority map specification
+ *
+ * @par IOC Shell
+ * <tt><b>mcorePriorityMap map</b></tt>
+ * <table border="0">
+ * <tr><td>@c map</td><td>priority map specification, e.g. @c 0-49=1-40,50-99=51-89,^41-50</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcorePriorityMap(const char *map);
+
+/**
+ * @brief @b iocShell: Print the priority map and the POSIX priorities of the EPICS threads.
+ *
+ * Lists the threads by POSIX priority, with their OSI priority and the POSIX
+ * priority the map gives for it. Flags mark threads that share their POSIX
+ * priority with threads of a different OSI priority (@c C), run in a reserved
+ * band (@c R), or do not run at the mapped priority (@c M).
+ *
+ * @param level verbosity level (>0 prints the map table and includes non real-time threads)
+ *
+ * @par IOC Shell
+ * <tt><b>mcorePriorityMapShow level</b></tt>
+ * <table border="0">
+ * <tr><td>@c level</td><td>verbosity level</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcorePriorityMapShow(unsigned int level);
+
 /**
  * @}
  */
 
 /**
- * @defgroup memlock Memory Locking
- * @brief Add functions for locking the process memory into RAM.
+ * @defgroup topology CPU Topology
+ * @brief Keep a model of the host's CPU topology.
+ * @{
+ *
+ * The CPU topology (configured, online and allowed CPUs, packages, physical cores,
+ * NUMA nodes and caches) is read once from sysfs and kept in memory.
+ * It is used for formatting cpusets and for resolving the topology based
+ * cpuset specifications (see @ref threadrules).
+ *
+ * The allowed CPUs are the affinity of the IOC process' main thread at the time
+ * the topology was read, which includes the restrictions of a container or cgroup cpuset.
+ * After a CPU change, the hotplug watcher sets them to the CPUs allowed at startup
+ * (or the cgroup's CPUs) that are online.
+ *
+ * All cpusets are allocated dynamically, sized for the highest CPU number the kernel
+ * may ever bring online (the @c possible CPUs), so that hosts with more than 1024 CPUs
+ * are fully supported. That size is determined once and does not change
+ * when the topology is re-read.
+ *
+ * @par Environment Variables
+ * <dl>
+ * <dt>`EPICS_MCORE_SYSFS`</dt>
+ * <dd>root of the sysfs tree to read the CPU topology from (default: `/sys`)</dd>
+ * </dl>
+ */
+
+/**
+ * @brief @b iocShell: Re-read the CPU topology.
+ *
+ * Needed after CPUs have been taken on- or offline, or the process' cpuset has changed.
+ * Existing rules are not changed.
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreTopologyRefresh</b></tt>
+ */
+epicsShareFunc void mcoreTopologyRefresh(void);
+
+/**
+ * @brief @b iocShell: Print the CPU topology.
+ *
+ * @param level verbosity level (>0 lists all packages, cores, NUMA nodes and caches)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreTopologyShow level</b></tt>
+ * <table border="0">
+ * <tr><td>@c level</td><td>verbosity level</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreTopologyShow(unsigned int level);
+
+/**
+ * @brief @b iocShell: Print the per-CPU load, interference and EPICS threads.
+ *
+ * For each online CPU, prints the share of user, nice, system, hard interrupt,
+ * softirq, steal and idle time from @c /proc/stat, the average number of tasks
+ * waiting on the run queue (@c AVGWAIT, the run queue wait time per elapsed time)
+ * and the mean wait per time slice from @c /proc/schedstat (if the kernel
+ * provides it), and the number of EPICS threads (all and real-time) whose
+ * affinity includes the CPU.
+ * The instantaneous run queue length is not available without debugfs;
+ * @c AVGWAIT counts the waiting tasks only, not the running one.
+ *
+ * The first call reports the values since boot, each further call the
+ * values since the previous call.
+ *
+ * @param level verbosity level (>0 lists the pinned and real-time EPICS threads
+ *              of each CPU, >1 all EPICS threads)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreCpuShow level</b></tt>
+ * <table border="0">
+ * <tr><td>@c level</td><td>verbosity level</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreCpuShow(unsigned int level);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup memlock Memory Locking and Power Management
+ * @brief Add functions for locking the process memory into RAM and keeping CPUs out of power saving states.
  * @{
  *
  * Adds functions that allow locking and unlocking the process virtual
@@ -395,6 +1078,170 @@ epicsShareFunc void mcoreMLock(void);
  */
 epicsShareFunc void mcoreMUnlock(void);
 
+/**
+ * @brief @b iocShell: Hold the PM QoS CPU latency limit.
+ *
+ * Opens @c /dev/cpu_dma_latency and writes the requested latency,
+ * keeping the device open for the lifetime of the IOC. While the device is held,
+ * the kernel does not use idle states with a longer exit latency on any CPU.
+ * Calling again changes the limit, a negative value releases it.
+ *
+ * The limit is released at exit.
+ *
+ * @param latency highest acceptable wakeup latency [us] (0 = no C-states, <0 = release)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreCpuLatency latency</b></tt>
+ * <table border="0">
+ * <tr><td>@c latency</td><td>latency in us</td></tr>
+ * </table>
+ *
+ * @par Environment Variables
+ * <dl>
+ * <dt>`EPICS_MCORE_DMA_LATENCY`</dt>
+ * <dd>PM QoS device (default: `/dev/cpu_dma_latency`)</dd>
+ * </dl>
+ */
+epicsShareFunc void mcoreCpuLatency(int latency);
+
+/**
+ * @brief @b iocShell: Set the cpufreq governor and minimum frequency of CPUs.
+ *
+ * Writes @c scaling_governor and @c scaling_min_freq of each CPU in the cpuset
+ * (below the sysfs root set by @c EPICS_MCORE_SYSFS).
+ * The previous values of each CPU are saved when it is first changed,
+ * and restored at exit.
+ *
+ * @param cpus     cpuset specification (see @ref threadrules)
+ * @param governor governor to set (NULL, empty or @c - = don't change)
+ * @param minFreq  minimum frequency in kHz, @c max = the CPU's highest frequency
+ *                 (NULL or empty = don't change)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreCpuFreq cpus governor min_freq</b></tt>
+ * <table border="0">
+ * <tr><td>@c cpus</td><td>cpuset specification</td></tr>
+ * <tr><td>@c governor</td><td>cpufreq governor, e.g. @c performance</td></tr>
+ * <tr><td>@c min_freq</td><td>minimum frequency [kHz] or @c max</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreCpuFreq(const char *cpus, const char *governor, const char *minFreq);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup audit Real-Time Readiness Audit
+ * @brief Check the host and process settings that real-time operation depends on.
+ * @{
+ *
+ * Each check prints PASS or FAIL together with the measured value, or SKIP if
+ * the information is not available on the host.
+ * The real-time CPUs are the CPUs that rules assign to FIFO or RR threads
+ * (all allowed CPUs if there are no such rules).
+ *
+ * <table>
+ * <tr><th>Check</th><th>Passes if</th></tr>
+ * <tr><td>@c governor</td><td>all real-time CPUs use the @c performance cpufreq governor</td></tr>
+ * <tr><td>@c cpu_dma_latency</td><td>a PM QoS CPU latency constraint is set</td></tr>
+ * <tr><td>@c C-states</td><td>no enabled C-state usable under that constraint has an exit latency
+ *   above 10 us on the real-time CPUs</td></tr>
+ * <tr><td>@c THP</td><td>transparent huge pages are not set to @c always</td></tr>
+ * <tr><td>@c swap</td><td>no memory of the process is swapped out</td></tr>
+ * <tr><td>@c rt_throttling</td><td>real-time throttling is disabled (@c sched_rt_runtime_us = -1)</td></tr>
+ * <tr><td>@c isolcpus</td><td>all real-time CPUs are isolated</td></tr>
+ * <tr><td>@c nohz_full</td><td>all real-time CPUs are in adaptive-tick mode</td></tr>
+ * <tr><td>@c irqbalance</td><td>the irqbalance daemon is not running</td></tr>
+ * <tr><td>@c RLIMIT_RTPRIO</td><td>the highest FIFO priority is allowed (or @c CAP_SYS_NICE)</td></tr>
+ * <tr><td>@c RLIMIT_MEMLOCK</td><td>locked memory is unlimited (or @c CAP_IPC_LOCK)</td></tr>
+ * <tr><td>@c mlock</td><td>process memory is locked (e.g. by mcoreMLock())</td></tr>
+ * </table>
+ *
+ * @par Environment Variables
+ * <dl>
+ * <dt>`EPICS_MCORE_SYSFS`</dt>
+ * <dd>root of the sysfs tree (default: `/sys`)</dd>
+ * <dt>`EPICS_MCORE_PROCFS`</dt>
+ * <dd>root of the procfs tree (default: `/proc`)</dd>
+ * <dt>`EPICS_MCORE_DMA_LATENCY`</dt>
+ * <dd>PM QoS device (default: `/dev/cpu_dma_latency`)</dd>
+ * </dl>
+ */
+
+/**
+ * @brief @b iocShell: Check the host and process for real-time readiness.
+ *
+ * @return number of failed checks, -1 on error
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreRtAudit</b></tt>
+ */
+epicsShareFunc int mcoreRtAudit(void);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup log Deferred Logging
+ * @brief Log messages from real-time code without blocking.
+ * @{
+ *
+ * The diagnostics of the MCoreUtils modules are posted to a lock-free ring
+ * buffer of fixed-size records, so that code running at real-time priority
+ * (e.g. the thread start hook on a freshly promoted FIFO thread) never
+ * blocks on a lock or on console I/O. A low priority drain thread forwards
+ * the messages, prefixed with the time they were posted, to errlog.
+ *
+ * Drivers can use mcoreLog() for diagnostics in their own hot paths.
+ *
+ * Messages are truncated to 159 characters. If the ring (256 records) is full,
+ * messages are dropped; the drain thread reports the number of dropped messages.
+ */
+
+/**
+ * @brief Initialization routine for the deferred log.
+ *
+ * Starts the drain thread. Called when the module is registered;
+ * messages posted before are forwarded when the drain thread starts.
+ */
+epicsShareFunc void mcoreLogInit(void);
+
+/**
+ * @brief Post a message to the deferred log.
+ *
+ * Formats the message (printf style) into a ring buffer record, without
+ * blocking, locking or allocating memory. Safe to call from real-time threads.
+ *
+ * @param format printf style format
+ * @return 0 on success, -1 if the message was dropped (ring buffer full)
+ */
+epicsShareFunc int mcoreLog(const char *format, ...) EPICS_PRINTF_STYLE(1,2);
+
+/**
+ * @brief @b iocShell: Forward all pending messages of the deferred log to errlog.
+ *
+ * Waits until errlog has written them.
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreLogFlush</b></tt>
+ */
+epicsShareFunc void mcoreLogFlush(void);
+
+/**
+ * @brief @b iocShell: Print the state and counters of the deferred log.
+ *
+ * @param level verbosity level (unused)
+ *
+ * @par IOC Shell
+ * <tt><b>mcoreLogShow level</b></tt>
+ * <table border="0">
+ * <tr><td>@c level</td><td>verbosity level</td></tr>
+ * </table>
+ */
+epicsShareFunc void mcoreLogShow(unsigned int level);
+
 /**
  * @}
  */
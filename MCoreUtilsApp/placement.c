@@ -0,0 +1,645 @@
+/********************************************//**
+ * @file
+ * @brief Placement of the threads matching a rule on single CPUs and in co-location groups.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * Rules with a placement mode pin each matching thread to a single CPU
+ * of the rule's cpuset instead of giving all of them the complete set.
+ * The assignments are kept per rule, and forgotten when the thread exits
+ * or the rule is deleted. EPICS threads are forgotten by a thread exit handler,
+ * other threads by placementPrune() (called by the task scan), keeping
+ * the thread start hook free of scans over all assignments.
+ *
+ * Rules with a co-location group place all member threads on the CPUs
+ * sharing a cache. The first member decides on the cache (the one of the CPU
+ * it is running on), later members follow. A group is forgotten when
+ * all its members have exited (detected the same way as for the placements).
+ *
+ * @ingroup threadrules
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+
+#include <ellLib.h>
+#include <errlog.h>
+#include <epicsExit.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+
+/// @cond NEVER
+#define epicsExportSharedSymbols
+/// @endcond
+#include "mcoreutils.h"
+#include "utils.h"
+#include "cpumask.h"
+#include "topology.h"
+#include "placement.h"
+
+/**
+ * @brief The CPU a thread has been placed on.
+ */
+typedef struct assignment {
+    pid_t       tid;            ///< Linux thread id
+    int         cpu;            ///< CPU the thread is pinned to
+} assignment;
+
+/**
+ * @brief The placement state of a rule.
+ */
+typedef struct placedRule {
+    ELLNODE     node;           ///< linked list node
+    char       *name;           ///< rule name
+    int         lastCpu;        ///< CPU of the last placement
+    assignment *assigned;       ///< assignments of the rule's threads
+    size_t      nAssigned;      ///< number of assignments
+    size_t      maxAssigned;    ///< allocated size of the assignments array
+} placedRule;
+
+/**
+ * @brief A co-location group.
+ */
+typedef struct colocGroup {
+    ELLNODE     node;           ///< linked list node
+    char       *name;           ///< group name
+    int         level;          ///< cache level (0 = last-level cache)
+    cpu_set_t  *cpuset;         ///< CPUs of the group
+    pid_t      *members;        ///< Linux thread ids of the members
+    size_t      nMembers;       ///< number of members
+    size_t      maxMembers;     ///< allocated size of the members array
+} colocGroup;
+
+static ELLLIST placedRules = ELLLIST_INIT;
+static ELLLIST groups = ELLLIST_INIT;
+static epicsMutexId placeLock;
+static const char *modeNames[] = { "none", "spread", "least-loaded" };
+
+/**
+ * @brief Convert string placement mode specification to placement mode.
+ *
+ * @param string placement mode ("spread" or "least-loaded", first letter suffices)
+ * @return placement mode, or -1 on error
+ */
+int strToPlacement(const char *string)
+{
+    if (0 == strncasecmp(string, "spread", 1)) {
+        return placementSpread;
+    } else if (0 == strncasecmp(string, "least-loaded", 1)) {
+        return placementLeastLoaded;
+    } else if (0 == strncasecmp(string, "none", 1)) {
+        return placementNone;
+    }
+    errlogPrintf("Invalid placement mode \"%s\"\n", string);
+    return -1;
+}
+
+/**
+ * @brief Convert placement mode to string.
+ *
+ * @param mode placement mode
+ * @return string representation
+ */
+const char *placementToStr(int mode)
+{
+    if (mode < placementNone || mode > placementLeastLoaded) return "?";
+    return modeNames[mode];
+}
+
+static placedRule *findPlacedRule(const char *name)
+{
+    placedRule *prule = (placedRule *) ellFirst(&placedRules);
+    while (prule) {
+        if (0 == strcmp(name, prule->name)) return prule;
+        prule = (placedRule *) ellNext(&prule->node);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Forget the assignments of threads that do not exist any more.
+ */
+static void pruneAssignments(void)
+{
+    placedRule *prule = (placedRule *) ellFirst(&placedRules);
+
+    while (prule) {
+        size_t i, j;
+        for (i = j = 0; i < prule->nAssigned; i++) {
+            if (taskExists(prule->assigned[i].tid)) {
+                prule->assigned[j++] = prule->assigned[i];
+            }
+        }
+        prule->nAssigned = j;
+        prule = (placedRule *) ellNext(&prule->node);
+    }
+}
+
+/**
+ * @brief Forget the assignments of a thread.
+ *
+ * @param tid Linux thread id
+ */
+static void forgetAssignments(pid_t tid)
+{
+    placedRule *prule = (placedRule *) ellFirst(&placedRules);
+
+    while (prule) {
+        size_t i;
+        for (i = 0; i < prule->nAssigned; i++) {
+            if (prule->assigned[i].tid == tid) {
+                prule->assigned[i] = prule->assigned[--prule->nAssigned];
+                break;
+            }
+        }
+        prule = (placedRule *) ellNext(&prule->node);
+    }
+}
+
+/**
+ * @brief Thread exit handler of the placed threads.
+ *
+ * @param arg Linux thread id
+ */
+static void atThreadExit(void *arg)
+{
+    placementThreadExit((pid_t) (long) arg);
+}
+
+/**
+ * @brief Select the least loaded CPU of a set.
+ *
+ * The load of a CPU is the number of threads placed on it by all rules.
+ * Of equally loaded CPUs, the next one after the last placement is selected.
+ *
+ * @param cpuset  CPUs to select from
+ * @param lastCpu CPU of the last placement of the rule
+ * @return selected CPU, -1 if the set is empty
+ */
+static int leastLoadedCpu(const cpu_set_t *cpuset, int lastCpu)
+{
+    const size_t setsize = cpusetSize();
+    const int ncpus = topologyNumCpus();
+    int *load = calloc(ncpus, sizeof(int));
+    placedRule *prule;
+    int cpu, best = -1;
+
+    if (!load) {
+        mcoreLog("Memory allocation error\n");
+        return -1;
+    }
+    for (prule = (placedRule *) ellFirst(&placedRules); prule;
+         prule = (placedRule *) ellNext(&prule->node)) {
+        size_t i;
+        for (i = 0; i < prule->nAssigned; i++) {
+            load[prule->assigned[i].cpu]++;
+        }
+    }
+    for (cpu = cpumaskNextSet(cpuset, setsize, lastCpu + 1); cpu >= 0;
+         cpu = cpumaskNextSet(cpuset, setsize, cpu + 1)) {
+        if (best < 0 || load[cpu] < load[best]) best = cpu;
+    }
+    for (cpu = cpumaskNextSet(cpuset, setsize, 0); cpu >= 0 && cpu <= lastCpu;
+         cpu = cpumaskNextSet(cpuset, setsize, cpu + 1)) {
+        if (best < 0 || load[cpu] < load[best]) best = cpu;
+    }
+    free(load);
+    return best;
+}
+
+/**
+ * @brief Select the CPU to place a thread on.
+ *
+ * A thread that has already been placed by the rule on a CPU of the set
+ * keeps its CPU.
+ *
+ * @param name   rule name
+ * @param mode   placement mode
+ * @param tid    Linux thread id
+ * @param cpuset CPUs of the rule
+ * @return selected CPU, -1 if no CPU was selected
+ */
+int placementSelect(const char *name, int mode, pid_t tid, const cpu_set_t *cpuset)
+{
+    const size_t setsize = cpusetSize();
+    placedRule *prule;
+    size_t i;
+    int cpu = -1;
+    int known = 0;
+
+    if (placementNone == mode) return -1;
+    placementInit();
+    epicsMutexLock(placeLock);
+    prule = findPlacedRule(name);
+    if (!prule) {
+        prule = calloc(1, sizeof(placedRule));
+        if (!prule || !(prule->name = strdup(name))) {
+            mcoreLog("Memory allocation error\n");
+            free(prule);
+            epicsMutexUnlock(placeLock);
+            return -1;
+        }
+        prule->lastCpu = -1;
+        ellAdd(&placedRules, &prule->node);
+    }
+
+    for (i = 0; i < prule->nAssigned; i++) {
+        if (prule->assigned[i].tid == tid) break;
+    }
+    if (i < prule->nAssigned) {
+        if (CPU_ISSET_S(prule->assigned[i].cpu, setsize, cpuset)) {
+            cpu = prule->assigned[i].cpu;
+            epicsMutexUnlock(placeLock);
+            return cpu;
+        }
+        prule->assigned[i] = prule->assigned[--prule->nAssigned];
+        known = 1;
+    }
+
+    if (placementSpread == mode) {
+        cpu = cpumaskNextSet(cpuset, setsize, prule->lastCpu + 1);
+        if (cpu < 0) {
+            cpu = cpumaskNextSet(cpuset, setsize, 0);
+        }
+    } else if (placementLeastLoaded == mode) {
+        cpu = leastLoadedCpu(cpuset, prule->lastCpu);
+    }
+
+    if (cpu >= 0) {
+        if (prule->nAssigned == prule->maxAssigned) {
+            size_t max = prule->maxAssigned ? 2 * prule->maxAssigned : 16;
+            assignment *list = realloc(prule->assigned, max * sizeof(assignment));
+            if (!list) {
+                mcoreLog("Memory allocation error\n");
+                epicsMutexUnlock(placeLock);
+                return -1;
+            }
+            prule->assigned = list;
+            prule->maxAssigned = max;
+        }
+        prule->assigned[prule->nAssigned].tid = tid;
+        prule->assigned[prule->nAssigned].cpu = cpu;
+        prule->nAssigned++;
+        prule->lastCpu = cpu;
+    }
+    epicsMutexUnlock(placeLock);
+
+    if (cpu >= 0 && !known && (pid_t) syscall(SYS_gettid) == tid) {
+        epicsAtThreadExit(atThreadExit, (void *) (long) tid);
+    }
+    return cpu;
+}
+
+/**
+ * @brief Forget the placements of a rule.
+ *
+ * @param name rule name
+ */
+void placementRelease(const char *name)
+{
+    placedRule *prule;
+
+    placementInit();
+    epicsMutexLock(placeLock);
+    if ((prule = findPlacedRule(name))) {
+        ellDelete(&placedRules, &prule->node);
+        free(prule->name);
+        free(prule->assigned);
+        free(prule);
+    }
+    epicsMutexUnlock(placeLock);
+}
+
+/**
+ * @brief Get the buffer length needed to list the placements of a rule.
+ *
+ * @param name rule name
+ * @return length of the list for placementMapToStr(), including the terminating null
+ */
+size_t placementMapStrLen(const char *name)
+{
+    placedRule *prule;
+    size_t i, len = 1;
+
+    placementInit();
+    epicsMutexLock(placeLock);
+    if ((prule = findPlacedRule(name))) {
+        for (i = 0; i < prule->nAssigned; i++) {
+            len += snprintf(NULL, 0, ",%d:%d",
+                            prule->assigned[i].cpu, (int) prule->assigned[i].tid);
+        }
+    }
+    epicsMutexUnlock(placeLock);
+    return len;
+}
+
+/**
+ * @brief List the placements of a rule.
+ *
+ * @param name rule name
+ * @param str  output buffer to write into, as list of @c CPU:LWP pairs (e.g. "2:1234,3:1240")
+ * @param len  length of @p str
+ * @return number of placed threads
+ */
+int placementMapToStr(const char *name, char *str, size_t len)
+{
+    placedRule *prule;
+    size_t i, pos = 0;
+    int count = 0;
+
+    if (!str || !len) return 0;
+    str[0] = '\0';
+    placementInit();
+    epicsMutexLock(placeLock);
+    pruneAssignments();
+    if ((prule = findPlacedRule(name))) {
+        for (i = 0; i < prule->nAssigned; i++) {
+            int n = snprintf(str + pos, len - pos, "%s%d:%d", pos ? "," : "",
+                             prule->assigned[i].cpu, (int) prule->assigned[i].tid);
+            if (n < 0 || (size_t) n >= len - pos) {
+                str[pos] = '\0';
+                break;
+            }
+            pos += n;
+        }
+        count = (int) prule->nAssigned;
+    }
+    epicsMutexUnlock(placeLock);
+    return count;
+}
+
+static colocGroup *findGroup(const char *name)
+{
+    colocGroup *pgroup = (colocGroup *) ellFirst(&groups);
+    while (pgroup) {
+        if (0 == strcmp(name, pgroup->name)) return pgroup;
+        pgroup = (colocGroup *) ellNext(&pgroup->node);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Forget the members that do not exist any more, and groups without members.
+ */
+static void pruneGroups(void)
+{
+    colocGroup *pgroup = (colocGroup *) ellFirst(&groups);
+
+    while (pgroup) {
+        colocGroup *next = (colocGroup *) ellNext(&pgroup->node);
+        size_t i, j;
+        for (i = j = 0; i < pgroup->nMembers; i++) {
+            if (taskExists(pgroup->members[i])) {
+                pgroup->members[j++] = pgroup->members[i];
+            }
+        }
+        pgroup->nMembers = j;
+        if (!pgroup->nMembers) {
+            ellDelete(&groups, &pgroup->node);
+            free(pgroup->name);
+            free(pgroup->members);
+            cpusetFree(pgroup->cpuset);
+            free(pgroup);
+        }
+        pgroup = next;
+    }
+}
+
+/**
+ * @brief Forget a member of all groups, and groups without members.
+ *
+ * @param tid Linux thread id
+ */
+static void forgetMember(pid_t tid)
+{
+    colocGroup *pgroup = (colocGroup *) ellFirst(&groups);
+
+    while (pgroup) {
+        colocGroup *next = (colocGroup *) ellNext(&pgroup->node);
+        size_t i;
+        for (i = 0; i < pgroup->nMembers; i++) {
+            if (pgroup->members[i] == tid) {
+                pgroup->members[i] = pgroup->members[--pgroup->nMembers];
+                break;
+            }
+        }
+        if (!pgroup->nMembers) {
+            ellDelete(&groups, &pgroup->node);
+            free(pgroup->name);
+            free(pgroup->members);
+            cpusetFree(pgroup->cpuset);
+            free(pgroup);
+        }
+        pgroup = next;
+    }
+}
+
+/**
+ * @brief Select the CPUs of a new group.
+ *
+ * Uses the CPUs sharing a cache with the CPU the first member is running on
+ * (or, if that is not in the set of candidates, the lowest candidate),
+ * restricted to the candidates.
+ *
+ * @param pgroup group to set
+ * @param tid    Linux thread id of the first member
+ * @param base   candidate CPUs
+ */
+static void selectGroupCpus(colocGroup *pgroup, pid_t tid, const cpu_set_t *base)
+{
+    const size_t setsize = cpusetSize();
+    int cpu = taskCpu(tid);
+
+    if (cpu < 0 || cpu >= topologyNumCpus() || !CPU_ISSET_S(cpu, setsize, base)) {
+        cpu = cpumaskNextSet(base, setsize, 0);
+    }
+    CPU_ZERO_S(setsize, pgroup->cpuset);
+    if (cpu >= 0 && 0 == topologyCpuCacheCpus(pgroup->level, cpu, pgroup->cpuset)) {
+        cpumaskAnd(pgroup->cpuset, pgroup->cpuset, base, setsize);
+    }
+    if (!cpumaskCount(pgroup->cpuset, setsize)) {
+        cpusetCopy(pgroup->cpuset, base);
+    }
+}
+
+/**
+ * @brief Get the CPUs of a co-location group for a member.
+ *
+ * The first member creates the group, deciding on its CPUs.
+ *
+ * @param name   group name
+ * @param level  cache level to share (0 = last-level cache)
+ * @param tid    Linux thread id of the member
+ * @param base   candidate CPUs (used by the first member)
+ * @param cpuset cpuset to write the group's CPUs into
+ * @return 0 on success, -1 on error
+ */
+int placementGroup(const char *name, int level, pid_t tid, const cpu_set_t *base, cpu_set_t *cpuset)
+{
+    colocGroup *pgroup;
+    size_t i;
+    int added = 0;
+
+    placementInit();
+    epicsMutexLock(placeLock);
+    pgroup = findGroup(name);
+    if (!pgroup) {
+        pgroup = calloc(1, sizeof(colocGroup));
+        if (!pgroup || !(pgroup->name = strdup(name)) || !(pgroup->cpuset = cpusetAlloc())) {
+            mcoreLog("Memory allocation error\n");
+            if (pgroup) free(pgroup->name);
+            free(pgroup);
+            epicsMutexUnlock(placeLock);
+            return -1;
+        }
+        pgroup->level = level;
+        selectGroupCpus(pgroup, tid, base);
+        ellAdd(&groups, &pgroup->node);
+    }
+    for (i = 0; i < pgroup->nMembers; i++) {
+        if (pgroup->members[i] == tid) break;
+    }
+    if (i == pgroup->nMembers) {
+        if (pgroup->nMembers == pgroup->maxMembers) {
+            size_t max = pgroup->maxMembers ? 2 * pgroup->maxMembers : 8;
+            pid_t *members = realloc(pgroup->members, max * sizeof(pid_t));
+            if (!members) {
+                mcoreLog("Memory allocation error\n");
+                epicsMutexUnlock(placeLock);
+                return -1;
+            }
+            pgroup->members = members;
+            pgroup->maxMembers = max;
+        }
+        pgroup->members[pgroup->nMembers++] = tid;
+        added = 1;
+    }
+    cpusetCopy(cpuset, pgroup->cpuset);
+    epicsMutexUnlock(placeLock);
+
+    if (added && (pid_t) syscall(SYS_gettid) == tid) {
+        epicsAtThreadExit(atThreadExit, (void *) (long) tid);
+    }
+    return 0;
+}
+
+/**
+ * @brief Get the buffer length needed to describe a co-location group.
+ *
+ * @param name group name
+ * @return length of the description by placementGroupToStr(), including the terminating null
+ */
+size_t placementGroupStrLen(const char *name)
+{
+    colocGroup *pgroup;
+    size_t i, len = 1;
+
+    placementInit();
+    epicsMutexLock(placeLock);
+    if ((pgroup = findGroup(name))) {
+        len += strlen("CPUs  LWP ") + topologyCpusetStrLen();
+        for (i = 0; i < pgroup->nMembers; i++) {
+            len += snprintf(NULL, 0, ",%d", (int) pgroup->members[i]);
+        }
+    }
+    epicsMutexUnlock(placeLock);
+    return len;
+}
+
+/**
+ * @brief Describe a co-location group.
+ *
+ * @param name group name
+ * @param str  output buffer to write into (e.g. "CPUs 2-3,6-7 LWP 1234,1240")
+ * @param len  length of @p str
+ * @return number of members, 0 if the group does not exist
+ */
+int placementGroupToStr(const char *name, char *str, size_t len)
+{
+    colocGroup *pgroup;
+    size_t i, pos;
+    int count = 0;
+
+    if (!str || !len) return 0;
+    str[0] = '\0';
+    placementInit();
+    epicsMutexLock(placeLock);
+    pruneGroups();
+    if ((pgroup = findGroup(name))) {
+        pos = snprintf(str, len, "CPUs ");
+        if (pos < len) {
+            pos += cpumaskFormat(str + pos, len - pos, pgroup->cpuset, cpusetSize());
+        }
+        for (i = 0; i < pgroup->nMembers && pos < len; i++) {
+            int n = snprintf(str + pos, len - pos, "%s%d", i ? "," : " LWP ", (int) pgroup->members[i]);
+            if (n < 0 || (size_t) n >= len - pos) {
+                str[pos] = '\0';
+                break;
+            }
+            pos += n;
+        }
+        count = (int) pgroup->nMembers;
+    }
+    epicsMutexUnlock(placeLock);
+    return count;
+}
+
+/**
+ * @brief Forget a thread that exits.
+ *
+ * @param tid Linux thread id
+ */
+void placementThreadExit(pid_t tid)
+{
+    placementInit();
+    epicsMutexLock(placeLock);
+    forgetAssignments(tid);
+    forgetMember(tid);
+    epicsMutexUnlock(placeLock);
+}
+
+/**
+ * @brief Forget all placed threads that do not exist any more.
+ *
+ * Needed for threads that exit without running the EPICS thread exit handlers.
+ */
+void placementPrune(void)
+{
+    placementInit();
+    epicsMutexLock(placeLock);
+    pruneAssignments();
+    pruneGroups();
+    epicsMutexUnlock(placeLock);
+}
+
+static void once(void *arg)
+{
+    placeLock = epicsMutexMustCreate();
+}
+
+/**
+ * @brief Initialization routine.
+ */
+void placementInit(void)
+{
+    static epicsThreadOnceId onceFlag = EPICS_THREAD_ONCE_INIT;
+    epicsThreadOnce(&onceFlag, once, NULL);
+}
+
+/**
+ *@}
+ */
@@ -0,0 +1,49 @@
+/********************************************//**
+ * @file
+ * @brief Header file for placement.c
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stddef.h>
+#include <sched.h>
+#include <sys/types.h>
+
+/**
+ * @brief Placement modes of the threads matching a rule.
+ */
+typedef enum placementMode {
+    placementNone = 0,          ///< all threads get the rule's cpuset
+    placementSpread,            ///< each thread gets the next CPU of the set (round robin)
+    placementLeastLoaded        ///< each thread gets the CPU of the set with the fewest placed threads
+} placementMode;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void placementInit(void);
+int strToPlacement(const char *string);
+const char *placementToStr(int mode);
+int placementSelect(const char *name, int mode, pid_t tid, const cpu_set_t *cpuset);
+void placementRelease(const char *name);
+void placementThreadExit(pid_t tid);
+void placementPrune(void);
+size_t placementMapStrLen(const char *name);
+int placementMapToStr(const char *name, char *str, size_t len);
+int placementGroup(const char *name, int level, pid_t tid, const cpu_set_t *base, cpu_set_t *cpuset);
+size_t placementGroupStrLen(const char *name);
+int placementGroupToStr(const char *name, char *str, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PLACEMENT_H
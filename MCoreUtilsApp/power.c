@@ -0,0 +1,264 @@
+/********************************************//**
+ * @file
+ * @brief PM QoS latency hold and CPU frequency settings.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * The PM QoS CPU latency constraint is active as long as the
+ * @c cpu_dma_latency device is kept open, so the file descriptor is held
+ * for the lifetime of the IOC (or until the constraint is released).
+ *
+ * The previous cpufreq governor and minimum frequency of each CPU are saved
+ * when a CPU is changed for the first time, and written back at exit.
+ *
+ * @ingroup memlock
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include <errlog.h>
+#include <envDefs.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsExit.h>
+#include <shareLib.h>
+
+#include "utils.h"
+#include "cpumask.h"
+#include "topology.h"
+#include "power.h"
+
+/// @cond NEVER
+#define epicsExportSharedSymbols
+/// @endcond
+#include "mcoreutils.h"
+
+/**
+ * @brief Saved cpufreq settings of a CPU.
+ */
+typedef struct cpuFreqSaved {
+    char        saved;          ///< flag: settings have been saved
+    char        governor[32];   ///< previous scaling_governor
+    char        minFreq[32];    ///< previous scaling_min_freq [kHz]
+} cpuFreqSaved;
+
+static ENV_PARAM dmaLatencyDevice = {"EPICS_MCORE_DMA_LATENCY","/dev/cpu_dma_latency"};
+
+static epicsMutexId powerLock;
+static int latencyFd = -1;
+static int latencyValue;
+static cpuFreqSaved *saved;
+static int ncpus;
+
+/**
+ * @brief Get the path of the PM QoS CPU latency device.
+ *
+ * @return path (from @c EPICS_MCORE_DMA_LATENCY, default @c /dev/cpu_dma_latency)
+ */
+const char *powerDmaLatencyPath(void)
+{
+    const char *path = envGetConfigParamPtr(&dmaLatencyDevice);
+    return path ? path : "/dev/cpu_dma_latency";
+}
+
+/**
+ * @brief Read a cpufreq attribute of a CPU.
+ *
+ * @param cpu   CPU number
+ * @param attr  attribute name
+ * @param value buffer to read into
+ * @param len   size of the buffer
+ * @return 0 on success, errno on error
+ */
+static int readCpuFreq(int cpu, const char *attr, char *value, size_t len)
+{
+    char path[512];
+    char *cp;
+    FILE *fp;
+
+    if (formatPath(path, sizeof(path), "%s/devices/system/cpu/cpu%d/cpufreq/%s",
+                   topologySysfsRoot(), cpu, attr)) return ENAMETOOLONG;
+    if (!(fp = fopen(path, "r"))) return errno;
+    if (!fgets(value, (int) len, fp)) {
+        fclose(fp);
+        return EIO;
+    }
+    fclose(fp);
+    if ((cp = strpbrk(value, "\n\r"))) *cp = '\0';
+    return 0;
+}
+
+/**
+ * @brief Write a cpufreq attribute of a CPU.
+ *
+ * @param cpu   CPU number
+ * @param attr  attribute name
+ * @param value value to write
+ * @return 0 on success, errno on error
+ */
+static int writeCpuFreq(int cpu, const char *attr, const char *value)
+{
+    char path[512];
+    FILE *fp;
+    int status = formatPath(path, sizeof(path), "%s/devices/system/cpu/cpu%d/cpufreq/%s",
+                            topologySysfsRoot(), cpu, attr);
+
+    if (!status) {
+        if (!(fp = fopen(path, "w"))) {
+            status = errno;
+        } else {
+            if (fputs(value, fp) < 0) status = errno;
+            if (fclose(fp) && !status) status = errno;
+        }
+    }
+    if (status)
+        errlogPrintf("mcoreCpuFreq: can't write %s to %s - %s\n", value, path, strerror(status));
+    return status;
+}
+
+/**
+ * @brief Restore the saved cpufreq settings and release the latency constraint.
+ *
+ * @param arg unused
+ */
+static void powerRestore(void *arg)
+{
+    int cpu;
+
+    epicsMutexLock(powerLock);
+    for (cpu = 0; cpu < ncpus; cpu++) {
+        if (!saved[cpu].saved) continue;
+        writeCpuFreq(cpu, "scaling_governor", saved[cpu].governor);
+        writeCpuFreq(cpu, "scaling_min_freq", saved[cpu].minFreq);
+        saved[cpu].saved = 0;
+    }
+    if (latencyFd >= 0) {
+        close(latencyFd);
+        latencyFd = -1;
+    }
+    epicsMutexUnlock(powerLock);
+}
+
+static void once(void *arg)
+{
+    powerLock = epicsMutexMustCreate();
+    ncpus = topologyNumCpus();
+    if (!(saved = calloc(ncpus, sizeof(cpuFreqSaved)))) {
+        errlogPrintf("Memory allocation error\n");
+        ncpus = 0;
+    }
+    epicsAtExit(powerRestore, NULL);
+}
+
+static void powerInit(void)
+{
+    static epicsThreadOnceId onceFlag = EPICS_THREAD_ONCE_INIT;
+    epicsThreadOnce(&onceFlag, once, NULL);
+}
+
+void mcoreCpuLatency(int latency)
+{
+    const char *path = powerDmaLatencyPath();
+    int status = 0;
+
+    powerInit();
+    epicsMutexLock(powerLock);
+    if (latency < 0) {
+        if (latencyFd >= 0) {
+            close(latencyFd);
+            latencyFd = -1;
+        }
+        epicsMutexUnlock(powerLock);
+        return;
+    }
+    if (latencyFd < 0 && (latencyFd = open(path, O_WRONLY | O_CLOEXEC)) < 0) {
+        status = errno;
+    } else {
+        ssize_t n = write(latencyFd, &latency, sizeof(latency));
+        if (n != sizeof(latency)) {
+            status = n < 0 ? errno : EIO;
+        } else {
+            latencyValue = latency;
+        }
+    }
+    if (status) {
+        errlogPrintf("mcoreCpuLatency: can't set %d us on %s - %s\n", latency, path, strerror(status));
+    } else if (errVerbose) {
+        errlogPrintf("mcoreCpuLatency: holding %s at %d us\n", path, latencyValue);
+    }
+    epicsMutexUnlock(powerLock);
+}
+
+void mcoreCpuFreq(const char *cpus, const char *governor, const char *minFreq)
+{
+    const size_t setsize = cpusetSize();
+    cpu_set_t *cpuset;
+    char freq[32];
+    int cpu;
+
+    if (!cpus || !*cpus) {
+        errlogPrintf("Usage: mcoreCpuFreq cpus [governor] [min_freq|max]\n");
+        return;
+    }
+    powerInit();
+    if (!(cpuset = cpusetAlloc())) {
+        errlogPrintf("Memory allocation error\n");
+        return;
+    }
+    if (strToCpuset(cpuset, cpus)) {
+        errlogPrintf("mcoreCpuFreq: invalid cpuset %s\n", cpus);
+        cpusetFree(cpuset);
+        return;
+    }
+    if (governor && (!*governor || 0 == strcmp(governor, "-"))) governor = NULL;
+    if (minFreq && !*minFreq) minFreq = NULL;
+
+    epicsMutexLock(powerLock);
+    for (cpu = cpumaskNextSet(cpuset, setsize, 0);
+         cpu >= 0 && cpu < ncpus;
+         cpu = cpumaskNextSet(cpuset, setsize, cpu + 1)) {
+        cpuFreqSaved *ps = &saved[cpu];
+
+        if (!ps->saved) {
+            if (readCpuFreq(cpu, "scaling_governor", ps->governor, sizeof(ps->governor))
+                    || readCpuFreq(cpu, "scaling_min_freq", ps->minFreq, sizeof(ps->minFreq))) {
+                errlogPrintf("mcoreCpuFreq: no cpufreq settings for CPU %d\n", cpu);
+                continue;
+            }
+            ps->saved = 1;
+        }
+        if (governor) {
+            writeCpuFreq(cpu, "scaling_governor", governor);
+        }
+        if (minFreq) {
+            if (0 == strcmp(minFreq, "max")) {
+                if (readCpuFreq(cpu, "cpuinfo_max_freq", freq, sizeof(freq))) continue;
+            } else {
+                strncpy(freq, minFreq, sizeof(freq) - 1);
+                freq[sizeof(freq) - 1] = '\0';
+            }
+            writeCpuFreq(cpu, "scaling_min_freq", freq);
+        }
+    }
+    epicsMutexUnlock(powerLock);
+    cpusetFree(cpuset);
+}
+
+/**
+ *@}
+ */
@@ -0,0 +1,396 @@
+/********************************************//**
+ * @file
+ * @brief Configurable mapping of OSI priorities to POSIX real-time priorities.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * EPICS base maps the OSI priorities 0-99 linearly onto the range of the
+ * real-time policies, so that neighbouring OSI priorities share a POSIX
+ * priority, and cannot keep a band of POSIX priorities free for the kernel.
+ *
+ * The map is a table of the POSIX priority for each OSI priority. Without
+ * configuration it is the linear mapping of EPICS base, spread over the
+ * POSIX priorities that are not reserved; configured segments replace parts
+ * of it. The table must not decrease, so that the order of the OSI
+ * priorities is preserved.
+ *
+ * @ingroup threadrules
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <errlog.h>
+#include <epicsStdio.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <shareLib.h>
+
+#include "utils.h"
+#include "prioMap.h"
+
+/// @cond NEVER
+#define epicsExportSharedSymbols
+/// @endcond
+#include "mcoreutils.h"
+
+#define NUM_OSI (epicsThreadPriorityMax + 1)
+#define MAX_POSIX 256
+
+/**
+ * @brief An EPICS thread, as collected for the map report.
+ */
+typedef struct prioThread {
+    char        name[32];       ///< thread name
+    int         policy;         ///< scheduling policy
+    int         osi;            ///< OSI priority
+    int         posix;          ///< current POSIX priority
+} prioThread;
+
+static epicsMutexId mapLock;
+static int mapped;                      ///< flag: a map is configured
+static char *mapSpec;                   ///< specification of the map
+static int table[NUM_OSI];              ///< POSIX priority of each OSI priority
+static char reserved[MAX_POSIX];        ///< flags: POSIX priority is reserved
+static __thread prioThread *threads;           ///< threads collected by collectThread()
+static __thread size_t nThreads, maxThreads;
+
+/**
+ * @brief Parse a number or a range of numbers (N or N-M).
+ *
+ * @param str  string to parse
+ * @param from first number
+ * @param to   last number
+ * @return 0 on success, -1 on error
+ */
+static int parseBand(const char *str, int *from, int *to)
+{
+    char *endp;
+
+    *from = *to = (int) strtol(str, &endp, 10);
+    if (endp == str) return -1;
+    if ('-' == *endp) {
+        str = endp + 1;
+        *to = (int) strtol(str, &endp, 10);
+        if (endp == str) return -1;
+    }
+    return ('\0' == *endp && *from <= *to) ? 0 : -1;
+}
+
+/**
+ * @brief Build a priority table from its specification.
+ *
+ * @param spec  specification (comma separated @c O=P, @c O-O=P-P and @c ^P-P items)
+ * @param map   table to write into
+ * @param resv  reserved flags to write into
+ * @return 0 on success, -1 on error
+ */
+static int buildMap(const char *spec, int *map, char *resv)
+{
+    const int minPrio = sched_get_priority_min(SCHED_FIFO);
+    const int maxPrio = sched_get_priority_max(SCHED_FIFO);
+    char *buff = strdup(spec);
+    char *tok, *save = NULL;
+    int avail[MAX_POSIX];
+    int navail = 0, osi, prio;
+
+    if (!buff) {
+        errlogPrintf("Memory allocation error\n");
+        return -1;
+    }
+    if (minPrio < 0 || maxPrio >= MAX_POSIX) {
+        free(buff);
+        return -1;
+    }
+    memset(resv, 0, MAX_POSIX);
+
+    // first pass: reserved bands
+    for (tok = strtok_r(buff, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        int from, to;
+        if ('^' != *tok) continue;
+        if (parseBand(tok + 1, &from, &to) || from < minPrio || to > maxPrio) {
+            errlogPrintf("mcorePriorityMap: invalid reserved band \"%s\"\n", tok);
+            free(buff);
+            return -1;
+        }
+        for (prio = from; prio <= to; prio++) resv[prio] = 1;
+    }
+    for (prio = minPrio; prio <= maxPrio; prio++) {
+        if (!resv[prio]) avail[navail++] = prio;
+    }
+    if (!navail) {
+        errlogPrintf("mcorePriorityMap: all priorities are reserved\n");
+        free(buff);
+        return -1;
+    }
+
+    // default: the linear EPICS mapping onto the available priorities
+    for (osi = 0; osi < NUM_OSI; osi++) {
+        map[osi] = avail[osi >= epicsThreadPriorityMax ? navail - 1
+                                                       : (int) ((double) osi * (navail - 1) / 100.0)];
+    }
+
+    // second pass: segments
+    strcpy(buff, spec);
+    save = NULL;
+    for (tok = strtok_r(buff, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        int o1, o2, p1, p2;
+        char *eq = strchr(tok, '=');
+        if ('^' == *tok) continue;
+        if (!eq) {
+            errlogPrintf("mcorePriorityMap: invalid item \"%s\"\n", tok);
+            free(buff);
+            return -1;
+        }
+        *eq++ = '\0';
+        if (parseBand(tok, &o1, &o2) || parseBand(eq, &p1, &p2)
+                || o1 < epicsThreadPriorityMin || o2 > epicsThreadPriorityMax
+                || p1 < minPrio || p2 > maxPrio) {
+            errlogPrintf("mcorePriorityMap: invalid segment \"%s=%s\"\n", tok, eq);
+            free(buff);
+            return -1;
+        }
+        for (osi = o1; osi <= o2; osi++) {
+            prio = (o1 == o2) ? p1 : p1 + (osi - o1) * (p2 - p1) / (o2 - o1);
+            if (resv[prio]) {
+                errlogPrintf("mcorePriorityMap: OSI %d maps to reserved priority %d\n", osi, prio);
+                free(buff);
+                return -1;
+            }
+            map[osi] = prio;
+        }
+    }
+    free(buff);
+
+    for (osi = 1; osi < NUM_OSI; osi++) {
+        if (map[osi] < map[osi - 1]) {
+            errlogPrintf("mcorePriorityMap: OSI %d maps below OSI %d (%d < %d)\n",
+                         osi, osi - 1, map[osi], map[osi - 1]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void once(void *arg)
+{
+    mapLock = epicsMutexMustCreate();
+}
+
+/**
+ * @brief Initialization routine.
+ */
+static void prioMapInit(void)
+{
+    static epicsThreadOnceId onceFlag = EPICS_THREAD_ONCE_INIT;
+    epicsThreadOnce(&onceFlag, once, NULL);
+}
+
+/**
+ * @brief Look up the POSIX priority of an OSI priority in the configured map.
+ *
+ * @param policy      scheduling policy
+ * @param osiPriority OSI priority
+ * @param posix       POSIX priority (written if found)
+ * @return 0 if mapped, -1 if no map applies (no map, or not a real-time policy)
+ */
+int prioMapToPosix(int policy, int osiPriority, int *posix)
+{
+    int status = -1;
+
+    if (SCHED_FIFO != policy && SCHED_RR != policy) return -1;
+    prioMapInit();
+    epicsMutexLock(mapLock);
+    if (mapped) {
+        if (osiPriority < epicsThreadPriorityMin) osiPriority = epicsThreadPriorityMin;
+        if (osiPriority > epicsThreadPriorityMax) osiPriority = epicsThreadPriorityMax;
+        *posix = table[osiPriority];
+        status = 0;
+    }
+    epicsMutexUnlock(mapLock);
+    return status;
+}
+
+/**
+ * @brief Look up the lowest OSI priority that maps to a POSIX priority or above.
+ *
+ * @param policy        scheduling policy
+ * @param posixPriority POSIX priority
+ * @param osi           OSI priority (written if found)
+ * @return 0 if mapped, -1 if no map applies (no map, or not a real-time policy)
+ */
+int prioMapToOsi(int policy, int posixPriority, int *osi)
+{
+    int status = -1;
+    int i;
+
+    if (SCHED_FIFO != policy && SCHED_RR != policy) return -1;
+    prioMapInit();
+    epicsMutexLock(mapLock);
+    if (mapped) {
+        for (i = 0; i < epicsThreadPriorityMax && table[i] < posixPriority; i++) ;
+        *osi = i;
+        status = 0;
+    }
+    epicsMutexUnlock(mapLock);
+    return status;
+}
+
+/**
+ * @brief Set the OSI to POSIX priority map.
+ */
+void mcorePriorityMap(const char *spec)
+{
+    int map[NUM_OSI];
+    char resv[MAX_POSIX];
+    char *copy = NULL;
+
+    prioMapInit();
+    if (spec && *spec && strcmp(spec, "default")) {
+        if (buildMap(spec, map, resv)) {
+            errlogPrintf("mcorePriorityMap: invalid map \"%s\", not changed\n", spec);
+            return;
+        }
+        if (!(copy = strdup(spec))) {
+            errlogPrintf("Memory allocation error\n");
+            return;
+        }
+    }
+    epicsMutexLock(mapLock);
+    free(mapSpec);
+    mapSpec = copy;
+    mapped = copy ? 1 : 0;
+    if (mapped) {
+        memcpy(table, map, sizeof(table));
+        memcpy(reserved, resv, sizeof(reserved));
+    } else {
+        memset(reserved, 0, sizeof(reserved));
+    }
+    epicsMutexUnlock(mapLock);
+}
+
+/**
+ * @brief Map callback collecting the EPICS threads with their priorities.
+ *
+ * @param id current thread (map argument)
+ */
+static void collectThread(epicsThreadId id)
+{
+    struct sched_param param;
+    prioThread *pt;
+
+    if (nThreads == maxThreads) {
+        size_t max = maxThreads ? 2 * maxThreads : 64;
+        prioThread *list = realloc(threads, max * sizeof(prioThread));
+        if (!list) return;
+        threads = list;
+        maxThreads = max;
+    }
+    pt = &threads[nThreads];
+    if (!id->tid || pthread_getschedparam(id->tid, &pt->policy, &param))
+        return;
+    strncpy(pt->name, id->name, sizeof(pt->name) - 1);
+    pt->name[sizeof(pt->name) - 1] = '\0';
+    pt->osi = (int) id->osiPriority;
+    pt->posix = param.sched_priority;
+    nThreads++;
+}
+
+/**
+ * @brief Compare two threads by POSIX priority (descending), then by OSI priority.
+ */
+static int comparePrio(const void *a, const void *b)
+{
+    const prioThread *ta = a, *tb = b;
+
+    if (ta->posix != tb->posix) return tb->posix - ta->posix;
+    return tb->osi - ta->osi;
+}
+
+static int isRealTime(int policy)
+{
+    return SCHED_FIFO == policy || SCHED_RR == policy;
+}
+
+/**
+ * @brief Print the priority map and the POSIX priorities of the EPICS threads.
+ */
+void mcorePriorityMapShow(unsigned int level)
+{
+    FILE *out = epicsGetStdout();
+    char resv[MAX_POSIX];
+    size_t i, j;
+    int osi, distinct = 1;
+
+    prioMapInit();
+    // collect the threads first: the map must not be run holding mapLock
+    nThreads = 0;
+    epicsThreadMap(collectThread);
+    qsort(threads, nThreads, sizeof(prioThread), comparePrio);
+
+    epicsMutexLock(mapLock);
+    fprintf(out, "Priority map: %s\n", mapped ? mapSpec : "default (linear, as EPICS base)");
+    if (mapped) {
+        for (osi = 1; osi < NUM_OSI; osi++) {
+            if (table[osi] != table[osi - 1]) distinct++;
+        }
+        fprintf(out, "%d OSI priorities on %d POSIX priorities\n", NUM_OSI, distinct);
+        if (level) {
+            for (osi = 0; osi < NUM_OSI; osi++) {
+                if (0 == osi % 10) fprintf(out, "  OSI %2d-%2d:", osi, osi + 9);
+                fprintf(out, " %3d", table[osi]);
+                if (9 == osi % 10) fprintf(out, "\n");
+            }
+        }
+    }
+    memcpy(resv, reserved, sizeof(resv));
+    epicsMutexUnlock(mapLock);
+
+    fprintf(out, "            NAME POLICY  OSI POSIX MAPPED FLAGS\n");
+    for (i = 0; i < nThreads; i++) {
+        prioThread *pt = &threads[i];
+        char flags[4];
+        char mappedPrio[8] = "-";
+        int collision = 0;
+
+        if (!isRealTime(pt->policy) && level < 1) continue;
+        for (j = 0; j < nThreads && isRealTime(pt->policy); j++) {
+            if (isRealTime(threads[j].policy)
+                    && threads[j].posix == pt->posix && threads[j].osi != pt->osi)
+                collision = 1;
+        }
+        if (isRealTime(pt->policy)) {
+            int expected = osiToPosixPriority(pt->policy, pt->osi);
+            sprintf(mappedPrio, "%d", expected);
+            flags[0] = collision ? 'C' : '-';
+            flags[1] = (pt->posix < MAX_POSIX && resv[pt->posix]) ? 'R' : '-';
+            flags[2] = expected != pt->posix ? 'M' : '-';
+        } else {
+            flags[0] = flags[1] = flags[2] = '-';
+        }
+        flags[3] = '\0';
+        fprintf(out, "%16.16s %6s %4d %5d %6s %5s\n", pt->name, policyToStr(pt->policy),
+                pt->osi, pt->posix, mappedPrio, flags);
+    }
+    fprintf(out, "(C = shares its POSIX priority with a different OSI priority,"
+            " R = in a reserved band, M = not as mapped)\n");
+    free(threads);
+    threads = NULL;
+    nThreads = maxThreads = 0;
+}
+
+/**
+ *@}
+ */
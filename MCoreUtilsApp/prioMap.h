@@ -0,0 +1,26 @@
+/********************************************//**
+ * @file
+ * @brief Header file for prioMap.c
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+#ifndef PRIOMAP_H
+#define PRIOMAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int prioMapToPosix(int policy, int osiPriority, int *posix);
+int prioMapToOsi(int policy, int posixPriority, int *osi);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PRIOMAP_H
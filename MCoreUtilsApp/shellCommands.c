@@ -11,6 +11,7 @@
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <iocsh.h>
 #include <epicsExport.h>
@@ -82,15 +83,17 @@ static const iocshArg mcoreThreadRuleAddArg1 = {"policy", iocshArgString};
 static const iocshArg mcoreThreadRuleAddArg2 = {"priority", iocshArgString};
 static const iocshArg mcoreThreadRuleAddArg3 = {"cpuset", iocshArgString};
 static const iocshArg mcoreThreadRuleAddArg4 = {"pattern", iocshArgString};
+static const iocshArg mcoreThreadRuleAddArg5 = {"options", iocshArgString};
 static const iocshArg *const mcoreThreadRuleAddArgs[] = {
     &mcoreThreadRuleAddArg0,
     &mcoreThreadRuleAddArg1,
     &mcoreThreadRuleAddArg2,
     &mcoreThreadRuleAddArg3,
     &mcoreThreadRuleAddArg4,
+    &mcoreThreadRuleAddArg5,
 };
 static const iocshFuncDef mcoreThreadRuleAddDef =
-    {"mcoreThreadRuleAdd", 5, mcoreThreadRuleAddArgs};
+    {"mcoreThreadRuleAdd", 6, mcoreThreadRuleAddArgs};
 static void mcoreThreadRuleAddCall(const iocshArgBuf * args) {
     int i;
     char missing = 0;
@@ -98,10 +101,10 @@ static void mcoreThreadRuleAddCall(const iocshArgBuf * args) {
         if (NULL == args[i].sval) missing |= 1;
     }
     if (missing) {
-        printf("Missing argument\nUsage: mcoreThreadRuleAdd name policy priority cpuset pattern\n");
+        printf("Missing argument\nUsage: mcoreThreadRuleAdd name policy priority cpuset pattern [options]\n");
         return;
     }
-    mcoreThreadRuleAdd(args[0].sval, args[1].sval, args[2].sval, args[3].sval, args[4].sval);
+    mcoreThreadRuleAddOpt(args[0].sval, args[1].sval, args[2].sval, args[3].sval, args[4].sval, args[5].sval);
 }
 
 static const iocshArg mcoreThreadRuleDeleteArg0 = {"name", iocshArgString};
@@ -124,18 +127,48 @@ static void mcoreThreadRulesShowCall(const iocshArgBuf * args) {
     mcoreThreadRulesShow();
 }
 
+static const iocshArg mcoreThreadRulesStatsArg0 = {"level", iocshArgInt};
+static const iocshArg *const mcoreThreadRulesStatsArgs[] = {
+    &mcoreThreadRulesStatsArg0,
+};
+static const iocshFuncDef mcoreThreadRulesStatsDef =
+    {"mcoreThreadRulesStats", 1, mcoreThreadRulesStatsArgs};
+static void mcoreThreadRulesStatsCall(const iocshArgBuf * args) {
+    unsigned int level = args[0].ival;
+    mcoreThreadRulesStats(level);
+}
+
+static const iocshFuncDef mcoreLogFlushDef =
+    {"mcoreLogFlush", 0, NULL};
+static void mcoreLogFlushCall(const iocshArgBuf * args) {
+    mcoreLogFlush();
+}
+
+static const iocshArg mcoreLogShowArg0 = {"level", iocshArgInt};
+static const iocshArg *const mcoreLogShowArgs[] = {
+    &mcoreLogShowArg0,
+};
+static const iocshFuncDef mcoreLogShowDef =
+    {"mcoreLogShow", 1, mcoreLogShowArgs};
+static void mcoreLogShowCall(const iocshArgBuf * args) {
+    unsigned int level = args[0].ival;
+    mcoreLogShow(level);
+}
+
 static const iocshArg mcoreThreadModifyArg0 = {"thread", iocshArgString};
 static const iocshArg mcoreThreadModifyArg1 = {"policy", iocshArgString};
 static const iocshArg mcoreThreadModifyArg2 = {"priority", iocshArgString};
 static const iocshArg mcoreThreadModifyArg3 = {"cpuset", iocshArgString};
+static const iocshArg mcoreThreadModifyArg4 = {"options", iocshArgString};
 static const iocshArg *const mcoreThreadModifyArgs[] = {
     &mcoreThreadModifyArg0,
     &mcoreThreadModifyArg1,
     &mcoreThreadModifyArg2,
     &mcoreThreadModifyArg3,
+    &mcoreThreadModifyArg4,
 };
 static const iocshFuncDef mcoreThreadModifyDef =
-    {"mcoreThreadModify", 4, mcoreThreadModifyArgs};
+    {"mcoreThreadModify", 5, mcoreThreadModifyArgs};
 static void mcoreThreadModifyCall(const iocshArgBuf * args) {
     epicsThreadId tid;
     int i;
@@ -145,12 +178,231 @@ static void mcoreThreadModifyCall(const iocshArgBuf * args) {
         if (NULL == args[i].sval) missing |= 1;
     }
     if (missing) {
-        printf("Missing argument\nUsage: mcoreThreadModify thread  policy  priority  cpuset\n");
+        printf("Missing argument\nUsage: mcoreThreadModify thread  policy  priority  cpuset  [options]\n");
         return;
     }
     tid = getThreadIdFor(args[0].sval);
     if (tid)
-        mcoreThreadModify(tid, args[1].sval, args[2].sval, args[3].sval);
+        mcoreThreadModifyOpt(tid, args[1].sval, args[2].sval, args[3].sval, args[4].sval);
+}
+
+static const iocshArg mcoreTaskScanArg0 = {"level", iocshArgInt};
+static const iocshArg *const mcoreTaskScanArgs[] = {
+    &mcoreTaskScanArg0,
+};
+static const iocshFuncDef mcoreTaskScanDef =
+    {"mcoreTaskScan", 1, mcoreTaskScanArgs};
+static void mcoreTaskScanCall(const iocshArgBuf * args) {
+    unsigned int level = args[0].ival;
+    mcoreTaskScan(level);
+}
+
+static const iocshArg mcoreTaskScanPeriodArg0 = {"period", iocshArgDouble};
+static const iocshArg *const mcoreTaskScanPeriodArgs[] = {
+    &mcoreTaskScanPeriodArg0,
+};
+static const iocshFuncDef mcoreTaskScanPeriodDef =
+    {"mcoreTaskScanPeriod", 1, mcoreTaskScanPeriodArgs};
+static void mcoreTaskScanPeriodCall(const iocshArgBuf * args) {
+    mcoreTaskScanPeriod(args[0].dval);
+}
+
+static const iocshArg mcoreBalancePeriodArg0 = {"period", iocshArgDouble};
+static const iocshArg *const mcoreBalancePeriodArgs[] = {
+    &mcoreBalancePeriodArg0,
+};
+static const iocshFuncDef mcoreBalancePeriodDef =
+    {"mcoreBalancePeriod", 1, mcoreBalancePeriodArgs};
+static void mcoreBalancePeriodCall(const iocshArgBuf * args) {
+    mcoreBalancePeriod(args[0].dval);
+}
+
+/**
+ * @brief Get the value of an optional numeric argument.
+ * @param arg string containing the value, "*" or NULL (omitted)
+ * @return value, -1 for "*" or an omitted argument
+ */
+static double getTuneArg(const char *arg) {
+    if (!arg || !*arg || 0 == strcmp(arg, "*")) return -1.0;
+    return strtod(arg, NULL);
+}
+
+static const iocshArg mcoreBalanceTuneArg0 = {"hysteresis", iocshArgString};
+static const iocshArg mcoreBalanceTuneArg1 = {"holdoff", iocshArgString};
+static const iocshArg mcoreBalanceTuneArg2 = {"migrations", iocshArgString};
+static const iocshArg *const mcoreBalanceTuneArgs[] = {
+    &mcoreBalanceTuneArg0,
+    &mcoreBalanceTuneArg1,
+    &mcoreBalanceTuneArg2,
+};
+static const iocshFuncDef mcoreBalanceTuneDef =
+    {"mcoreBalanceTune", 3, mcoreBalanceTuneArgs};
+static void mcoreBalanceTuneCall(const iocshArgBuf * args) {
+    mcoreBalanceTune(getTuneArg(args[0].sval),
+                     (int) getTuneArg(args[1].sval),
+                     (int) getTuneArg(args[2].sval));
+}
+
+static const iocshArg mcoreBalanceShowArg0 = {"level", iocshArgInt};
+static const iocshArg *const mcoreBalanceShowArgs[] = {
+    &mcoreBalanceShowArg0,
+};
+static const iocshFuncDef mcoreBalanceShowDef =
+    {"mcoreBalanceShow", 1, mcoreBalanceShowArgs};
+static void mcoreBalanceShowCall(const iocshArgBuf * args) {
+    unsigned int level = args[0].ival;
+    mcoreBalanceShow(level);
+}
+
+static const iocshArg mcoreBoostPeriodArg0 = {"period", iocshArgDouble};
+static const iocshArg *const mcoreBoostPeriodArgs[] = {
+    &mcoreBoostPeriodArg0,
+};
+static const iocshFuncDef mcoreBoostPeriodDef =
+    {"mcoreBoostPeriod", 1, mcoreBoostPeriodArgs};
+static void mcoreBoostPeriodCall(const iocshArgBuf * args) {
+    mcoreBoostPeriod(args[0].dval);
+}
+
+static const iocshArg mcoreBoostShowArg0 = {"level", iocshArgInt};
+static const iocshArg *const mcoreBoostShowArgs[] = {
+    &mcoreBoostShowArg0,
+};
+static const iocshFuncDef mcoreBoostShowDef =
+    {"mcoreBoostShow", 1, mcoreBoostShowArgs};
+static void mcoreBoostShowCall(const iocshArgBuf * args) {
+    unsigned int level = args[0].ival;
+    mcoreBoostShow(level);
+}
+
+static const iocshArg mcoreWatchdogPeriodArg0 = {"period", iocshArgDouble};
+static const iocshArg mcoreWatchdogPeriodArg1 = {"window", iocshArgDouble};
+static const iocshArg mcoreWatchdogPeriodArg2 = {"cpuset", iocshArgString};
+static const iocshArg *const mcoreWatchdogPeriodArgs[] = {
+    &mcoreWatchdogPeriodArg0,
+    &mcoreWatchdogPeriodArg1,
+    &mcoreWatchdogPeriodArg2,
+};
+static const iocshFuncDef mcoreWatchdogPeriodDef =
+    {"mcoreWatchdogPeriod", 3, mcoreWatchdogPeriodArgs};
+static void mcoreWatchdogPeriodCall(const iocshArgBuf * args) {
+    mcoreWatchdogPeriod(args[0].dval, args[1].dval, args[2].sval);
+}
+
+static const iocshArg mcoreWatchdogRtTimeArg0 = {"usec", iocshArgInt};
+static const iocshArg *const mcoreWatchdogRtTimeArgs[] = {
+    &mcoreWatchdogRtTimeArg0,
+};
+static const iocshFuncDef mcoreWatchdogRtTimeDef =
+    {"mcoreWatchdogRtTime", 1, mcoreWatchdogRtTimeArgs};
+static void mcoreWatchdogRtTimeCall(const iocshArgBuf * args) {
+    if (args[0].ival < 0) {
+        printf("Invalid argument\nUsage: mcoreWatchdogRtTime usec\n");
+        return;
+    }
+    mcoreWatchdogRtTime(args[0].ival);
+}
+
+static const iocshArg mcoreWatchdogShowArg0 = {"level", iocshArgInt};
+static const iocshArg *const mcoreWatchdogShowArgs[] = {
+    &mcoreWatchdogShowArg0,
+};
+static const iocshFuncDef mcoreWatchdogShowDef =
+    {"mcoreWatchdogShow", 1, mcoreWatchdogShowArgs};
+static void mcoreWatchdogShowCall(const iocshArgBuf * args) {
+    unsigned int level = args[0].ival;
+    mcoreWatchdogShow(level);
+}
+
+static const iocshArg mcoreCgroupPartitionArg0 = {"name", iocshArgString};
+static const iocshArg *const mcoreCgroupPartitionArgs[] = {
+    &mcoreCgroupPartitionArg0,
+};
+static const iocshFuncDef mcoreCgroupPartitionDef =
+    {"mcoreCgroupPartition", 1, mcoreCgroupPartitionArgs};
+static void mcoreCgroupPartitionCall(const iocshArgBuf * args) {
+    mcoreCgroupPartition(args[0].sval);
+}
+
+static const iocshArg mcoreCgroupShowArg0 = {"level", iocshArgInt};
+static const iocshArg *const mcoreCgroupShowArgs[] = {
+    &mcoreCgroupShowArg0,
+};
+static const iocshFuncDef mcoreCgroupShowDef =
+    {"mcoreCgroupShow", 1, mcoreCgroupShowArgs};
+static void mcoreCgroupShowCall(const iocshArgBuf * args) {
+    unsigned int level = args[0].ival;
+    mcoreCgroupShow(level);
+}
+
+static const iocshArg mcoreHotplugPeriodArg0 = {"period", iocshArgDouble};
+static const iocshArg *const mcoreHotplugPeriodArgs[] = {
+    &mcoreHotplugPeriodArg0,
+};
+static const iocshFuncDef mcoreHotplugPeriodDef =
+    {"mcoreHotplugPeriod", 1, mcoreHotplugPeriodArgs};
+static void mcoreHotplugPeriodCall(const iocshArgBuf * args) {
+    mcoreHotplugPeriod(args[0].dval);
+}
+
+static const iocshArg mcoreHotplugShowArg0 = {"level", iocshArgInt};
+static const iocshArg *const mcoreHotplugShowArgs[] = {
+    &mcoreHotplugShowArg0,
+};
+static const iocshFuncDef mcoreHotplugShowDef =
+    {"mcoreHotplugShow", 1, mcoreHotplugShowArgs};
+static void mcoreHotplugShowCall(const iocshArgBuf * args) {
+    unsigned int level = args[0].ival;
+    mcoreHotplugShow(level);
+}
+
+static const iocshArg mcorePriorityMapArg0 = {"map", iocshArgString};
+static const iocshArg *const mcorePriorityMapArgs[] = {
+    &mcorePriorityMapArg0,
+};
+static const iocshFuncDef mcorePriorityMapDef =
+    {"mcorePriorityMap", 1, mcorePriorityMapArgs};
+static void mcorePriorityMapCall(const iocshArgBuf * args) {
+    mcorePriorityMap(args[0].sval);
+}
+
+static const iocshArg mcorePriorityMapShowArg0 = {"level", iocshArgInt};
+static const iocshArg *const mcorePriorityMapShowArgs[] = {
+    &mcorePriorityMapShowArg0,
+};
+static const iocshFuncDef mcorePriorityMapShowDef =
+    {"mcorePriorityMapShow", 1, mcorePriorityMapShowArgs};
+static void mcorePriorityMapShowCall(const iocshArgBuf * args) {
+    unsigned int level = args[0].ival;
+    mcorePriorityMapShow(level);
+}
+
+static const iocshFuncDef mcoreTopologyRefreshDef =
+    {"mcoreTopologyRefresh", 0, NULL};
+static void mcoreTopologyRefreshCall(const iocshArgBuf * args) {
+    mcoreTopologyRefresh();
+}
+
+static const iocshArg mcoreTopologyShowArg0 = {"level", iocshArgInt};
+static const iocshArg *const mcoreTopologyShowArgs[] = {
+    &mcoreTopologyShowArg0,
+};
+static const iocshFuncDef mcoreTopologyShowDef =
+    {"mcoreTopologyShow", 1, mcoreTopologyShowArgs};
+static void mcoreTopologyShowCall(const iocshArgBuf * args) {
+    unsigned int level = args[0].ival;
+    mcoreTopologyShow(level);
+}
+
+static const iocshArg mcoreCpuShowArg0 = {"level", iocshArgInt};
+static const iocshArg *const mcoreCpuShowArgs[] = {
+    &mcoreCpuShowArg0,
+};
+static const iocshFuncDef mcoreCpuShowDef =
+    {"mcoreCpuShow", 1, mcoreCpuShowArgs};
+static void mcoreCpuShowCall(const iocshArgBuf * args) {
+    unsigned int level = args[0].ival;
+    mcoreCpuShow(level);
 }
 
 static const iocshFuncDef mcoreMLockDef =
@@ -165,22 +417,79 @@ static void mcoreMUnlockCall(const iocshArgBuf * args) {
     mcoreMUnlock();
 }
 
+static const iocshArg mcoreCpuLatencyArg0 = {"latency", iocshArgInt};
+static const iocshArg *const mcoreCpuLatencyArgs[] = {
+    &mcoreCpuLatencyArg0,
+};
+static const iocshFuncDef mcoreCpuLatencyDef =
+    {"mcoreCpuLatency", 1, mcoreCpuLatencyArgs};
+static void mcoreCpuLatencyCall(const iocshArgBuf * args) {
+    mcoreCpuLatency(args[0].ival);
+}
+
+static const iocshArg mcoreCpuFreqArg0 = {"cpus", iocshArgString};
+static const iocshArg mcoreCpuFreqArg1 = {"governor", iocshArgString};
+static const iocshArg mcoreCpuFreqArg2 = {"min_freq", iocshArgString};
+static const iocshArg *const mcoreCpuFreqArgs[] = {
+    &mcoreCpuFreqArg0,
+    &mcoreCpuFreqArg1,
+    &mcoreCpuFreqArg2,
+};
+static const iocshFuncDef mcoreCpuFreqDef =
+    {"mcoreCpuFreq", 3, mcoreCpuFreqArgs};
+static void mcoreCpuFreqCall(const iocshArgBuf * args) {
+    mcoreCpuFreq(args[0].sval, args[1].sval, args[2].sval);
+}
+
+static const iocshFuncDef mcoreRtAuditDef =
+    {"mcoreRtAudit", 0, NULL};
+static void mcoreRtAuditCall(const iocshArgBuf * args) {
+    mcoreRtAudit();
+}
+
 static void mcoreRegister(void)
 {
     static int firstTime = 1;
     if(!firstTime) return;
     firstTime = 0;
 
+    mcoreLogInit();
     mcoreThreadShowInit();
     mcoreThreadRulesInit();
+    mcoreTaskScanInit();
     iocshRegister(&mcoreThreadShowDef,       mcoreThreadShowCall);
     iocshRegister(&mcoreThreadShowAllDef,    mcoreThreadShowAllCall);
     iocshRegister(&mcoreThreadRuleAddDef,    mcoreThreadRuleAddCall);
     iocshRegister(&mcoreThreadRuleDeleteDef, mcoreThreadRuleDeleteCall);
     iocshRegister(&mcoreThreadRulesShowDef,  mcoreThreadRulesShowCall);
+    iocshRegister(&mcoreThreadRulesStatsDef, mcoreThreadRulesStatsCall);
+    iocshRegister(&mcoreLogFlushDef,         mcoreLogFlushCall);
+    iocshRegister(&mcoreLogShowDef,          mcoreLogShowCall);
     iocshRegister(&mcoreThreadModifyDef,     mcoreThreadModifyCall);
+    iocshRegister(&mcoreTaskScanDef,         mcoreTaskScanCall);
+    iocshRegister(&mcoreTaskScanPeriodDef,   mcoreTaskScanPeriodCall);
+    iocshRegister(&mcoreBalancePeriodDef,    mcoreBalancePeriodCall);
+    iocshRegister(&mcoreBalanceTuneDef,      mcoreBalanceTuneCall);
+    iocshRegister(&mcoreBalanceShowDef,      mcoreBalanceShowCall);
+    iocshRegister(&mcoreBoostPeriodDef,      mcoreBoostPeriodCall);
+    iocshRegister(&mcoreBoostShowDef,        mcoreBoostShowCall);
+    iocshRegister(&mcoreWatchdogPeriodDef,   mcoreWatchdogPeriodCall);
+    iocshRegister(&mcoreWatchdogRtTimeDef,   mcoreWatchdogRtTimeCall);
+    iocshRegister(&mcoreWatchdogShowDef,     mcoreWatchdogShowCall);
+    iocshRegister(&mcoreCgroupPartitionDef,  mcoreCgroupPartitionCall);
+    iocshRegister(&mcoreCgroupShowDef,       mcoreCgroupShowCall);
+    iocshRegister(&mcoreHotplugPeriodDef,    mcoreHotplugPeriodCall);
+    iocshRegister(&mcoreHotplugShowDef,      mcoreHotplugShowCall);
+    iocshRegister(&mcorePriorityMapDef,      mcorePriorityMapCall);
+    iocshRegister(&mcorePriorityMapShowDef,  mcorePriorityMapShowCall);
+    iocshRegister(&mcoreTopologyRefreshDef,  mcoreTopologyRefreshCall);
+    iocshRegister(&mcoreTopologyShowDef,     mcoreTopologyShowCall);
+    iocshRegister(&mcoreCpuShowDef,          mcoreCpuShowCall);
     iocshRegister(&mcoreMLockDef,            mcoreMLockCall);
     iocshRegister(&mcoreMUnlockDef,          mcoreMUnlockCall);
+    iocshRegister(&mcoreCpuLatencyDef,       mcoreCpuLatencyCall);
+    iocshRegister(&mcoreCpuFreqDef,          mcoreCpuFreqCall);
+    iocshRegister(&mcoreRtAuditDef,          mcoreRtAuditCall);
 }
 /// @cond NEVER
 epicsExportRegistrar(mcoreRegister);
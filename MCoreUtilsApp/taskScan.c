@@ -0,0 +1,359 @@
+/********************************************//**
+ * @file
+ * @brief Applying thread rules to all tasks of the IOC process.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * @ingroup threadrules
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <sched.h>
+#include <sys/types.h>
+
+#include <errlog.h>
+#include <epicsStdio.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <shareLib.h>
+
+#include "utils.h"
+#include "topology.h"
+#include "exclusive.h"
+#include "placement.h"
+#include "threadRules.h"
+#include "taskScan.h"
+
+/// @cond NEVER
+#define epicsExportSharedSymbols
+/// @endcond
+#include "mcoreutils.h"
+
+/**
+ * @brief A task that has been handled by a previous scan.
+ */
+typedef struct knownTask {
+    pid_t       tid;            ///< Linux thread id
+    char        seen;           ///< flag: found in current scan
+} knownTask;
+
+static const char *taskDir = "/proc/self/task";
+static epicsMutexId scanLock;
+static pid_t *epicsTids;
+static size_t nEpicsTids, maxEpicsTids;
+static int nStarting;           ///< number of EPICS threads without Linux thread id
+static pid_t *newTids;
+static size_t nNewTids, maxNewTids;
+static knownTask *known;
+static size_t nKnown, maxKnown;
+static epicsThreadId scanThread;
+static epicsEventId scanEvent;
+static double scanPeriod;
+static cpu_set_t *rtset;
+static cpu_set_t *cpuset;
+
+/**
+ * @brief Append a Linux thread id to a list, growing it as needed.
+ *
+ * @param list  list of thread ids
+ * @param n     number of thread ids in the list
+ * @param max   allocated length of the list
+ * @param tid   Linux thread id to append
+ */
+static void appendTid(pid_t **list, size_t *n, size_t *max, pid_t tid)
+{
+    if (*n == *max) {
+        size_t len = *max ? 2 * *max : 64;
+        pid_t *tids = realloc(*list, len * sizeof(pid_t));
+        if (!tids) return;
+        *list = tids;
+        *max = len;
+    }
+    (*list)[(*n)++] = tid;
+}
+
+/**
+ * @brief Map callback collecting the Linux thread ids of all EPICS threads.
+ *
+ * Threads that are still starting have no Linux thread id yet; they are counted.
+ *
+ * @param id current thread (map argument)
+ */
+static void collectEpicsTid(epicsThreadId id)
+{
+    if (!id->lwpId) {
+        nStarting++;
+        return;
+    }
+    appendTid(&epicsTids, &nEpicsTids, &maxEpicsTids, id->lwpId);
+}
+
+static int isEpicsTid(pid_t tid)
+{
+    size_t i;
+    for (i = 0; i < nEpicsTids; i++) {
+        if (epicsTids[i] == tid) return 1;
+    }
+    return 0;
+}
+
+static knownTask *findKnown(pid_t tid)
+{
+    size_t i;
+    for (i = 0; i < nKnown; i++) {
+        if (known[i].tid == tid) return &known[i];
+    }
+    return NULL;
+}
+
+static void addKnown(pid_t tid)
+{
+    if (nKnown == maxKnown) {
+        size_t max = maxKnown ? 2 * maxKnown : 64;
+        knownTask *tasks = realloc(known, max * sizeof(knownTask));
+        if (!tasks) return;
+        known = tasks;
+        maxKnown = max;
+    }
+    known[nKnown].tid = tid;
+    known[nKnown].seen = 1;
+    nKnown++;
+}
+
+/**
+ * @brief Scan all tasks of the process and apply the rules to new non-EPICS tasks.
+ *
+ * The EPICS threads are collected after reading the task directory, so that
+ * an EPICS thread started in between is not taken for a non-EPICS task
+ * (its rules are applied by the thread start hook). While an EPICS thread is
+ * starting and has no Linux thread id yet, the new tasks are left for the next scan.
+ *
+ * @param level verbosity level
+ * @return number of new tasks found, -1 on error
+ */
+static int scanTasks(unsigned int level)
+{
+    DIR *dir;
+    struct dirent *ent;
+    const size_t setsize = cpusetSize();
+    int nrt = 0;
+    int count = 0;
+    size_t i, j;
+    char name[32];
+    char buf[topologyCpusetStrLen()];
+
+    epicsMutexLock(scanLock);
+    if (rtset && cpuset) {
+        nrt = rtRulesCpuset(rtset);
+    }
+    for (i = 0; i < nKnown; i++) {
+        known[i].seen = 0;
+    }
+
+    dir = opendir(taskDir);
+    if (!dir) {
+        mcoreLog("mcoreTaskScan: can't open %s\n", taskDir);
+        epicsMutexUnlock(scanLock);
+        return -1;
+    }
+    nNewTids = 0;
+    while ((ent = readdir(dir))) {
+        knownTask *ptask;
+        char *endp;
+        pid_t tid = (pid_t) strtol(ent->d_name, &endp, 10);
+
+        if (*endp || tid <= 0)
+            continue;
+        if ((ptask = findKnown(tid))) {
+            ptask->seen = 1;
+            continue;
+        }
+        appendTid(&newTids, &nNewTids, &maxNewTids, tid);
+    }
+    closedir(dir);
+
+    nEpicsTids = 0;
+    nStarting = 0;
+    epicsThreadMap(collectEpicsTid);
+    if (nStarting && nNewTids) {
+        if (level) {
+            fprintf(epicsGetStdout(), "EPICS thread(s) starting, %d new task(s) left for the next scan\n",
+                    (int) nNewTids);
+        }
+        nNewTids = 0;
+    }
+
+    for (i = 0; i < nNewTids; i++) {
+        pid_t tid = newTids[i];
+        int matches;
+
+        if (isEpicsTid(tid) || taskName(tid, name, sizeof(name)))
+            continue;
+
+        matches = applyRulesToTask(tid, name);
+        if (level) {
+            fprintf(epicsGetStdout(), "%16.16s %8d  %d rule(s) applied\n",
+                    name, (int) tid, matches);
+        }
+        if (!matches && nrt) {
+            if (0 == sched_getaffinity(tid, setsize, cpuset)) {
+                CPU_AND_S(setsize, cpuset, cpuset, rtset);
+                if (CPU_COUNT_S(setsize, cpuset)) {
+                    cpusetToStr(buf, sizeof(buf), cpuset);
+                    mcoreLog("mcoreTaskScan: unknown thread %s (LWP %d) may run on RT CPUs %s\n",
+                             name, (int) tid, buf);
+                }
+            }
+        }
+        addKnown(tid);
+        count++;
+    }
+
+    for (i = j = 0; i < nKnown; i++) {
+        if (known[i].seen) {
+            known[j++] = known[i];
+        }
+    }
+    nKnown = j;
+    epicsMutexUnlock(scanLock);
+    exclusivePrune();
+    placementPrune();
+    return count;
+}
+
+/**
+ * @brief Apply the thread rules to a new non-EPICS task, unless a scan already has.
+ *
+ * The task is recorded as handled, so that later scans skip it
+ * and the rules (e.g. relative priorities) are not applied twice.
+ *
+ * @param tid  Linux thread id
+ * @param name task name
+ * @return number of matching rules, 0 if the task had already been handled,
+ * -1 if the rules have not been initialized (the task is left to the scan)
+ */
+int taskScanApply(pid_t tid, const char *name)
+{
+    int matches = 0;
+
+    mcoreTaskScanInit();
+    epicsMutexLock(scanLock);
+    if (!findKnown(tid) && (matches = applyRulesToTask(tid, name)) >= 0) {
+        addKnown(tid);
+    }
+    epicsMutexUnlock(scanLock);
+    return matches;
+}
+
+/**
+ * @brief Get the Linux thread ids of the non-EPICS tasks found by earlier scans.
+ *
+ * @param tids array to write into
+ * @param max  length of the array
+ * @return number of known tasks (may exceed @p max)
+ */
+size_t taskScanKnown(pid_t *tids, size_t max)
+{
+    size_t i, count;
+
+    mcoreTaskScanInit();
+    epicsMutexLock(scanLock);
+    for (i = 0; i < nKnown && i < max; i++) {
+        tids[i] = known[i].tid;
+    }
+    count = nKnown;
+    epicsMutexUnlock(scanLock);
+    return count;
+}
+
+/**
+ * @brief Scan thread main loop, scanning until the period is set to zero.
+ *
+ * @param arg unused
+ */
+static void scanLoop(void *arg)
+{
+    epicsMutexLock(scanLock);
+    while (scanPeriod > 0.0) {
+        double period = scanPeriod;
+        epicsMutexUnlock(scanLock);
+        scanTasks(0);
+        epicsEventWaitWithTimeout(scanEvent, period);
+        epicsMutexLock(scanLock);
+    }
+    scanThread = NULL;
+    epicsMutexUnlock(scanLock);
+}
+
+/**
+ * @brief Scan all tasks and apply the thread rules to new non-EPICS tasks.
+ */
+void mcoreTaskScan(unsigned int level)
+{
+    int count;
+
+    mcoreTaskScanInit();
+    if (level) {
+        fprintf(epicsGetStdout(), "            NAME   LWP ID\n");
+    }
+    count = scanTasks(level);
+    if (level && count >= 0) {
+        fprintf(epicsGetStdout(), "%d new non-EPICS thread(s) found.\n", count);
+    }
+}
+
+/**
+ * @brief Set the period for scanning all tasks.
+ */
+void mcoreTaskScanPeriod(double period)
+{
+    mcoreTaskScanInit();
+    epicsMutexLock(scanLock);
+    scanPeriod = period;
+    if (period > 0.0 && !scanThread) {
+        scanThread = ownThreadCreate("mcoreTaskScan",
+                                     epicsThreadPriorityLow,
+                                     epicsThreadGetStackSize(epicsThreadStackSmall),
+                                     scanLoop, NULL);
+        if (!scanThread) {
+            errlogPrintf("mcoreTaskScan: can't create scan thread\n");
+            scanPeriod = 0.0;
+        }
+    }
+    epicsMutexUnlock(scanLock);
+    epicsEventSignal(scanEvent);
+}
+
+static void once(void *arg)
+{
+    scanLock = epicsMutexMustCreate();
+    scanEvent = epicsEventMustCreate(epicsEventEmpty);
+    rtset = cpusetAlloc();
+    cpuset = cpusetAlloc();
+}
+
+/**
+ * @brief Initialization routine.
+ */
+void mcoreTaskScanInit(void)
+{
+    static epicsThreadOnceId onceFlag = EPICS_THREAD_ONCE_INIT;
+    epicsThreadOnce(&onceFlag, once, NULL);
+}
+
+/**
+ *@}
+ */
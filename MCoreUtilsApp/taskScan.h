@@ -0,0 +1,29 @@
+/********************************************//**
+ * @file
+ * @brief Header file for taskScan.c
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+#ifndef TASKSCAN_H
+#define TASKSCAN_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+size_t taskScanKnown(pid_t *tids, size_t max);
+int taskScanApply(pid_t tid, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TASKSCAN_H
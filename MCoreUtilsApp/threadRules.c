@@ -22,6 +22,8 @@
 #include <sys/types.h>
 #include <regex.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 
 #include <ellLib.h>
 #include <envDefs.h>
@@ -30,18 +32,42 @@
 #include <epicsMath.h>
 #include <epicsThread.h>
 #include <epicsMutex.h>
+#include <epicsAtomic.h>
+#include <epicsVersion.h>
 #include <shareLib.h>
 
 #include "utils.h"
+#include "cpumask.h"
+#include "topology.h"
+#include "exclusive.h"
+#include "placement.h"
+#include "balance.h"
+#include "boost.h"
+#include "watchdog.h"
+#include "cgroup.h"
+#include "hotplug.h"
+#include "threadRules.h"
 
 /// @cond NEVER
 #define epicsExportSharedSymbols
 /// @endcond
 #include "mcoreutils.h"
 
-/// @cond NEVER
-extern int epicsThreadGetPosixPriority(epicsThreadOSD *pthreadInfo);
-/// @endcond
+// joinable threads (and the joinable flag of implicit threads) since EPICS 7.0.2
+#if defined(VERSION_INT) && EPICS_VERSION_INT >= VERSION_INT(7,0,2,0)
+#define HAVE_JOINABLE_THREADS
+#endif
+
+/**
+ * @brief Registrations of a rule's threads with the monitors, which options can turn off.
+ */
+typedef enum ruleRegistration {
+    regExclusive = 1,           ///< exclusive CPU reservation
+    regPlacement = 2,           ///< placement on single CPUs
+    regBalanced  = 4,           ///< balancer
+    regLatency   = 8,           ///< latency monitor
+    regBudget    = 16           ///< watchdog
+} ruleRegistration;
 
 /**
  * @brief A thread rule.
@@ -54,23 +80,129 @@ typedef struct threadRule {
     char       *name;           ///< rule name
     char       *pattern;        ///< regex pattern (string)
     char       *cpus;           ///< cpu set (string)
+    char       *options;        ///< options (string)
     regex_t     reg;            ///< regex pattern (compiled)
     char        ch_policy;      ///< flag: change policy
     char        ch_priority;    ///< flag: change priority
     char        ch_affinity;    ///< flag: change affinity
+    char        ch_timerslack;  ///< flag: change timer slack
+    char        ch_ioprio;      ///< flag: change I/O priority
+    char        ch_nice;        ///< flag: change nice value
+    char        ch_uclamp_min;  ///< flag: change utilization clamp minimum
+    char        ch_uclamp_max;  ///< flag: change utilization clamp maximum
     char        rel_priority;   ///< flag: priority is relative
+    char        exclusive;      ///< flag: reserve the cpuset for the matching threads
+    char        balanced;       ///< flag: move the matching threads between CPUs according to load
+    char        m_priority;     ///< flag: match on the OSI priority range
+    char        m_joinable;     ///< flag: match on the joinable state
+    char        m_stack;        ///< flag: match on the stack size class
+    char        joinable;       ///< joinable state to match
+    int         minPriority;    ///< lowest OSI priority to match
+    int         maxPriority;    ///< highest OSI priority to match
+    int         stackClass;     ///< stack size class to match (epicsThreadStackSizeClass)
+    unsigned long latency;      ///< run queue latency target [us] (0 = not monitored)
+    int         ceiling;        ///< highest OSI priority a latency boost may set (0 = default)
+    unsigned int budget;        ///< CPU time budget for the watchdog [% of one CPU] (0 = not watched)
+    int         placement;      ///< placement mode (placementMode)
+    unsigned int cleared;       ///< registrations turned off by the options (ruleRegistration)
+    char       *group;          ///< co-location group name (NULL = none)
+    int         groupLevel;     ///< cache level shared by the group (0 = last-level cache)
     int         policy;         ///< policy value
     int         priority;       ///< priority value
-    cpu_set_t   cpuset;         ///< cpuset (opaque)
+    int         ioprio;         ///< I/O priority value
+    int         nice;           ///< nice value
+    unsigned int uclamp_min;    ///< utilization clamp minimum
+    unsigned int uclamp_max;    ///< utilization clamp maximum
+    unsigned long timerslack;   ///< timer slack value [ns]
+    cpu_set_t  *cpuset;         ///< cpuset (allocated if affinity is changed)
+    size_t      matches;        ///< number of times the rule matched a thread (atomic)
+    size_t      applied;        ///< number of times the rule was applied without error (atomic)
+    size_t      failures;       ///< number of failed system calls (atomic)
+    int         lastErrno;      ///< error of the last failed system call
+    const char *lastCall;       ///< last failed system call
 } threadRule;
 
+/**
+ * @brief The properties of a thread that rules can match on.
+ */
+typedef struct threadInfo {
+    const char *name;           ///< thread name
+    int         priority;       ///< OSI priority (-1 = unknown)
+    int         joinable;       ///< joinable state (-1 = unknown)
+    int         stackClass;     ///< stack size class (-1 = unknown)
+    int         own;            ///< flag: thread of MCoreUtils itself
+} threadInfo;
+
+/**
+ * @brief An exclusive CPU reservation to acquire once listLock is released.
+ */
+typedef struct pendingAcquire {
+    struct pendingAcquire *next;    ///< next pending acquisition
+    char       *name;               ///< rule name
+    cpu_set_t  *cpuset;             ///< CPUs to reserve
+} pendingAcquire;
+
 static ELLLIST threadRules = ELLLIST_INIT;
 static epicsMutexId listLock;
+static size_t stackSizes[epicsThreadStackBig + 1];
+
+#define HOOK_BUCKETS 20
+static size_t hookHist[HOOK_BUCKETS];   ///< thread start hook times: <1us, then [2^(i-1), 2^i) us
+static size_t hookCalls;                ///< thread start hook calls
+static size_t hookTotal;                ///< total thread start hook time [ns]
+static size_t hookMax;                  ///< longest thread start hook time [ns]
 static unsigned int cpuspecLen;
 static char *sysConfigFile      = "/etc/rtrules";
 static ENV_PARAM userHome       = {"HOME","/"};
 static ENV_PARAM userConfigFile = {"EPICS_MCORE_USERCONFIG",".rtrules"};
 
+/**
+ * @brief Restrict a rule's cpuset to the CPUs the process is allowed to use.
+ *
+ * CPUs outside the allowed set (e.g. of a container) are removed and reported,
+ * as setting an affinity including them would fail.
+ *
+ * @param name   rule name (for the messages)
+ * @param cpuset cpuset to restrict
+ * @param cpus   cpuset specification of the rule (for the messages)
+ * @return 0 on success, -1 if no allowed CPU is left
+ */
+static int restrictToAllowed(const char *name, cpu_set_t *cpuset, const char *cpus)
+{
+    const size_t setsize = cpusetSize();
+    const int buflen = topologyCpusetStrLen();
+    cpu_set_t *allowed = cpusetAlloc();
+    cpu_set_t *dropped = cpusetAlloc();
+    char *buf = malloc(buflen);
+    int status = 0;
+
+    if (!allowed || !dropped || !buf) {
+        errlogPrintf("Memory allocation error\n");
+        status = -1;
+    } else {
+        topologyAllowedCpus(allowed);
+        cpumaskAndNot(dropped, cpuset, allowed, setsize);
+        cpumaskAnd(cpuset, cpuset, allowed, setsize);
+        if (CPU_COUNT_S(setsize, dropped)) {
+            cpusetToStr(buf, buflen, dropped);
+            mcoreLog("mcoreThreadRules: %s: CPU(s) %s of \"%s\" not allowed, ignored\n",
+                     name, buf, cpus);
+        }
+        if (!CPU_COUNT_S(setsize, cpuset)) {
+            mcoreLog("mcoreThreadRules: %s: no allowed CPU in \"%s\", affinity not changed\n",
+                     name, cpus);
+            status = -1;
+        } else if (errVerbose) {
+            cpusetToStr(buf, buflen, cpuset);
+            mcoreLog("mcoreThreadRules: %s: \"%s\" resolved to %s\n", name, cpus, buf);
+        }
+    }
+    cpusetFree(allowed);
+    cpusetFree(dropped);
+    free(buf);
+    return status;
+}
+
 /**
  * @brief Parse the property modifiers into a thread rule.
  *
@@ -98,9 +230,287 @@ static void parseModifiers(threadRule *prule, const char *policy, const char *pr
         if (prule->priority < epicsThreadPriorityMin) prule->priority = epicsThreadPriorityMin;
     }
     if (cpus && '*' != cpus[0] && '\0' != cpus[0]) {
-        prule->ch_affinity = 1;
-        strToCpuset(&prule->cpuset, cpus);
+        prule->cpuset = cpusetAlloc();
+        if (prule->cpuset && 0 == strToCpuset(prule->cpuset, cpus)
+                && 0 == restrictToAllowed(prule->name, prule->cpuset, cpus)) {
+            prule->ch_affinity = 1;
+        } else {
+            cpusetFree(prule->cpuset);
+            prule->cpuset = NULL;
+        }
+    }
+}
+
+/**
+ * @brief Parse an OSI priority range (@c N, @c N-M, @c N- or @c -M).
+ *
+ * @param str range to parse
+ * @param min lowest priority of the range
+ * @param max highest priority of the range
+ * @return 0 on success, -1 on error
+ */
+static int parsePriorityRange(const char *str, int *min, int *max)
+{
+    char *endp;
+
+    *min = epicsThreadPriorityMin;
+    *max = epicsThreadPriorityMax;
+    if ('-' != *str) {
+        *min = (int) strtol(str, &endp, 10);
+        if (endp == str) return -1;
+        str = endp;
+        if ('\0' == *str) *max = *min;
+    }
+    if ('-' == *str && '\0' != *++str) {
+        *max = (int) strtol(str, &endp, 10);
+        if (endp == str) return -1;
+        str = endp;
+    }
+    if ('\0' != *str || *min < epicsThreadPriorityMin || *max > epicsThreadPriorityMax
+            || *min > *max)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Record whether an option turns a registration off.
+ *
+ * @param prule rule being parsed
+ * @param reg   registration (ruleRegistration)
+ * @param off   flag: the option turns the registration off
+ */
+static void setCleared(threadRule *prule, unsigned int reg, int off)
+{
+    if (off) {
+        prule->cleared |= reg;
+    } else {
+        prule->cleared &= ~reg;
+    }
+}
+
+/**
+ * @brief Parse the options into a thread rule.
+ *
+ * Invalid options are reported and ignored. Options turning off a registration
+ * (e.g. @c exclusive=0) are recorded in the rule's @c cleared flags.
+ *
+ * @param prule   rule to set
+ * @param options comma separated list of @c key=value options (NULL = none)
+ */
+static void parseOptions(threadRule *prule, const char *options)
+{
+    char *buff, *tok, *save = NULL;
+
+    if (!options || '\0' == options[0]) return;
+    buff = strdup(options);
+    if (!buff) {
+        errlogPrintf("Memory allocation error\n");
+        return;
+    }
+
+    tok = strtok_r(buff, ", \t", &save);
+    while (tok) {
+        char *val = strchr(tok, '=');
+        if (val) {
+            *val++ = '\0';
+        }
+        if (0 == strcmp(tok, "slack") && val) {
+            char *endp;
+            prule->timerslack = strtoul(val, &endp, 0);
+            if (*endp) {
+                errlogPrintf("Invalid timer slack \"%s\"\n", val);
+            } else {
+                prule->ch_timerslack = 1;
+            }
+        } else if (0 == strcmp(tok, "ioprio") && val) {
+            prule->ioprio = strToIoprio(val);
+            if (-1 != prule->ioprio) {
+                prule->ch_ioprio = 1;
+            }
+        } else if (0 == strcmp(tok, "nice") && val) {
+            char *endp;
+            long nice = strtol(val, &endp, 10);
+            if (*endp || nice < -20 || nice > 19) {
+                errlogPrintf("Invalid nice value \"%s\"\n", val);
+            } else {
+                prule->nice = nice;
+                prule->ch_nice = 1;
+            }
+        } else if ((0 == strcmp(tok, "uclamp_min") || 0 == strcmp(tok, "uclamp_max")) && val) {
+            char *endp;
+            unsigned long util = strtoul(val, &endp, 10);
+            if (*endp || util > UCLAMP_MAX) {
+                errlogPrintf("Invalid utilization clamp \"%s\"\n", val);
+            } else if (0 == strcmp(tok, "uclamp_min")) {
+                prule->uclamp_min = util;
+                prule->ch_uclamp_min = 1;
+            } else {
+                prule->uclamp_max = util;
+                prule->ch_uclamp_max = 1;
+            }
+        } else if (0 == strcmp(tok, "placement") && val) {
+            int mode = strToPlacement(val);
+            if (-1 != mode) {
+                prule->placement = mode;
+                setCleared(prule, regPlacement, placementNone == mode);
+            }
+        } else if (0 == strcmp(tok, "group") && val && *val) {
+            char *lp = strchr(val, '/');
+            int level = 0;
+            if (lp) {
+                *lp++ = '\0';
+                level = atoi(lp);
+            }
+            if (level < 0 || level > 4 || !*val) {
+                errlogPrintf("Invalid co-location group \"%s\"\n", val);
+            } else {
+                free(prule->group);
+                prule->group = strdup(val);
+                prule->groupLevel = level;
+            }
+        } else if (0 == strcmp(tok, "exclusive")) {
+            prule->exclusive = (!val || atoi(val)) ? 1 : 0;
+            setCleared(prule, regExclusive, !prule->exclusive);
+        } else if (0 == strcmp(tok, "balanced")) {
+            prule->balanced = (!val || atoi(val)) ? 1 : 0;
+            setCleared(prule, regBalanced, !prule->balanced);
+        } else if (0 == strcmp(tok, "latency") && val) {
+            char *endp;
+            unsigned long latency = strtoul(val, &endp, 10);
+            if (*endp) {
+                errlogPrintf("Invalid latency target \"%s\"\n", val);
+            } else {
+                prule->latency = latency;
+                setCleared(prule, regLatency, !latency);
+            }
+        } else if (0 == strcmp(tok, "ceiling") && val) {
+            char *endp;
+            long ceiling = strtol(val, &endp, 10);
+            if (*endp || ceiling <= epicsThreadPriorityMin || ceiling > epicsThreadPriorityMax) {
+                errlogPrintf("Invalid priority ceiling \"%s\"\n", val);
+            } else {
+                prule->ceiling = ceiling;
+            }
+        } else if (0 == strcmp(tok, "osi") && val) {
+            if (parsePriorityRange(val, &prule->minPriority, &prule->maxPriority)) {
+                errlogPrintf("Invalid OSI priority range \"%s\"\n", val);
+            } else {
+                prule->m_priority = 1;
+            }
+        } else if (0 == strcmp(tok, "joinable")) {
+            prule->joinable = (!val || atoi(val) || 0 == strcmp(val, "yes")) ? 1 : 0;
+            prule->m_joinable = 1;
+        } else if (0 == strcmp(tok, "stack") && val) {
+            if (0 == strcmp(val, "small")) {
+                prule->stackClass = epicsThreadStackSmall;
+            } else if (0 == strcmp(val, "medium")) {
+                prule->stackClass = epicsThreadStackMedium;
+            } else if (0 == strcmp(val, "big")) {
+                prule->stackClass = epicsThreadStackBig;
+            } else {
+                errlogPrintf("Invalid stack size class \"%s\"\n", val);
+                val = NULL;
+            }
+            if (val) prule->m_stack = 1;
+        } else if (0 == strcmp(tok, "budget") && val) {
+            char *endp;
+            unsigned long budget = strtoul(val, &endp, 10);
+            if (*endp || budget > 100) {
+                errlogPrintf("Invalid CPU time budget \"%s\"\n", val);
+            } else {
+                prule->budget = budget;
+                setCleared(prule, regBudget, !budget);
+            }
+        } else {
+            errlogPrintf("Invalid option \"%s\"\n", tok);
+        }
+        tok = strtok_r(NULL, ", \t", &save);
+    }
+    free(buff);
+}
+
+/**
+ * @brief Remove a thread rule from the list.
+ *
+ * Must be called with listLock held.
+ *
+ * @param name rule name (identifier)
+ * @return the removed rule, NULL if there is no such rule
+ */
+static threadRule *unlinkRule(const char *name)
+{
+    threadRule *prule = (threadRule *) ellFirst(&threadRules);
+
+    while (prule) {
+        if (0 == strcmp(name, prule->name)) {
+            ellDelete(&threadRules, &prule->node);
+            return prule;
+        }
+        prule = (threadRule *) ellNext(&prule->node);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Get the registrations a rule makes for its threads.
+ *
+ * @param prule rule
+ * @return registrations (ruleRegistration)
+ */
+static unsigned int activeRegistrations(const threadRule *prule)
+{
+    return (prule->exclusive ? regExclusive : 0)
+            | (prule->placement ? regPlacement : 0)
+            | (prule->balanced ? regBalanced : 0)
+            | (prule->latency ? regLatency : 0)
+            | (prule->budget ? regBudget : 0);
+}
+
+/**
+ * @brief Release registrations of the threads of a rule.
+ *
+ * Must be called without listLock held: the releases look up EPICS threads.
+ *
+ * @param name rule name
+ * @param regs registrations to release (ruleRegistration)
+ */
+static void releaseRegistrations(const char *name, unsigned int regs)
+{
+    if (regs & regExclusive) {
+        exclusiveRelease(name);
+    }
+    if (regs & regPlacement) {
+        placementRelease(name);
     }
+    if (regs & regBalanced) {
+        balanceRelease(name);
+    }
+    if (regs & regLatency) {
+        boostRelease(name);
+    }
+    if (regs & regBudget) {
+        watchdogRelease(name);
+    }
+}
+
+/**
+ * @brief Release the resources of a removed thread rule and free it.
+ *
+ * Must be called without listLock held: the releases look up EPICS threads.
+ *
+ * @param prule rule removed by unlinkRule()
+ */
+static void releaseRule(threadRule *prule)
+{
+    releaseRegistrations(prule->name, activeRegistrations(prule));
+    free(prule->name);
+    free(prule->pattern);
+    free(prule->cpus);
+    free(prule->options);
+    free(prule->group);
+    cpusetFree(prule->cpuset);
+    regfree(&prule->reg);
+    free(prule);
 }
 
 /**
@@ -108,7 +518,16 @@ static void parseModifiers(threadRule *prule, const char *policy, const char *pr
  */
 long mcoreThreadRuleAdd(const char *name, const char *policy, const char *priority, const char *cpus, const char *pattern)
 {
-    threadRule *prule;
+    return mcoreThreadRuleAddOpt(name, policy, priority, cpus, pattern, NULL);
+}
+
+/**
+ * @brief Add or replace a thread rule with options.
+ */
+long mcoreThreadRuleAddOpt(const char *name, const char *policy, const char *priority, const char *cpus,
+                           const char *pattern, const char *options)
+{
+    threadRule *prule, *old;
 
     prule = calloc(1,sizeof(threadRule));
     if (!prule) {
@@ -119,27 +538,41 @@ long mcoreThreadRuleAdd(const char *name, const char *policy, const char *priori
     prule->name    = strdup(name);
     prule->pattern = strdup(pattern);
     prule->cpus    = strdup(cpus);
-    if (!prule->name || !prule->pattern || !prule->cpus) {
+    prule->options = strdup(options ? options : "");
+    if (!prule->name || !prule->pattern || !prule->cpus || !prule->options) {
         errlogPrintf("Memory allocation error\n");
-        free(prule->name); free(prule->pattern); free(prule->cpus);
+        free(prule->name); free(prule->pattern); free(prule->cpus); free(prule->options);
         free(prule);
         return -1;
     }
 
     parseModifiers(prule, policy, priority, cpus);
+    parseOptions(prule, options);
     regcomp(&prule->reg, prule->pattern, (REG_EXTENDED || REG_NOSUB));
 
+    // the release calls map the EPICS threads, so they must run without listLock
     epicsMutexLock(listLock);
-    mcoreThreadRuleDelete(name);
+    while ((old = unlinkRule(name))) {
+        epicsMutexUnlock(listLock);
+        releaseRule(old);
+        epicsMutexLock(listLock);
+    }
     ellAdd(&threadRules, &prule->node);
     epicsMutexUnlock(listLock);
     return 0;
 }
 
 /**
- * @brief Delete a thread rule.
+ * @brief Add options to an existing thread rule.
+ *
+ * Options that are already set are overridden. The registrations
+ * of the rule's threads that an option turns off are released.
+ *
+ * @param name    rule name (identifier)
+ * @param options comma separated list of @c key=value options
+ * @return (OK, ERROR) as (0,-1)
  */
-void mcoreThreadRuleDelete(const char *name)
+static long addRuleOptions(const char *name, const char *options)
 {
     threadRule *prule;
 
@@ -147,18 +580,67 @@ void mcoreThreadRuleDelete(const char *name)
     prule = (threadRule *) ellFirst(&threadRules);
     while (prule) {
         if (0 == strcmp(name, prule->name)) {
-            ellDelete(&threadRules, &prule->node);
+            char *opts = malloc(strlen(prule->options) + strlen(options) + 2);
+            unsigned int active = activeRegistrations(prule);
+            unsigned int cleared;
+            if (!opts) {
+                errlogPrintf("Memory allocation error\n");
+                break;
+            }
+            sprintf(opts, "%s%s%s", prule->options, prule->options[0] ? "," : "", options);
+            free(prule->options);
+            prule->options = opts;
+            prule->cleared = 0;
+            parseOptions(prule, options);
+            cleared = prule->cleared & active;
             epicsMutexUnlock(listLock);
-            free(prule->name);
-            free(prule->pattern);
-            free(prule->cpus);
-            regfree(&prule->reg);
-            free(prule);
-            return;
+            // the releases map the EPICS threads, so they must run without listLock
+            releaseRegistrations(name, cleared);
+            return 0;
         }
         prule = (threadRule *) ellNext(&prule->node);
     }
     epicsMutexUnlock(listLock);
+    if (!prule) {
+        errlogPrintf("mcoreThreadRules: no rule named %s\n", name);
+    }
+    return -1;
+}
+
+/**
+ * @brief Delete a thread rule.
+ */
+void mcoreThreadRuleDelete(const char *name)
+{
+    threadRule *prule;
+
+    epicsMutexLock(listLock);
+    prule = unlinkRule(name);
+    epicsMutexUnlock(listLock);
+    if (prule) {
+        releaseRule(prule);
+    }
+}
+
+/**
+ * @brief Format a rule's statistics.
+ *
+ * @param prule rule
+ * @param buf   buffer to write into
+ * @param len   length of @p buf
+ */
+static void ruleStatsToStr(const threadRule *prule, char *buf, size_t len)
+{
+    size_t failures = epicsAtomicGetSizeT(&prule->failures);
+    int n;
+
+    n = snprintf(buf, len, "%8lu %8lu %8lu",
+                 (unsigned long) epicsAtomicGetSizeT(&prule->matches),
+                 (unsigned long) epicsAtomicGetSizeT(&prule->applied),
+                 (unsigned long) failures);
+    if (failures && prule->lastCall && n > 0 && (size_t) n < len) {
+        snprintf(buf + n, len - n, " %s: %s", prule->lastCall, strerror(prule->lastErrno));
+    }
 }
 
 /**
@@ -167,7 +649,7 @@ void mcoreThreadRuleDelete(const char *name)
 void mcoreThreadRulesShow(void)
 {
     threadRule *prule;
-    const int buflen = 128; //FIXME should be ~ NO_OF_CPUS
+    const int buflen = topologyCpusetStrLen();
     char buf[buflen];
 
     epicsMutexLock(listLock);
@@ -179,7 +661,10 @@ void mcoreThreadRulesShow(void)
     }
     fprintf(epicsGetStdout(), "            NAME  PRIO POLICY %-*s PATTERN\n", cpuspecLen, "AFFINITY");
     while (prule) {
-        cpusetToStr(buf, buflen, &prule->cpuset);
+        buf[0] = '\0';
+        if (prule->ch_affinity) {
+            cpusetToStr(buf, buflen, prule->cpuset);
+        }
         fprintf(epicsGetStdout(), "%16s  ",
                 prule->name);
         if (prule->ch_priority) {
@@ -196,122 +681,1071 @@ void mcoreThreadRulesShow(void)
                 cpuspecLen, prule->ch_affinity?buf:"*",
                 prule->pattern
                 );
+        if (prule->ch_affinity && strcmp(prule->cpus, buf)) {
+            fprintf(epicsGetStdout(), "                     cpus: %s\n", prule->cpus);
+        }
+        if (prule->options[0]) {
+            fprintf(epicsGetStdout(), "                  options: %s\n", prule->options);
+        }
+        if (prule->exclusive && exclusiveOwnersToStr(prule->name, buf, buflen) > 0) {
+            fprintf(epicsGetStdout(), "                exclusive: LWP %s\n", buf);
+        }
+        if (prule->group) {
+            // headroom for members joining (at most one per CPU) until the group is described
+            size_t desclen = placementGroupStrLen(prule->group) + topologyNumCpus() * 12;
+            char *desc = malloc(desclen);
+            char level[8];
+            if (prule->groupLevel) {
+                sprintf(level, "L%d", prule->groupLevel);
+            } else {
+                strcpy(level, "LLC");
+            }
+            if (desc) {
+                placementGroupToStr(prule->group, desc, desclen);
+                fprintf(epicsGetStdout(), "                    group: %s (%s) %s\n",
+                        prule->group, level, desc[0] ? desc : "-");
+                free(desc);
+            }
+        }
+        if (prule->placement) {
+            // headroom for threads placed (at most one per CPU) until the map is listed
+            size_t maplen = placementMapStrLen(prule->name) + topologyNumCpus() * 24;
+            char *map = malloc(maplen);
+            if (map) {
+                placementMapToStr(prule->name, map, maplen);
+                fprintf(epicsGetStdout(), "                placement: %s %s\n",
+                        placementToStr(prule->placement), map[0] ? map : "-");
+                free(map);
+            }
+        }
+        if (prule->balanced) {
+            fprintf(epicsGetStdout(), "                 balanced: %d thread(s)\n",
+                    balanceCount(prule->name));
+        }
+        if (prule->latency) {
+            fprintf(epicsGetStdout(), "                  latency: %lu us, %d thread(s)\n",
+                    prule->latency, boostCount(prule->name));
+        }
+        if (prule->budget) {
+            fprintf(epicsGetStdout(), "                   budget: %u%%, %d thread(s)\n",
+                    prule->budget, watchdogCount(prule->name));
+        }
+        if (epicsAtomicGetSizeT(&prule->matches)) {
+            char stats[256];
+            ruleStatsToStr(prule, stats, sizeof(stats));
+            fprintf(epicsGetStdout(), "     matched/applied/fail: %s\n", stats);
+        }
         prule = (threadRule *) ellNext(&prule->node);
     }
     epicsMutexUnlock(listLock);
 }
 
 /**
- * @brief Modify a thread's real-time properties according to the specified thread rule.
- *
- * @param id EPICS thread id
- * @param prule thread rule to use
+ * @brief Print the rule counters and the thread start hook timing histogram.
  */
-static void modifyRTProperties(epicsThreadId id, threadRule *prule)
+void mcoreThreadRulesStats(unsigned int level)
 {
-    int status;
-
-    if (prule->ch_policy || prule->ch_priority) {
-        status = pthread_attr_getschedparam(&id->attr, &id->schedParam);
-        if (errVerbose)
-            checkStatus(status,"pthread_attr_getschedparam");
-        status = pthread_attr_getschedpolicy(&id->attr, &id->schedPolicy);
-        if (errVerbose)
-            checkStatus(status,"pthread_attr_getschedpolicy");
-
-        if (prule->ch_policy) {
-            id->schedPolicy = prule->policy;
-            status = pthread_attr_setschedpolicy(&id->attr, id->schedPolicy);
-            if (errVerbose)
-                checkStatus(status,"pthread_attr_setschedpolicy");
-            if (SCHED_FIFO == prule->policy || SCHED_RR == prule->policy) {
-                id->isRealTimeScheduled = 1;
-            } else {
-                id->isRealTimeScheduled = 0;
-            }
-        }
-
-        if (prule->ch_priority) {
-            unsigned int priority;
-            if (prule->rel_priority) {
-                priority = id->osiPriority + prule->priority;
-                if (priority > epicsThreadPriorityMax) priority = epicsThreadPriorityMax;
-                if (priority < epicsThreadPriorityMin) priority = epicsThreadPriorityMin;
-            } else {
-                priority = prule->priority;
-            }
-            id->osiPriority = priority;
-            id->schedParam.sched_priority = epicsThreadGetPosixPriority(id);
-            status = pthread_attr_setschedparam(&id->attr, &id->schedParam);
-            if (errVerbose)
-                checkStatus(status,"pthread_attr_setschedparam");
-        }
+    FILE *out = epicsGetStdout();
+    threadRule *prule;
+    size_t calls = epicsAtomicGetSizeT(&hookCalls);
+    size_t peak = 0;
+    char buf[256];
+    int i;
 
-        status = pthread_setschedparam(id->tid, id->schedPolicy, &id->schedParam);
-        if (errVerbose)
-            checkStatus(status,"pthread_setschedparam");
+    mcoreThreadRulesInit();
+    epicsMutexLock(listLock);
+    fprintf(out, "            NAME  MATCHES  APPLIED FAILURES LAST ERROR\n");
+    for (prule = (threadRule *) ellFirst(&threadRules); prule; prule = (threadRule *) ellNext(&prule->node)) {
+        if (!level && !epicsAtomicGetSizeT(&prule->matches)) continue;
+        ruleStatsToStr(prule, buf, sizeof(buf));
+        fprintf(out, "%16s %s\n", prule->name, buf);
     }
+    epicsMutexUnlock(listLock);
 
-    if (prule->ch_affinity) {
-        status = pthread_attr_setaffinity_np(&id->attr,
-                                             sizeof(cpu_set_t),
-                                             &prule->cpuset);
-        if (errVerbose)
-            checkStatus(status,"pthread_attr_setaffinity_np");
-        status = pthread_setaffinity_np(id->tid,
-                                        sizeof(cpu_set_t),
-                                        &prule->cpuset);
-        if (errVerbose)
-            checkStatus(status,"pthread_setaffinity_np");
+    fprintf(out, "Thread start hook: %lu call(s)", (unsigned long) calls);
+    if (calls) {
+        fprintf(out, ", mean %.1f us, max %.1f us",
+                epicsAtomicGetSizeT(&hookTotal) * 1e-3 / calls, epicsAtomicGetSizeT(&hookMax) * 1e-3);
+    }
+    fprintf(out, "\n");
+    for (i = 0; i < HOOK_BUCKETS; i++) {
+        size_t count = epicsAtomicGetSizeT(&hookHist[i]);
+        if (count > peak) peak = count;
+    }
+    for (i = 0; i < HOOK_BUCKETS && peak; i++) {
+        size_t count = epicsAtomicGetSizeT(&hookHist[i]);
+        char range[32];
+        if (!count && !level) continue;
+        if (0 == i) {
+            strcpy(range, "< 1");
+        } else if (HOOK_BUCKETS - 1 == i) {
+            sprintf(range, ">= %lu", 1UL << (i - 1));
+        } else {
+            sprintf(range, "%lu - %lu", 1UL << (i - 1), 1UL << i);
+        }
+        memset(buf, '#', 40);
+        buf[(int) (40.0 * count / peak + 0.5)] = '\0';
+        fprintf(out, "  %16s us %8lu%s%s\n", range, (unsigned long) count, buf[0] ? " " : "", buf);
     }
 }
 
-static void threadStartHook (epicsThreadId id)
+/**
+ * @brief Record a failed system call of a rule.
+ *
+ * The first failure of each rule is always reported, further ones only with errVerbose,
+ * all of them are counted.
+ *
+ * @param prule  rule being applied
+ * @param status status (errno value) of the system call
+ * @param call   name of the system call
+ * @return 1 if the call failed, 0 if not
+ */
+static int ruleStatus(threadRule *prule, int status, const char *call)
 {
-    threadRule *prule;
-
-    epicsMutexLock(listLock);
-    prule = (threadRule *) ellFirst(&threadRules);
-    if (!prule) {
-        epicsMutexUnlock(listLock);
-        return;
+    if (!status) return 0;
+    prule->lastErrno = status;
+    prule->lastCall = call;
+    if (1 == epicsAtomicIncrSizeT(&prule->failures) || errVerbose) {
+        mcoreLog("mcoreThreadRules: %s: %s error %s\n", prule->name, call, strerror(status));
     }
-    while (prule) {
-        if (0 == regexec(&prule->reg, id->name, 0, NULL, 0)) {
-            modifyRTProperties(id, prule);
-        }
-        prule = (threadRule *) ellNext(&prule->node);
-    }
-    epicsMutexUnlock(listLock);
+    return 1;
 }
 
 /**
- * @brief Modify a thread's real-time properties.
+ * @brief Record the execution time of the thread start hook.
+ *
+ * @param start time the hook started
  */
-void mcoreThreadModify(epicsThreadId id, const char *policy, const char *priority, const char *cpus)
+static void hookTiming(const struct timespec *start)
 {
-    threadRule rule;
+    struct timespec now;
+    size_t ns, us, max;
+    int bucket = 0;
 
-    assert(id);
-    parseModifiers(&rule, policy, priority, cpus);
-    modifyRTProperties(id, &rule);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (now.tv_sec - start->tv_sec) * 1000000000UL + now.tv_nsec - start->tv_nsec;
+    for (us = ns / 1000; us && bucket < HOOK_BUCKETS - 1; us >>= 1) bucket++;
+    epicsAtomicIncrSizeT(&hookHist[bucket]);
+    epicsAtomicIncrSizeT(&hookCalls);
+    epicsAtomicAddSizeT(&hookTotal, ns);
+    while ((max = epicsAtomicGetSizeT(&hookMax)) < ns
+           && epicsAtomicCmpAndSwapSizeT(&hookMax, max, ns) != max) ;
 }
 
 /**
- * @brief Read a set of thread rules from a file.
+ * @brief Modify a task's timer slack, I/O priority, nice value and utilization clamps
+ * according to the specified thread rule.
  *
- * @param file
- * @return number of rules read
+ * The timer slack of a thread other than the calling thread
+ * can only be set on Linux 4.6 and newer, utilization clamps need Linux 5.3.
+ * The nice value has no effect on real-time (FIFO or RR) threads.
+ *
+ * @param tid   Linux thread id (0 = calling thread)
+ * @param prule thread rule to use
+ * @return number of failed system calls
  */
-static int readRulesFromFile(const char *file)
+static int modifyTaskOptions(pid_t tid, threadRule *prule)
 {
-    const int linelen = 256;
-    const char sep = ':';
-    char line[linelen];
-    int count = 0;
+    int status;
+    int failed = 0;
 
-    FILE *fp = fopen(file, "r");
-    if (NULL == fp) {
+    if (prule->ch_timerslack) {
+        status = setTimerSlack(tid, prule->timerslack);
+        failed += ruleStatus(prule, status, "setTimerSlack");
+    }
+
+    if (prule->ch_ioprio) {
+        status = setIoprio(tid, prule->ioprio);
+        failed += ruleStatus(prule, status, "ioprio_set");
+    }
+
+    if (prule->ch_nice || prule->ch_uclamp_min || prule->ch_uclamp_max) {
+        mcoreSchedAttr attr;
+        status = schedGetAttr(tid, &attr);
+        failed += ruleStatus(prule, status, "sched_getattr");
+        if (!status) {
+            attr.sched_flags &= SCHED_FLAG_RESET_ON_FORK;
+            // Linux 5.3+: keep the policy (and the parameters, unless the nice value
+            // changes) instead of writing back what was read
+            if (attr.size >= SCHED_ATTR_SIZE_UCLAMP) {
+                attr.sched_flags |= SCHED_FLAG_KEEP_POLICY;
+                if (!prule->ch_nice) {
+                    attr.sched_flags |= SCHED_FLAG_KEEP_PARAMS;
+                }
+            }
+            if (prule->ch_nice) {
+                attr.sched_nice = prule->nice;
+            }
+            if (prule->ch_uclamp_min) {
+                attr.sched_flags |= SCHED_FLAG_UTIL_CLAMP_MIN;
+                attr.sched_util_min = prule->uclamp_min;
+            }
+            if (prule->ch_uclamp_max) {
+                attr.sched_flags |= SCHED_FLAG_UTIL_CLAMP_MAX;
+                attr.sched_util_max = prule->uclamp_max;
+            }
+            status = schedSetAttr(tid, &attr);
+            failed += ruleStatus(prule, status, "sched_setattr");
+        }
+    }
+    return failed;
+}
+
+/**
+ * @brief Get the cpuset to apply to a thread, according to the rule's
+ * co-location group and placement mode.
+ *
+ * The group's CPUs are selected from the rule's cpuset, or from the CPUs
+ * the process is allowed to run on if the rule does not change the affinity.
+ * The placement mode then selects a single CPU.
+ *
+ * @param tid   Linux thread id
+ * @param prule thread rule to use
+ * @return cpuset to apply (NULL on error), to be released with cpusetFree()
+ * if it is not the rule's cpuset
+ */
+static cpu_set_t *placedCpuset(pid_t tid, threadRule *prule)
+{
+    const size_t setsize = cpusetSize();
+    cpu_set_t *cpuset;
+    int cpu;
+
+    if (!prule->group && !prule->placement) return prule->cpuset;
+    if (!(cpuset = cpusetAlloc())) return prule->cpuset;
+    if (prule->ch_affinity) {
+        cpusetCopy(cpuset, prule->cpuset);
+    } else {
+        topologyAllowedCpus(cpuset);
+    }
+    if (prule->group) {
+        placementGroup(prule->group, prule->groupLevel, tid, cpuset, cpuset);
+    }
+    if (prule->placement) {
+        cpu = placementSelect(prule->name, prule->placement, tid, cpuset);
+        if (cpu >= 0) {
+            CPU_ZERO_S(setsize, cpuset);
+            CPU_SET_S(cpu, setsize, cpuset);
+        }
+    }
+    return cpuset;
+}
+
+/**
+ * @brief Get the stack size class of a stack size.
+ *
+ * @param size stack size
+ * @return largest class whose size the stack has
+ */
+static int stackClassOf(size_t size)
+{
+    if (size >= stackSizes[epicsThreadStackBig]) return epicsThreadStackBig;
+    if (size >= stackSizes[epicsThreadStackMedium]) return epicsThreadStackMedium;
+    return epicsThreadStackSmall;
+}
+
+/**
+ * @brief Collect the properties of a thread from its creation attributes.
+ *
+ * A thread with attributes is taken as one of MCoreUtils if the calling thread
+ * is creating it through ownThreadCreate() (interposer).
+ *
+ * @param info        thread properties to write into
+ * @param name        thread name
+ * @param attr        creation attributes (NULL = not an EPICS thread)
+ * @param osiPriority OSI priority (ignored if @p attr is NULL)
+ */
+static void threadInfoFromAttr(threadInfo *info, const char *name, const pthread_attr_t *attr,
+                               unsigned int osiPriority)
+{
+    size_t size;
+    int state;
+
+    info->name = name;
+    info->priority = info->joinable = info->stackClass = -1;
+    info->own = attr && ownThreadCreating();
+    if (!attr) return;
+    info->priority = (int) osiPriority;
+    if (0 == pthread_attr_getdetachstate(attr, &state)) {
+        info->joinable = (PTHREAD_CREATE_JOINABLE == state);
+    }
+    if (0 == pthread_attr_getstacksize(attr, &size)) {
+        info->stackClass = stackClassOf(size);
+    }
+}
+
+/**
+ * @brief Collect the properties of an EPICS thread.
+ *
+ * @param info thread properties to write into
+ * @param id   thread
+ */
+static void threadInfoFromId(threadInfo *info, epicsThreadId id)
+{
+    threadInfoFromAttr(info, id->name, &id->attr, id->osiPriority);
+    info->own = isOwnThread(id);
+#ifdef HAVE_JOINABLE_THREADS
+    info->joinable = id->joinable;
+#endif
+}
+
+/**
+ * @brief Check whether a rule matches a thread.
+ *
+ * The priority, joinable and stack conditions are checked before the name
+ * pattern, so that a rule that does not match them costs no regex evaluation.
+ * A condition on a property that is unknown (e.g. for a non-EPICS thread) fails.
+ * No rule matches the threads of MCoreUtils itself.
+ *
+ * @param prule rule to check
+ * @param info  thread properties
+ * @return 1 if the rule matches, 0 if not
+ */
+static int ruleMatches(const threadRule *prule, const threadInfo *info)
+{
+    if (info->own)
+        return 0;
+    if (prule->m_priority
+            && (info->priority < prule->minPriority || info->priority > prule->maxPriority))
+        return 0;
+    if (prule->m_joinable && info->joinable != prule->joinable)
+        return 0;
+    if (prule->m_stack && info->stackClass != prule->stackClass)
+        return 0;
+    return 0 == regexec(&prule->reg, info->name, 0, NULL, 0);
+}
+
+/**
+ * @brief Check whether a rule assigns a real-time (FIFO or RR) policy and an affinity.
+ *
+ * @param prule rule to check
+ * @return 1 if it does, 0 if not
+ */
+static int isRtRule(const threadRule *prule)
+{
+    return prule->ch_affinity && prule->ch_policy
+            && (SCHED_FIFO == prule->policy || SCHED_RR == prule->policy);
+}
+
+/**
+ * @brief Check whether the threads of a rule belong into the cgroup cpuset partition.
+ *
+ * @param prule rule to check
+ * @return 1 if they do, 0 if not
+ */
+static int isPartitionRule(const threadRule *prule)
+{
+    return isRtRule(prule) || (prule->ch_affinity && prule->exclusive);
+}
+
+/**
+ * @brief Check whether a real-time or exclusive rule matches a thread.
+ *
+ * @param info thread properties
+ * @return 1 if one does, 0 if not
+ */
+static int partitionMatch(const threadInfo *info)
+{
+    threadRule *prule;
+    int match = 0;
+
+    epicsMutexLock(listLock);
+    prule = (threadRule *) ellFirst(&threadRules);
+    while (prule && !match) {
+        if (isPartitionRule(prule) && ruleMatches(prule, info)) {
+            match = 1;
+        }
+        prule = (threadRule *) ellNext(&prule->node);
+    }
+    epicsMutexUnlock(listLock);
+    return match;
+}
+
+/**
+ * @brief Record an exclusive CPU reservation of a rule for runAcquires().
+ *
+ * Acquiring a reservation evicts the CPUs from all tasks of the process,
+ * which must not be done while holding listLock.
+ *
+ * @param list  pending acquisitions to add to
+ * @param prule thread rule
+ */
+static void deferAcquire(pendingAcquire **list, const threadRule *prule)
+{
+    pendingAcquire *pacq = calloc(1, sizeof(pendingAcquire));
+
+    if (!pacq || !(pacq->name = strdup(prule->name)) || !(pacq->cpuset = cpusetAlloc())) {
+        mcoreLog("Memory allocation error\n");
+        if (pacq) free(pacq->name);
+        free(pacq);
+        return;
+    }
+    cpusetCopy(pacq->cpuset, prule->cpuset);
+    pacq->next = *list;
+    *list = pacq;
+}
+
+/**
+ * @brief Acquire the pending exclusive CPU reservations for a thread and free them.
+ *
+ * Must be called without listLock held.
+ *
+ * @param list pending acquisitions
+ * @param tid  Linux thread id
+ */
+static void runAcquires(pendingAcquire *list, pid_t tid)
+{
+    while (list) {
+        pendingAcquire *next = list->next;
+        exclusiveAcquire(list->name, tid, list->cpuset);
+        free(list->name);
+        cpusetFree(list->cpuset);
+        free(list);
+        list = next;
+    }
+}
+
+/**
+ * @brief Modify a thread's real-time properties according to the specified thread rule.
+ *
+ * Must be called with listLock held. The thread must already have joined the
+ * cgroup partition if the rule requires it (joining resets the affinity on
+ * kernels before 6.2); exclusive CPU reservations are added to @p acquire.
+ *
+ * @param id      EPICS thread id
+ * @param prule   thread rule to use
+ * @param acquire pending exclusive CPU reservations
+ */
+static void modifyRTProperties(epicsThreadId id, threadRule *prule, pendingAcquire **acquire)
+{
+    cpu_set_t *cpuset;
+    int status;
+    int failed = 0;
+
+    epicsAtomicIncrSizeT(&prule->matches);
+
+    if (prule->ch_policy || prule->ch_priority) {
+        status = pthread_attr_getschedparam(&id->attr, &id->schedParam);
+        failed += ruleStatus(prule, status, "pthread_attr_getschedparam");
+        status = pthread_attr_getschedpolicy(&id->attr, &id->schedPolicy);
+        failed += ruleStatus(prule, status, "pthread_attr_getschedpolicy");
+
+        if (prule->ch_policy) {
+            id->schedPolicy = prule->policy;
+            status = pthread_attr_setschedpolicy(&id->attr, id->schedPolicy);
+            failed += ruleStatus(prule, status, "pthread_attr_setschedpolicy");
+            if (SCHED_FIFO == prule->policy || SCHED_RR == prule->policy) {
+                id->isRealTimeScheduled = 1;
+            } else {
+                id->isRealTimeScheduled = 0;
+            }
+        }
+
+        if (prule->ch_priority) {
+            unsigned int priority;
+            if (prule->rel_priority) {
+                priority = id->osiPriority + prule->priority;
+                if (priority > epicsThreadPriorityMax) priority = epicsThreadPriorityMax;
+                if (priority < epicsThreadPriorityMin) priority = epicsThreadPriorityMin;
+            } else {
+                priority = prule->priority;
+            }
+            id->osiPriority = priority;
+            id->schedParam.sched_priority = osiToPosixPriority(id->schedPolicy, priority);
+            status = pthread_attr_setschedparam(&id->attr, &id->schedParam);
+            failed += ruleStatus(prule, status, "pthread_attr_setschedparam");
+        }
+
+        status = pthread_setschedparam(id->tid, id->schedPolicy, &id->schedParam);
+        failed += ruleStatus(prule, status, "pthread_setschedparam");
+    }
+
+    if ((prule->ch_affinity || prule->group || prule->placement) && (cpuset = placedCpuset(id->lwpId, prule))) {
+        status = pthread_attr_setaffinity_np(&id->attr,
+                                             cpusetSize(),
+                                             cpuset);
+        failed += ruleStatus(prule, status, "pthread_attr_setaffinity_np");
+        status = pthread_setaffinity_np(id->tid,
+                                        cpusetSize(),
+                                        cpuset);
+        failed += ruleStatus(prule, status, "pthread_setaffinity_np");
+        if (!status && prule->exclusive && prule->ch_affinity) {
+            deferAcquire(acquire, prule);
+        }
+        if (cpuset != prule->cpuset) {
+            cpusetFree(cpuset);
+        }
+    }
+
+    if (prule->balanced) {
+        balanceRegister(prule->name, id->lwpId, prule->ch_affinity ? prule->cpuset : NULL);
+    }
+
+    if (prule->latency) {
+        boostRegister(prule->name, id->lwpId, id, prule->latency, prule->ceiling);
+    }
+
+    if (prule->budget) {
+        watchdogRegister(prule->name, id->lwpId, prule->budget);
+    }
+
+    if (prule->ch_timerslack || prule->ch_ioprio
+            || prule->ch_nice || prule->ch_uclamp_min || prule->ch_uclamp_max) {
+        failed += modifyTaskOptions(pthread_equal(id->tid, pthread_self()) ? 0 : id->lwpId, prule);
+    }
+    if (!failed) {
+        epicsAtomicIncrSizeT(&prule->applied);
+    }
+}
+
+/**
+ * @brief Modify a task's real-time properties according to the specified thread rule.
+ *
+ * Used for threads that were not created through the EPICS API,
+ * which can only be addressed by their Linux thread id.
+ * Called like modifyRTProperties().
+ *
+ * @param tid     Linux thread id
+ * @param prule   thread rule to use
+ * @param acquire pending exclusive CPU reservations
+ */
+static void modifyTaskProperties(pid_t tid, threadRule *prule, pendingAcquire **acquire)
+{
+    cpu_set_t *cpuset;
+    int status;
+    int failed = 0;
+
+    epicsAtomicIncrSizeT(&prule->matches);
+
+    if (prule->ch_policy || prule->ch_priority) {
+        mcoreSchedAttr attr;
+        status = schedGetAttr(tid, &attr);
+        failed += ruleStatus(prule, status, "sched_getattr");
+        if (!status) {
+            int priority = posixToOsiPriority(attr.sched_policy, attr.sched_priority);
+
+            attr.sched_flags &= SCHED_FLAG_RESET_ON_FORK;
+            if (prule->ch_policy) {
+                attr.sched_policy = prule->policy;
+            }
+            if (prule->ch_priority) {
+                if (prule->rel_priority) {
+                    priority += prule->priority;
+                    if (priority > epicsThreadPriorityMax) priority = epicsThreadPriorityMax;
+                    if (priority < epicsThreadPriorityMin) priority = epicsThreadPriorityMin;
+                } else {
+                    priority = prule->priority;
+                }
+            }
+            attr.sched_priority = osiToPosixPriority(attr.sched_policy, priority);
+            status = schedSetAttr(tid, &attr);
+            failed += ruleStatus(prule, status, "sched_setattr");
+        }
+    }
+
+    if ((prule->ch_affinity || prule->group || prule->placement) && (cpuset = placedCpuset(tid, prule))) {
+        status = sched_setaffinity(tid, cpusetSize(), cpuset) ? errno : 0;
+        failed += ruleStatus(prule, status, "sched_setaffinity");
+        if (!status && prule->exclusive && prule->ch_affinity) {
+            deferAcquire(acquire, prule);
+        }
+        if (cpuset != prule->cpuset) {
+            cpusetFree(cpuset);
+        }
+    }
+
+    if (prule->balanced) {
+        balanceRegister(prule->name, tid, prule->ch_affinity ? prule->cpuset : NULL);
+    }
+
+    if (prule->latency) {
+        boostRegister(prule->name, tid, NULL, prule->latency, prule->ceiling);
+    }
+
+    if (prule->budget) {
+        watchdogRegister(prule->name, tid, prule->budget);
+    }
+
+    failed += modifyTaskOptions(tid, prule);
+    if (!failed) {
+        epicsAtomicIncrSizeT(&prule->applied);
+    }
+}
+
+/**
+ * @brief Apply all matching thread rules to a task that is not an EPICS thread.
+ *
+ * Does nothing if the rules have not been initialized yet.
+ *
+ * @param tid  Linux thread id
+ * @param name task name (as in /proc/self/task/<tid>/comm)
+ * @return number of matching rules, -1 if the rules have not been initialized
+ */
+int applyRulesToTask(pid_t tid, const char *name)
+{
+    threadRule *prule;
+    threadInfo info;
+    pendingAcquire *acquire = NULL;
+    int count = 0;
+
+    if (!listLock) return -1;
+
+    threadInfoFromAttr(&info, name, NULL, 0);
+    // joining a cpuset cgroup resets the affinity (kernels before 6.2), so join first
+    if (partitionMatch(&info)) {
+        cgroupAttach(tid);
+    }
+    epicsMutexLock(listLock);
+    prule = (threadRule *) ellFirst(&threadRules);
+    while (prule) {
+        if (ruleMatches(prule, &info)) {
+            modifyTaskProperties(tid, prule, &acquire);
+            count++;
+        }
+        prule = (threadRule *) ellNext(&prule->node);
+    }
+    epicsMutexUnlock(listLock);
+    runAcquires(acquire, tid);
+    exclusiveEvict(tid);
+    return count;
+}
+
+/**
+ * @brief Modify the real-time properties in a thread's creation attributes
+ * according to the specified thread rule.
+ *
+ * Failed calls are counted, but not the match: the start hook applies the rule
+ * again once the thread runs, and counts it there.
+ *
+ * @param attr        thread attributes to modify
+ * @param osiPriority OSI priority of the thread (updated)
+ * @param prule       thread rule to use
+ */
+static void modifyAttrProperties(pthread_attr_t *attr, unsigned int *osiPriority, threadRule *prule)
+{
+    int status;
+
+    if (prule->ch_policy || prule->ch_priority) {
+        struct sched_param param;
+        int policy;
+
+        status = pthread_attr_getschedpolicy(attr, &policy);
+        ruleStatus(prule, status, "pthread_attr_getschedpolicy");
+        if (prule->ch_policy) {
+            policy = prule->policy;
+        }
+        if (prule->ch_priority) {
+            int priority;
+            if (prule->rel_priority) {
+                priority = *osiPriority + prule->priority;
+                if (priority > epicsThreadPriorityMax) priority = epicsThreadPriorityMax;
+                if (priority < epicsThreadPriorityMin) priority = epicsThreadPriorityMin;
+            } else {
+                priority = prule->priority;
+            }
+            *osiPriority = priority;
+        }
+        param.sched_priority = osiToPosixPriority(policy, *osiPriority);
+
+        status = pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+        ruleStatus(prule, status, "pthread_attr_setinheritsched");
+        status = pthread_attr_setschedpolicy(attr, policy);
+        ruleStatus(prule, status, "pthread_attr_setschedpolicy");
+        status = pthread_attr_setschedparam(attr, &param);
+        ruleStatus(prule, status, "pthread_attr_setschedparam");
+    }
+
+    if (prule->ch_affinity) {
+        status = pthread_attr_setaffinity_np(attr,
+                                             cpusetSize(),
+                                             prule->cpuset);
+        ruleStatus(prule, status, "pthread_attr_setaffinity_np");
+    }
+}
+
+/**
+ * @brief Apply all matching thread rules to the attributes of a thread that is about to be created.
+ *
+ * Does nothing if the rules have not been initialized yet.
+ *
+ * @param attr        thread attributes to modify
+ * @param name        name of the thread
+ * @param osiPriority OSI priority the thread is created with
+ * @return number of matching rules
+ */
+int applyRulesToAttr(pthread_attr_t *attr, const char *name, unsigned int osiPriority)
+{
+    threadRule *prule;
+    threadInfo info;
+    int count = 0;
+
+    if (!listLock) return 0;
+
+    threadInfoFromAttr(&info, name, attr, osiPriority);
+    epicsMutexLock(listLock);
+    prule = (threadRule *) ellFirst(&threadRules);
+    while (prule) {
+        if (ruleMatches(prule, &info)) {
+            modifyAttrProperties(attr, &osiPriority, prule);
+            info.priority = (int) osiPriority;
+            count++;
+        }
+        prule = (threadRule *) ellNext(&prule->node);
+    }
+    epicsMutexUnlock(listLock);
+    return count;
+}
+
+/**
+ * @brief Resolve the cpuset specifications of all rules again.
+ *
+ * Needed after the online or allowed CPUs have changed and the topology
+ * has been re-read. A rule whose specification no longer contains any
+ * allowed CPU keeps its previous cpuset.
+ *
+ * @return number of rules whose cpuset changed
+ */
+int rulesReresolve(void)
+{
+    const size_t setsize = cpusetSize();
+    const int buflen = topologyCpusetStrLen();
+    cpu_set_t *cpuset = cpusetAlloc();
+    char *from = malloc(buflen);
+    char *to = malloc(buflen);
+    threadRule *prule;
+    int count = 0;
+
+    if (!cpuset || !from || !to) {
+        errlogPrintf("Memory allocation error\n");
+        cpusetFree(cpuset);
+        free(from);
+        free(to);
+        return 0;
+    }
+    epicsMutexLock(listLock);
+    prule = (threadRule *) ellFirst(&threadRules);
+    while (prule) {
+        const char *cpus = prule->cpus;
+        if (cpus && '*' != cpus[0] && '\0' != cpus[0]
+                && 0 == strToCpuset(cpuset, cpus)
+                && 0 == restrictToAllowed(prule->name, cpuset, cpus)
+                && (!prule->ch_affinity || !cpumaskEqual(cpuset, prule->cpuset, setsize))) {
+            if (!prule->cpuset && !(prule->cpuset = cpusetAlloc())) {
+                errlogPrintf("Memory allocation error\n");
+            } else {
+                if (prule->ch_affinity) {
+                    cpusetToStr(from, buflen, prule->cpuset);
+                } else {
+                    strcpy(from, "*");
+                }
+                cpusetCopy(prule->cpuset, cpuset);
+                prule->ch_affinity = 1;
+                cpusetToStr(to, buflen, cpuset);
+                mcoreLog("mcoreThreadRules: %s: cpuset %s -> %s\n", prule->name, from, to);
+                count++;
+            }
+        }
+        prule = (threadRule *) ellNext(&prule->node);
+    }
+    epicsMutexUnlock(listLock);
+    cpusetFree(cpuset);
+    free(from);
+    free(to);
+    return count;
+}
+
+/**
+ * @brief Set a thread's affinity according to the specified thread rule,
+ * leaving all other properties (and registrations) alone.
+ *
+ * @param tid   Linux thread id
+ * @param id    EPICS thread id (NULL for other tasks)
+ * @param prule thread rule to use
+ */
+static void modifyAffinity(pid_t tid, epicsThreadId id, threadRule *prule)
+{
+    cpu_set_t *cpuset = placedCpuset(tid, prule);
+    int status;
+
+    if (!cpuset) return;
+    if (id) {
+        status = pthread_attr_setaffinity_np(&id->attr, cpusetSize(), cpuset);
+        ruleStatus(prule, status, "pthread_attr_setaffinity_np");
+        status = pthread_setaffinity_np(id->tid, cpusetSize(), cpuset);
+        ruleStatus(prule, status, "pthread_setaffinity_np");
+    } else {
+        status = sched_setaffinity(tid, cpusetSize(), cpuset) ? errno : 0;
+        ruleStatus(prule, status, "sched_setaffinity");
+    }
+    if (cpuset != prule->cpuset) {
+        cpusetFree(cpuset);
+    }
+}
+
+/**
+ * @brief Apply the affinities of the matching rules (with an affinity, co-location group or placement) again.
+ *
+ * @param tid  Linux thread id
+ * @param id   EPICS thread id (NULL for other tasks)
+ * @param info thread info to match the rules against
+ * @return number of rules applied
+ */
+static int reapplyAffinity(pid_t tid, epicsThreadId id, const threadInfo *info)
+{
+    threadRule *prule;
+    int count = 0;
+
+    if (!listLock) return 0;
+
+    epicsMutexLock(listLock);
+    prule = (threadRule *) ellFirst(&threadRules);
+    while (prule) {
+        if ((prule->ch_affinity || prule->group || prule->placement) && ruleMatches(prule, info)) {
+            modifyAffinity(tid, id, prule);
+            count++;
+        }
+        prule = (threadRule *) ellNext(&prule->node);
+    }
+    epicsMutexUnlock(listLock);
+    return count;
+}
+
+/**
+ * @brief Apply the affinities of the matching rules to an EPICS thread again.
+ *
+ * Only the affinity is set; priorities (relative ones would accumulate) and the
+ * exclusive, balancer, boost and watchdog registrations are left alone.
+ *
+ * @param id EPICS thread id
+ * @return number of rules applied
+ */
+int applyAffinityRules(epicsThreadId id)
+{
+    threadInfo info;
+
+    threadInfoFromId(&info, id);
+    return reapplyAffinity(id->lwpId, id, &info);
+}
+
+/**
+ * @brief Apply the affinities of the matching rules to a task that is not an EPICS thread again.
+ *
+ * @param tid  Linux thread id
+ * @param name task name (as in /proc/self/task/<tid>/comm)
+ * @return number of rules applied
+ */
+int applyAffinityRulesToTask(pid_t tid, const char *name)
+{
+    threadInfo info;
+
+    threadInfoFromAttr(&info, name, NULL, 0);
+    return reapplyAffinity(tid, NULL, &info);
+}
+
+/**
+ * @brief Get the set of CPUs that rules assign to real-time (FIFO or RR) threads.
+ *
+ * @param cpuset cpuset to write into
+ * @return number of CPUs in the set
+ */
+int rtRulesCpuset(cpu_set_t *cpuset)
+{
+    threadRule *prule;
+
+    CPU_ZERO_S(cpusetSize(), cpuset);
+    epicsMutexLock(listLock);
+    prule = (threadRule *) ellFirst(&threadRules);
+    while (prule) {
+        if (isRtRule(prule)) {
+            CPU_OR_S(cpusetSize(), cpuset, cpuset, prule->cpuset);
+        }
+        prule = (threadRule *) ellNext(&prule->node);
+    }
+    epicsMutexUnlock(listLock);
+    return CPU_COUNT_S(cpusetSize(), cpuset);
+}
+
+/**
+ * @brief Get the set of CPUs that rules assign to real-time or exclusive threads.
+ *
+ * @param cpuset cpuset to write into
+ * @return number of CPUs in the set
+ */
+int partitionRulesCpuset(cpu_set_t *cpuset)
+{
+    threadRule *prule;
+
+    CPU_ZERO_S(cpusetSize(), cpuset);
+    epicsMutexLock(listLock);
+    prule = (threadRule *) ellFirst(&threadRules);
+    while (prule) {
+        if (isPartitionRule(prule)) {
+            CPU_OR_S(cpusetSize(), cpuset, cpuset, prule->cpuset);
+        }
+        prule = (threadRule *) ellNext(&prule->node);
+    }
+    epicsMutexUnlock(listLock);
+    return CPU_COUNT_S(cpusetSize(), cpuset);
+}
+
+/**
+ * @brief Map callback moving an EPICS thread matching a real-time or exclusive rule into the partition.
+ *
+ * The affinities of the matching rules are applied again afterwards.
+ *
+ * @param id current thread (map argument)
+ */
+static void attachThread(epicsThreadId id)
+{
+    threadInfo info;
+
+    threadInfoFromId(&info, id);
+    if (partitionMatch(&info) && 0 == cgroupAttach(id->lwpId)) {
+        // joining the partition has reset the affinity (kernels before 6.2)
+        applyAffinityRules(id);
+    }
+}
+
+/**
+ * @brief Move all existing EPICS threads matching a real-time or exclusive rule into the partition,
+ * keeping their rule affinities.
+ */
+void partitionRulesAttach(void)
+{
+    epicsThreadMap(attachThread);
+}
+
+/**
+ * @brief Thread start hook applying the matching rules to a new EPICS thread.
+ *
+ * Joining the cgroup partition, acquiring exclusive CPUs (which evicts them
+ * from all tasks) and evicting reserved CPUs from the new thread are done
+ * without holding listLock, so that other starting threads do not wait for them.
+ *
+ * @param id EPICS thread id
+ */
+static void threadStartHook (epicsThreadId id)
+{
+    threadRule *prule;
+    threadInfo info;
+    pendingAcquire *acquire = NULL;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    threadInfoFromId(&info, id);
+    // joining a cpuset cgroup resets the affinity (kernels before 6.2), so join first
+    if (partitionMatch(&info)) {
+        cgroupAttach(id->lwpId);
+    }
+    epicsMutexLock(listLock);
+    prule = (threadRule *) ellFirst(&threadRules);
+    while (prule) {
+        if (ruleMatches(prule, &info)) {
+            modifyRTProperties(id, prule, &acquire);
+            info.priority = (int) id->osiPriority;
+        }
+        prule = (threadRule *) ellNext(&prule->node);
+    }
+    epicsMutexUnlock(listLock);
+    runAcquires(acquire, id->lwpId);
+    exclusiveEvict(id->lwpId);
+    hookTiming(&start);
+}
+
+/**
+ * @brief Modify a thread's real-time properties.
+ */
+void mcoreThreadModify(epicsThreadId id, const char *policy, const char *priority, const char *cpus)
+{
+    mcoreThreadModifyOpt(id, policy, priority, cpus, NULL);
+}
+
+/**
+ * @brief Modify a thread's real-time properties and options.
+ */
+void mcoreThreadModifyOpt(epicsThreadId id, const char *policy, const char *priority, const char *cpus,
+                          const char *options)
+{
+    threadRule rule;
+    pendingAcquire *acquire = NULL;
+
+    assert(id);
+    memset(&rule, 0, sizeof(threadRule));
+    rule.name = id->name;
+    parseModifiers(&rule, policy, priority, cpus);
+    parseOptions(&rule, options);
+    // the registrations of a modification are made under the thread name
+    releaseRegistrations(rule.name, rule.cleared);
+    if (isPartitionRule(&rule)) {
+        cgroupAttach(id->lwpId);
+    }
+    epicsMutexLock(listLock);
+    modifyRTProperties(id, &rule, &acquire);
+    epicsMutexUnlock(listLock);
+    runAcquires(acquire, id->lwpId);
+    exclusiveEvict(id->lwpId);
+    cpusetFree(rule.cpuset);
+    free(rule.group);
+}
+
+/**
+ * @brief Execute a directive from a rules file.
+ *
+ * Directives are lines starting with @c @ followed by a keyword and
+ * whitespace separated arguments.
+ *
+ * @param line directive line (after the @c @)
+ * @return (OK, ERROR) as (0,-1)
+ */
+static long readDirective(char *line)
+{
+    const int maxArgs = 4;
+    char *args[maxArgs];
+    char *keyword, *save = NULL;
+    int i;
+
+    keyword = strtok_r(line, " \t\r\n", &save);
+    for (i = 0; i < maxArgs; i++) {
+        args[i] = strtok_r(NULL, " \t\r\n", &save);
+    }
+    if (!keyword) return -1;
+
+    if (0 == strcmp(keyword, "options") && args[0] && args[1]) {
+        return addRuleOptions(args[0], args[1]);
+    }
+    if (0 == strcmp(keyword, "latency") && args[0]) {
+        mcoreCpuLatency(atoi(args[0]));
+        return 0;
+    }
+    if (0 == strcmp(keyword, "partition")) {
+        mcoreCgroupPartition(args[0]);
+        return 0;
+    }
+    if (0 == strcmp(keyword, "priomap") && args[0]) {
+        mcorePriorityMap(args[0]);
+        return 0;
+    }
+    if (0 == strcmp(keyword, "cpufreq") && args[0] && args[1]) {
+        mcoreCpuFreq(args[0], args[1], args[2]);
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Read a set of thread rules from a file.
+ *
+ * @param file
+ * @return number of rules read
+ */
+static int readRulesFromFile(const char *file)
+{
+    const int linelen = 256;
+    const char sep = ':';
+    char line[linelen];
+    int count = 0;
+
+    FILE *fp = fopen(file, "r");
+    if (NULL == fp) {
         if (errVerbose)
             errlogPrintf("mcoreThreadRules: can't open rules file %s\n", file);
     } else {
@@ -322,19 +1756,34 @@ static int readRulesFromFile(const char *file)
             char *sp;
             char *cp;
             lineno++;
-            args[0] = cp = line;
+            cp = line;
             cp += strspn(cp, " \t\r\n");   // trim leading whitespace and empty lines
             if (*cp == '#' || *cp == '\0')
                 continue;
-            for (i = 1; i < 5; i++) {
-                sp = strchr(cp, sep);
+            if (*cp == '@') {
+                if (readDirective(cp+1))
+                    errlogPrintf("mcoreThreadRules: error in directive on line %d of file %s\n", lineno, file);
+                continue;
+            }
+            for (i = 0; i < 4; i++) {
+                char *qp;
+                if (*cp == '"' && (qp = strchr(cp+1, '"'))) {   // quoted field (may contain separators)
+                    args[i] = cp+1;
+                    *qp = '\0';
+                    sp = (*(qp+1) == sep) ? qp+1 : NULL;
+                } else {
+                    args[i] = cp;
+                    sp = strchr(cp, sep);
+                }
                 if (!sp) {
                     errlogPrintf("mcoreThreadRules: error parsing line %d of file %s\n", lineno, file);
+                    fclose(fp);
                     return count;
                 }
                 *sp++ = '\0';
-                args[i] = cp = sp;
+                cp = sp;
             }
+            args[4] = cp;
             if ((sp = strpbrk(cp, "\n\r"))) {
                 *sp = '\0';
             }
@@ -353,10 +1802,22 @@ static void once(void *arg)
     char userRel[len];
     int count;
 
-    cpuspecLen = (int) (log10(NO_OF_CPUS-1) + 2) * NO_OF_CPUS / 2;
+    mcoreLogInit();
+
+    cpuspecLen = (int) (log10(topologyNumCpus()-1) + 2) * topologyNumCpus() / 2;
     if (cpuspecLen < 10)
         cpuspecLen = 10;
     listLock = epicsMutexMustCreate();
+    stackSizes[epicsThreadStackSmall] = epicsThreadGetStackSize(epicsThreadStackSmall);
+    stackSizes[epicsThreadStackMedium] = epicsThreadGetStackSize(epicsThreadStackMedium);
+    stackSizes[epicsThreadStackBig] = epicsThreadGetStackSize(epicsThreadStackBig);
+    exclusiveInit();
+    placementInit();
+    balanceInit();
+    boostInit();
+    watchdogInit();
+    cgroupInit();
+    hotplugInit();
 
     envGetConfigParam(&userHome, sizeof(userFile), userFile);
     envGetConfigParam(&userConfigFile, sizeof(userRel), userRel);
@@ -365,10 +1826,10 @@ static void once(void *arg)
     strncat(userFile, userRel, len-strlen(userFile)-1);
 
     count = readRulesFromFile(sysConfigFile);
-    printf("MCoreUtils: Read %d thread rule(s) from %s\n", count, sysConfigFile);
+    mcoreLog("MCoreUtils: Read %d thread rule(s) from %s\n", count, sysConfigFile);
 
     count = readRulesFromFile(userFile);
-    printf("MCoreUtils: Read %d thread rule(s) from %s\n", count, userFile);
+    mcoreLog("MCoreUtils: Read %d thread rule(s) from %s\n", count, userFile);
 
     epicsThreadHookAdd(threadStartHook);
 }
@@ -0,0 +1,38 @@
+/********************************************//**
+ * @file
+ * @brief Internal header file for threadRules.c
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+#ifndef THREADRULES_H
+#define THREADRULES_H
+
+#include <sched.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <epicsThread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int applyRulesToTask(pid_t tid, const char *name);
+int rtRulesCpuset(cpu_set_t *cpuset);
+int partitionRulesCpuset(cpu_set_t *cpuset);
+void partitionRulesAttach(void);
+int rulesReresolve(void);
+int applyAffinityRules(epicsThreadId id);
+int applyAffinityRulesToTask(pid_t tid, const char *name);
+int applyRulesToAttr(pthread_attr_t *attr, const char *name, unsigned int osiPriority);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // THREADRULES_H
@@ -30,6 +30,7 @@
 #include <shareLib.h>
 
 #include "utils.h"
+#include "topology.h"
 
 /// @cond NEVER
 #define epicsExportSharedSymbols
@@ -40,19 +41,22 @@ static epicsThreadId showThread;
 static unsigned int showLevel;
 static char *buffer;
 static char *cpuspec;
+static cpu_set_t *cpuset;
 static const char *policies;
 
 /**
  * @brief Print one line of thread info.
  *
  * @param pthreadInfo thread id to print line for, NULL = print header line
- * @param level       verbosity level (unused)
+ * @param level       verbosity level (>0 adds timer slack, I/O priority, nice value
+ *                    and utilization clamps)
  */
 static void mcoreThreadShowPrint(epicsThreadOSD *pthreadInfo, unsigned int level)
 {
     if (!pthreadInfo) {
         fprintf(epicsGetStdout(), "            NAME       EPICS ID   "
-            "LWP ID   OSIPRI  OSSPRI  STATE  POLICY CPUSET\n");
+            "LWP ID   OSIPRI  OSSPRI  STATE  POLICY %s\n",
+            level ? "   SLACK  IOPRIO NICE   UCLAMP CPUSET" : "CPUSET");
     } else {
         struct sched_param param;
         int priority = 0;
@@ -61,7 +65,6 @@ static void mcoreThreadShowPrint(epicsThreadOSD *pthreadInfo, unsigned int level
         policies = "?";
         cpuspec[0] = '?'; cpuspec[1] = '\0';
         if (pthreadInfo->tid) {
-            cpu_set_t cpuset;
             int status;
             status = pthread_getschedparam(pthreadInfo->tid,
                                            &policy,
@@ -74,21 +77,51 @@ static void mcoreThreadShowPrint(epicsThreadOSD *pthreadInfo, unsigned int level
                 policies = policyToStr(policy);
             }
 
-            status = pthread_getaffinity_np(pthreadInfo->tid,
-                                            sizeof(cpu_set_t),
-                                            &cpuset);
-            if (!status) {
-                cpusetToStr(cpuspec, NO_OF_CPUS+2, &cpuset);
+            if (cpuset) {
+                status = pthread_getaffinity_np(pthreadInfo->tid,
+                                                cpusetSize(),
+                                                cpuset);
+                if (!status) {
+                    cpusetToStr(cpuspec, topologyCpusetStrLen(), cpuset);
+                }
             }
         }
 
-        fprintf(epicsGetStdout(),"%16.16s %14p %8lu    %3d%8d %8.8s %7.7s %s\n",
+        fprintf(epicsGetStdout(),"%16.16s %14p %8lu    %3d%8d %8.8s %7.7s ",
                 pthreadInfo->name,
                 (void *)pthreadInfo,
                 (unsigned long)pthreadInfo->lwpId,
                 pthreadInfo->osiPriority, priority,
                 pthreadInfo->isSuspended ? "SUSPEND" : "OK",
-                policies, cpuspec);
+                policies);
+        if (level) {
+            mcoreSchedAttr attr;
+            char ioprio[16];
+            long slack = -1;
+            int status = -1;
+
+            ioprioToStr(ioprio, sizeof(ioprio), -1);
+            if (pthreadInfo->lwpId) {
+                slack = getTimerSlack(pthreadInfo->lwpId);
+                ioprioToStr(ioprio, sizeof(ioprio), getIoprio(pthreadInfo->lwpId));
+                status = schedGetAttr(pthreadInfo->lwpId, &attr);
+            }
+            if (slack >= 0) {
+                fprintf(epicsGetStdout(), "%8ld ", slack);
+            } else {
+                fprintf(epicsGetStdout(), "       ? ");
+            }
+            fprintf(epicsGetStdout(), "%7.7s ", ioprio);
+            if (status) {
+                fprintf(epicsGetStdout(), "   ?        ? ");
+            } else if (attr.size < SCHED_ATTR_SIZE_UCLAMP) {
+                fprintf(epicsGetStdout(), "%4d        - ", attr.sched_nice);
+            } else {
+                fprintf(epicsGetStdout(), "%4d %4u-%-4u", attr.sched_nice,
+                        attr.sched_util_min, attr.sched_util_max);
+            }
+        }
+        fprintf(epicsGetStdout(), "%s\n", cpuspec);
     }
 }
 
@@ -142,9 +175,10 @@ void mcoreThreadShowAll(unsigned int level)
 
 static void once(void *arg)
 {
-    cpuDigits = (int) log10(NO_OF_CPUS-1) + 1;
+    cpuDigits = (int) log10(topologyNumCpus()-1) + 1;
     if (!buffer)  buffer  = (char *) calloc(cpuDigits+2, sizeof(char));
-    if (!cpuspec) cpuspec = (char *) calloc(NO_OF_CPUS + 2, sizeof(char));
+    if (!cpuspec) cpuspec = (char *) calloc(topologyCpusetStrLen(), sizeof(char));
+    if (!cpuset)  cpuset  = cpusetAlloc();
     printf("MCoreUtils version " VERSION "\n");
 }
 
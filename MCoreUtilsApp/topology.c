@@ -0,0 +1,740 @@
+/********************************************//**
+ * @file
+ * @brief CPU topology model read from sysfs.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * @ingroup topology
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include <envDefs.h>
+#include <errlog.h>
+#include <epicsStdio.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <shareLib.h>
+
+/// @cond NEVER
+#define epicsExportSharedSymbols
+/// @endcond
+#include "utils.h"
+#include "cpumask.h"
+#include "topology.h"
+#include "mcoreutils.h"
+
+/// @cond NEVER
+#define MAX_CACHE_LEVEL 4
+/// @endcond
+
+/**
+ * @brief The CPU topology of the host.
+ *
+ * Packages, physical cores and caches are numbered in the order
+ * of their lowest-numbered CPU. NUMA nodes use the kernel's node numbers.
+ */
+typedef struct cpuTopology {
+    cpu_set_t  *configured;     ///< configured (present) CPUs
+    cpu_set_t  *online;         ///< online CPUs
+    cpu_set_t  *allowed;        ///< CPUs the process is allowed to run on
+    cpu_set_t  *isolated;       ///< isolated CPUs
+    int         nPackages;      ///< number of packages (sockets)
+    cpu_set_t **packages;       ///< CPUs of each package
+    int         nCores;         ///< number of physical cores
+    cpu_set_t **cores;          ///< CPUs (hyperthreads) of each physical core
+    int         nNodes;         ///< number of NUMA nodes (highest node + 1)
+    cpu_set_t **nodes;          ///< CPUs of each NUMA node
+    int         cacheLevels;    ///< highest cache level (last-level cache)
+    int         nCaches[MAX_CACHE_LEVEL+1];  ///< number of caches of each level
+    cpu_set_t **caches[MAX_CACHE_LEVEL+1];   ///< CPUs sharing each cache of each level
+} cpuTopology;
+
+static cpuTopology topo;
+static epicsMutexId topoLock;
+static int nCpus;               ///< number of possible CPUs (highest CPU + 1)
+static int strLen;              ///< maximum length of a cpuset string specification
+static ENV_PARAM sysfsRoot = {"EPICS_MCORE_SYSFS","/sys"};
+static ENV_PARAM procfsRoot = {"EPICS_MCORE_PROCFS","/proc"};
+
+/**
+ * @brief Get the root directory of the sysfs tree to read topology information from.
+ *
+ * @return sysfs root (default: @c /sys)
+ */
+const char *topologySysfsRoot(void)
+{
+    const char *root = envGetConfigParamPtr(&sysfsRoot);
+    return root ? root : "/sys";
+}
+
+/**
+ * @brief Get the root directory of the procfs tree to read process and kernel information from.
+ *
+ * @return procfs root (default: @c /proc)
+ */
+const char *topologyProcfsRoot(void)
+{
+    const char *root = envGetConfigParamPtr(&procfsRoot);
+    return root ? root : "/proc";
+}
+
+/**
+ * @brief Read a cpuset in list format (e.g. "0,2-3") from a file.
+ *
+ * @param path   file to read
+ * @param cpuset cpuset to write into
+ * @return 0 on success, -1 on error
+ */
+int readCpuList(const char *path, cpu_set_t *cpuset)
+{
+    char buf[4096];
+    char *cp;
+    FILE *fp;
+
+    CPU_ZERO_S(cpusetSize(), cpuset);
+    fp = fopen(path, "r");
+    if (!fp) return -1;
+    if (!fgets(buf, sizeof(buf), fp)) {
+        buf[0] = '\0';
+    }
+    fclose(fp);
+    if ((cp = strpbrk(buf, "\n\r"))) {
+        *cp = '\0';
+    }
+    return strToCpuset(cpuset, buf);
+}
+
+/**
+ * @brief Add a cpuset to a list of distinct cpusets, unless it is already part of the list.
+ *
+ * @param list   pointer to the list
+ * @param count  pointer to the number of elements in the list
+ * @param cpuset cpuset to add
+ */
+static void addDistinct(cpu_set_t ***list, int *count, const cpu_set_t *cpuset)
+{
+    const size_t setsize = cpusetSize();
+    cpu_set_t **extended;
+    cpu_set_t *copy;
+    int i;
+
+    for (i = 0; i < *count; i++) {
+        if (cpumaskEqual((*list)[i], cpuset, setsize)) return;
+    }
+    copy = cpusetAlloc();
+    if (!copy) return;
+    extended = realloc(*list, (*count + 1) * sizeof(cpu_set_t *));
+    if (!extended) {
+        errlogPrintf("Memory allocation error\n");
+        cpusetFree(copy);
+        return;
+    }
+    cpusetCopy(copy, cpuset);
+    *list = extended;
+    (*list)[(*count)++] = copy;
+}
+
+/**
+ * @brief Read the caches of a CPU into the topology.
+ *
+ * @param ptopo  topology to add to
+ * @param cpudir sysfs directory of the CPU
+ * @param cpuset scratch cpuset
+ */
+static void readCaches(cpuTopology *ptopo, const char *cpudir, cpu_set_t *cpuset)
+{
+    char path[512];
+    char type[32];
+    int index;
+    FILE *fp;
+
+    for (index = 0; ; index++) {
+        int level;
+        if (formatPath(path, sizeof(path), "%s/cache/index%d/level", cpudir, index)
+                || !(fp = fopen(path, "r"))) break;
+        if (1 != fscanf(fp, "%d", &level)) level = 0;
+        fclose(fp);
+        if (level < 1 || level > MAX_CACHE_LEVEL) continue;
+        if (0 == formatPath(path, sizeof(path), "%s/cache/index%d/type", cpudir, index)
+                && (fp = fopen(path, "r"))) {
+            int instruction = (1 == fscanf(fp, "%31s", type) && 0 == strcmp(type, "Instruction"));
+            fclose(fp);
+            if (instruction) continue;
+        }
+        if (0 == formatPath(path, sizeof(path), "%s/cache/index%d/shared_cpu_list", cpudir, index)
+                && 0 == readCpuList(path, cpuset)) {
+            addDistinct(&ptopo->caches[level], &ptopo->nCaches[level], cpuset);
+            if (level > ptopo->cacheLevels) ptopo->cacheLevels = level;
+        }
+    }
+}
+
+/**
+ * @brief Free the cpusets of a topology.
+ *
+ * @param ptopo topology to free
+ */
+static void freeTopology(cpuTopology *ptopo)
+{
+    int i, level;
+
+    cpusetFree(ptopo->configured);
+    cpusetFree(ptopo->online);
+    cpusetFree(ptopo->allowed);
+    cpusetFree(ptopo->isolated);
+    for (i = 0; i < ptopo->nPackages; i++) cpusetFree(ptopo->packages[i]);
+    free(ptopo->packages);
+    for (i = 0; i < ptopo->nCores; i++) cpusetFree(ptopo->cores[i]);
+    free(ptopo->cores);
+    for (i = 0; i < ptopo->nNodes; i++) cpusetFree(ptopo->nodes[i]);
+    free(ptopo->nodes);
+    for (level = 0; level <= MAX_CACHE_LEVEL; level++) {
+        for (i = 0; i < ptopo->nCaches[level]; i++) cpusetFree(ptopo->caches[level][i]);
+        free(ptopo->caches[level]);
+    }
+    memset(ptopo, 0, sizeof(cpuTopology));
+}
+
+/**
+ * @brief Read the topology from sysfs.
+ *
+ * @param ptopo topology to read into
+ * @return 0 on success, -1 on error
+ */
+static int readTopology(cpuTopology *ptopo)
+{
+    const char *root = topologySysfsRoot();
+    const size_t setsize = cpusetSize();
+    const int ncpus = topologyNumCpus();
+    char path[512];
+    char cpudir[512];
+    DIR *dir;
+    struct dirent *ent;
+    cpu_set_t *cpuset;
+    int cpu;
+
+    memset(ptopo, 0, sizeof(cpuTopology));
+    ptopo->configured = cpusetAlloc();
+    ptopo->online = cpusetAlloc();
+    ptopo->allowed = cpusetAlloc();
+    ptopo->isolated = cpusetAlloc();
+    cpuset = cpusetAlloc();
+    if (!ptopo->configured || !ptopo->online || !ptopo->allowed || !ptopo->isolated || !cpuset) {
+        cpusetFree(cpuset);
+        freeTopology(ptopo);
+        return -1;
+    }
+
+    if (formatPath(path, sizeof(path), "%s/devices/system/cpu/present", root)
+            || readCpuList(path, ptopo->configured) || 0 == CPU_COUNT_S(setsize, ptopo->configured)) {
+        long n = sysconf(_SC_NPROCESSORS_CONF);
+        CPU_ZERO_S(setsize, ptopo->configured);
+        for (cpu = 0; cpu < n && cpu < ncpus; cpu++) {
+            CPU_SET_S(cpu, setsize, ptopo->configured);
+        }
+    }
+    if (formatPath(path, sizeof(path), "%s/devices/system/cpu/online", root)
+            || readCpuList(path, ptopo->online) || 0 == CPU_COUNT_S(setsize, ptopo->online)) {
+        cpusetCopy(ptopo->online, ptopo->configured);
+    }
+    if (sched_getaffinity(getpid(), setsize, ptopo->allowed)) {
+        cpusetCopy(ptopo->allowed, ptopo->online);
+    }
+    if (0 == formatPath(path, sizeof(path), "%s/devices/system/cpu/isolated", root)) {
+        readCpuList(path, ptopo->isolated);
+    }
+
+    for (cpu = 0; cpu < ncpus; cpu++) {
+        if (!CPU_ISSET_S(cpu, setsize, ptopo->online)) continue;
+        // if truncated, the paths below are too long as well and the defaults are used
+        formatPath(cpudir, sizeof(cpudir), "%s/devices/system/cpu/cpu%d", root, cpu);
+
+        if (formatPath(path, sizeof(path), "%s/topology/core_siblings_list", cpudir)
+                || readCpuList(path, cpuset) || !CPU_ISSET_S(cpu, setsize, cpuset)) {
+            cpusetCopy(cpuset, ptopo->online);
+        }
+        addDistinct(&ptopo->packages, &ptopo->nPackages, cpuset);
+
+        if (formatPath(path, sizeof(path), "%s/topology/thread_siblings_list", cpudir)
+                || readCpuList(path, cpuset) || !CPU_ISSET_S(cpu, setsize, cpuset)) {
+            CPU_ZERO_S(setsize, cpuset);
+            CPU_SET_S(cpu, setsize, cpuset);
+        }
+        addDistinct(&ptopo->cores, &ptopo->nCores, cpuset);
+
+        readCaches(ptopo, cpudir, cpuset);
+    }
+    cpusetFree(cpuset);
+
+    if (0 == formatPath(path, sizeof(path), "%s/devices/system/node", root)
+            && (dir = opendir(path))) {
+        while ((ent = readdir(dir))) {
+            int node;
+            char *endp;
+            if (strncmp(ent->d_name, "node", 4)) continue;
+            node = strtol(ent->d_name + 4, &endp, 10);
+            if (*endp || endp == ent->d_name + 4 || node < 0) continue;
+            if (node >= ptopo->nNodes) {
+                cpu_set_t **extended = realloc(ptopo->nodes, (node + 1) * sizeof(cpu_set_t *));
+                if (!extended) {
+                    errlogPrintf("Memory allocation error\n");
+                    continue;
+                }
+                ptopo->nodes = extended;
+                while (ptopo->nNodes <= node) {
+                    if (!(ptopo->nodes[ptopo->nNodes] = cpusetAlloc())) break;
+                    ptopo->nNodes++;
+                }
+                if (node >= ptopo->nNodes) continue;
+            }
+            if (0 == formatPath(cpudir, sizeof(cpudir), "%s/%s/cpulist", path, ent->d_name)) {
+                readCpuList(cpudir, ptopo->nodes[node]);
+            }
+        }
+        closedir(dir);
+    }
+    return 0;
+}
+
+/**
+ * @brief Determine the number of CPUs the kernel may ever bring online.
+ *
+ * Uses the highest CPU number found in the @c possible, @c present and @c online
+ * lists, but at least the number of configured CPUs. The number is fixed for
+ * the lifetime of the process, so that all cpusets are allocated with the same size,
+ * which is also large enough for the affinity system calls.
+ *
+ * @param arg unused
+ */
+static void countOnce(void *arg)
+{
+    static const char *lists[] = { "possible", "present", "online" };
+    char path[512];
+    char buf[4096];
+    char *cp;
+    FILE *fp;
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    int i, cpu;
+
+    nCpus = n > 0 ? (int) n : 1;
+    for (i = 0; i < (int) (sizeof(lists) / sizeof(lists[0])); i++) {
+        if (formatPath(path, sizeof(path), "%s/devices/system/cpu/%s", topologySysfsRoot(), lists[i])
+                || !(fp = fopen(path, "r"))) continue;
+        if (fgets(buf, sizeof(buf), fp)) {
+            for (cp = buf; *cp; ) {
+                if (*cp >= '0' && *cp <= '9') {
+                    long last = strtol(cp, &cp, 10);
+                    if (last >= nCpus) nCpus = (int) last + 1;
+                } else {
+                    cp++;
+                }
+            }
+        }
+        fclose(fp);
+    }
+    for (cpu = 0; cpu < nCpus; cpu++) {
+        int d;
+        for (d = cpu, strLen++; d >= 10; d /= 10) {
+            strLen++;
+        }
+        strLen++;
+    }
+}
+
+static void once(void *arg)
+{
+    topoLock = epicsMutexMustCreate();
+    readTopology(&topo);
+}
+
+/**
+ * @brief Initialize the topology model on first use.
+ */
+static void topologyInit(void)
+{
+    static epicsThreadOnceId onceFlag = EPICS_THREAD_ONCE_INIT;
+    epicsThreadOnce(&onceFlag, once, NULL);
+}
+
+/**
+ * @brief Get the number of possible CPUs, i.e. the size of all cpusets.
+ *
+ * @return highest possible CPU number + 1
+ */
+int topologyNumCpus(void)
+{
+    static epicsThreadOnceId onceFlag = EPICS_THREAD_ONCE_INIT;
+    epicsThreadOnce(&onceFlag, countOnce, NULL);
+    return nCpus;
+}
+
+/**
+ * @brief Get the maximum length of a cpuset string specification.
+ *
+ * @return length of the specification listing all possible CPUs separately,
+ * including the terminating null byte
+ */
+int topologyCpusetStrLen(void)
+{
+    topologyNumCpus();
+    return strLen + 1;
+}
+
+/**
+ * @brief Get the online CPUs.
+ *
+ * @param cpuset cpuset to add the CPUs to
+ * @return number of online CPUs
+ */
+int topologyOnlineCpus(cpu_set_t *cpuset)
+{
+    int count;
+
+    topologyInit();
+    epicsMutexLock(topoLock);
+    CPU_OR_S(cpusetSize(), cpuset, cpuset, topo.online);
+    count = CPU_COUNT_S(cpusetSize(), topo.online);
+    epicsMutexUnlock(topoLock);
+    return count;
+}
+
+/**
+ * @brief Get the CPUs the process is allowed to run on.
+ *
+ * @param cpuset cpuset to add the CPUs to
+ * @return number of allowed CPUs
+ */
+int topologyAllowedCpus(cpu_set_t *cpuset)
+{
+    int count;
+
+    topologyInit();
+    epicsMutexLock(topoLock);
+    CPU_OR_S(cpusetSize(), cpuset, cpuset, topo.allowed);
+    count = CPU_COUNT_S(cpusetSize(), topo.allowed);
+    epicsMutexUnlock(topoLock);
+    return count;
+}
+
+/**
+ * @brief Get the element of a cpuset list of the topology.
+ *
+ * @param list   cpuset list
+ * @param count  number of elements in the list
+ * @param index  index of the element
+ * @param cpuset cpuset to add the CPUs to
+ * @return 0 on success, -1 if there is no such element
+ */
+static int getListCpus(cpu_set_t ** const *list, const int *count, int index, cpu_set_t *cpuset)
+{
+    int status = -1;
+
+    topologyInit();
+    epicsMutexLock(topoLock);
+    if (index >= 0 && index < *count) {
+        CPU_OR_S(cpusetSize(), cpuset, cpuset, (*list)[index]);
+        status = 0;
+    }
+    epicsMutexUnlock(topoLock);
+    return status;
+}
+
+/**
+ * @brief Get the CPUs of a package (socket).
+ *
+ * @param package package number (in order of the packages' lowest CPU)
+ * @param cpuset  cpuset to add the CPUs to
+ * @return 0 on success, -1 if there is no such package
+ */
+int topologyPackageCpus(int package, cpu_set_t *cpuset)
+{
+    return getListCpus(&topo.packages, &topo.nPackages, package, cpuset);
+}
+
+/**
+ * @brief Get the CPUs (hyperthreads) of a physical core.
+ *
+ * @param core   physical core number (in order of the cores' lowest CPU)
+ * @param cpuset cpuset to add the CPUs to
+ * @return 0 on success, -1 if there is no such core
+ */
+int topologyCoreCpus(int core, cpu_set_t *cpuset)
+{
+    return getListCpus(&topo.cores, &topo.nCores, core, cpuset);
+}
+
+/**
+ * @brief Get the CPUs of a NUMA node.
+ *
+ * @param node   NUMA node number
+ * @param cpuset cpuset to add the CPUs to
+ * @return 0 on success, -1 if there is no such node
+ */
+int topologyNodeCpus(int node, cpu_set_t *cpuset)
+{
+    return getListCpus(&topo.nodes, &topo.nNodes, node, cpuset);
+}
+
+/**
+ * @brief Get the CPUs local to a network interface or PCI device.
+ *
+ * The device is looked up as a network interface (e.g. @c eth2), then as
+ * a PCI device address (e.g. @c 0000:3b:00.0, the domain may be omitted).
+ *
+ * @param device interface name or PCI address
+ * @param cpuset cpuset to add the CPUs to
+ * @return 0 on success, -1 if there is no such device
+ */
+int topologyDeviceCpus(const char *device, cpu_set_t *cpuset)
+{
+    const char *root = topologySysfsRoot();
+    cpu_set_t *local;
+    char path[512];
+    int found;
+    int status = -1;
+
+    if (!*device || strchr(device, '/') || '.' == *device || strlen(device) > 64)
+        return -1;
+    if (!(local = cpusetAlloc())) return -1;
+
+    // a path that doesn't fit counts as not found
+    found = !formatPath(path, sizeof(path), "%s/class/net/%s/device/local_cpulist", root, device)
+            && !access(path, R_OK);
+    if (!found) {
+        found = !formatPath(path, sizeof(path), "%s/bus/pci/devices/%s/local_cpulist", root, device)
+                && !access(path, R_OK);
+    }
+    if (!found && 2 == strspn(device, "0123456789abcdefABCDEF") && ':' == device[2]) {
+        found = !formatPath(path, sizeof(path), "%s/bus/pci/devices/0000:%s/local_cpulist", root, device)
+                && !access(path, R_OK);
+    }
+    if (found && 0 == readCpuList(path, local) && CPU_COUNT_S(cpusetSize(), local)) {
+        cpumaskOr(cpuset, cpuset, local, cpusetSize());
+        status = 0;
+    }
+    cpusetFree(local);
+    return status;
+}
+
+/**
+ * @brief Get the CPUs sharing a cache.
+ *
+ * @param level  cache level (0 = last-level cache)
+ * @param cache  cache number (in order of the caches' lowest CPU)
+ * @param cpuset cpuset to add the CPUs to
+ * @return 0 on success, -1 if there is no such cache
+ */
+int topologyCacheCpus(int level, int cache, cpu_set_t *cpuset)
+{
+    int status = -1;
+
+    topologyInit();
+    epicsMutexLock(topoLock);
+    if (0 == level) {
+        level = topo.cacheLevels;
+    }
+    if (level > 0 && level <= MAX_CACHE_LEVEL && cache >= 0 && cache < topo.nCaches[level]) {
+        CPU_OR_S(cpusetSize(), cpuset, cpuset, topo.caches[level][cache]);
+        status = 0;
+    }
+    epicsMutexUnlock(topoLock);
+    return status;
+}
+
+/**
+ * @brief Get the CPUs sharing a cache with a CPU.
+ *
+ * @param level  cache level (0 = last-level cache)
+ * @param cpu    CPU number
+ * @param cpuset cpuset to add the CPUs to
+ * @return 0 on success, -1 if there is no such cache
+ */
+int topologyCpuCacheCpus(int level, int cpu, cpu_set_t *cpuset)
+{
+    const size_t setsize = cpusetSize();
+    int status = -1;
+    int cache;
+
+    topologyInit();
+    epicsMutexLock(topoLock);
+    if (0 == level) {
+        level = topo.cacheLevels;
+    }
+    if (level > 0 && level <= MAX_CACHE_LEVEL && cpu >= 0 && cpu < nCpus) {
+        for (cache = 0; cache < topo.nCaches[level]; cache++) {
+            if (CPU_ISSET_S(cpu, setsize, topo.caches[level][cache])) {
+                CPU_OR_S(setsize, cpuset, cpuset, topo.caches[level][cache]);
+                status = 0;
+                break;
+            }
+        }
+    }
+    epicsMutexUnlock(topoLock);
+    return status;
+}
+
+/**
+ * @brief Get the CPUs sharing the last-level cache.
+ *
+ * @param llc    last-level cache number (in order of the caches' lowest CPU)
+ * @param cpuset cpuset to add the CPUs to
+ * @return 0 on success, -1 if there is no such cache
+ */
+int topologyLlcCpus(int llc, cpu_set_t *cpuset)
+{
+    return topologyCacheCpus(0, llc, cpuset);
+}
+
+/**
+ * @brief Get the isolated CPUs (@c isolcpus kernel parameter).
+ *
+ * @param cpuset cpuset to add the CPUs to
+ * @return number of isolated CPUs
+ */
+int topologyIsolatedCpus(cpu_set_t *cpuset)
+{
+    int count;
+
+    topologyInit();
+    epicsMutexLock(topoLock);
+    CPU_OR_S(cpusetSize(), cpuset, cpuset, topo.isolated);
+    count = CPU_COUNT_S(cpusetSize(), topo.isolated);
+    epicsMutexUnlock(topoLock);
+    return count;
+}
+
+/**
+ * @brief Reduce a cpuset to one CPU (hyperthread) per physical core.
+ *
+ * For each physical core, only the lowest-numbered of its CPUs in the set is kept.
+ *
+ * @param cpuset cpuset to reduce
+ */
+void topologyNoSmt(cpu_set_t *cpuset)
+{
+    const size_t setsize = cpusetSize();
+    int core;
+
+    topologyInit();
+    epicsMutexLock(topoLock);
+    for (core = 0; core < topo.nCores; core++) {
+        int cpu;
+        int keep = -1;
+        for (cpu = cpumaskNextSet(topo.cores[core], setsize, 0); cpu >= 0;
+             cpu = cpumaskNextSet(topo.cores[core], setsize, cpu + 1)) {
+            if (!CPU_ISSET_S(cpu, setsize, cpuset)) continue;
+            if (keep < 0) {
+                keep = cpu;
+            } else {
+                CPU_CLR_S(cpu, setsize, cpuset);
+            }
+        }
+    }
+    epicsMutexUnlock(topoLock);
+}
+
+/**
+ * @brief Re-read the CPU topology, with the given allowed CPUs.
+ *
+ * Used by the hotplug watcher, which computes the allowed CPUs itself
+ * instead of restoring the main thread's affinity (which may come from a rule).
+ *
+ * @param allowed CPUs the process is allowed to run on
+ * (NULL or empty = the affinity of the main thread)
+ */
+void topologyRefreshAllowed(const cpu_set_t *allowed)
+{
+    cpuTopology fresh;
+    cpuTopology old;
+
+    topologyInit();
+    if (readTopology(&fresh)) return;
+    if (allowed && CPU_COUNT_S(cpusetSize(), allowed)) {
+        cpusetCopy(fresh.allowed, allowed);
+    }
+    epicsMutexLock(topoLock);
+    old = topo;
+    topo = fresh;
+    epicsMutexUnlock(topoLock);
+    freeTopology(&old);
+}
+
+/**
+ * @brief Re-read the CPU topology.
+ */
+void mcoreTopologyRefresh(void)
+{
+    topologyRefreshAllowed(NULL);
+}
+
+/**
+ * @brief Print a list of cpusets of the topology.
+ *
+ * @param title name of the list elements
+ * @param list  cpuset list
+ * @param count number of elements in the list
+ * @param buf   buffer for the string specification
+ * @param len   length of @p buf
+ */
+static void showList(const char *title, cpu_set_t * const *list, int count, char *buf, size_t len)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        cpusetToStr(buf, len, list[i]);
+        fprintf(epicsGetStdout(), "  %-8s %3d: %s\n", title, i, buf);
+    }
+}
+
+/**
+ * @brief Print the CPU topology.
+ */
+void mcoreTopologyShow(unsigned int level)
+{
+    char buf[topologyCpusetStrLen()];
+    int l;
+
+    topologyInit();
+    epicsMutexLock(topoLock);
+    fprintf(epicsGetStdout(), "CPU topology (from %s):\n", topologySysfsRoot());
+    cpusetToStr(buf, sizeof(buf), topo.configured);
+    fprintf(epicsGetStdout(), "  configured CPUs: %s\n", buf);
+    cpusetToStr(buf, sizeof(buf), topo.online);
+    fprintf(epicsGetStdout(), "  online CPUs:     %s\n", buf);
+    cpusetToStr(buf, sizeof(buf), topo.allowed);
+    fprintf(epicsGetStdout(), "  allowed CPUs:    %s\n", buf);
+    cpusetToStr(buf, sizeof(buf), topo.isolated);
+    fprintf(epicsGetStdout(), "  isolated CPUs:   %s\n", buf[0] ? buf : "-");
+    fprintf(epicsGetStdout(), "  %d package(s), %d core(s), %d NUMA node(s), %d cache level(s)\n",
+            topo.nPackages, topo.nCores, topo.nNodes, topo.cacheLevels);
+    if (level) {
+        showList("package", topo.packages, topo.nPackages, buf, sizeof(buf));
+        showList("core", topo.cores, topo.nCores, buf, sizeof(buf));
+        showList("node", topo.nodes, topo.nNodes, buf, sizeof(buf));
+        for (l = 1; l <= topo.cacheLevels; l++) {
+            char title[16];
+            sprintf(title, "L%d cache", l);
+            showList(title, topo.caches[l], topo.nCaches[l], buf, sizeof(buf));
+        }
+    }
+    epicsMutexUnlock(topoLock);
+}
+
+/**
+ *@}
+ */
@@ -0,0 +1,43 @@
+/********************************************//**
+ * @file
+ * @brief Header file for topology.c
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <sched.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const char *topologySysfsRoot(void);
+const char *topologyProcfsRoot(void);
+int readCpuList(const char *path, cpu_set_t *cpuset);
+int topologyNumCpus(void);
+int topologyCpusetStrLen(void);
+int topologyOnlineCpus(cpu_set_t *cpuset);
+int topologyAllowedCpus(cpu_set_t *cpuset);
+int topologyPackageCpus(int package, cpu_set_t *cpuset);
+int topologyCoreCpus(int core, cpu_set_t *cpuset);
+int topologyNodeCpus(int node, cpu_set_t *cpuset);
+int topologyDeviceCpus(const char *device, cpu_set_t *cpuset);
+int topologyCacheCpus(int level, int cache, cpu_set_t *cpuset);
+int topologyCpuCacheCpus(int level, int cpu, cpu_set_t *cpuset);
+int topologyLlcCpus(int llc, cpu_set_t *cpuset);
+int topologyIsolatedCpus(cpu_set_t *cpuset);
+void topologyNoSmt(cpu_set_t *cpuset);
+void topologyRefreshAllowed(const cpu_set_t *allowed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TOPOLOGY_H
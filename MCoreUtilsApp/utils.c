@@ -11,46 +11,310 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <sched.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
 
 #include <errlog.h>
+#include <epicsMath.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
 #include <shareLib.h>
 
 /// @cond NEVER
 #define epicsExportSharedSymbols
 /// @endcond
 #include "utils.h"
+#include "cpumask.h"
+#include "topology.h"
+#include "prioMap.h"
 
 epicsShareDef int cpuDigits;
 
+/// @cond NEVER
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_PRIO_MASK    ((1 << IOPRIO_CLASS_SHIFT) - 1)
+#define IOPRIO_WHO_PROCESS  1
+/// @endcond
+
+static const char *ioprioClasses[] = { "NONE", "RT", "BE", "IDLE" };
+
+/**
+ * @brief Parse a number or a range of numbers with optional stride
+ * (e.g. "2", "2-5" or "0-31:2").
+ *
+ * @param spec   range specification
+ * @param from   first number of the range
+ * @param to     last number of the range
+ * @param stride distance between the numbers of the range (1 if not specified)
+ * @return 0 on success, -1 on error
+ */
+static int parseRange(const char *spec, int *from, int *to, int *stride)
+{
+    char *endp;
+
+    *stride = 1;
+    *from = *to = strtol(spec, &endp, 10);
+    if (endp == spec) return -1;
+    if ('-' == *endp) {
+        spec = endp + 1;
+        *to = strtol(spec, &endp, 10);
+        if (endp == spec) return -1;
+        if (':' == *endp) {
+            spec = endp + 1;
+            *stride = strtol(spec, &endp, 10);
+            if (endp == spec) return -1;
+        }
+    }
+    if (*endp || *from < 0 || *to < *from || *stride < 1) return -1;
+    return 0;
+}
+
+/**
+ * @brief Parse an index or slice bound of the allowed CPUs.
+ *
+ * Negative values count from the end, as in Python.
+ *
+ * @param spec  string to parse
+ * @param endp  pointer to the first character after the number
+ * @param n     number of allowed CPUs
+ * @param value parsed (non-negative) value, unchanged if there is no number
+ */
+static void parseBound(const char *spec, char **endp, int n, int *value)
+{
+    long v = strtol(spec, endp, 10);
+
+    if (*endp != spec) {
+        *value = (int) (v < 0 ? n + v : v);
+    }
+}
+
+/**
+ * @brief Add the allowed CPUs selected by an index or a slice.
+ *
+ * The allowed CPUs are numbered in ascending order. The selection is
+ * empty (no index or slice) for all allowed CPUs, @c [i] for the i-th CPU,
+ * or @c [from:to] for the CPUs from index @c from up to, but not including, index @c to.
+ * Negative indices count from the end (@c [-1] is the last allowed CPU).
+ * Slice bounds are clamped to the allowed CPUs, so that a slice works for all
+ * container sizes. An index beyond the allowed CPUs is an error.
+ *
+ * @param spec   selection (after the @c allowed keyword)
+ * @param target cpuset to add the selected CPUs to
+ * @return 0 on success, -1 on error
+ */
+static int allowedSlice(const char *spec, cpu_set_t *target)
+{
+    const size_t setsize = cpusetSize();
+    cpu_set_t *allowed = cpusetAlloc();
+    char *endp;
+    int n, from = 0, to, index, cpu;
+
+    if (!allowed) return -1;
+    n = topologyAllowedCpus(allowed);
+    to = n;
+    if ('\0' == *spec) {
+        cpumaskOr(target, target, allowed, setsize);
+        cpusetFree(allowed);
+        return 0;
+    }
+    if ('[' != *spec++) {
+        cpusetFree(allowed);
+        return -1;
+    }
+    parseBound(spec, &endp, n, &from);
+    if (':' == *endp) {
+        if (endp == spec) from = 0;
+        spec = endp + 1;
+        parseBound(spec, &endp, n, &to);
+        if (from < 0) from = 0;
+        if (to > n) to = n;
+    } else if (endp == spec || from < 0 || from >= n) {
+        cpusetFree(allowed);
+        return -1;
+    } else {
+        to = from + 1;
+    }
+    if (']' != endp[0] || '\0' != endp[1]) {
+        cpusetFree(allowed);
+        return -1;
+    }
+    for (cpu = cpumaskNextSet(allowed, setsize, 0), index = 0;
+         cpu >= 0 && index < to;
+         cpu = cpumaskNextSet(allowed, setsize, cpu + 1), index++) {
+        if (index >= from) CPU_SET_S(cpu, setsize, target);
+    }
+    cpusetFree(allowed);
+    return 0;
+}
+
+/**
+ * @brief Get the size of the dynamically allocated cpusets.
+ *
+ * All cpusets are sized for the CPUs the kernel may ever bring online
+ * (see topologyNumCpus()), so that they can be passed to the affinity system calls.
+ *
+ * @return size of a cpuset in bytes
+ */
+size_t cpusetSize(void)
+{
+    return CPU_ALLOC_SIZE(topologyNumCpus());
+}
+
+/**
+ * @brief Allocate an empty cpuset.
+ *
+ * @return cpuset (to be released with cpusetFree()), NULL on error
+ */
+cpu_set_t *cpusetAlloc(void)
+{
+    cpu_set_t *cpuset = CPU_ALLOC(topologyNumCpus());
+
+    if (!cpuset) {
+        errlogPrintf("Memory allocation error\n");
+        return NULL;
+    }
+    CPU_ZERO_S(cpusetSize(), cpuset);
+    return cpuset;
+}
+
+/**
+ * @brief Free a cpuset allocated by cpusetAlloc().
+ *
+ * @param cpuset cpuset to free (may be NULL)
+ */
+void cpusetFree(cpu_set_t *cpuset)
+{
+    if (cpuset) CPU_FREE(cpuset);
+}
+
+/**
+ * @brief Copy a cpuset.
+ *
+ * @param dest cpuset to write into
+ * @param src  cpuset to copy
+ */
+void cpusetCopy(cpu_set_t *dest, const cpu_set_t *src)
+{
+    memcpy(dest, src, cpusetSize());
+}
+
 /**
  * @brief Convert a cpuset string specification (e.g. "0,2-3") to a cpuset.
  *
- * @param cpuset cpuset to write into
+ * The specification is a comma separated list of items, each being one of
+ * @li @c N or @c N-M  - CPU or range of CPUs
+ * @li @c core:R       - all CPUs (hyperthreads) of physical core(s) R
+ * @li @c nosmt:R      - CPUs R, keeping only one CPU per physical core
+ * @li @c llc:R        - all CPUs sharing last-level cache(s) R
+ * @li @c node:R       - all CPUs of NUMA node(s) R
+ * @li @c near:D       - all CPUs local to network interface or PCI device D
+ * @li @c isolated     - all isolated CPUs
+ * @li @c allowed      - all CPUs the process may use (container or cgroup cpuset)
+ * @li @c allowed[I]   - the I-th allowed CPU (negative I counts from the end)
+ * @li @c allowed[F:T] - the allowed CPUs from index F up to, but not including, index T
+ *                       (either may be omitted or negative)
+ *
+ * where @c R is a number or a range of numbers. Ranges may have a stride
+ * (e.g. @c 0-31:2 for the even CPUs 0 to 30).
+ * Items prefixed with @c ^ are excluded from the set, regardless of their position
+ * in the list (e.g. @c 0-7,^3).
+ *
+ * @param cpuset cpuset (allocated by cpusetAlloc()) to write into
  * @param spec   specification string
+ * @return 0 on success, -1 on error
  */
-void strToCpuset(cpu_set_t *cpuset, const char *spec)
+int strToCpuset(cpu_set_t *cpuset, const char *spec)
 {
+    const size_t setsize = cpusetSize();
+    const int ncpus = topologyNumCpus();
+    cpu_set_t *excluded = cpusetAlloc();
+    cpu_set_t *range = cpusetAlloc();
     char *buff = strdup(spec);
     char *tok, *save = NULL;
+    int status = 0;
 
-    CPU_ZERO(cpuset);
+    CPU_ZERO_S(setsize, cpuset);
+    if (!buff || !excluded || !range) {
+        errlogPrintf("Memory allocation error\n");
+        free(buff);
+        cpusetFree(excluded);
+        cpusetFree(range);
+        return -1;
+    }
 
     tok = strtok_r(buff, ",", &save);
-    while (tok) {
+    while (tok && !status) {
         int i;
-        int from, to;
-        from = to = atoi(tok);
-        char *sep = strstr(tok, "-");
-        if (sep) {
-            to = atoi(sep+1);
+        int from, to, stride;
+        cpu_set_t *target = cpuset;
+        char *arg;
+
+        if ('^' == *tok) {
+            target = excluded;
+            tok++;
         }
-        for (i = from; i <= to; i++) {
-            CPU_SET(i, cpuset);
+        arg = strchr(tok, ':');
+
+        if (0 == strcmp(tok, "isolated")) {
+            topologyIsolatedCpus(target);
+        } else if (0 == strncmp(tok, "allowed", 7)) {
+            status = allowedSlice(tok + 7, target);
+        } else if (0 == strncmp(tok, "near:", 5)) {
+            // PCI addresses contain colons, so this can't go through parseRange()
+            if ((status = topologyDeviceCpus(tok + 5, target)))
+                errlogPrintf("No CPUs found for device %s\n", tok + 5);
+        } else if (isdigit((unsigned char) *tok)) {
+            status = parseRange(tok, &from, &to, &stride);
+            if (!status && from < ncpus) {
+                cpumaskSetRange(target, setsize, from, to < ncpus ? to : ncpus - 1, stride);
+            }
+        } else if (!arg) {
+            status = -1;
+        } else {
+            *arg++ = '\0';
+            status = parseRange(arg, &from, &to, &stride);
+            if (status) {
+                break;
+            } else if (0 == strcmp(tok, "core")) {
+                for (i = from; !status && i <= to; i += stride) {
+                    status = topologyCoreCpus(i, target);
+                }
+            } else if (0 == strcmp(tok, "llc")) {
+                for (i = from; !status && i <= to; i += stride) {
+                    status = topologyLlcCpus(i, target);
+                }
+            } else if (0 == strcmp(tok, "node")) {
+                for (i = from; !status && i <= to; i += stride) {
+                    status = topologyNodeCpus(i, target);
+                }
+            } else if (0 == strcmp(tok, "nosmt")) {
+                CPU_ZERO_S(setsize, range);
+                if (from < ncpus) {
+                    cpumaskSetRange(range, setsize, from, to < ncpus ? to : ncpus - 1, stride);
+                }
+                topologyNoSmt(range);
+                cpumaskOr(target, target, range, setsize);
+            } else {
+                status = -1;
+            }
         }
         tok = strtok_r(NULL, ",", &save);
     }
+    cpumaskAndNot(cpuset, cpuset, excluded, setsize);
+    free(buff);
+    cpusetFree(excluded);
+    cpusetFree(range);
+
+    if (status) {
+        errlogPrintf("Invalid cpuset specification \"%s\"\n", spec);
+        CPU_ZERO_S(setsize, cpuset);
+    }
+    return status;
 }
 
 /**
@@ -62,34 +326,7 @@ void strToCpuset(cpu_set_t *cpuset, const char *spec)
  */
 void cpusetToStr(char *set, size_t len, const cpu_set_t *cpuset)
 {
-    int cpu = 0;
-    int l;
-    char buf[cpuDigits*2+3];
-
-    if (!set || !len) return;
-    set[0] = '\0';
-    while (cpu < NO_OF_CPUS) {
-        int from, to;
-        while (!CPU_ISSET(cpu, cpuset) && cpu < NO_OF_CPUS) {
-            cpu++;
-        }
-        if (cpu >= NO_OF_CPUS) {
-            break;
-        }
-        from = to = cpu++;
-        while (CPU_ISSET(cpu, cpuset) && cpu < NO_OF_CPUS) {
-            to = cpu++;
-        }
-        if (from == to) {
-            sprintf(buf, "%d,", from);
-        } else {
-            sprintf(buf, "%d-%d,", from, to);
-        }
-        strncat(set, buf, (len - 1 - strlen(set)));
-    }
-    if ((l = strlen(set))) {
-        set[l-1] = '\0';
-    }
+    cpumaskFormat(set, len, cpuset, cpusetSize());
 }
 
 /**
@@ -155,3 +392,586 @@ int strToPolicy(const char *string)
     }
     return policy;
 }
+
+/**
+ * @brief Convert an OSI priority to the POSIX priority of a scheduling policy.
+ *
+ * Uses the configured priority map (see mcorePriorityMap()) for the real-time
+ * policies, otherwise the same linear mapping as EPICS base does for its own threads.
+ *
+ * @param policy      scheduling policy
+ * @param osiPriority OSI priority to convert
+ * @return POSIX priority value
+ */
+int osiToPosixPriority(int policy, int osiPriority)
+{
+    int minPriority = sched_get_priority_min(policy);
+    int maxPriority = sched_get_priority_max(policy);
+    int posixPriority;
+
+    if (0 == prioMapToPosix(policy, osiPriority, &posixPriority)) return posixPriority;
+
+    if (minPriority < 0 || maxPriority < 0) return 0;
+    if (osiPriority >= epicsThreadPriorityMax) return maxPriority;
+    if (osiPriority <= epicsThreadPriorityMin) return minPriority;
+    return (int) ((double) osiPriority * (maxPriority - minPriority) / 100.0 + minPriority);
+}
+
+/**
+ * @brief Convert a POSIX priority of a scheduling policy to an OSI priority.
+ *
+ * Inverse of osiToPosixPriority(), rounding up so that converting the result
+ * back yields the original POSIX priority.
+ *
+ * @param policy        scheduling policy
+ * @param posixPriority POSIX priority to convert
+ * @return OSI priority value
+ */
+int posixToOsiPriority(int policy, int posixPriority)
+{
+    int minPriority = sched_get_priority_min(policy);
+    int maxPriority = sched_get_priority_max(policy);
+    int osiPriority;
+
+    if (0 == prioMapToOsi(policy, posixPriority, &osiPriority)) return osiPriority;
+
+    if (minPriority < 0 || maxPriority <= minPriority) return epicsThreadPriorityMin;
+    if (posixPriority >= maxPriority) return epicsThreadPriorityMax;
+    if (posixPriority <= minPriority) return epicsThreadPriorityMin;
+    return (int) ceil((double) (posixPriority - minPriority) * 100.0 / (maxPriority - minPriority));
+}
+
+/**
+ * @brief Read the scheduling attributes of a task.
+ *
+ * @param tid  Linux thread id (0 = calling thread)
+ * @param attr attributes to read into
+ * @return 0 on success, errno value on error
+ */
+int schedGetAttr(pid_t tid, mcoreSchedAttr *attr)
+{
+    memset(attr, 0, sizeof(mcoreSchedAttr));
+#ifdef SYS_sched_getattr
+    if (syscall(SYS_sched_getattr, tid, attr, sizeof(mcoreSchedAttr), 0)) {
+        return errno;
+    }
+    return 0;
+#else
+    return ENOSYS;
+#endif
+}
+
+/**
+ * @brief Set the scheduling attributes of a task.
+ *
+ * @param tid  Linux thread id (0 = calling thread)
+ * @param attr attributes to set
+ * @return 0 on success, errno value on error
+ */
+int schedSetAttr(pid_t tid, mcoreSchedAttr *attr)
+{
+    attr->size = sizeof(mcoreSchedAttr);
+#ifdef SYS_sched_setattr
+    if (syscall(SYS_sched_setattr, tid, attr, 0)) {
+        return errno;
+    }
+    return 0;
+#else
+    return ENOSYS;
+#endif
+}
+
+/**
+ * @brief Convert string I/O priority specification (e.g. "be/4") to I/O priority.
+ *
+ * The class is given by its first letter (RT, BE, IDLE, NONE; not case sensitive),
+ * optionally followed by a slash and the level (0..7, default 4).
+ *
+ * @param string string I/O priority specification
+ * @return I/O priority value, or -1 on error
+ */
+int strToIoprio(const char *string)
+{
+    int ioclass;
+    int level = 4;
+    const char *sep = strchr(string, '/');
+
+    if (0 == strncasecmp(string, "RT", 1)) {
+        ioclass = 1;
+    } else if (0 == strncasecmp(string, "BE", 1)) {
+        ioclass = 2;
+    } else if (0 == strncasecmp(string, "IDLE", 1)) {
+        ioclass = 3;
+        level = 0;
+    } else if (0 == strncasecmp(string, "NONE", 1)) {
+        ioclass = 0;
+        level = 0;
+    } else {
+        errlogPrintf("Invalid I/O priority \"%s\"\n", string);
+        return -1;
+    }
+    if (sep) {
+        level = atoi(sep+1);
+        if (level < 0 || level > 7) {
+            errlogPrintf("Invalid I/O priority level \"%s\"\n", string);
+            return -1;
+        }
+    }
+    return (ioclass << IOPRIO_CLASS_SHIFT) | level;
+}
+
+/**
+ * @brief Convert I/O priority into its string specification (e.g. "BE/4").
+ *
+ * @param str    output buffer to write into
+ * @param len    length of @p str
+ * @param ioprio I/O priority to convert
+ */
+void ioprioToStr(char *str, size_t len, int ioprio)
+{
+    int ioclass = ioprio >> IOPRIO_CLASS_SHIFT;
+
+    if (!str || !len) return;
+    if (ioprio < 0 || ioclass > 3) {
+        snprintf(str, len, "?");
+    } else if (1 == ioclass || 2 == ioclass) {
+        snprintf(str, len, "%s/%d", ioprioClasses[ioclass], ioprio & IOPRIO_PRIO_MASK);
+    } else {
+        snprintf(str, len, "%s", ioprioClasses[ioclass]);
+    }
+}
+
+/**
+ * @brief Read the I/O priority of a task.
+ *
+ * @param tid Linux thread id (0 = calling thread)
+ * @return I/O priority value, or -1 on error
+ */
+int getIoprio(pid_t tid)
+{
+#ifdef SYS_ioprio_get
+    return (int) syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, tid);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/**
+ * @brief Set the I/O priority of a task.
+ *
+ * @param tid    Linux thread id (0 = calling thread)
+ * @param ioprio I/O priority value
+ * @return 0 on success, errno value on error
+ */
+int setIoprio(pid_t tid, int ioprio)
+{
+#ifdef SYS_ioprio_set
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, ioprio)) {
+        return errno;
+    }
+    return 0;
+#else
+    return ENOSYS;
+#endif
+}
+
+/**
+ * @brief Read the timer slack of a task.
+ *
+ * Uses prctl(2) for the calling thread, /proc/<tid>/timerslack_ns otherwise.
+ *
+ * @param tid Linux thread id (0 = calling thread)
+ * @return timer slack in ns, or -1 on error
+ */
+long getTimerSlack(pid_t tid)
+{
+    char path[64];
+    long slack = -1;
+    FILE *fp;
+
+    if (0 == tid || (pid_t) syscall(SYS_gettid) == tid) {
+        return (long) prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+    }
+    sprintf(path, "/proc/%d/timerslack_ns", (int) tid);
+    fp = fopen(path, "r");
+    if (!fp) return -1;
+    if (1 != fscanf(fp, "%ld", &slack)) {
+        slack = -1;
+    }
+    fclose(fp);
+    return slack;
+}
+
+/**
+ * @brief Set the timer slack of a task.
+ *
+ * Uses prctl(2) for the calling thread, /proc/<tid>/timerslack_ns otherwise
+ * (Linux 4.6+; writing it needs CAP_SYS_NICE on current kernels, also for
+ * threads of the own process).
+ *
+ * @param tid   Linux thread id (0 = calling thread)
+ * @param slack timer slack in ns (0 = reset to the process default)
+ * @return 0 on success, errno value on error
+ */
+int setTimerSlack(pid_t tid, unsigned long slack)
+{
+    char path[64];
+    int status = 0;
+    FILE *fp;
+
+    if (0 == tid || (pid_t) syscall(SYS_gettid) == tid) {
+        return prctl(PR_SET_TIMERSLACK, slack, 0, 0, 0) ? errno : 0;
+    }
+    sprintf(path, "/proc/%d/timerslack_ns", (int) tid);
+    fp = fopen(path, "w");
+    if (!fp) return errno;
+    if (fprintf(fp, "%lu\n", slack) < 0) {
+        status = errno;
+    }
+    if (fclose(fp) && !status) {
+        status = errno;
+    }
+    return status;
+}
+
+/**
+ * @brief Format a file name (printf style) into a buffer.
+ *
+ * Used for paths below the configurable sysfs, procfs and cgroupfs roots,
+ * which may be too long for the caller's buffer.
+ *
+ * @param path   buffer to write the file name into
+ * @param len    length of @p path
+ * @param format printf style format
+ * @return 0 on success, ENAMETOOLONG if the name was truncated
+ */
+int formatPath(char *path, size_t len, const char *format, ...)
+{
+    va_list args;
+    int n;
+
+    va_start(args, format);
+    n = vsnprintf(path, len, format, args);
+    va_end(args);
+    if (n < 0 || (size_t) n >= len) {
+        return ENAMETOOLONG;
+    }
+    return 0;
+}
+
+/**
+ * @brief Check if a task of the process (still) exists.
+ *
+ * @param tid Linux thread id
+ * @return 1 if the task exists, 0 otherwise
+ */
+int taskExists(pid_t tid)
+{
+    char path[64];
+
+    sprintf(path, "/proc/self/task/%d", (int) tid);
+    return 0 == access(path, F_OK);
+}
+
+/**
+ * @brief Get the CPU a task of the process last ran on.
+ *
+ * @param tid Linux thread id (0 = calling thread)
+ * @return CPU number, -1 on error
+ */
+int taskCpu(pid_t tid)
+{
+    char path[64];
+    char buf[1024];
+    char *cp, *save = NULL;
+    int field;
+    FILE *fp;
+
+    if (0 == tid) {
+        return sched_getcpu();
+    }
+    sprintf(path, "/proc/self/task/%d/stat", (int) tid);
+    fp = fopen(path, "r");
+    if (!fp) return -1;
+    if (!fgets(buf, sizeof(buf), fp)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    // skip pid and (comm), which may contain spaces
+    if (!(cp = strrchr(buf, ')'))) return -1;
+    // field 39 (processor), counting from the state as field 3
+    cp = strtok_r(cp + 1, " ", &save);
+    for (field = 3; cp && field < 39; field++) {
+        cp = strtok_r(NULL, " ", &save);
+    }
+    return cp ? atoi(cp) : -1;
+}
+
+/**
+ * @brief Read the name of a task of the process.
+ *
+ * @param tid  Linux thread id
+ * @param name buffer to write the name into
+ * @param len  length of @p name
+ * @return 0 on success, -1 if the task does not exist (any more)
+ */
+int taskName(pid_t tid, char *name, size_t len)
+{
+    char path[64];
+    char *cp;
+    FILE *fp;
+
+    sprintf(path, "/proc/self/task/%d/comm", (int) tid);
+    fp = fopen(path, "r");
+    if (!fp) return -1;
+    if (!fgets(name, len, fp)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    if ((cp = strpbrk(name, "\n\r"))) {
+        *cp = '\0';
+    }
+    return 0;
+}
+
+/**
+ * @brief Read the scheduler statistics of a task of the process.
+ *
+ * @param tid     Linux thread id
+ * @param runtime time spent running on a CPU [ns]
+ * @param delay   time spent waiting on a run queue [ns]
+ * @param slices  number of times the task was scheduled on a CPU (NULL = not needed)
+ * @return 0 on success, -1 on error
+ */
+int taskSchedstat(pid_t tid, unsigned long long *runtime, unsigned long long *delay,
+                  unsigned long *slices)
+{
+    char path[64];
+    unsigned long count = 0;
+    FILE *fp;
+    int n;
+
+    sprintf(path, "/proc/self/task/%d/schedstat", (int) tid);
+    fp = fopen(path, "r");
+    if (!fp) return -1;
+    n = fscanf(fp, "%llu %llu %lu", runtime, delay, &count);
+    fclose(fp);
+    if (slices) *slices = count;
+    return n >= 2 ? 0 : -1;
+}
+
+/**
+ * @brief Read the number of voluntary context switches of a task of the process.
+ *
+ * @param tid       Linux thread id
+ * @param voluntary number of times the task blocked (output)
+ * @return 0 on success, -1 on error
+ */
+int taskSwitches(pid_t tid, unsigned long *voluntary)
+{
+    char path[64];
+    char line[128];
+    int status = -1;
+    FILE *fp;
+
+    sprintf(path, "/proc/self/task/%d/status", (int) tid);
+    fp = fopen(path, "r");
+    if (!fp) return -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (1 == sscanf(line, "voluntary_ctxt_switches: %lu", voluntary)) {
+            status = 0;
+            break;
+        }
+    }
+    fclose(fp);
+    return status;
+}
+
+/**
+ * @brief Read the accumulated times of all CPUs from /proc/stat.
+ *
+ * Entries of CPUs that are not listed (offline) are set to zero.
+ *
+ * @param times array of CPU times [ticks]
+ * @param ncpus length of the array
+ * @return number of CPUs read, -1 on error
+ */
+int readCpuTimes(mcoreCpuTimes *times, int ncpus)
+{
+    char line[256];
+    int count = 0;
+    FILE *fp;
+
+    memset(times, 0, ncpus * sizeof(mcoreCpuTimes));
+    fp = fopen("/proc/stat", "r");
+    if (!fp) return -1;
+    while (fgets(line, sizeof(line), fp)) {
+        mcoreCpuTimes t;
+        int cpu;
+
+        if (strncmp(line, "cpu", 3) || !isdigit((unsigned char) line[3]))
+            continue;
+        memset(&t, 0, sizeof(t));
+        if (sscanf(line + 3, "%d %llu %llu %llu %llu %llu %llu %llu %llu", &cpu,
+                   &t.user, &t.nice, &t.system, &t.idle, &t.iowait,
+                   &t.irq, &t.softirq, &t.steal) < 5
+                || cpu < 0 || cpu >= ncpus)
+            continue;
+        times[cpu] = t;
+        count++;
+    }
+    fclose(fp);
+    return count;
+}
+
+/**
+ * @brief Get the busy time (user, nice, system, irq, softirq, steal) of a CPU.
+ *
+ * @param times CPU times
+ * @return busy time [ticks]
+ */
+unsigned long long cpuTimesBusy(const mcoreCpuTimes *times)
+{
+    return times->user + times->nice + times->system
+            + times->irq + times->softirq + times->steal;
+}
+
+/**
+ * @brief Get the total time (busy, idle and iowait) of a CPU.
+ *
+ * @param times CPU times
+ * @return total time [ticks]
+ */
+unsigned long long cpuTimesTotal(const mcoreCpuTimes *times)
+{
+    return cpuTimesBusy(times) + times->idle + times->iowait;
+}
+
+/**
+ * @brief Start arguments of a thread of MCoreUtils itself.
+ */
+typedef struct ownThreadStart {
+    EPICSTHREADFUNC func;       ///< thread function
+    void           *parm;       ///< argument of the thread function
+} ownThreadStart;
+
+static epicsMutexId ownLock;
+static epicsThreadId *ownThreads;       ///< threads created by ownThreadCreate()
+static size_t nOwn, maxOwn;
+static __thread int creatingOwn;        ///< flag: the calling thread is in ownThreadCreate()
+
+static void ownOnce(void *arg)
+{
+    ownLock = epicsMutexMustCreate();
+}
+
+/**
+ * @brief Main function of the threads of MCoreUtils, forgetting the thread when it ends.
+ *
+ * @param arg start arguments (ownThreadStart, freed)
+ */
+static void ownThreadMain(void *arg)
+{
+    ownThreadStart start = *(ownThreadStart *) arg;
+    epicsThreadId id = epicsThreadGetIdSelf();
+    size_t i;
+
+    free(arg);
+    start.func(start.parm);
+    epicsMutexLock(ownLock);
+    for (i = 0; i < nOwn; i++) {
+        if (ownThreads[i] == id) {
+            ownThreads[i] = ownThreads[--nOwn];
+            break;
+        }
+    }
+    epicsMutexUnlock(ownLock);
+}
+
+/**
+ * @brief Create a thread of MCoreUtils itself, which no thread rule applies to.
+ *
+ * The thread is recorded before its start hooks can look it up:
+ * isOwnThread() waits for the creation to finish.
+ *
+ * @param name      thread name
+ * @param priority  OSI priority
+ * @param stackSize stack size
+ * @param func      thread function
+ * @param parm      argument of the thread function
+ * @return thread id, NULL on error
+ */
+epicsThreadId ownThreadCreate(const char *name, unsigned int priority, unsigned int stackSize,
+                              EPICSTHREADFUNC func, void *parm)
+{
+    static epicsThreadOnceId onceFlag = EPICS_THREAD_ONCE_INIT;
+    ownThreadStart *start = malloc(sizeof(ownThreadStart));
+    epicsThreadId id = NULL;
+
+    epicsThreadOnce(&onceFlag, ownOnce, NULL);
+    if (!start) {
+        errlogPrintf("Memory allocation error\n");
+        return NULL;
+    }
+    start->func = func;
+    start->parm = parm;
+    epicsMutexLock(ownLock);
+    if (nOwn == maxOwn) {
+        size_t max = maxOwn ? 2 * maxOwn : 16;
+        epicsThreadId *list = realloc(ownThreads, max * sizeof(epicsThreadId));
+        if (!list) {
+            errlogPrintf("Memory allocation error\n");
+            epicsMutexUnlock(ownLock);
+            free(start);
+            return NULL;
+        }
+        ownThreads = list;
+        maxOwn = max;
+    }
+    creatingOwn = 1;
+    id = epicsThreadCreate(name, priority, stackSize, ownThreadMain, start);
+    creatingOwn = 0;
+    if (id) {
+        ownThreads[nOwn++] = id;
+    } else {
+        free(start);
+    }
+    epicsMutexUnlock(ownLock);
+    return id;
+}
+
+/**
+ * @brief Check whether a thread was created by ownThreadCreate().
+ *
+ * @param id EPICS thread id
+ * @return 1 if it was, 0 if not
+ */
+int isOwnThread(epicsThreadId id)
+{
+    size_t i;
+    int own = 0;
+
+    if (!ownLock) return 0;
+    epicsMutexLock(ownLock);
+    for (i = 0; i < nOwn && !own; i++) {
+        own = (ownThreads[i] == id);
+    }
+    epicsMutexUnlock(ownLock);
+    return own;
+}
+
+/**
+ * @brief Check whether the calling thread is creating a thread in ownThreadCreate().
+ *
+ * Used when the thread being created has no EPICS thread id yet
+ * (thread creation interposer).
+ *
+ * @return 1 if it is, 0 if not
+ */
+int ownThreadCreating(void)
+{
+    return creatingOwn;
+}
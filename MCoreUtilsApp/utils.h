@@ -12,14 +12,45 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stdint.h>
 #include <sched.h>
 #include <unistd.h>
+#include <sys/types.h>
 
 #include <errlog.h>
+#include <epicsThread.h>
+#include <compilerDependencies.h>
 #include <shareLib.h>
 
-// TODO: Use libCom call when get-cpus branch is merged
-#define NO_OF_CPUS sysconf(_SC_NPROCESSORS_CONF)
+/// @cond NEVER
+#ifndef SCHED_FLAG_RESET_ON_FORK
+#define SCHED_FLAG_RESET_ON_FORK    0x01
+#endif
+#ifndef SCHED_FLAG_KEEP_POLICY
+#define SCHED_FLAG_KEEP_POLICY      0x08
+#endif
+#ifndef SCHED_FLAG_KEEP_PARAMS
+#define SCHED_FLAG_KEEP_PARAMS      0x10
+#endif
+#ifndef SCHED_FLAG_UTIL_CLAMP_MIN
+#define SCHED_FLAG_UTIL_CLAMP_MIN   0x20
+#endif
+#ifndef SCHED_FLAG_UTIL_CLAMP_MAX
+#define SCHED_FLAG_UTIL_CLAMP_MAX   0x40
+#endif
+/// @endcond
+
+/**
+ * @brief Size of the sched_setattr(2) attributes including the utilization clamps.
+ *
+ * Kernels older than 5.3 return a smaller size and no utilization clamps.
+ */
+#define SCHED_ATTR_SIZE_UCLAMP 56
+
+/**
+ * @brief Maximum utilization clamp value.
+ */
+#define UCLAMP_MAX 1024
 
 #define checkStatus(status,message) \
 if((status))  {\
@@ -37,10 +68,70 @@ extern "C" {
  */
 epicsShareExtern int cpuDigits;
 
-void strToCpuset(cpu_set_t *cpuset, const char *spec);
+/**
+ * @brief Scheduling attributes as used by the sched_setattr(2) system call.
+ *
+ * Not all C libraries provide this structure, so it is defined here.
+ */
+typedef struct mcoreSchedAttr {
+    uint32_t size;              ///< size of the structure
+    uint32_t sched_policy;      ///< scheduling policy
+    uint64_t sched_flags;       ///< scheduling flags
+    int32_t  sched_nice;        ///< nice value (SCHED_OTHER, SCHED_BATCH)
+    uint32_t sched_priority;    ///< static priority (SCHED_FIFO, SCHED_RR)
+    uint64_t sched_runtime;     ///< runtime (SCHED_DEADLINE)
+    uint64_t sched_deadline;    ///< deadline (SCHED_DEADLINE)
+    uint64_t sched_period;      ///< period (SCHED_DEADLINE)
+    uint32_t sched_util_min;    ///< utilization clamp minimum
+    uint32_t sched_util_max;    ///< utilization clamp maximum
+} mcoreSchedAttr;
+
+/**
+ * @brief Accumulated times of a CPU, as read from /proc/stat [ticks].
+ */
+typedef struct mcoreCpuTimes {
+    unsigned long long user;    ///< user mode
+    unsigned long long nice;    ///< user mode, niced
+    unsigned long long system;  ///< kernel mode
+    unsigned long long idle;    ///< idle
+    unsigned long long iowait;  ///< idle, waiting for I/O
+    unsigned long long irq;     ///< servicing interrupts
+    unsigned long long softirq; ///< servicing softirqs
+    unsigned long long steal;   ///< stolen by the hypervisor
+} mcoreCpuTimes;
+
+size_t cpusetSize(void);
+cpu_set_t *cpusetAlloc(void);
+void cpusetFree(cpu_set_t *cpuset);
+void cpusetCopy(cpu_set_t *dest, const cpu_set_t *src);
+int strToCpuset(cpu_set_t *cpuset, const char *spec);
 void cpusetToStr(char *set, size_t len, const cpu_set_t *cpuset);
 const char *policyToStr(const int policy);
 int strToPolicy(const char *string);
+int osiToPosixPriority(int policy, int osiPriority);
+int posixToOsiPriority(int policy, int posixPriority);
+int schedGetAttr(pid_t tid, mcoreSchedAttr *attr);
+int schedSetAttr(pid_t tid, mcoreSchedAttr *attr);
+int strToIoprio(const char *string);
+void ioprioToStr(char *str, size_t len, int ioprio);
+int getIoprio(pid_t tid);
+int setIoprio(pid_t tid, int ioprio);
+long getTimerSlack(pid_t tid);
+int setTimerSlack(pid_t tid, unsigned long slack);
+int formatPath(char *path, size_t len, const char *format, ...) EPICS_PRINTF_STYLE(3,4);
+int taskExists(pid_t tid);
+int taskCpu(pid_t tid);
+int taskName(pid_t tid, char *name, size_t len);
+int taskSchedstat(pid_t tid, unsigned long long *runtime, unsigned long long *delay,
+                  unsigned long *slices);
+int taskSwitches(pid_t tid, unsigned long *voluntary);
+int readCpuTimes(mcoreCpuTimes *times, int ncpus);
+unsigned long long cpuTimesBusy(const mcoreCpuTimes *times);
+unsigned long long cpuTimesTotal(const mcoreCpuTimes *times);
+epicsThreadId ownThreadCreate(const char *name, unsigned int priority, unsigned int stackSize,
+                              EPICSTHREADFUNC func, void *parm);
+int isOwnThread(epicsThreadId id);
+int ownThreadCreating(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,610 @@
+/********************************************//**
+ * @file
+ * @brief Watchdog demoting runaway real-time threads.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * Threads matching a rule with the @c budget option are registered with
+ * the watchdog. Once per period, the watchdog reads the run time of each
+ * thread from @c /proc/self/task/<tid>/schedstat and sums it over a sliding
+ * window. A FIFO or RR thread that used more than its budget (percentage
+ * of one CPU) over the complete window is demoted to @c SCHED_OTHER, and
+ * an alarm is logged.
+ *
+ * Optionally, the @c RLIMIT_RTTIME resource limit makes the kernel send
+ * @c SIGXCPU when a real-time thread has been running for a given time without
+ * blocking. The signal is sent to the process and delivered to any thread that does
+ * not block it (EPICS threads block all signals), so the handler can't tell which
+ * thread exceeded the limit: it only counts the signal. The next watchdog pass
+ * demotes the registered FIFO or RR threads whose run time grew without a voluntary
+ * context switch since the previous pass, and logs the alarm.
+ *
+ * Only the kernel's scheduling attributes of a demoted thread are changed. An EPICS thread
+ * keeps its recorded policy and priority, so that a later epicsThreadSetPriority() makes it
+ * real-time again (and the watchdog watches it as before).
+ *
+ * The watchdog thread runs at the highest FIFO priority, pinned to the
+ * housekeeping CPUs (by default, the allowed CPUs that no real-time rule uses).
+ * Thread rules do not apply to it.
+ *
+ * @ingroup threadrules
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <errlog.h>
+#include <epicsStdio.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <shareLib.h>
+
+#include "utils.h"
+#include "cpumask.h"
+#include "topology.h"
+#include "threadRules.h"
+#include "watchdog.h"
+
+/// @cond NEVER
+#define epicsExportSharedSymbols
+/// @endcond
+#include "mcoreutils.h"
+
+/// maximum number of periods in the window
+#define WATCHDOG_SLOTS 100
+/// number of alarms kept for mcoreWatchdogShow()
+#define WATCHDOG_LOG_SIZE 32
+
+/**
+ * @brief A thread watched by the watchdog.
+ */
+typedef struct watchedTask {
+    char       *name;           ///< name of the rule that registered the thread
+    pid_t       tid;            ///< Linux thread id
+    double      budget;         ///< CPU time budget (fraction of one CPU)
+    char        sampled;        ///< flag: run time has been sampled
+    char        demoted;        ///< flag: demoted by the watchdog
+    char        switched;       ///< flag: voluntary context switches have been sampled
+    unsigned long long runtime; ///< run time at the last pass [ns]
+    unsigned long voluntary;    ///< voluntary context switches at the last pass
+    double      run[WATCHDOG_SLOTS];     ///< run time of the last periods [ns]
+    double      elapsed[WATCHDOG_SLOTS]; ///< duration of the last periods [ns]
+    double      sumRun;         ///< run time in the window [ns]
+    double      sumElapsed;     ///< duration of the window [ns]
+    unsigned int nSlots;        ///< number of valid periods in the window
+    unsigned int next;          ///< window position of the next period
+    double      usage;          ///< CPU usage over the window (fraction of one CPU)
+} watchedTask;
+
+/**
+ * @brief An alarm raised by the watchdog.
+ */
+typedef struct watchdogAlarm {
+    epicsTimeStamp time;        ///< time of the alarm
+    pid_t       tid;            ///< Linux thread id
+    double      usage;          ///< CPU usage over the window (0 = RLIMIT_RTTIME)
+    int         status;         ///< result of the demotion (0 = demoted, errno on error)
+} watchdogAlarm;
+
+static epicsMutexId wdLock;
+static watchedTask *tasks;
+static size_t nTasks, maxTasks;
+static watchdogAlarm alarms[WATCHDOG_LOG_SIZE];
+static unsigned long nAlarms;
+static epicsThreadId wdThread;
+static epicsEventId wdEvent;
+static double wdPeriod;
+static double wdWindow;
+static unsigned int wdSlots = 1;
+static cpu_set_t *wdCpuset;
+static char wdCpusSet;
+static char wdPlace;                    ///< flag: the watchdog thread has to (re-)place itself
+static unsigned long rtTime;
+static struct timespec prevTime;
+static volatile int rtTimeSignals;      ///< SIGXCPU signals since the last pass
+
+/**
+ * @brief Counters of the watchdog.
+ */
+static struct {
+    unsigned long passes;       ///< watchdog passes
+    unsigned long demotions;    ///< threads demoted for exceeding their budget
+    unsigned long rttime;       ///< threads demoted for exceeding RLIMIT_RTTIME
+    unsigned long errors;       ///< errors demoting threads
+} counters;
+
+static watchedTask *findTask(pid_t tid)
+{
+    size_t i;
+    for (i = 0; i < nTasks; i++) {
+        if (tasks[i].tid == tid) return &tasks[i];
+    }
+    return NULL;
+}
+
+static void removeTask(size_t i)
+{
+    free(tasks[i].name);
+    tasks[i] = tasks[--nTasks];
+}
+
+static void resetWindow(watchedTask *pt)
+{
+    pt->sumRun = pt->sumElapsed = pt->usage = 0.0;
+    pt->nSlots = pt->next = 0;
+}
+
+/**
+ * @brief Demote a real-time thread to SCHED_OTHER.
+ *
+ * @param tid Linux thread id
+ * @return 0 on success, -1 if the thread is not real-time, errno on error
+ */
+static int demote(pid_t tid)
+{
+    mcoreSchedAttr attr;
+    int status;
+
+    status = schedGetAttr(tid, &attr);
+    if (status) return status;
+    if (SCHED_FIFO != attr.sched_policy && SCHED_RR != attr.sched_policy) return -1;
+    attr.sched_flags &= SCHED_FLAG_RESET_ON_FORK;
+    attr.sched_policy = SCHED_OTHER;
+    attr.sched_priority = 0;
+    return schedSetAttr(tid, &attr);
+}
+
+static void raiseAlarm(pid_t tid, double usage, int status)
+{
+    watchdogAlarm *pa = &alarms[nAlarms++ % WATCHDOG_LOG_SIZE];
+    char name[32];
+
+    epicsTimeGetCurrent(&pa->time);
+    pa->tid = tid;
+    pa->usage = usage;
+    pa->status = status;
+    if (taskName(tid, name, sizeof(name))) strcpy(name, "?");
+    if (usage > 0.0) {
+        mcoreLog("mcoreWatchdog: ALARM thread %s (LWP %d) used %.0f%% CPU, %s\n",
+                 name, (int) tid, usage * 100.0,
+                 status ? "demotion failed" : "demoted to SCHED_OTHER");
+    } else {
+        mcoreLog("mcoreWatchdog: ALARM thread %s (LWP %d) exceeded RLIMIT_RTTIME, %s\n",
+                 name, (int) tid, status ? "demotion failed" : "demoted to SCHED_OTHER");
+    }
+}
+
+/**
+ * @brief SIGXCPU handler, counting the signal for the next watchdog pass.
+ *
+ * The thread running the handler is not the one that exceeded the limit,
+ * so nothing is done here.
+ *
+ * @param sig signal number
+ */
+static void rtTimeHandler(int sig)
+{
+    __sync_fetch_and_add(&rtTimeSignals, 1);
+}
+
+/**
+ * @brief Register a thread with the watchdog.
+ *
+ * A thread that is already registered gets the new rule name and budget.
+ *
+ * @param name   name of the rule
+ * @param tid    Linux thread id
+ * @param budget CPU time budget (percent of one CPU)
+ */
+void watchdogRegister(const char *name, pid_t tid, unsigned int budget)
+{
+    watchedTask *pt;
+    char *nm;
+
+    watchdogInit();
+    epicsMutexLock(wdLock);
+    if (!(nm = strdup(name))) {
+        mcoreLog("Memory allocation error\n");
+        epicsMutexUnlock(wdLock);
+        return;
+    }
+    if (!(pt = findTask(tid))) {
+        if (nTasks == maxTasks) {
+            size_t max = maxTasks ? 2 * maxTasks : 16;
+            watchedTask *list = realloc(tasks, max * sizeof(watchedTask));
+            if (!list) {
+                mcoreLog("Memory allocation error\n");
+                free(nm);
+                epicsMutexUnlock(wdLock);
+                return;
+            }
+            tasks = list;
+            maxTasks = max;
+        }
+        pt = &tasks[nTasks++];
+        memset(pt, 0, sizeof(watchedTask));
+        pt->tid = tid;
+    }
+    free(pt->name);
+    pt->name = nm;
+    pt->budget = budget / 100.0;
+    pt->demoted = 0;
+    epicsMutexUnlock(wdLock);
+}
+
+/**
+ * @brief Stop watching all threads registered by a rule.
+ *
+ * @param name name of the rule
+ */
+void watchdogRelease(const char *name)
+{
+    size_t i;
+
+    watchdogInit();
+    epicsMutexLock(wdLock);
+    for (i = 0; i < nTasks; ) {
+        if (0 == strcmp(name, tasks[i].name)) {
+            removeTask(i);
+        } else {
+            i++;
+        }
+    }
+    epicsMutexUnlock(wdLock);
+}
+
+/**
+ * @brief Count the threads registered by a rule.
+ *
+ * @param name name of the rule
+ * @return number of threads
+ */
+int watchdogCount(const char *name)
+{
+    size_t i;
+    int count = 0;
+
+    watchdogInit();
+    epicsMutexLock(wdLock);
+    for (i = 0; i < nTasks; i++) {
+        if (0 == strcmp(name, tasks[i].name)) count++;
+    }
+    epicsMutexUnlock(wdLock);
+    return count;
+}
+
+/**
+ * @brief Run one watchdog pass.
+ */
+static void watchdogPass(void)
+{
+    struct timespec now;
+    double elapsed;
+    size_t i;
+    int signals, found = 0;
+
+    epicsMutexLock(wdLock);
+    counters.passes++;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - prevTime.tv_sec) * 1e9 + (now.tv_nsec - prevTime.tv_nsec);
+    prevTime = now;
+    signals = __sync_fetch_and_and(&rtTimeSignals, 0);
+
+    for (i = 0; i < nTasks; ) {
+        watchedTask *pt = &tasks[i];
+        unsigned long long runtime, delay;
+        unsigned long voluntary = 0;
+        int switched, runaway;
+
+        if (taskSchedstat(pt->tid, &runtime, &delay, NULL)) {
+            removeTask(i);
+            continue;
+        }
+        i++;
+
+        // RLIMIT_RTTIME: the thread has been running without blocking since the last pass
+        switched = rtTime && 0 == taskSwitches(pt->tid, &voluntary);
+        runaway = signals && switched && pt->switched && pt->sampled
+                  && runtime > pt->runtime && voluntary == pt->voluntary;
+        pt->voluntary = voluntary;
+        pt->switched = switched;
+        if (runaway) {
+            int status = demote(pt->tid);
+            if (-1 != status) {
+                if (status) {
+                    counters.errors++;
+                } else {
+                    counters.rttime++;
+                    pt->demoted = 1;
+                }
+                raiseAlarm(pt->tid, 0.0, status);
+                resetWindow(pt);
+                found++;
+            }
+        }
+        if (pt->sampled) {
+            if (pt->nSlots == wdSlots) {
+                pt->sumRun -= pt->run[pt->next];
+                pt->sumElapsed -= pt->elapsed[pt->next];
+            } else {
+                pt->nSlots++;
+            }
+            pt->run[pt->next] = runtime - pt->runtime;
+            pt->elapsed[pt->next] = elapsed;
+            pt->sumRun += pt->run[pt->next];
+            pt->sumElapsed += elapsed;
+            pt->next = (pt->next + 1) % wdSlots;
+            pt->usage = pt->sumElapsed > 0.0 ? pt->sumRun / pt->sumElapsed : 0.0;
+        }
+        pt->runtime = runtime;
+        pt->sampled = 1;
+
+        if (pt->nSlots == wdSlots && pt->usage > pt->budget) {
+            int status = demote(pt->tid);
+            if (-1 != status) {
+                if (status) {
+                    counters.errors++;
+                } else {
+                    counters.demotions++;
+                    pt->demoted = 1;
+                }
+                raiseAlarm(pt->tid, pt->usage, status);
+            }
+            resetWindow(pt);
+        }
+    }
+    if (signals && !found) {
+        mcoreLog("mcoreWatchdog: RLIMIT_RTTIME exceeded, no watched thread found running without blocking\n");
+    }
+    epicsMutexUnlock(wdLock);
+}
+
+/**
+ * @brief Move the calling (watchdog) thread to the highest FIFO priority
+ * on the housekeeping CPUs.
+ */
+static void watchdogPlace(void)
+{
+    const size_t setsize = cpusetSize();
+    cpu_set_t *cpuset = cpusetAlloc();
+    cpu_set_t *rtset = cpusetAlloc();
+    struct sched_param param;
+    int status;
+
+    param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+    status = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (status) {
+        errlogPrintf("mcoreWatchdog: can't set FIFO priority %d (%s)\n",
+                     param.sched_priority, strerror(status));
+    }
+    if (!cpuset || !rtset) {
+        cpusetFree(cpuset);
+        cpusetFree(rtset);
+        return;
+    }
+    // the housekeeping CPUs are looked up before taking wdLock: rtRulesCpuset() takes
+    // the rule list lock, which the thread start hook holds when registering threads
+    topologyAllowedCpus(cpuset);
+    if (rtRulesCpuset(rtset)) {
+        cpumaskAndNot(rtset, cpuset, rtset, setsize);
+        if (cpumaskCount(rtset, setsize)) {
+            cpusetCopy(cpuset, rtset);
+        }
+    }
+    epicsMutexLock(wdLock);
+    if (wdCpusSet) {
+        cpusetCopy(cpuset, wdCpuset);
+    }
+    epicsMutexUnlock(wdLock);
+    status = sched_setaffinity(0, setsize, cpuset) ? errno : 0;
+    if (status && errVerbose)
+        mcoreLog("sched_setaffinity error %s\n", strerror(status));
+    cpusetFree(cpuset);
+    cpusetFree(rtset);
+}
+
+/**
+ * @brief Watchdog thread main loop, running until the period is set to zero.
+ *
+ * @param arg unused
+ */
+static void watchdogLoop(void *arg)
+{
+    epicsMutexLock(wdLock);
+    while (wdPeriod > 0.0) {
+        double period = wdPeriod;
+        int place = wdPlace;
+        wdPlace = 0;
+        epicsMutexUnlock(wdLock);
+        if (place) watchdogPlace();
+        watchdogPass();
+        epicsEventWaitWithTimeout(wdEvent, period);
+        epicsMutexLock(wdLock);
+    }
+    wdThread = NULL;
+    epicsMutexUnlock(wdLock);
+}
+
+/**
+ * @brief Start, reconfigure or stop the watchdog.
+ */
+void mcoreWatchdogPeriod(double period, double window, const char *cpus)
+{
+    cpu_set_t *cpuset = cpusetAlloc();
+    int cpusSet = 0;
+    size_t i;
+
+    watchdogInit();
+    if (cpus && '*' != cpus[0] && '\0' != cpus[0] && cpuset) {
+        if (0 == strToCpuset(cpuset, cpus)) cpusSet = 1;
+    }
+    epicsMutexLock(wdLock);
+    wdPeriod = period;
+    wdWindow = window > 0.0 ? window : 10.0 * period;
+    wdSlots = period > 0.0 ? (unsigned int) (wdWindow / period + 0.5) : 1;
+    if (wdSlots < 1) wdSlots = 1;
+    if (wdSlots > WATCHDOG_SLOTS) {
+        wdSlots = WATCHDOG_SLOTS;
+        wdWindow = WATCHDOG_SLOTS * period;
+    }
+    for (i = 0; i < nTasks; i++) {
+        resetWindow(&tasks[i]);
+    }
+    // a running watchdog thread moves at its next pass
+    if (wdCpuset && (cpusSet != wdCpusSet
+                     || (cpusSet && !cpumaskEqual(cpuset, wdCpuset, cpusetSize())))) {
+        if (cpusSet) cpusetCopy(wdCpuset, cpuset);
+        wdCpusSet = cpusSet;
+        wdPlace = 1;
+    }
+    if (period > 0.0 && !wdThread) {
+        clock_gettime(CLOCK_MONOTONIC, &prevTime);
+        wdPlace = 1;
+        wdThread = ownThreadCreate("mcoreWatchdog",
+                                   epicsThreadPriorityMax,
+                                   epicsThreadGetStackSize(epicsThreadStackSmall),
+                                   watchdogLoop, NULL);
+        if (!wdThread) {
+            errlogPrintf("mcoreWatchdog: can't create watchdog thread\n");
+            wdPeriod = 0.0;
+        }
+    }
+    epicsMutexUnlock(wdLock);
+    epicsEventSignal(wdEvent);
+    cpusetFree(cpuset);
+}
+
+/**
+ * @brief Set the RLIMIT_RTTIME limit of the process.
+ */
+void mcoreWatchdogRtTime(unsigned long usec)
+{
+    struct rlimit limit;
+    struct sigaction action;
+
+    watchdogInit();
+    if (getrlimit(RLIMIT_RTTIME, &limit)) {
+        checkStatus(errno,"getrlimit");
+        return;
+    }
+    if (usec) {
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = rtTimeHandler;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        if (sigaction(SIGXCPU, &action, NULL)) {
+            checkStatus(errno,"sigaction");
+            return;
+        }
+    }
+    limit.rlim_cur = usec ? usec : RLIM_INFINITY;
+    if (limit.rlim_max != RLIM_INFINITY && limit.rlim_cur > limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+    }
+    if (setrlimit(RLIMIT_RTTIME, &limit)) {
+        checkStatus(errno,"setrlimit");
+        return;
+    }
+    epicsMutexLock(wdLock);
+    rtTime = usec;
+    epicsMutexUnlock(wdLock);
+}
+
+/**
+ * @brief Print the watchdog's state, counters and alarms.
+ */
+void mcoreWatchdogShow(unsigned int level)
+{
+    FILE *out = epicsGetStdout();
+    char name[32];
+    unsigned long i, first;
+
+    watchdogInit();
+    epicsMutexLock(wdLock);
+    if (wdPeriod > 0.0) {
+        fprintf(out, "Watchdog running, period %g s, window %g s", wdPeriod, wdWindow);
+    } else {
+        fprintf(out, "Watchdog stopped");
+    }
+    if (rtTime) {
+        fprintf(out, ", RLIMIT_RTTIME %lu us\n", rtTime);
+    } else {
+        fprintf(out, "\n");
+    }
+    fprintf(out, "%lu passes, %lu demoted (budget), %lu demoted (RLIMIT_RTTIME), %lu errors\n",
+            counters.passes, counters.demotions, counters.rttime, counters.errors);
+    if (!level) {
+        fprintf(out, "%lu thread(s) watched.\n", (unsigned long) nTasks);
+        epicsMutexUnlock(wdLock);
+        return;
+    }
+
+    if (nTasks) {
+        fprintf(out, "            NAME   LWP ID BUDGET USAGE STATE    RULE\n");
+    }
+    for (i = 0; i < nTasks; i++) {
+        watchedTask *pt = &tasks[i];
+        if (taskName(pt->tid, name, sizeof(name))) strcpy(name, "-");
+        fprintf(out, "%16.16s %8d %5.0f%% %4.0f%% %-8s %s\n",
+                name, (int) pt->tid, pt->budget * 100.0, pt->usage * 100.0,
+                pt->demoted ? "DEMOTED" : "ok", pt->name);
+    }
+
+    if (nAlarms) {
+        first = nAlarms > WATCHDOG_LOG_SIZE ? nAlarms - WATCHDOG_LOG_SIZE : 0;
+        fprintf(out, "Alarms:\n"
+                "    TIME   LWP ID CAUSE\n");
+        for (i = first; i < nAlarms; i++) {
+            watchdogAlarm *pa = &alarms[i % WATCHDOG_LOG_SIZE];
+            char stamp[16];
+            epicsTimeToStrftime(stamp, sizeof(stamp), "%H:%M:%S", &pa->time);
+            if (pa->usage > 0.0) {
+                fprintf(out, "%8s %8d %.0f%% CPU", stamp, (int) pa->tid, pa->usage * 100.0);
+            } else {
+                fprintf(out, "%8s %8d RLIMIT_RTTIME", stamp, (int) pa->tid);
+            }
+            fprintf(out, "%s\n", pa->status ? " (demotion failed)" : "");
+        }
+    }
+    epicsMutexUnlock(wdLock);
+}
+
+static void once(void *arg)
+{
+    wdLock = epicsMutexMustCreate();
+    wdEvent = epicsEventMustCreate(epicsEventEmpty);
+    wdCpuset = cpusetAlloc();
+}
+
+/**
+ * @brief Initialization routine.
+ */
+void watchdogInit(void)
+{
+    static epicsThreadOnceId onceFlag = EPICS_THREAD_ONCE_INIT;
+    epicsThreadOnce(&onceFlag, once, NULL);
+}
+
+/**
+ *@}
+ */
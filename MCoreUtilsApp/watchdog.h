@@ -0,0 +1,30 @@
+/********************************************//**
+ * @file
+ * @brief Header file for watchdog.c
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void watchdogInit(void);
+void watchdogRegister(const char *name, pid_t tid, unsigned int budget);
+void watchdogRelease(const char *name);
+int watchdogCount(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WATCHDOG_H
@@ -0,0 +1,101 @@
+/********************************************//**
+ * @file
+ * @brief Fake sysfs/procfs/cgroupfs trees for the tests.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * The library reads the kernel's pseudo file systems below configurable roots
+ * (@c EPICS_MCORE_SYSFS, @c EPICS_MCORE_PROCFS, @c EPICS_MCORE_CGROUPFS).
+ * The tests create a temporary directory tree with the files they need
+ * and point the roots at it.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fakeRoot.h"
+
+/**
+ * @brief Create an empty temporary directory to build a fake tree in.
+ *
+ * @return name of the directory (free with fakeRootRemove()), NULL on error
+ */
+char *fakeRootCreate(void)
+{
+    const char *tmp = getenv("TMPDIR");
+    char *root = malloc(strlen(tmp ? tmp : "/tmp") + 20);
+
+    if (!root) return NULL;
+    sprintf(root, "%s/mcoreTestXXXXXX", tmp ? tmp : "/tmp");
+    if (!mkdtemp(root)) {
+        free(root);
+        return NULL;
+    }
+    return root;
+}
+
+/**
+ * @brief Create a file (and its directories) in a fake tree.
+ *
+ * @param root    root directory of the tree
+ * @param file    name of the file, relative to @p root
+ * @param content content of the file (NULL = create a directory)
+ * @return 0 on success, errno value on error
+ */
+int fakeRootFile(const char *root, const char *file, const char *content)
+{
+    char *path = malloc(strlen(root) + strlen(file) + 2);
+    char *cp;
+    FILE *fp;
+    int status = 0;
+
+    if (!path) return ENOMEM;
+    sprintf(path, "%s/%s", root, file);
+    for (cp = path + strlen(root) + 1; (cp = strchr(cp, '/')); cp++) {
+        *cp = '\0';
+        if (mkdir(path, 0755) && EEXIST != errno) status = errno;
+        *cp = '/';
+    }
+    if (!status && !content) {
+        if (mkdir(path, 0755) && EEXIST != errno) status = errno;
+    } else if (!status) {
+        if ((fp = fopen(path, "w"))) {
+            if (EOF == fputs(content, fp)) status = errno;
+            if (fclose(fp) && !status) status = errno;
+        } else {
+            status = errno;
+        }
+    }
+    free(path);
+    return status;
+}
+
+static int removeEntry(const char *path, const struct stat *sb, int flag, struct FTW *ftwbuf)
+{
+    return remove(path);
+}
+
+/**
+ * @brief Remove a fake tree.
+ *
+ * @param root root directory of the tree (as returned by fakeRootCreate())
+ */
+void fakeRootRemove(char *root)
+{
+    if (!root) return;
+    nftw(root, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    free(root);
+}
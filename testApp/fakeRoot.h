@@ -0,0 +1,27 @@
+/********************************************//**
+ * @file
+ * @brief Header file for fakeRoot.c
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+#ifndef FAKEROOT_H
+#define FAKEROOT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+char *fakeRootCreate(void);
+int fakeRootFile(const char *root, const char *file, const char *content);
+void fakeRootRemove(char *root);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FAKEROOT_H
@@ -0,0 +1,414 @@
+/********************************************//**
+ * @file
+ * @brief Tests and benchmarks for cpumask operations and cpuset specifications.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * Runs on a fake sysfs tree with 4096 CPUs, so that specifications beyond
+ * 1024 CPUs are checked on any host.
+ *
+ * The benchmarks compare the word-level functions with bit-by-bit loops
+ * using @c CPU_ISSET_S() and @c CPU_SET_S(), including the formatter that
+ * cpumaskFormat() replaced (appending each item with @c strncat()).
+ * The times are reported as diagnostics; the tests only check that both
+ * give the same results.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+
+#include <envDefs.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "utils.h"
+#include "cpumask.h"
+#include "topology.h"
+#include "fakeRoot.h"
+
+#define NCPUS 4096              ///< number of CPUs of the fake host
+#define STRLEN 16384            ///< length of the formatting buffers
+#define BENCH_TIME 0.02         ///< minimum run time of each benchmark [s]
+
+/**
+ * @brief Arguments of a benchmarked function.
+ */
+typedef struct benchArgs {
+    cpu_set_t *set;             ///< cpuset to work on
+    size_t setsize;             ///< size of the cpuset in bytes
+    int ncpus;                  ///< number of CPUs in the cpuset
+    char *str;                  ///< output buffer
+} benchArgs;
+
+typedef void (*benchFunc)(benchArgs *args);
+
+static volatile int sink;       ///< keeps the compiler from dropping the scan loops
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/**
+ * @brief Run a function repeatedly for at least BENCH_TIME.
+ *
+ * @return average time per call in ns
+ */
+static double bench(benchFunc func, benchArgs *args)
+{
+    double start = now();
+    double elapsed;
+    long n = 0;
+
+    do {
+        func(args);
+        n++;
+    } while ((elapsed = now() - start) < BENCH_TIME);
+    return 1e9 * elapsed / n;
+}
+
+/**
+ * @brief The formatter replaced by cpumaskFormat(): bit by bit, appending with strncat().
+ */
+static void formatBitwise(char *str, size_t len, const cpu_set_t *set, size_t setsize, int ncpus)
+{
+    int cpu = 0;
+    size_t l;
+    char buf[32];
+
+    str[0] = '\0';
+    while (cpu < ncpus) {
+        int from, to;
+        while (cpu < ncpus && !CPU_ISSET_S(cpu, setsize, set)) {
+            cpu++;
+        }
+        if (cpu >= ncpus) {
+            break;
+        }
+        from = to = cpu++;
+        while (cpu < ncpus && CPU_ISSET_S(cpu, setsize, set)) {
+            to = cpu++;
+        }
+        if (from == to) {
+            sprintf(buf, "%d,", from);
+        } else {
+            sprintf(buf, "%d-%d,", from, to);
+        }
+        strncat(str, buf, len - 1 - strlen(str));
+    }
+    if ((l = strlen(str))) {
+        str[l - 1] = '\0';
+    }
+}
+
+static void benchFormat(benchArgs *args)
+{
+    cpumaskFormat(args->str, STRLEN, args->set, args->setsize);
+}
+
+static void benchFormatBitwise(benchArgs *args)
+{
+    formatBitwise(args->str, STRLEN, args->set, args->setsize, args->ncpus);
+}
+
+static void benchNextSet(benchArgs *args)
+{
+    int cpu, sum = 0;
+    for (cpu = cpumaskNextSet(args->set, args->setsize, 0); cpu >= 0;
+         cpu = cpumaskNextSet(args->set, args->setsize, cpu + 1)) {
+        sum += cpu;
+    }
+    sink = sum;
+}
+
+static void benchNextSetBitwise(benchArgs *args)
+{
+    int cpu, sum = 0;
+    for (cpu = 0; cpu < args->ncpus; cpu++) {
+        if (CPU_ISSET_S(cpu, args->setsize, args->set)) sum += cpu;
+    }
+    sink = sum;
+}
+
+static void benchSetRange(benchArgs *args)
+{
+    CPU_ZERO_S(args->setsize, args->set);
+    cpumaskSetRange(args->set, args->setsize, 0, args->ncpus - 1, 1);
+}
+
+static void benchSetRangeBitwise(benchArgs *args)
+{
+    int cpu;
+    CPU_ZERO_S(args->setsize, args->set);
+    for (cpu = 0; cpu < args->ncpus; cpu++) {
+        CPU_SET_S(cpu, args->setsize, args->set);
+    }
+}
+
+static void benchParse(benchArgs *args)
+{
+    strToCpuset(args->set, args->str);
+}
+
+/**
+ * @brief Check the result of parsing and formatting a specification.
+ */
+static void checkSpec(const char *spec, const char *expected)
+{
+    cpu_set_t *set = cpusetAlloc();
+    char str[STRLEN];
+    int status = strToCpuset(set, spec);
+
+    cpusetToStr(str, sizeof(str), set);
+    testOk(0 == status && 0 == strcmp(str, expected),
+           "\"%s\" -> \"%s\" (expected \"%s\")", spec, str, expected);
+    cpusetFree(set);
+}
+
+/**
+ * @brief Check that an invalid specification is rejected.
+ */
+static void checkInvalid(const char *spec)
+{
+    cpu_set_t *set = cpusetAlloc();
+    int status = strToCpuset(set, spec);
+
+    testOk(0 != status && 0 == cpumaskCount(set, cpusetSize()),
+           "\"%s\" rejected", spec);
+    cpusetFree(set);
+}
+
+static void testSpecs(void)
+{
+    testDiag("cpuset specifications on %d CPUs", topologyNumCpus());
+    checkSpec("0-31:2", "0,2,4,6,8,10,12,14,16,18,20,22,24,26,28,30");
+    checkSpec("0-7,^3", "0-2,4-7");
+    checkSpec("0-4095,^1024-2047", "0-1023,2048-4095");
+    checkSpec("60-67", "60-67");
+    checkSpec("1023-1025", "1023-1025");
+    checkSpec("0-8191:1024", "0,1024,2048,3072");
+    checkSpec("4000-4095:8,^4000-4047", "4048,4056,4064,4072,4080,4088");
+    checkSpec("isolated", "4032-4095");
+    checkSpec("isolated,^4033-4095", "4032");
+    checkSpec("4095", "4095");
+    checkSpec("^5", "");
+    checkSpec("5000", "");
+    checkSpec("^0-3,0-7", "4-7");
+    checkSpec("0-15:4,^8", "0,4,12");
+    checkSpec("0-9:3,^0-9:2", "3,9");
+    checkSpec("4090-5000:2", "4090,4092,4094");
+    checkSpec("1-1:5", "1");
+    checkInvalid("abc");
+    checkInvalid("3-1");
+    checkInvalid("0-7:0");
+    checkInvalid("0-7:x");
+    checkInvalid("^core");
+    checkInvalid("core");
+}
+
+/**
+ * @brief Check an @c allowed specification against the allowed CPUs.
+ *
+ * The allowed CPUs are those of the process, so the expected set is
+ * computed from them: the allowed CPUs with index @p from up to @p to.
+ */
+static void checkAllowed(const char *spec, const cpu_set_t *allowed, int from, int to)
+{
+    const size_t setsize = cpusetSize();
+    cpu_set_t *set = cpusetAlloc();
+    cpu_set_t *expected = cpusetAlloc();
+    char str[STRLEN], exp[STRLEN];
+    int status = strToCpuset(set, spec);
+    int cpu, index;
+
+    for (cpu = cpumaskNextSet(allowed, setsize, 0), index = 0; cpu >= 0;
+         cpu = cpumaskNextSet(allowed, setsize, cpu + 1), index++) {
+        if (index >= from && index < to) CPU_SET_S(cpu, setsize, expected);
+    }
+    cpusetToStr(str, sizeof(str), set);
+    cpusetToStr(exp, sizeof(exp), expected);
+    testOk(0 == status && cpumaskEqual(set, expected, setsize),
+           "\"%s\" -> \"%s\" (expected \"%s\")", spec, str, exp);
+    cpusetFree(set);
+    cpusetFree(expected);
+}
+
+static void testAllowed(void)
+{
+    cpu_set_t *allowed = cpusetAlloc();
+    int n = topologyAllowedCpus(allowed);
+    char spec[32];
+
+    testDiag("allowed CPU selections on %d allowed CPUs", n);
+    checkAllowed("allowed", allowed, 0, n);
+    checkAllowed("allowed[0]", allowed, 0, 1);
+    checkAllowed("allowed[-1]", allowed, n - 1, n);
+    checkAllowed("allowed[1:3]", allowed, 1, 3);
+    checkAllowed("allowed[:2]", allowed, 0, 2);
+    checkAllowed("allowed[-2:]", allowed, n - 2, n);
+    checkAllowed("allowed,^allowed[0]", allowed, 1, n);
+    sprintf(spec, "allowed[%d]", n);
+    checkInvalid(spec);
+    checkInvalid("allowed[]");
+    checkInvalid("allowed[0");
+    checkInvalid("allowed[0]x");
+    cpusetFree(allowed);
+}
+
+static void testWordOps(void)
+{
+    const size_t setsize = cpusetSize();
+    cpu_set_t *a = cpusetAlloc();
+    cpu_set_t *b = cpusetAlloc();
+    char str[16];
+    size_t len;
+
+    testDiag("word-level operations");
+    CPU_SET_S(NCPUS - 1, setsize, a);
+    testOk1(NCPUS - 1 == cpumaskNextSet(a, setsize, 0));
+    testOk1(-1 == cpumaskNextSet(a, setsize, NCPUS));
+    cpumaskSetRange(b, setsize, 0, NCPUS - 1, 1);
+    testOk1(NCPUS == cpumaskNextClear(b, setsize, 0));
+    CPU_ZERO_S(setsize, a);
+    CPU_SET_S(3, setsize, a);
+    CPU_SET_S(1000, setsize, a);
+    testOk1(1000 == cpumaskLast(a, setsize));
+    CPU_ZERO_S(setsize, b);
+    cpumaskSetRange(b, setsize, 0, NCPUS - 1, 3);
+    testOk1(1366 == cpumaskCount(b, setsize));
+    cpusetCopy(a, b);
+    testOk1(cpumaskEqual(a, b, setsize));
+    CPU_CLR_S(4095, setsize, a);
+    testOk1(!cpumaskEqual(a, b, setsize));
+    cpumaskAndNot(a, b, a, setsize);
+    testOk1(1 == cpumaskCount(a, setsize) && CPU_ISSET_S(4095, setsize, a));
+
+    CPU_ZERO_S(setsize, a);
+    cpumaskSetRange(a, setsize, 0, 2, 1);
+    cpumaskSetRange(a, setsize, 4, 7, 1);
+    CPU_SET_S(10, setsize, a);
+    len = cpumaskFormat(str, 8, a, setsize);
+    testOk(7 == len && 0 == strcmp(str, "0-2,4-7"), "truncated at item boundary: \"%s\"", str);
+
+    cpusetFree(a);
+    cpusetFree(b);
+}
+
+static void testRoundTrip(void)
+{
+    const size_t setsize = cpusetSize();
+    cpu_set_t *a = cpusetAlloc();
+    cpu_set_t *b = cpusetAlloc();
+    char *str = malloc(STRLEN);
+    unsigned int seed = 42;
+    int i, cpu, failed = 0;
+
+    for (i = 0; i < 200; i++) {
+        CPU_ZERO_S(setsize, a);
+        for (cpu = 0; cpu < NCPUS; cpu++) {
+            if (rand_r(&seed) % 4 == 0) CPU_SET_S(cpu, setsize, a);
+        }
+        cpumaskFormat(str, STRLEN, a, setsize);
+        if (strToCpuset(b, str) || !cpumaskEqual(a, b, setsize)) failed++;
+    }
+    testOk(0 == failed, "200 random sets formatted and parsed back (%d failed)", failed);
+    free(str);
+    cpusetFree(a);
+    cpusetFree(b);
+}
+
+static void testBenchmarks(void)
+{
+    static const int sizes[] = { 64, 1024, NCPUS };
+    static const char *patterns[] = { "alternating", "4 ranges", "last CPU" };
+    char *reference = malloc(STRLEN);
+    benchArgs args;
+    unsigned int i, p;
+
+    args.str = malloc(STRLEN);
+    testDiag("benchmarks (ns per call): word-level vs. bit by bit");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        args.ncpus = sizes[i];
+        args.setsize = CPU_ALLOC_SIZE(args.ncpus);
+        args.set = CPU_ALLOC(args.ncpus);
+        for (p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+            double fast, slow;
+            int n = args.ncpus;
+
+            CPU_ZERO_S(args.setsize, args.set);
+            if (0 == p) {
+                cpumaskSetRange(args.set, args.setsize, 0, n - 1, 2);
+            } else if (1 == p) {
+                cpumaskSetRange(args.set, args.setsize, 0, n / 8 - 1, 1);
+                cpumaskSetRange(args.set, args.setsize, n / 4, 3 * n / 8 - 1, 1);
+                cpumaskSetRange(args.set, args.setsize, n / 2, 5 * n / 8 - 1, 1);
+                cpumaskSetRange(args.set, args.setsize, 3 * n / 4, 7 * n / 8 - 1, 1);
+            } else {
+                CPU_SET_S(n - 1, args.setsize, args.set);
+            }
+            formatBitwise(reference, STRLEN, args.set, args.setsize, n);
+            fast = bench(benchFormat, &args);
+            slow = bench(benchFormatBitwise, &args);
+            testOk(0 == strcmp(args.str, reference), "%4d CPUs, %-11s: same output", n, patterns[p]);
+            testDiag("  format   %4d CPUs, %-11s: %10.0f (strncat %10.0f)", n, patterns[p], fast, slow);
+            fast = bench(benchNextSet, &args);
+            slow = bench(benchNextSetBitwise, &args);
+            testDiag("  scan     %4d CPUs, %-11s: %10.0f (CPU_ISSET_S %6.0f)", n, patterns[p], fast, slow);
+        }
+        {
+            double fast = bench(benchSetRange, &args);
+            double slow = bench(benchSetRangeBitwise, &args);
+            testDiag("  setrange %4d CPUs, %-11s: %10.0f (CPU_SET_S %8.0f)", args.ncpus, "all", fast, slow);
+        }
+        CPU_FREE(args.set);
+    }
+
+    args.set = cpusetAlloc();
+    args.setsize = cpusetSize();
+    args.ncpus = NCPUS;
+    strcpy(args.str, "0-4095:2");
+    testDiag("  parse    \"%s\": %10.0f", args.str, bench(benchParse, &args));
+    strcpy(args.str, "0-4095,^1024-2047");
+    testDiag("  parse    \"%s\": %10.0f", args.str, bench(benchParse, &args));
+    cpusetFree(args.set);
+    free(args.str);
+    free(reference);
+}
+
+MAIN(testCpumask)
+{
+    char *root = fakeRootCreate();
+
+    testPlan(53);
+    if (!root
+            || fakeRootFile(root, "devices/system/cpu/possible", "0-4095\n")
+            || fakeRootFile(root, "devices/system/cpu/present", "0-4095\n")
+            || fakeRootFile(root, "devices/system/cpu/online", "0-4095\n")
+            || fakeRootFile(root, "devices/system/cpu/isolated", "4032-4095\n")) {
+        testAbort("Can't create fake sysfs tree");
+    }
+    epicsEnvSet("EPICS_MCORE_SYSFS", root);
+
+    testSpecs();
+    testAllowed();
+    testWordOps();
+    testRoundTrip();
+    testBenchmarks();
+
+    fakeRootRemove(root);
+    return testDone();
+}
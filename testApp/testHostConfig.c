@@ -0,0 +1,361 @@
+/********************************************//**
+ * @file
+ * @brief Tests for the host configuration: audit, cgroup partition, near: cpusets and power settings.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * Runs on fake sysfs, procfs and cgroupfs trees of a 4 CPU host, and on a
+ * regular file as PM QoS device, so that the checks do not depend on (or change)
+ * the configuration of the host running the tests.
+ * The real-time rule uses the last CPU the process is allowed to run on,
+ * as rule CPUs outside the process affinity are dropped.
+ *
+ * The audit is run before and after the power settings: the governor and
+ * C-state checks fail on the prepared tree and pass once the settings are made.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+
+#include <envDefs.h>
+#include <epicsExit.h>
+#include <epicsStdio.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "mcoreutils.h"
+#include "utils.h"
+#include "cpumask.h"
+#include "topology.h"
+#include "cgroup.h"
+#include "fakeRoot.h"
+
+static char *root;              ///< root directory of the fake trees
+static char rtCpus[16];         ///< CPU of the real-time rule (last allowed CPU)
+static char otherCpus[16];      ///< the other CPUs of the fake host
+static int rtCpu;               ///< number of the real-time CPU
+static int otherCpu;            ///< one of the other CPUs
+
+/**
+ * @brief A file of the fake trees.
+ */
+typedef struct fakeFile {
+    const char *file;           ///< name, relative to the root
+    const char *content;        ///< content (NULL = directory)
+} fakeFile;
+
+static const fakeFile files[] = {
+    { "sys/devices/system/cpu/possible", "0-3\n" },
+    { "sys/devices/system/cpu/present", "0-3\n" },
+    { "sys/devices/system/cpu/online", "0-3\n" },
+    { "sys/devices/system/cpu/isolated", "0-3\n" },
+    { "sys/devices/system/cpu/nohz_full", "(null)\n" },
+    { "sys/kernel/mm/transparent_hugepage/enabled", "always [madvise] never\n" },
+    { "sys/class/net/eth9/device/local_cpulist", "2-3\n" },
+    { "sys/bus/pci/devices/0000:3b:00.0/local_cpulist", "1\n" },
+    { "proc/self/status", "Name:\ttestHostConfig\nVmLck:\t       0 kB\nVmRSS:\t    1000 kB\n"
+                          "VmSwap:\t       0 kB\nCapEff:\t0000000000000000\n" },
+    { "proc/self/limits", "Limit                     Soft Limit           Hard Limit           Units\n"
+                          "Max locked memory         unlimited            unlimited            bytes\n"
+                          "Max realtime priority     99                   99\n" },
+    { "proc/self/cgroup", "0::/ioc\n" },
+    { "proc/meminfo", "SwapTotal:       1000 kB\nSwapFree:        1000 kB\n" },
+    { "proc/sys/kernel/sched_rt_runtime_us", "-1\n" },
+    { "proc/sys/kernel/sched_rt_period_us", "1000000\n" },
+    { "proc/4711/comm", "irqbalance\n" },
+    { "cgroup/ioc/cpuset.cpus.effective", "0-3\n" },
+    { "dev/cpu_dma_latency", "" },
+};
+
+/**
+ * @brief Read the first line of a file of the fake trees, without the line end.
+ *
+ * @return line (static buffer), "" if the file can't be read
+ */
+static const char *readFake(const char *file)
+{
+    static char line[256];
+    char path[1024];
+    char *cp;
+    FILE *fp;
+
+    line[0] = '\0';
+    snprintf(path, sizeof(path), "%s/%s", root, file);
+    if ((fp = fopen(path, "r"))) {
+        if (!fgets(line, sizeof(line), fp)) line[0] = '\0';
+        fclose(fp);
+    }
+    if ((cp = strpbrk(line, "\n\r"))) *cp = '\0';
+    return line;
+}
+
+/**
+ * @brief Prepare the cpufreq and cpuidle files of a CPU.
+ */
+static int fakeCpu(int cpu)
+{
+    static const char *attrs[][2] = {
+        { "cpufreq/scaling_governor", "powersave\n" },
+        { "cpufreq/scaling_min_freq", "800000\n" },
+        { "cpufreq/cpuinfo_max_freq", "3000000\n" },
+        { "cpuidle/state0/name", "POLL\n" },
+        { "cpuidle/state0/latency", "0\n" },
+        { "cpuidle/state0/disable", "0\n" },
+        { "cpuidle/state1/name", "C6\n" },
+        { "cpuidle/state1/latency", "100\n" },
+        { "cpuidle/state1/disable", "0\n" },
+    };
+    char file[128];
+    size_t i;
+
+    for (i = 0; i < sizeof(attrs) / sizeof(attrs[0]); i++) {
+        snprintf(file, sizeof(file), "sys/devices/system/cpu/cpu%d/%s", cpu, attrs[i][0]);
+        if (fakeRootFile(root, file, attrs[i][1])) return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Run the audit, keeping its output.
+ *
+ * @param failed number of failed checks (output)
+ * @return output of the audit (free with fclose()), NULL on error
+ */
+static FILE *runAudit(int *failed)
+{
+    FILE *out = tmpfile();
+    FILE *saved = epicsGetStdout();
+
+    if (!out) return NULL;
+    epicsSetThreadStdout(out);
+    *failed = mcoreRtAudit();
+    epicsSetThreadStdout(saved);
+    return out;
+}
+
+/**
+ * @brief Get the result of a check from the output of the audit.
+ *
+ * @return "PASS", "FAIL" or "SKIP" (static buffer), "" if the check is missing
+ */
+static const char *auditResultOf(FILE *out, const char *check)
+{
+    static char result[8];
+    char line[256], name[32];
+
+    result[0] = '\0';
+    rewind(out);
+    while (fgets(line, sizeof(line), out)) {
+        if (2 == sscanf(line, "%31s %7s", name, result) && 0 == strcmp(name, check)) {
+            return result;
+        }
+    }
+    result[0] = '\0';
+    return result;
+}
+
+static void checkAudit(FILE *out, const char *check, const char *expected)
+{
+    const char *result = auditResultOf(out, check);
+    testOk(0 == strcmp(result, expected), "audit %s: %s (expected %s)", check, result, expected);
+}
+
+/**
+ * @brief Choose the real-time CPU: the last allowed CPU of the fake host.
+ *
+ * @return 0 on success, -1 if none of the fake host's CPUs is allowed
+ */
+static int chooseCpus(void)
+{
+    const size_t setsize = cpusetSize();
+    cpu_set_t *set = cpusetAlloc();
+    int status = -1;
+
+    if (set && 0 == strToCpuset(set, "allowed[-1]") && 1 == CPU_COUNT_S(setsize, set)) {
+        rtCpu = cpumaskLast(set, setsize);
+        otherCpu = rtCpu ? 0 : 1;
+        cpusetToStr(rtCpus, sizeof(rtCpus), set);
+        strToCpuset(set, "0-3");
+        CPU_CLR_S(rtCpu, setsize, set);
+        cpusetToStr(otherCpus, sizeof(otherCpus), set);
+        status = 0;
+    }
+    cpusetFree(set);
+    return status;
+}
+
+static void testNear(void)
+{
+    cpu_set_t *set = cpusetAlloc();
+    char str[64];
+
+    testDiag("near: cpusets");
+    testOk(0 == strToCpuset(set, "near:eth9"), "near:eth9 accepted");
+    cpusetToStr(str, sizeof(str), set);
+    testOk(0 == strcmp(str, "2-3"), "near:eth9 -> \"%s\" (expected \"2-3\")", str);
+    strToCpuset(set, "near:0000:3b:00.0");
+    cpusetToStr(str, sizeof(str), set);
+    testOk(0 == strcmp(str, "1"), "near:0000:3b:00.0 -> \"%s\" (expected \"1\")", str);
+    strToCpuset(set, "near:3b:00.0,0");
+    cpusetToStr(str, sizeof(str), set);
+    testOk(0 == strcmp(str, "0-1"), "near:3b:00.0,0 -> \"%s\" (expected \"0-1\")", str);
+    testOk(0 != strToCpuset(set, "near:eth0"), "near:eth0 (no such device) rejected");
+    testOk(0 != strToCpuset(set, "near:../eth9"), "near:../eth9 rejected");
+    cpusetFree(set);
+}
+
+static void testAuditBefore(void)
+{
+    FILE *out;
+    int failed = -1;
+
+    testDiag("audit of the prepared host");
+    if (!(out = runAudit(&failed))) {
+        testSkip(13, "can't capture audit output");
+        return;
+    }
+    testOk(5 == failed, "%d checks failed (expected 5)", failed);
+    checkAudit(out, "governor", "FAIL");
+    checkAudit(out, "cpu_dma_latency", "SKIP");
+    checkAudit(out, "C-states", "FAIL");
+    checkAudit(out, "THP", "PASS");
+    checkAudit(out, "swap", "PASS");
+    checkAudit(out, "rt_throttling", "PASS");
+    checkAudit(out, "isolcpus", "PASS");
+    checkAudit(out, "nohz_full", "FAIL");
+    checkAudit(out, "irqbalance", "FAIL");
+    checkAudit(out, "RLIMIT_RTPRIO", "PASS");
+    checkAudit(out, "RLIMIT_MEMLOCK", "PASS");
+    checkAudit(out, "mlock", "FAIL");
+    fclose(out);
+}
+
+static void testPower(void)
+{
+    char file[128];
+
+    testDiag("power settings");
+    mcoreCpuFreq(rtCpus, "performance", "max");
+    sprintf(file, "sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", rtCpu);
+    testOk(0 == strcmp(readFake(file), "performance"), "CPU %d: governor performance", rtCpu);
+    sprintf(file, "sys/devices/system/cpu/cpu%d/cpufreq/scaling_min_freq", rtCpu);
+    testOk(0 == strcmp(readFake(file), "3000000"), "CPU %d: minimum frequency 3000000", rtCpu);
+    sprintf(file, "sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", otherCpu);
+    testOk(0 == strcmp(readFake(file), "powersave"), "CPU %d: governor unchanged", otherCpu);
+    mcoreCpuLatency(0);
+}
+
+static void testAuditAfter(void)
+{
+    FILE *out;
+    int failed = -1;
+
+    testDiag("audit after the power settings");
+    if (!(out = runAudit(&failed))) {
+        testSkip(4, "can't capture audit output");
+        return;
+    }
+    testOk(3 == failed, "%d checks failed (expected 3)", failed);
+    checkAudit(out, "governor", "PASS");
+    checkAudit(out, "cpu_dma_latency", "PASS");
+    checkAudit(out, "C-states", "PASS");
+    fclose(out);
+}
+
+static void testCgroup(void)
+{
+    const size_t setsize = cpusetSize();
+    cpu_set_t *set = cpusetAlloc();
+    char str[64];
+    char tid[32];
+
+    testDiag("cgroup partition");
+    mcoreCgroupPartition("rt");
+    testOk1(0 == strcmp(readFake("cgroup/ioc/cgroup.subtree_control"), "+cpuset"));
+    testOk1(0 == strcmp(readFake("cgroup/ioc/rt/cgroup.type"), "threaded"));
+    testOk(0 == strcmp(readFake("cgroup/ioc/rt/cpuset.cpus"), rtCpus),
+           "partition CPUs \"%s\" (expected \"%s\")", readFake("cgroup/ioc/rt/cpuset.cpus"), rtCpus);
+    testOk1(0 == strcmp(readFake("cgroup/ioc/rt/cpuset.cpus.partition"), "isolated"));
+
+    testOk1(0 == cgroupAttach(4711));
+    testOk1(0 == strcmp(readFake("cgroup/ioc/rt/cgroup.threads"), "4711"));
+
+    // the kernel removes the partition's CPUs from the parent's effective CPUs
+    sprintf(str, "%s\n", otherCpus);
+    fakeRootFile(root, "cgroup/ioc/cpuset.cpus.effective", str);
+    sprintf(str, "%s\n", rtCpus);
+    fakeRootFile(root, "cgroup/ioc/rt/cpuset.cpus.effective", str);
+    CPU_ZERO_S(setsize, set);
+    testOk1(4 == cgroupEffectiveCpus(set));
+    cpusetToStr(str, sizeof(str), set);
+    testOk(0 == strcmp(str, "0-3"), "effective CPUs \"%s\" (expected \"0-3\")", str);
+
+    sprintf(tid, "%d", 4712);
+    testOk1(0 == cgroupAttach(4712) && 0 == strcmp(readFake("cgroup/ioc/rt/cgroup.threads"), tid));
+    cpusetFree(set);
+}
+
+static void testRestore(void)
+{
+    char file[128];
+
+    testDiag("power settings restored at exit");
+    epicsExitCallAtExits();
+    sprintf(file, "sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", rtCpu);
+    testOk(0 == strcmp(readFake(file), "powersave"), "CPU %d: governor restored", rtCpu);
+    sprintf(file, "sys/devices/system/cpu/cpu%d/cpufreq/scaling_min_freq", rtCpu);
+    testOk(0 == strcmp(readFake(file), "800000"), "CPU %d: minimum frequency restored", rtCpu);
+}
+
+MAIN(testHostConfig)
+{
+    char path[1024];
+    size_t i;
+    int cpu, status = 0;
+
+    testPlan(37);
+    root = fakeRootCreate();
+    for (i = 0; root && !status && i < sizeof(files) / sizeof(files[0]); i++) {
+        status = fakeRootFile(root, files[i].file, files[i].content);
+    }
+    for (cpu = 0; root && !status && cpu < 4; cpu++) {
+        status = fakeCpu(cpu);
+    }
+    if (!root || status) {
+        testAbort("Can't create fake sysfs/procfs/cgroupfs trees");
+    }
+    snprintf(path, sizeof(path), "%s/sys", root);
+    epicsEnvSet("EPICS_MCORE_SYSFS", path);
+    snprintf(path, sizeof(path), "%s/proc", root);
+    epicsEnvSet("EPICS_MCORE_PROCFS", path);
+    snprintf(path, sizeof(path), "%s/cgroup", root);
+    epicsEnvSet("EPICS_MCORE_CGROUPFS", path);
+    snprintf(path, sizeof(path), "%s/dev/cpu_dma_latency", root);
+    epicsEnvSet("EPICS_MCORE_DMA_LATENCY", path);
+
+    // the real-time CPU of the audit and of the partition
+    if (chooseCpus()) {
+        testAbort("No allowed CPU on the fake host");
+    }
+    mcoreThreadRuleAdd("rt", "FIFO", "80", "allowed[-1]", "^testHostConfigRt$");
+
+    testNear();
+    testAuditBefore();
+    testPower();
+    testAuditAfter();
+    testCgroup();
+    testRestore();
+
+    fakeRootRemove(root);
+    return testDone();
+}
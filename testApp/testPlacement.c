@@ -0,0 +1,146 @@
+/********************************************//**
+ * @file
+ * @brief Tests for the placement modes and the OSI to POSIX priority map.
+ * @author Ralph Lange <Ralph.Lange@gmx.de>
+ * @copyright
+ * Copyright (c) 2012 ITER Organization
+ * @copyright
+ * Distributed subject to the EPICS_BASE Software License Agreement found
+ * in the file LICENSE that is included with this distribution.
+ ***********************************************/
+
+/**
+ * @file
+ *
+ * The placements run on a fake sysfs tree with 8 CPUs, for made-up thread ids:
+ * the CPU selection only keeps track of the threads, it does not move them.
+ * The priority map tests assume the Linux range of the real-time policies (1-99).
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+
+#include <envDefs.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "mcoreutils.h"
+#include "utils.h"
+#include "placement.h"
+#include "prioMap.h"
+#include "fakeRoot.h"
+
+/**
+ * @brief Check the CPU selected for a thread.
+ */
+static void checkSelect(const char *name, int mode, pid_t tid, const char *spec, int expected)
+{
+    cpu_set_t *set = cpusetAlloc();
+    int cpu;
+
+    strToCpuset(set, spec);
+    cpu = placementSelect(name, mode, tid, set);
+    testOk(cpu == expected, "%s: thread %d on \"%s\" -> CPU %d (expected %d)",
+           name, (int) tid, spec, cpu, expected);
+    cpusetFree(set);
+}
+
+static void testPlacementModes(void)
+{
+    testDiag("spread placement");
+    checkSelect("spread", placementSpread, 101, "2-4", 2);
+    checkSelect("spread", placementSpread, 102, "2-4", 3);
+    checkSelect("spread", placementSpread, 103, "2-4", 4);
+    checkSelect("spread", placementSpread, 104, "2-4", 2);
+    checkSelect("spread", placementSpread, 101, "2-4", 2);
+    // CPU 3 left the set: the thread is placed again
+    checkSelect("spread", placementSpread, 102, "4-5", 4);
+
+    testDiag("least-loaded placement (load 2:2, 4:2 from the spread rule)");
+    checkSelect("least", placementLeastLoaded, 201, "2-5", 3);
+    checkSelect("least", placementLeastLoaded, 202, "2-5", 5);
+    checkSelect("least", placementLeastLoaded, 203, "2-7", 6);
+    checkSelect("least", placementNone, 204, "2-5", -1);
+
+    placementRelease("spread");
+    checkSelect("least", placementLeastLoaded, 204, "2-5", 2);
+    placementThreadExit(201);
+    checkSelect("least", placementLeastLoaded, 205, "2-5", 3);
+}
+
+/**
+ * @brief Check the POSIX priority an OSI priority maps to.
+ */
+static void checkMap(int osi, int expected)
+{
+    int posix = -1;
+    int status = prioMapToPosix(SCHED_FIFO, osi, &posix);
+
+    testOk(0 == status && posix == expected, "OSI %d -> %d (expected %d)", osi, posix, expected);
+}
+
+/**
+ * @brief Check that an invalid map is rejected, keeping the previous one.
+ */
+static void checkInvalidMap(const char *spec)
+{
+    int posix = -1;
+
+    mcorePriorityMap(spec);
+    testOk(0 == prioMapToPosix(SCHED_FIFO, 50, &posix) && 11 == posix,
+           "\"%s\" rejected, OSI 50 still maps to %d", spec, posix);
+}
+
+static void testPriorityMap(void)
+{
+    int value;
+
+    testDiag("priority map");
+    testOk(-1 == prioMapToPosix(SCHED_FIFO, 50, &value), "no map configured");
+
+    mcorePriorityMap("^90-99");
+    checkMap(0, 1);
+    checkMap(50, 45);
+    checkMap(99, 89);
+    testOk(-1 == prioMapToPosix(SCHED_OTHER, 50, &value), "not mapped for SCHED_OTHER");
+
+    mcorePriorityMap("0-49=1-10,50-99=11-60");
+    checkMap(0, 1);
+    checkMap(25, 5);
+    checkMap(49, 10);
+    checkMap(50, 11);
+    checkMap(99, 60);
+    testOk(0 == prioMapToOsi(SCHED_FIFO, 11, &value) && 50 == value,
+           "POSIX 11 -> OSI %d (expected 50)", value);
+
+    checkInvalidMap("50=80,51=10");
+    checkInvalidMap("^1-99");
+    checkInvalidMap("10=95,^90-99");
+    checkInvalidMap("0-99=1-100");
+    checkInvalidMap("abc");
+
+    mcorePriorityMap("default");
+    testOk(-1 == prioMapToPosix(SCHED_FIFO, 50, &value), "map reset to default");
+}
+
+MAIN(testPlacement)
+{
+    char *root = fakeRootCreate();
+
+    testPlan(29);
+    if (!root
+            || fakeRootFile(root, "devices/system/cpu/possible", "0-7\n")
+            || fakeRootFile(root, "devices/system/cpu/present", "0-7\n")
+            || fakeRootFile(root, "devices/system/cpu/online", "0-7\n")) {
+        testAbort("Can't create fake sysfs tree");
+    }
+    epicsEnvSet("EPICS_MCORE_SYSFS", root);
+
+    testPlacementModes();
+    testPriorityMap();
+
+    fakeRootRemove(root);
+    return testDone();
+}